@@ -14,7 +14,26 @@ HEADERS       = glwidget.h \
 		transfuncarea.h \
 		transfunclutarea.h \
 		transfuncalphaarea.h \
-		presetmanager.h
+		presetmanager.h \
+		synthvolume.h \
+		camerapath.h \
+		benchmark.h \
+		frameprofiler.h \
+		histogram.h \
+		gradient.h \
+		transfunc2darea.h \
+		volumestorage.h \
+		volumepyramid.h \
+		volumecache.h \
+		renderer.h \
+		posterwriter.h \
+		framesequence.h \
+		renderserver.h \
+		sortlast.h \
+		shadercache.h \
+		volumeseries.h \
+		volumemask.h \
+		volumeprobe.h
 
 
 SOURCES       = glwidget.cpp \
@@ -25,15 +44,38 @@ SOURCES       = glwidget.cpp \
 		transfuncarea.cpp \
 		transfunclutarea.cpp \
 		transfuncalphaarea.cpp \
-		presetmanager.cpp
+		presetmanager.cpp \
+		synthvolume.cpp \
+		camerapath.cpp \
+		benchmark.cpp \
+		frameprofiler.cpp \
+		histogram.cpp \
+		gradient.cpp \
+		transfunc2darea.cpp \
+		volumestorage.cpp \
+		volumepyramid.cpp \
+		volumecache.cpp \
+		renderer.cpp \
+		posterwriter.cpp \
+		framesequence.cpp \
+		renderserver.cpp \
+		sortlast.cpp \
+		shadercache.cpp \
+		volumeseries.cpp \
+		volumemask.cpp \
+		volumeprobe.cpp
 
 
-QT           += widgets
+QT           += widgets concurrent network
+
+RESOURCES     = shaders.qrc
 
 DISTFILES += \
 AUTHORS \
 COPYING \
 tools/dicom2raw.py \
+tools/benchcompare.py \
+tools/qvrc_client.py \
 shaders/firstpass.vert \
 shaders/firstpass.frag \
 shaders/raycast.vert \
@@ -43,6 +85,8 @@ presets/invmip.json \
 presets/stent_ossa_vasi.json \
 presets/stag.json \
 presets/bones.json \
+presets/bench/dvr.json \
+presets/bench/mip.json \
 datasets/head256.raw 
 
 # install
@@ -29,13 +29,18 @@ uniform mat4 view;
 uniform mat4 model;
 
 uniform vec3 origin;
+/* z range of the cube in volume coordinates, a slab of it in
+ * sort-last mode */
+uniform vec2 slab;
 
 out vec3 color;
 
 void main()
 {
+    vec3 position = vec3(vertex_position.xy, mix(slab.x, slab.y, vertex_position.z));
+
     /* transform coordinates */
-    gl_Position = projection * view * model * vec4(vertex_position, 1.0);
+    gl_Position = projection * view * model * vec4(position, 1.0);
     /* pass position as color down the line */
-    color = vertex_position;
+    color = position;
 }
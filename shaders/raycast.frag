@@ -25,12 +25,47 @@
 /* parameters */
 in vec3 ray_in;
 in mat3 normalmatrix;
-out vec4 outcolor;
+layout (location = 0) out vec4 outcolor;
+/* ray cost counters, only attached when collecting statistics:
+ *   raystats: samples taken, samples shaded, early terminated, 1.0
+ *   raycost:  samples the ray would take without early termination,
+ *             fraction of them skipped, 0.0, 1.0
+ * the 1.0 in alpha counts covered pixels once averaged */
+layout (location = 1) out vec4 raystats;
+layout (location = 2) out vec4 raycost;
 
 /* uniforms */
 uniform sampler2D backtex;
 uniform sampler3D voltex;
+/* volume storage, VOLUME_FORMAT_* in volumestorage.h
+ * 0: normalized, sampled as is
+ * 1: 8 bit intensity codes, decoded through the dequant table
+ * 2: 12 bit intensity + 4 bit gradient packed in an integer texture,
+ *    voltex_packed, filtered by hand */
+uniform int volume_format;
+uniform sampler1D dequant;
+uniform usampler3D voltex_packed;
+/* mip levels past the first, 0 samples the full resolution only */
+uniform float max_lod;
 uniform sampler1D tftex;
+/* intensity x gradient magnitude, the volume carries the normalized
+ * gradient magnitude in its green channel */
+uniform sampler2D tf2dtex;
+uniform int tf_mode;
+/* 0: sampling_rate samples per voxel crossed along each ray
+ * 1: same world space step for every ray, world_step */
+uniform int fixed_step;
+uniform float world_step;
+/* opacity correction already baked into the transfer function */
+uniform int tf_corrected;
+/* transfer function already applied to the whole volume, rgba,
+ * front to back only, see classify_volume() */
+uniform sampler3D classtex;
+uniform int preclassified;
+/* cuts, 0 cut away and 1 kept, filtered in between, see
+ * volumemask.h */
+uniform sampler3D masktex;
+uniform int masked;
 
 uniform mat4 projection;
 uniform mat4 view;
@@ -46,7 +81,11 @@ uniform float ka;
 uniform float kd;
 uniform float ks;
 
-uniform float nsamples;
+uniform vec3 volume_size;     /* voxels */
+uniform vec2 intensity_map;   /* scale and offset, stored to windowed */
+uniform vec2 slab_texture;    /* z offset and extent of the texture */
+uniform float sampling_rate;  /* samples per voxel */
+uniform int shading;
 uniform int compositing_mode;
 uniform int shading_mode;
 
@@ -55,7 +94,9 @@ const float DELTA = 0.005;
 const float SHADING_THRES = 0.10;
 
 /* globals */
-float stepsize;
+float stepsize;     /* texture space, along the ray */
+float opacity_step; /* world space, for opacity correction */
+float lod;          /* mip level of the current sample */
 
 
 
@@ -67,34 +108,109 @@ float rand() {
     return fract(sin(dot(gl_FragCoord.xy, vec2(12.9898, 78.233))) * 43758.5453);
 }
 
+/* bucket midpoints, same decoding as storage_error() */
+vec2 fetch_packed(ivec3 p, ivec3 size, int level)
+{
+    uint v = texelFetch(voltex_packed, clamp(p, ivec3(0), size - 1), level).r;
+
+    return vec2((float(v & 0xfff0u) + 8.0) / 65535.0,
+                (float(v & 0xfu) * 4096.0 + 2048.0) / 65535.0);
+}
+
+/* integer textures can't be filtered, trilinear by hand on the
+ * nearest mip level */
+vec2 sample_packed(vec3 pos)
+{
+    int level = int(lod + 0.5);
+    ivec3 size = textureSize(voltex_packed, level);
+    vec3 p = pos * vec3(size) - 0.5;
+    vec3 f = fract(p);
+    ivec3 i = ivec3(floor(p));
+
+    vec2 c00 = mix(fetch_packed(i, size, level),
+                   fetch_packed(i + ivec3(1, 0, 0), size, level), f.x);
+    vec2 c10 = mix(fetch_packed(i + ivec3(0, 1, 0), size, level),
+                   fetch_packed(i + ivec3(1, 1, 0), size, level), f.x);
+    vec2 c01 = mix(fetch_packed(i + ivec3(0, 0, 1), size, level),
+                   fetch_packed(i + ivec3(1, 0, 1), size, level), f.x);
+    vec2 c11 = mix(fetch_packed(i + ivec3(0, 1, 1), size, level),
+                   fetch_packed(i + ivec3(1, 1, 1), size, level), f.x);
+
+    return mix(mix(c00, c10, f.y), mix(c01, c11, f.y), f.z);
+}
+
+/* (intensity, gradient magnitude) whatever the storage */
+vec2 sample_volume(vec3 pos)
+{
+    /* volume to texture coordinates, only differ for a sort-last
+     * slab */
+    pos.z = (pos.z - slab_texture.x) / slab_texture.y;
+
+    vec2 voxel;
+    if (volume_format == 2) {
+        voxel = sample_packed(pos);
+    } else {
+        voxel = textureLod(voltex, pos, lod).rg;
+        /* codes are filtered first, the table is linear in between */
+        if (volume_format == 1)
+            voxel.r = textureLod(dequant, voxel.r * (255.0/256.0) + 0.5/256.0, 0.0).r;
+    }
+
+    /* stored value to the window, bit depth and rescale folded in,
+     * outside the window saturates like on a light box */
+    voxel.r = clamp(voxel.r * intensity_map.x + intensity_map.y, 0.0, 1.0);
+
+    return voxel;
+}
+
 /* calculate voxel gradient using central differences approximation */
 /*  f' = ( f(x+h)-f(x-h) ) / 2*h */
-vec3 gradient_central_diff(sampler3D sampler, vec3 pos, float delta)
+vec3 gradient_central_diff(vec3 pos, float delta)
 {
     vec3 fl, fh;
 
-    fl.x = texture(sampler, pos - vec3(delta*scale.x, 0.0, 0.0)).r;
-    fl.y = texture(sampler, pos - vec3(0.0, delta*scale.y, 0.0)).r;
-    fl.z = texture(sampler, pos - vec3(0.0, 0.0, delta*scale.z)).r;
+    fl.x = sample_volume(pos - vec3(delta*scale.x, 0.0, 0.0)).r;
+    fl.y = sample_volume(pos - vec3(0.0, delta*scale.y, 0.0)).r;
+    fl.z = sample_volume(pos - vec3(0.0, 0.0, delta*scale.z)).r;
 
-    fh.x = texture(sampler, pos + vec3(delta*scale.x, 0.0, 0.0)).r;
-    fh.y = texture(sampler, pos + vec3(0.0, delta*scale.y, 0.0)).r;
-    fh.z = texture(sampler, pos + vec3(0.0, 0.0, delta*scale.z)).r;
+    fh.x = sample_volume(pos + vec3(delta*scale.x, 0.0, 0.0)).r;
+    fh.y = sample_volume(pos + vec3(0.0, delta*scale.y, 0.0)).r;
+    fh.z = sample_volume(pos + vec3(0.0, 0.0, delta*scale.z)).r;
 
     /* well we should really divide it by 2h here, but we'll use it
      * for the normals anyway, it's ok to just normalize it here */
     return normalize(fh - fl);
 }
 
+/* plain old jet colormap for the cost heatmaps */
+vec3 heat(float t)
+{
+    t = clamp(t, 0.0, 1.0);
+    return clamp(vec3(1.5 - abs(4.0*t - 3.0),
+                      1.5 - abs(4.0*t - 2.0),
+                      1.5 - abs(4.0*t - 1.0)), 0.0, 1.0);
+}
+
 /* Standard compositing, alpha blend next pixel with the previous */
 vec4 composite_front_to_back(vec4 incolor, vec4 outcolor)
 {
-    /* opacity correction for varying stepsize */
-    /* Engel et. al.: "Real-Time Volume Graphics" - § 1.4.3 and 9.1.3 */
-    incolor.a = 1.0 - pow(1.0 - incolor.a, stepsize*200.0);
-
-    /* associate color and opacity (Blinn 1994) */
-    incolor.rgb *= incolor.a;
+    if (preclassified == 1) {
+        /* associated already, the corrected opacity scales the color
+         * along with it, a'/a */
+        if (tf_corrected == 0 && incolor.a > 0.0) {
+            float a = 1.0 - pow(1.0 - min(incolor.a, 1.0), opacity_step*200.0);
+            incolor.rgb *= a / incolor.a;
+            incolor.a = a;
+        }
+    } else {
+        /* opacity correction for varying stepsize */
+        /* Engel et. al.: "Real-Time Volume Graphics" - § 1.4.3 and 9.1.3 */
+        if (tf_corrected == 0)
+            incolor.a = 1.0 - pow(1.0 - incolor.a, opacity_step*200.0);
+
+        /* associate color and opacity (Blinn 1994) */
+        incolor.rgb *= incolor.a;
+    }
 
     outcolor += (1.0 - outcolor.a) * incolor;
 
@@ -121,7 +237,8 @@ vec4 composite_mida(vec4 incolor, vec4 outcolor, float f_P_i, inout float f_max_
 {
     /* opacity correction for varying stepsize */
     /* Engel et. al.: "Real-Time Volume Graphics" - § 1.4.3 and 9.1.3 */
-    incolor.a = 1.0 - pow(1.0 - incolor.a, stepsize*200.0);
+    if (tf_corrected == 0)
+        incolor.a = 1.0 - pow(1.0 - incolor.a, opacity_step*200.0);
 
     /* associate color and opacity (Blinn 1994) */
     incolor.rgb *= incolor.a;
@@ -188,6 +305,27 @@ vec3 blinn_phong_toon_shading(vec3 N, vec3 V, vec3 L)
     return ambient + diffuse + specular;
 }
 
+#ifdef CLASSIFY
+/* pre-classification: a slice of voxel centers through the transfer
+ * function, the raycaster would get the same colors sampling right
+ * on them. Stored associated, see composite_front_to_back() */
+void main()
+{
+    lod = 0.0;
+    vec2 voxel = sample_volume(ray_in);
+
+    if (tf_mode == 1)
+        outcolor = texture(tf2dtex, voxel);
+    else
+        outcolor = texture(tftex, voxel.r);
+    if (masked == 1)
+        outcolor.a *= textureLod(masktex, ray_in, 0.0).r;
+    outcolor.rgb *= outcolor.a;
+
+    raystats = vec4(0.0);
+    raycost = vec4(0.0);
+}
+#else
 void main()
 {
     /* screen to normalized viewport coordinates */
@@ -199,9 +337,25 @@ void main()
 
     vec3 direction = end - start;
     float len = length(direction);
-    stepsize = len / nsamples;
-    direction = normalize(direction);
+    direction = len > 0.0 ? direction / len : vec3(0.0);
+
+    /* texture space is stretched differently along each axis both in
+     * voxels and in world units (scale) */
+    float voxels_per_unit = max(length(direction * volume_size), 1.0);
+    float world_per_unit = length(direction * scale);
+
+    if (fixed_step == 1) {
+        opacity_step = world_step;
+        stepsize = world_step / max(world_per_unit, 1e-6);
+    } else {
+        stepsize = 1.0 / (sampling_rate * voxels_per_unit);
+        opacity_step = stepsize * world_per_unit;
+    }
+
+    int nsteps = int(ceil(len / stepsize));
     vec3 delta = direction * stepsize;
+    /* the longest ray through the volume, scales the heatmaps */
+    float max_samples = sampling_rate * length(volume_size);
 
     vec3 pos = start;
 
@@ -212,6 +366,17 @@ void main()
      * aliasing */
     pos  = pos + delta * rand();
 
+    /* level of detail: log2 of the voxels a pixel covers at the
+     * sample depth, view space depth is linear along the ray */
+    mat4 modelview = view * model;
+    float view_z = (modelview * vec4(pos, 1.0)).z;
+    float view_dz = (modelview * vec4(delta, 0.0)).z;
+    float voxel_world = min(min(scale.x / volume_size.x, scale.y / volume_size.y),
+                            scale.z / volume_size.z);
+    float pixel_angle = 2.0 / (projection[1][1] * screen_height);
+    float lod_scale = pixel_angle / voxel_world;
+    lod = 0.0;
+
     vec3 eyePosition = view[3].xyz;
     vec3 lightPosition = eyePosition - vec3(0, 0, 4);
 
@@ -221,6 +386,15 @@ void main()
     outcolor = vec4(0.0);
     vec4 color = vec4(0.0);
 
+    /* ray cost counters */
+    float potential = max(len / stepsize, 1.0);
+    float taken = 0.0;
+    float shaded = 0.0;
+    bool terminated = false;
+
+    raystats = vec4(0.0);
+    raycost = vec4(0.0);
+
     /* debugging modes */
     if (compositing_mode == 3) {
         outcolor = vec4(start, 1.0);
@@ -235,11 +409,35 @@ void main()
 
 
     /* marching loop */
-    for(int i = 0; i < nsamples && len > 0; i++, pos+=delta, len-=stepsize) {
-        /* sample intensity from the 3D texture */
-        intensity = texture(voltex, pos).r;
-        /* map intensity to transfer function LUT */
-        color = texture(tftex, intensity);
+    for(int i = 0; i < nsteps && len > 0; i++, pos+=delta, len-=stepsize) {
+        taken += 1.0;
+
+        if (max_lod > 0.0)
+            lod = clamp(log2(max(-view_z, 1e-6) * lod_scale), 0.0, max_lod);
+        view_z += view_dz;
+
+        if (preclassified == 1) {
+            /* a single fetch, no dependent lookup, the color comes
+             * opacity weighted */
+            color = textureLod(classtex, pos, lod);
+            intensity = color.a;
+        } else {
+            /* sample intensity (and gradient magnitude) from the 3D texture */
+            vec2 voxel = sample_volume(pos);
+            intensity = voxel.r;
+            /* map intensity to transfer function LUT */
+            if (tf_mode == 1)
+                color = texture(tf2dtex, voxel);
+            else
+                color = texture(tftex, intensity);
+
+            /* the pre-classified colors have it already */
+            if (masked == 1) {
+                float keep = textureLod(masktex, pos, lod).r;
+                color.a *= keep;
+                intensity *= keep;
+            }
+        }
 
 
         /* shading_mode
@@ -250,9 +448,11 @@ void main()
          */
         if ((color.a > SHADING_THRES) &&
             (shading_mode != 3) &&
-            (nsamples > 500)) {
+            (shading == 1)) {
+            shaded += 1.0;
+
             /* everything in world space */
-            vec3 N = gradient_central_diff(voltex, pos, DELTA);
+            vec3 N = gradient_central_diff(pos, DELTA);
 
             vec3 pos_world = vec3(model * vec4(pos, 1.0));
 
@@ -261,13 +461,16 @@ void main()
             vec3 L = normalize(lightPosition - pos_world);
             vec3 V = normalize(eyePosition - pos_world);
 
+            /* light on associated colors is weighted too */
+            float weight = preclassified == 1 ? color.a : 1.0;
+
             if (shading_mode == 0) {
-                color.rgb += blinn_phong_shading(N, V, L);
+                color.rgb += weight * blinn_phong_shading(N, V, L);
             } else {
                 if (shading_mode == 1)
-                    color.rgb += blinn_phong_shading(N, V, L);
+                    color.rgb += weight * blinn_phong_shading(N, V, L);
                 else if (shading_mode == 2)
-                    color.rgb += blinn_phong_toon_shading(N, V, L);
+                    color.rgb += weight * blinn_phong_toon_shading(N, V, L);
 
                 /* enhance edges when the gradient is almost
                  * perpendicular to the viewing direction */
@@ -285,7 +488,8 @@ void main()
         /* does this affect performance? */
         /* in the old days there was no real branching, but it
          * seems we're past that nowawadays */
-        if (compositing_mode == 0)
+        /* cost heatmaps (6-8) measure front to back compositing */
+        if (compositing_mode == 0 || compositing_mode >= 6)
             outcolor = composite_front_to_back(color, outcolor);
         else if (compositing_mode == 1)
             outcolor = composite_mip(color, outcolor);
@@ -294,7 +498,22 @@ void main()
 
         /* early ray termination */
         if (outcolor.a > 0.95) {
+            terminated = true;
             break;
         }
     }
+
+    float skipped = terminated ? 1.0 - taken / potential : 0.0;
+    raystats = vec4(taken, shaded, terminated ? 1.0 : 0.0, 1.0);
+    raycost = vec4(potential, skipped, 0.0, 1.0);
+
+    /* cost heatmaps, blue is cheap, red is expensive (or for early
+     * termination: stopped early, black rays went all the way) */
+    if (compositing_mode == 6)
+        outcolor = vec4(heat(taken / max_samples), 1.0);
+    else if (compositing_mode == 7)
+        outcolor = terminated ? vec4(heat(skipped), 1.0) : vec4(0.0, 0.0, 0.0, 1.0);
+    else if (compositing_mode == 8)
+        outcolor = vec4(heat(shaded / max_samples), 1.0);
 }
+#endif
@@ -29,17 +29,33 @@ uniform mat4 view;
 uniform mat4 model;
 
 uniform vec3 origin;
+/* z range of the cube in volume coordinates, a slab of it in
+ * sort-last mode */
+uniform vec2 slab;
+#ifdef CLASSIFY
+/* pre-classification draws the z = 0 face over a whole slice of the
+ * volume instead, see classify_volume() */
+uniform float slice;
+#endif
 
 out vec3 ray_in;
 out mat3 normalmatrix;
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(vertex_position, 1.0);
-    ray_in = vertex_position;
+#ifdef CLASSIFY
+    gl_Position = vec4(vertex_position.xy * 2.0 - 1.0, 0.0, 1.0);
+    ray_in = vec3(vertex_position.xy, slice);
+    normalmatrix = mat3(1.0);
+#else
+    vec3 position = vec3(vertex_position.xy, mix(slab.x, slab.y, vertex_position.z));
+
+    gl_Position = projection * view * model * vec4(position, 1.0);
+    ray_in = position;
 
     /* transform local normals to world space */
     normalmatrix = mat3(transpose(inverse(model)));
     /* in eye space it would be */
     /* normalmatrix = mat3(transpose(inverse(view * model))); */
+#endif
 }
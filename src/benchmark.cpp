@@ -0,0 +1,296 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#include "benchmark.h"
+#include "presetmanager.h"
+#include "transfuncwidget.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QJsonDocument>
+#include <QFile>
+#include <QtAlgorithms>
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define BENCH_PRESETS_DIR "presets/bench/"
+
+typedef struct _BenchMode
+{
+    const char *name;
+    const char *preset;
+    int compositing_mode;
+    int shading_mode;
+} BenchMode;
+
+/* every compositing mode and every shading mode at least once */
+static const BenchMode bench_modes[] = {
+    { "dvr-phong",    "dvr.json", 0, 0 },
+    { "dvr-edges",    "dvr.json", 0, 1 },
+    { "dvr-toon",     "dvr.json", 0, 2 },
+    { "dvr-unshaded", "dvr.json", 0, 3 },
+    { "mip",          "mip.json", 1, 3 },
+    { "mida",         "dvr.json", 2, 0 },
+};
+
+/* linear interpolation between closest ranks, values must be sorted */
+static double percentile(const QVector<double> &sorted, double p)
+{
+    if (sorted.isEmpty())
+        return 0.0;
+
+    double rank = p / 100.0 * (sorted.size() - 1);
+    int lo = (int) rank;
+    int hi = MIN(lo + 1, sorted.size() - 1);
+
+    return lerp(sorted[lo], sorted[hi], rank - lo);
+}
+
+static QJsonObject summarize(QVector<double> values)
+{
+    QJsonObject o;
+
+    if (values.isEmpty())
+        return o;
+
+    qSort(values.begin(), values.end());
+
+    double sum = 0.0;
+    foreach (double v, values)
+        sum += v;
+
+    o.insert("min", values.first());
+    o.insert("mean", sum / values.size());
+    o.insert("p50", percentile(values, 50));
+    o.insert("p90", percentile(values, 90));
+    o.insert("p95", percentile(values, 95));
+    o.insert("p99", percentile(values, 99));
+    o.insert("max", values.last());
+
+    return o;
+}
+
+Benchmark::Benchmark(GLWidget *glwidget, const InitOptions &opt,
+                     const QString &output, int frames, QObject *parent) :
+    QObject(parent)
+{
+    this->glwidget = glwidget;
+    this->opt = opt;
+    this->output = output;
+    this->frames = MAX(frames, 1);
+
+    current_run = -1;
+    current_frame = 0;
+
+    /* still frames and interactive frames along the orbit, still
+     * frames only for the zoom, that's where sampling gets weird */
+    for (unsigned int i=0; i<sizeof(bench_modes)/sizeof(bench_modes[0]); i++) {
+        const BenchMode &m = bench_modes[i];
+        BenchRun r;
+
+        r.preset = m.preset;
+        r.compositing_mode = m.compositing_mode;
+        r.shading_mode = m.shading_mode;
+
+        r.name = QString(m.name) + "/orbit/still";
+        r.fast_rendering = false;
+        r.path = CAMERA_ORBIT;
+        runs << r;
+
+        r.name = QString(m.name) + "/orbit/interactive";
+        r.fast_rendering = true;
+        r.path = CAMERA_ORBIT;
+        runs << r;
+
+        r.name = QString(m.name) + "/zoom/still";
+        r.fast_rendering = false;
+        r.path = CAMERA_ZOOM;
+        runs << r;
+    }
+}
+
+void Benchmark::set_dataset_label(const QString &label)
+{
+    dataset_label = label;
+}
+
+void Benchmark::start()
+{
+    printf("benchmark: %d runs, %d frames each\n", runs.size(), frames);
+
+    connect(glwidget, &GLWidget::frame_presented,
+            this, &Benchmark::frame_done);
+
+    /* wait for the first frame, by then the transfer function widget
+     * is done pushing its own initial state and won't override ours */
+    current_run = -1;
+    glwidget->set_frame_timing(true);
+}
+
+void Benchmark::begin_run()
+{
+    const BenchRun &r = runs[current_run];
+
+    Preset preset(BENCH_PRESETS_DIR + r.preset);
+    float *tf = (float *) calloc(4 * TF_CHANNEL_SIZE, sizeof(float));
+    preset_to_rgba(&preset, tf, TF_CHANNEL_SIZE);
+    glwidget->new_transfer_function(tf, TF_CHANNEL_SIZE);
+    free(tf);
+
+    glwidget->set_compositing_mode(r.compositing_mode);
+    glwidget->set_shading_mode(r.shading_mode);
+    glwidget->set_fast_rendering(r.fast_rendering);
+
+    samples.clear();
+    current_frame = 0;
+
+    apply_frame();
+}
+
+void Benchmark::apply_frame()
+{
+    const BenchRun &r = runs[current_run];
+    QQuaternion rotation;
+    float depth;
+
+    /* warmup frames all sit on the first pose */
+    int i = MAX(0, current_frame - BENCH_WARMUP_FRAMES);
+    camera_path_pose(r.path, i, frames, &rotation, &depth);
+
+    wall_timer.start();
+    glwidget->set_camera(rotation, depth);
+}
+
+void Benchmark::frame_done()
+{
+    if (current_run < 0) {
+        current_run = 0;
+        begin_run();
+        return;
+    }
+
+    if (current_run >= runs.size())
+        return;
+
+    if (current_frame >= BENCH_WARMUP_FRAMES) {
+        BenchFrame f;
+        f.cpu_time = glwidget->get_last_cpu_time();
+        f.gpu_time = glwidget->get_last_gpu_time();
+        f.wall_time = wall_timer.nsecsElapsed() / 1e6;
+        samples << f;
+    }
+
+    current_frame++;
+
+    if (current_frame < frames + BENCH_WARMUP_FRAMES) {
+        apply_frame();
+        return;
+    }
+
+    end_run();
+
+    if (++current_run < runs.size())
+        begin_run();
+    else
+        finish();
+}
+
+void Benchmark::end_run()
+{
+    const BenchRun &r = runs[current_run];
+    QVector<double> cpu, gpu, wall;
+    QJsonArray frame_array;
+
+    foreach (const BenchFrame &f, samples) {
+        cpu << f.cpu_time;
+        gpu << f.gpu_time;
+        wall << f.wall_time;
+
+        QJsonObject o;
+        o.insert("cpu_ms", f.cpu_time);
+        o.insert("gpu_ms", f.gpu_time);
+        o.insert("wall_ms", f.wall_time);
+        frame_array.append(o);
+    }
+
+    QJsonObject summary;
+    summary.insert("cpu_ms", summarize(cpu));
+    summary.insert("gpu_ms", summarize(gpu));
+    summary.insert("wall_ms", summarize(wall));
+
+    QJsonObject run;
+    run.insert("name", r.name);
+    run.insert("preset", r.preset);
+    run.insert("compositing_mode", r.compositing_mode);
+    run.insert("shading_mode", r.shading_mode);
+    run.insert("quality", r.fast_rendering ? "interactive" : "still");
+    run.insert("path", camera_path_to_string(r.path));
+    run.insert("summary", summary);
+    run.insert("frames", frame_array);
+    results.append(run);
+
+    QJsonObject wall_summary = summary["wall_ms"].toObject();
+    printf("%-28s p50 %8.2f ms  p95 %8.2f ms\n", r.name.toUtf8().data(),
+           wall_summary["p50"].toDouble(), wall_summary["p95"].toDouble());
+}
+
+void Benchmark::finish()
+{
+    disconnect(glwidget, &GLWidget::frame_presented,
+               this, &Benchmark::frame_done);
+    glwidget->set_frame_timing(false);
+
+    QJsonObject dataset;
+    dataset.insert("filename", opt.filename);
+    dataset.insert("label", dataset_label);
+    dataset.insert("width", (int) opt.width);
+    dataset.insert("height", (int) opt.height);
+    dataset.insert("depth", (int) opt.depth);
+    dataset.insert("bit_depth", (int) opt.bit_depth);
+    dataset.insert("storage", volume_storage_to_string(glwidget->get_storage()));
+    dataset.insert("volume_bytes", (double) glwidget->get_volume_bytes());
+
+    QJsonObject doc;
+    doc.insert("version", QCoreApplication::applicationVersion());
+    doc.insert("build", QString(__DATE__ " " __TIME__));
+    doc.insert("qt", QString(qVersion()));
+    doc.insert("renderer", glwidget->get_renderer_string());
+    doc.insert("gl_version", glwidget->get_gl_version_string());
+    doc.insert("date", QDateTime::currentDateTime().toString(Qt::ISODate));
+    doc.insert("viewport", QJsonArray({ glwidget->width(), glwidget->height() }));
+    doc.insert("frames_per_run", frames);
+    doc.insert("warmup_frames", BENCH_WARMUP_FRAMES);
+    doc.insert("dataset", dataset);
+    doc.insert("runs", results);
+
+    QFile outfile(output);
+    if (!outfile.open(QIODevice::WriteOnly)) {
+        fprintf(stderr, "couldn't open for writing: %s\n", output.toUtf8().data());
+    } else {
+        outfile.write(QJsonDocument(doc).toJson());
+        outfile.close();
+        printf("benchmark results written to %s\n", output.toUtf8().data());
+    }
+
+    QCoreApplication::quit();
+}
@@ -0,0 +1,97 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QObject>
+#include <QString>
+#include <QVector>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QElapsedTimer>
+
+#include "glwidget.h"
+#include "camerapath.h"
+#include "util.h"
+
+#define BENCH_WARMUP_FRAMES 5
+
+/* one timed run: a fixed transfer function and rendering mode
+ * flying along a camera path */
+typedef struct _BenchRun
+{
+    QString name;
+    QString preset;
+    int compositing_mode;
+    int shading_mode;
+    bool fast_rendering;
+    CameraPath path;
+} BenchRun;
+
+typedef struct _BenchFrame
+{
+    double cpu_time;
+    double gpu_time;
+    double wall_time;
+} BenchFrame;
+
+/* Drives a GLWidget through every run, collects per frame timings
+ * and dumps everything to a json file when done, then quits */
+class Benchmark : public QObject
+{
+    Q_OBJECT
+
+public:
+    Benchmark(GLWidget *glwidget, const InitOptions &opt,
+              const QString &output, int frames, QObject *parent = 0);
+
+    /* free form description of the dataset, e.g. the synthetic kind */
+    void set_dataset_label(const QString &label);
+
+    void start();
+
+private slots:
+    void frame_done();
+
+private:
+    void begin_run();
+    void apply_frame();
+    void end_run();
+    void finish();
+
+    GLWidget *glwidget;
+    InitOptions opt;
+    QString output;
+    QString dataset_label;
+    int frames;
+
+    QVector<BenchRun> runs;
+    int current_run;
+    int current_frame;
+
+    QVector<BenchFrame> samples;
+    QElapsedTimer wall_timer;
+    QJsonArray results;
+};
+
+#endif /* BENCHMARK_H */
@@ -0,0 +1,74 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#include "camerapath.h"
+
+#include <math.h>
+
+/* default eye depth, keep in sync with GLWidget */
+#define DEFAULT_DEPTH 1.1f
+
+bool camera_path_from_string(const QString &name, CameraPath *path)
+{
+    if (name == "orbit")
+        *path = CAMERA_ORBIT;
+    else if (name == "zoom")
+        *path = CAMERA_ZOOM;
+    else
+        return false;
+
+    return true;
+}
+
+QString camera_path_to_string(CameraPath path)
+{
+    switch (path) {
+    case CAMERA_ORBIT: return "orbit";
+    case CAMERA_ZOOM:  return "zoom";
+    }
+
+    return QString();
+}
+
+void camera_path_pose(CameraPath path, int i, int n,
+                      QQuaternion *rotation, float *depth)
+{
+    float t = n > 1 ? (float) i / (n - 1) : 0.0f;
+
+    switch (path) {
+    case CAMERA_ORBIT:
+        *rotation = QQuaternion::fromEulerAngles(20.0f, 360.0f * t, 0.0f);
+        *depth = DEFAULT_DEPTH;
+        break;
+    case CAMERA_ZOOM:
+        /* 1.1 -> 2.0 -> 0.6 -> 1.1, a bit of rotation to avoid
+         * caching effects of a perfectly still image */
+        *rotation = QQuaternion::fromEulerAngles(20.0f, 30.0f + 30.0f * t, 0.0f);
+        if (t < 0.25f)
+            *depth = DEFAULT_DEPTH + (2.0f - DEFAULT_DEPTH) * (t / 0.25f);
+        else if (t < 0.75f)
+            *depth = 2.0f + (0.6f - 2.0f) * ((t - 0.25f) / 0.5f);
+        else
+            *depth = 0.6f + (DEFAULT_DEPTH - 0.6f) * ((t - 0.75f) / 0.25f);
+        break;
+    }
+}
@@ -0,0 +1,44 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#ifndef CAMERA_PATH_H
+#define CAMERA_PATH_H
+
+#include <QQuaternion>
+#include <QString>
+
+/* scripted camera motion, same parametrization GLWidget uses for
+ * mouse navigation: a rotation of the model and an eye depth */
+typedef enum _CameraPath
+{
+    CAMERA_ORBIT,  /* full turn around the vertical axis, slightly tilted */
+    CAMERA_ZOOM    /* pull back, push in close and back to the start */
+} CameraPath;
+
+bool camera_path_from_string(const QString &name, CameraPath *path);
+QString camera_path_to_string(CameraPath path);
+
+/* pose at frame i of n */
+void camera_path_pose(CameraPath path, int i, int n,
+                      QQuaternion *rotation, float *depth);
+
+#endif /* CAMERA_PATH_H */
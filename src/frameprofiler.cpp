@@ -0,0 +1,353 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#include "frameprofiler.h"
+
+#include <QJsonObject>
+#include <QJsonDocument>
+
+#include <stdio.h>
+#include <string.h>
+
+FrameProfiler::FrameProfiler(QObject *parent) :
+    QObject(parent)
+{
+    for (int i=0; i<PROFILER_BUFFERS; i++) {
+        monitors[i] = NULL;
+        in_flight[i] = false;
+        gpu_recorded[i] = false;
+        composed[i] = false;
+    }
+    for (int i=0; i<PROFILER_UPLOAD_BATCHES; i++) {
+        upload_monitors[i] = NULL;
+        upload_samples[i] = 0;
+    }
+
+    memset(&last_stats, 0, sizeof(FrameStats));
+
+    gpu_available = false;
+    blocking = false;
+    current = 0;
+    frame_count = 0;
+    upload_batch = 0;
+    upload_depth = 0;
+    upload_time = 0.0;
+    log_csv = false;
+
+    clock.start();
+}
+
+/* monitors hold GL objects, the owner must make the context current */
+FrameProfiler::~FrameProfiler()
+{
+    for (int i=0; i<PROFILER_BUFFERS; i++)
+        delete monitors[i];
+    for (int i=0; i<PROFILER_UPLOAD_BATCHES; i++)
+        delete upload_monitors[i];
+
+    if (log.isOpen())
+        log.close();
+}
+
+bool FrameProfiler::init()
+{
+    /* timestamps need GL 3.3 or ARB_timer_query, cpu timings still
+     * work without them */
+    gpu_available = true;
+    for (int i=0; i<PROFILER_BUFFERS; i++) {
+        monitors[i] = new QOpenGLTimeMonitor(this);
+        monitors[i]->setSampleCount(PROFILER_SAMPLES);
+        if (!monitors[i]->create())
+            gpu_available = false;
+    }
+    for (int i=0; i<PROFILER_UPLOAD_BATCHES; i++) {
+        upload_monitors[i] = new QOpenGLTimeMonitor(this);
+        upload_monitors[i]->setSampleCount(PROFILER_UPLOAD_SAMPLES);
+        if (!upload_monitors[i]->create())
+            gpu_available = false;
+    }
+
+    if (!gpu_available) {
+        fprintf(stderr, "GL timer queries not available, no gpu timings\n");
+        for (int i=0; i<PROFILER_BUFFERS; i++) {
+            delete monitors[i];
+            monitors[i] = NULL;
+        }
+        for (int i=0; i<PROFILER_UPLOAD_BATCHES; i++) {
+            delete upload_monitors[i];
+            upload_monitors[i] = NULL;
+        }
+    }
+
+    return gpu_available;
+}
+
+void FrameProfiler::set_blocking(bool blocking)
+{
+    this->blocking = blocking;
+}
+
+bool FrameProfiler::open_log(const QString &path)
+{
+    log.setFileName(path);
+    if (!log.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        fprintf(stderr, "couldn't open for writing: %s\n", path.toUtf8().data());
+        return false;
+    }
+
+    log_csv = path.endsWith(".csv", Qt::CaseInsensitive);
+    if (log_csv)
+        log.write("frame,timestamp_ms,gpu_valid,first_pass_ms,raycast_ms,"
+                  "upload_ms,paint_ms,compose_ms,sampling_rate,width,height,"
+                  "compositing_mode,shading_mode,fast_rendering,rays_valid,"
+                  "rays,samples_taken,samples_shaded,terminated,samples_saved\n");
+
+    return true;
+}
+
+void FrameProfiler::begin_frame(const FrameStats &info)
+{
+    collect(false);
+
+    /* uploads since the last frame wait for the gpu from now on */
+    if (gpu_available && upload_samples[upload_batch] > 0)
+        next_upload_batch();
+    collect_uploads();
+
+    /* if the slot is still waiting for the gpu after a full ring we
+     * give up on its timings rather than wait */
+    int slot = (current + 1) % PROFILER_BUFFERS;
+    if (in_flight[slot])
+        finalize(slot);
+    current = slot;
+
+    FrameStats &s = pending[slot];
+    s = info;
+    s.frame = frame_count++;
+    s.timestamp = clock.nsecsElapsed() / 1e6;
+    s.gpu_valid = false;
+    s.first_pass = 0.0;
+    s.raycast = 0.0;
+    s.upload = upload_time;
+    s.paint = 0.0;
+    s.compose = 0.0;
+    upload_time = 0.0;
+
+    in_flight[slot] = true;
+    composed[slot] = false;
+    gpu_recorded[slot] = gpu_available;
+
+    if (gpu_recorded[slot]) {
+        monitors[slot]->reset();
+        monitors[slot]->recordSample();
+    }
+}
+
+/* mark the end of a pass, the last one ends with the frame */
+void FrameProfiler::end_pass()
+{
+    if (in_flight[current] && gpu_recorded[current])
+        monitors[current]->recordSample();
+}
+
+void FrameProfiler::end_frame(double paint_time)
+{
+    if (!in_flight[current])
+        return;
+
+    pending[current].paint = paint_time;
+    if (gpu_recorded[current])
+        monitors[current]->recordSample();
+
+    compose_timer.start();
+
+    if (blocking) {
+        composed[current] = true;
+        collect(true);
+    }
+}
+
+/* the monitor is reset when the slot comes around again, samples
+ * recorded so far don't matter */
+void FrameProfiler::abort_frame()
+{
+    in_flight[current] = false;
+}
+
+void FrameProfiler::begin_upload()
+{
+    if (!gpu_available || upload_depth++ > 0)
+        return;
+
+    if (upload_samples[upload_batch] + 2 > PROFILER_UPLOAD_SAMPLES)
+        next_upload_batch();
+    upload_monitors[upload_batch]->recordSample();
+    upload_samples[upload_batch]++;
+}
+
+void FrameProfiler::end_upload()
+{
+    if (!gpu_available || upload_depth == 0 || --upload_depth > 0)
+        return;
+
+    upload_monitors[upload_batch]->recordSample();
+    upload_samples[upload_batch]++;
+}
+
+/* the recording batch is done, the oldest one takes over. Still
+ * waiting for the gpu after a full ring, it's dropped */
+void FrameProfiler::next_upload_batch()
+{
+    collect_uploads();
+
+    upload_batch = (upload_batch + 1) % PROFILER_UPLOAD_BATCHES;
+    upload_monitors[upload_batch]->reset();
+    upload_samples[upload_batch] = 0;
+}
+
+/* finished batches, every other interval is an upload, the ones in
+ * between are whatever ran meanwhile */
+void FrameProfiler::collect_uploads()
+{
+    for (int k=1; k<PROFILER_UPLOAD_BATCHES; k++) {
+        int b = (upload_batch + k) % PROFILER_UPLOAD_BATCHES;
+
+        if (upload_samples[b] == 0 || !upload_monitors[b]->isResultAvailable())
+            continue;
+
+        QVector<GLuint64> intervals = upload_monitors[b]->waitForIntervals();
+        for (int i=0; i<intervals.size(); i+=2)
+            upload_time += intervals[i] / 1e6;
+        upload_samples[b] = 0;
+    }
+}
+
+void FrameProfiler::frame_swapped()
+{
+    if (in_flight[current] && !composed[current]) {
+        pending[current].compose = compose_timer.nsecsElapsed() / 1e6;
+        composed[current] = true;
+    }
+
+    collect(false);
+}
+
+const FrameStats &FrameProfiler::last()
+{
+    return last_stats;
+}
+
+/* oldest first, stop at the first frame that isn't ready so stats
+ * always come out in order */
+void FrameProfiler::collect(bool wait)
+{
+    for (int k=1; k<=PROFILER_BUFFERS; k++) {
+        int slot = (current + k) % PROFILER_BUFFERS;
+
+        if (!in_flight[slot])
+            continue;
+        if (!composed[slot])
+            break;
+
+        if (gpu_recorded[slot]) {
+            if (!wait && !monitors[slot]->isResultAvailable())
+                break;
+
+            QVector<GLuint64> intervals = monitors[slot]->waitForIntervals();
+            if (intervals.size() == PROFILER_PASSES) {
+                pending[slot].first_pass = intervals[0] / 1e6;
+                pending[slot].raycast = intervals[1] / 1e6;
+                pending[slot].gpu_valid = true;
+            }
+        }
+
+        finalize(slot);
+    }
+}
+
+void FrameProfiler::finalize(int slot)
+{
+    in_flight[slot] = false;
+    last_stats = pending[slot];
+
+    if (log.isOpen())
+        write_log(last_stats);
+
+    emit stats_ready(last_stats);
+}
+
+void FrameProfiler::write_log(const FrameStats &s)
+{
+    if (log_csv) {
+        QString line = QString("%1,%2,%3,%4,%5,%6,%7,%8,%9,%10,%11,%12,%13,%14,"
+                               "%15,%16,%17,%18,%19,%20\n")
+            .arg(s.frame)
+            .arg(s.timestamp, 0, 'f', 3)
+            .arg(s.gpu_valid ? 1 : 0)
+            .arg(s.first_pass, 0, 'f', 4)
+            .arg(s.raycast, 0, 'f', 4)
+            .arg(s.upload, 0, 'f', 4)
+            .arg(s.paint, 0, 'f', 4)
+            .arg(s.compose, 0, 'f', 4)
+            .arg(s.sampling_rate, 0, 'f', 2)
+            .arg(s.width)
+            .arg(s.height)
+            .arg(s.compositing_mode)
+            .arg(s.shading_mode)
+            .arg(s.fast_rendering ? 1 : 0)
+            .arg(s.rays_valid ? 1 : 0)
+            .arg(s.rays, 0, 'f', 0)
+            .arg(s.samples_taken, 0, 'f', 2)
+            .arg(s.samples_shaded, 0, 'f', 2)
+            .arg(s.terminated, 0, 'f', 4)
+            .arg(s.samples_saved, 0, 'f', 4);
+        log.write(line.toUtf8());
+    } else {
+        QJsonObject o;
+        o.insert("frame", (double) s.frame);
+        o.insert("timestamp_ms", s.timestamp);
+        o.insert("gpu_valid", s.gpu_valid);
+        o.insert("first_pass_ms", s.first_pass);
+        o.insert("raycast_ms", s.raycast);
+        o.insert("upload_ms", s.upload);
+        o.insert("paint_ms", s.paint);
+        o.insert("compose_ms", s.compose);
+        o.insert("sampling_rate", s.sampling_rate);
+        o.insert("width", s.width);
+        o.insert("height", s.height);
+        o.insert("compositing_mode", s.compositing_mode);
+        o.insert("shading_mode", s.shading_mode);
+        o.insert("fast_rendering", s.fast_rendering);
+        if (s.rays_valid) {
+            o.insert("rays", s.rays);
+            o.insert("samples_taken", s.samples_taken);
+            o.insert("samples_shaded", s.samples_shaded);
+            o.insert("terminated", s.terminated);
+            o.insert("samples_saved", s.samples_saved);
+        }
+        log.write(QJsonDocument(o).toJson(QJsonDocument::Compact));
+        log.write("\n");
+    }
+
+    /* we want the log to survive a crash or a kill */
+    log.flush();
+}
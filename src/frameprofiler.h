@@ -0,0 +1,155 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#ifndef FRAME_PROFILER_H
+#define FRAME_PROFILER_H
+
+#include <QObject>
+#include <QString>
+#include <QFile>
+#include <QElapsedTimer>
+#include <QOpenGLTimeMonitor>
+
+/* one gpu timestamp at frame start, one after each pass */
+#define PROFILER_PASSES  2
+#define PROFILER_SAMPLES (PROFILER_PASSES + 1)
+/* results are read back this many frames late, never stall */
+#define PROFILER_BUFFERS 2
+/* texture uploads get a ring of their own, they happen whenever,
+ * a begin and an end timestamp each, batches past the samples go to
+ * the next monitor */
+#define PROFILER_UPLOAD_BATCHES 4
+#define PROFILER_UPLOAD_SAMPLES 16
+
+/* everything we know about a rendered frame, times in milliseconds */
+typedef struct _FrameStats
+{
+    qint64 frame;
+    double timestamp;   /* since the profiler was created */
+
+    bool gpu_valid;     /* false if the driver has no timer queries or
+                         * results weren't ready in time */
+    double first_pass;  /* gpu */
+    double raycast;     /* gpu */
+
+    double upload;      /* gpu, texture uploads (volume, mipmaps,
+                         * transfer functions, mask) whose results came
+                         * in since the previous frame, so usually a
+                         * frame or two late. Encoding them on the cpu
+                         * and disk reads aren't in it */
+    double paint;       /* cpu, whole frame on the render thread */
+    double compose;     /* cpu, frame end to the handoff to the widget */
+
+    double sampling_rate;   /* samples per voxel, requested */
+
+    /* measured ray cost, only when collecting ray statistics and
+     * always a frame late */
+    bool rays_valid;
+    double rays;            /* rays cast (covered pixels) */
+    double samples_taken;   /* per ray */
+    double samples_shaded;  /* per ray */
+    double terminated;      /* fraction of rays stopped early */
+    double samples_saved;   /* fraction of samples early termination skipped */
+
+    int width;
+    int height;
+    int compositing_mode;
+    int shading_mode;
+    bool fast_rendering;
+} FrameStats;
+
+/* Per pass gpu timings through a ring of timer monitors, results are
+ * collected only when the driver says they're available so we never
+ * wait on the gpu, except when asked to (benchmarks). Texture uploads
+ * are timed the same way, between begin_upload() and end_upload().
+ * Finished frames are emitted and optionally streamed to a csv or
+ * json lines log */
+class FrameProfiler : public QObject
+{
+    Q_OBJECT
+
+public:
+    FrameProfiler(QObject *parent = 0);
+    ~FrameProfiler();
+
+    /* needs a current GL context */
+    bool init();
+
+    /* wait for gpu results at the end of every frame */
+    void set_blocking(bool blocking);
+
+    /* path ending in .csv gets csv, anything else json lines */
+    bool open_log(const QString &path);
+
+    /* frame boundaries and pass markers, call while rendering */
+    void begin_frame(const FrameStats &info);
+    void end_pass();
+    void end_frame(double paint_time);
+    /* drop the frame in progress, it won't be finished */
+    void abort_frame();
+
+    /* around the GL calls of a texture upload, anywhere, nested pairs
+     * count once */
+    void begin_upload();
+    void end_upload();
+
+    /* out of frame events */
+    void frame_swapped();
+
+    const FrameStats &last();
+
+signals:
+    void stats_ready(const FrameStats &stats);
+
+private:
+    void collect(bool wait);
+    void collect_uploads();
+    void next_upload_batch();
+    void finalize(int slot);
+    void write_log(const FrameStats &stats);
+
+    QOpenGLTimeMonitor *monitors[PROFILER_BUFFERS];
+    FrameStats pending[PROFILER_BUFFERS];
+    bool in_flight[PROFILER_BUFFERS];
+    bool gpu_recorded[PROFILER_BUFFERS];
+    bool composed[PROFILER_BUFFERS];
+
+    bool gpu_available;
+    bool blocking;
+    int current;
+    qint64 frame_count;
+
+    QOpenGLTimeMonitor *upload_monitors[PROFILER_UPLOAD_BATCHES];
+    int upload_samples[PROFILER_UPLOAD_BATCHES];   /* 0 when read */
+    int upload_batch;   /* recording */
+    int upload_depth;
+    double upload_time; /* read back, not reported yet */
+
+    QElapsedTimer clock;
+    QElapsedTimer compose_timer;
+    FrameStats last_stats;
+
+    QFile log;
+    bool log_csv;
+};
+
+#endif /* FRAME_PROFILER_H */
@@ -0,0 +1,176 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#include "framesequence.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QImage>
+
+#include <stdio.h>
+
+/* top row first, alpha dropped */
+static void rgba_to_rgb(const uchar *in, int w, int h, uchar *out, int stride)
+{
+    for (int y=0; y<h; y++) {
+        const uchar *src = in + (size_t) (h - 1 - y) * w * 4;
+        uchar *dst = out + (size_t) y * stride;
+        for (int x=0; x<w; x++) {
+            dst[3*x + 0] = src[4*x + 0];
+            dst[3*x + 1] = src[4*x + 1];
+            dst[3*x + 2] = src[4*x + 2];
+        }
+    }
+}
+
+/* split @pattern around its frame number, see FrameSequence */
+static bool parse_pattern(FrameSequence *s, const QString &pattern)
+{
+    QString *out = &s->prefix;
+    s->prefix.clear();
+    s->suffix.clear();
+    s->digits = 0;
+    s->fill = ' ';
+    s->raw = true;
+
+    for (int i=0; i<pattern.size(); i++) {
+        if (pattern[i] != '%') {
+            *out += pattern[i];
+            continue;
+        }
+        if (i + 1 < pattern.size() && pattern[i+1] == '%') {
+            *out += '%';
+            i++;
+            continue;
+        }
+
+        int j = i + 1;
+        QChar fill = ' ';
+        if (j < pattern.size() && pattern[j] == '0') {
+            fill = '0';
+            j++;
+        }
+        int digits = 0;
+        while (j < pattern.size() && pattern[j].isDigit() && digits < 100)
+            digits = 10 * digits + pattern[j++].digitValue();
+
+        if (j >= pattern.size() || pattern[j] != 'd' || !s->raw || digits >= 100) {
+            fprintf(stderr, "bad frame pattern %s: one %%d, %%Nd or %%0Nd for the "
+                    "frame number, %%%% for a literal %%\n", pattern.toUtf8().data());
+            return false;
+        }
+
+        s->raw = false;
+        s->digits = digits;
+        s->fill = fill;
+        out = &s->suffix;
+        i = j;
+    }
+
+    return true;
+}
+
+static QString frame_path(const FrameSequence *s, int frame)
+{
+    return s->prefix + QString("%1").arg(frame, s->digits, 10, s->fill) + s->suffix;
+}
+
+bool frame_sequence_open(FrameSequence *s, const QString &pattern, int width, int height)
+{
+    s->pattern = pattern;
+    s->width = width;
+    s->height = height;
+
+    if (!parse_pattern(s, pattern))
+        return false;
+
+    if (!s->raw) {
+        /* numbered images next to each other, make room for them */
+        QDir dir = QFileInfo(frame_path(s, 0)).absoluteDir();
+        if (!dir.mkpath(".")) {
+            fprintf(stderr, "couldn't create %s\n", dir.path().toUtf8().data());
+            return false;
+        }
+        return true;
+    }
+
+    s->file.setFileName(s->prefix);
+    if (!s->file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        fprintf(stderr, "couldn't open %s: %s\n", s->prefix.toUtf8().data(),
+                s->file.errorString().toUtf8().data());
+        return false;
+    }
+
+    return true;
+}
+
+bool frame_sequence_write(FrameSequence *s, int frame, const QByteArray &rgba)
+{
+    int w = s->width;
+    int h = s->height;
+    const uchar *in = (const uchar *) rgba.constData();
+
+    if (rgba.size() < w * h * 4) {
+        fprintf(stderr, "short frame %d\n", frame);
+        return false;
+    }
+
+    if (!s->raw) {
+        QImage image(w, h, QImage::Format_RGB888);
+        rgba_to_rgb(in, w, h, image.bits(), image.bytesPerLine());
+
+        QString path = frame_path(s, frame);
+        if (!image.save(path)) {
+            fprintf(stderr, "couldn't write %s\n", path.toUtf8().data());
+            return false;
+        }
+        return true;
+    }
+
+    QByteArray rgb(w * h * 3, 0);
+    rgba_to_rgb(in, w, h, (uchar *) rgb.data(), w * 3);
+
+    QMutexLocker locker(&s->file_lock);
+    if (!s->file.seek((qint64) frame * rgb.size()) ||
+        s->file.write(rgb) != rgb.size()) {
+        fprintf(stderr, "couldn't write frame %d to %s: %s\n", frame,
+                s->prefix.toUtf8().data(), s->file.errorString().toUtf8().data());
+        return false;
+    }
+
+    return true;
+}
+
+bool frame_sequence_close(FrameSequence *s)
+{
+    if (!s->raw)
+        return true;
+
+    s->file.close();
+    if (s->file.error() != QFileDevice::NoError)
+        return false;
+
+    printf("ffmpeg -f rawvideo -pix_fmt rgb24 -s %dx%d -i %s ...\n",
+           s->width, s->height, s->prefix.toUtf8().data());
+
+    return true;
+}
@@ -0,0 +1,62 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#ifndef FRAME_SEQUENCE_H
+#define FRAME_SEQUENCE_H
+
+#include <QFile>
+#include <QMutex>
+#include <QString>
+#include <QByteArray>
+
+/* Numbered images when the pattern has a printf style frame number
+   (frames/turntable-%04d.png, any format QImage writes), otherwise a
+   single raw rgb24 stream ffmpeg can read with -f rawvideo -pix_fmt
+   rgb24. Frames can be written from any thread in any order, raw
+   frames go straight to their offset in the stream.
+
+   The pattern is never handed to printf: one %d, %Nd or %0Nd is the
+   frame number, %% a literal %, anything else is refused.
+*/
+typedef struct _FrameSequence
+{
+    QString pattern;
+    bool raw;
+    int width;
+    int height;
+
+    /* around the frame number, the whole path when raw */
+    QString prefix;
+    QString suffix;
+    int digits;
+    QChar fill;
+
+    QFile file;
+    QMutex file_lock;
+} FrameSequence;
+
+bool frame_sequence_open(FrameSequence *s, const QString &pattern, int width, int height);
+/* @rgba: bottom row first as glReadPixels() leaves it, thread safe */
+bool frame_sequence_write(FrameSequence *s, int frame, const QByteArray &rgba);
+bool frame_sequence_close(FrameSequence *s);
+
+#endif /* FRAME_SEQUENCE_H */
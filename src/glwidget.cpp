@@ -22,628 +22,736 @@
 
 #include "glwidget.h"
 
-#include <math.h>
-#include <stdint.h>
+#include <QPainter>
+#include <QImage>
 
-#define NSAMPLES_HIGH 4000
-#define NSAMPLES_LOW  100
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 
-/* construct and init defaults */
+/* construct and init defaults, the renderer thread starts right away
+ * but waits for a context until initializeGL() */
 GLWidget::GLWidget(InitOptions &opt)
 {
     this->opt = opt;
 
-    fast_rendering = false;
-    nsamples = NSAMPLES_HIGH;
-
-    /* default eye depth */
-    depth = 1.1f;
+    render_params_init(&params, opt);
     mouse_wheel_delta = 0;
+    mask_tool = MASK_TOOL_NONE;
+    mask_drawing = false;
 
-    /* front to back dvr and blinn phong shading */
-    compositing_mode = 0;
-    shading_mode = 0;
-
-    /* black background */
-    background_color[0] = 0.0;
-    background_color[1] = 0.0;
-    background_color[2] = 0.0;
-    background_color[3] = 1.0;
+    posted_serial = 0;
+    presented_serial = 0;
+    blit_fbo = 0;
+    surface = NULL;
 
-    /* white spotlight */
-    light_color[0] = 1.0;
-    light_color[1] = 1.0;
-    light_color[2] = 1.0;
-
-    /* material */
-    ambient_reflectance = 0.05;
-    diffuse_reflectance = 0.3;
-    specular_reflectance = 0.45;
+    histogram.total = 0;
+    histogram.peak = 0;
+    histogram.bit_depth = 0;
+    storage = STORAGE_NATIVE;
+    volume_bytes = 0;
+    memset(&last_stats, 0, sizeof(FrameStats));
 
     update_timer = new QTimer(this);
     update_timer->setSingleShot(true);
     connect(update_timer, SIGNAL(timeout()), this, SLOT(update_timer_timeout()));
-}
 
-/* clean up resources */
+    /* series playback, frames the reader is late with are skipped */
+    series_timer = new QTimer(this);
+    series_timer->setInterval(1000 / opt.fps);
+    connect(series_timer, SIGNAL(timeout()), this, SLOT(series_timer_timeout()));
+
+    hover_timer = new QTimer(this);
+    hover_timer->setSingleShot(true);
+    hover_timer->setInterval(PROBE_RETRY_MS);
+    connect(hover_timer, SIGNAL(timeout()), this, SLOT(hover_probe()));
+
+    /* frame statistics on top of the rendering */
+    stats_overlay = false;
+    stats_label = new QLabel(this);
+    QFont font("monospace");
+    font.setStyleHint(QFont::Monospace);
+    stats_label->setFont(font);
+    stats_label->setStyleSheet("QLabel { background-color: rgba(0, 0, 0, 160);"
+                               " color: white; padding: 4px; }");
+    stats_label->setAttribute(Qt::WA_TransparentForMouseEvents);
+    stats_label->move(8, 8);
+    stats_label->hide();
+
+    render_thread = new QThread(this);
+    renderer = new Renderer(opt);
+    renderer->moveToThread(render_thread);
+
+    /* moves without a button pressed, for the hover probe */
+    setMouseTracking(renderer->get_probe() != NULL);
+
+    /* all queued, they come from the render thread */
+    connect(renderer, &Renderer::initialized,
+            this, &GLWidget::renderer_initialized);
+    connect(renderer, &Renderer::histogram_ready,
+            this, &GLWidget::histogram_ready);
+    connect(renderer, &Renderer::histogram_ready,
+            this, [=](const Histogram &h) { histogram = h; });
+    connect(renderer, &Renderer::volume_ready,
+            this, &GLWidget::volume_ready);
+    connect(renderer, &Renderer::dataset_ready,
+            this, &GLWidget::dataset_ready);
+    connect(renderer, &Renderer::dataset_failed,
+            this, &GLWidget::dataset_failed);
+    connect(renderer, &Renderer::series_frame_shown,
+            this, &GLWidget::series_frame_shown);
+    connect(renderer, &Renderer::mask_edited,
+            this, &GLWidget::mask_edited);
+    connect(renderer, &Renderer::stats_ready,
+            this, &GLWidget::update_stats_overlay);
+    connect(renderer, &Renderer::frame_ready,
+            this, &GLWidget::frame_ready);
+    connect(renderer, &Renderer::export_progress,
+            this, &GLWidget::export_progress);
+    connect(renderer, &Renderer::export_finished,
+            this, &GLWidget::export_finished);
+
+    render_thread->start();
+}
+
+/* clean up resources, GL ones go with the render thread */
 GLWidget::~GLWidget()
 {
-    delete distance_shader;
-    delete raycast_shader;
-    delete update_timer;
+    QMetaObject::invokeMethod(renderer, "shutdown", Qt::BlockingQueuedConnection);
+    render_thread->quit();
+    render_thread->wait();
+    delete renderer;
+    delete surface;
 
-    glDeleteTextures(1, &volume_texture);
-    glDeleteTextures(1, &transfer_function);
-    glDeleteTextures(1, &target_texture);
-    glDeleteRenderbuffers(1, &db);
-    glDeleteFramebuffers(1, &fbo);
-    glDeleteVertexArrays(1, &vao);
+    makeCurrent();
+    glDeleteFramebuffers(1, &blit_fbo);
+    doneCurrent();
+
+    delete update_timer;
+    delete series_timer;
 }
 
 QSize GLWidget::minimumSizeHint() const { return QSize(50, 50); }
 QSize GLWidget::sizeHint() const { return QSize(600, 600); }
 
+/* a copy of the current state to the render thread, it supersedes
+ * anything still pending there */
+void GLWidget::post_params()
+{
+    posted_serial = renderer->post(params);
+}
+
 /* reduce sampling rate when the UI asks for fast rendering, usually
  * because either the model is rotating or something like that and we
  * need interactive framerates */
 void GLWidget::set_fast_rendering(bool s)
 {
-    if (s != fast_rendering) {
-        fast_rendering = s;
-        nsamples = s ? NSAMPLES_LOW : NSAMPLES_HIGH;
-        update();
+    if (s != params.fast_rendering) {
+        params.fast_rendering = s;
+        post_params();
     }
 }
 
+/* quality of still frames, interaction always drops to preview */
+void GLWidget::set_quality(int q)
+{
+    params.quality = CLAMP(q, (int) QUALITY_PREVIEW, (int) QUALITY_FINAL);
+    post_params();
+}
+
 void GLWidget::set_compositing_mode(int mode)
 {
-    compositing_mode = mode;
-    update();
+    params.compositing_mode = mode;
+    post_params();
 }
 
 void GLWidget::set_shading_mode(int mode)
 {
-    shading_mode = mode;
-    update();
+    params.shading_mode = mode;
+    post_params();
 }
 
 void GLWidget::set_background_color(const QColor &color)
 {
-    background_color[0] = color.redF();
-    background_color[1] = color.greenF();
-    background_color[2] = color.blueF();
-    background_color[3] = color.alphaF();
-
-    makeCurrent();
-    glClearColor(background_color[0], background_color[1],
-                 background_color[2], background_color[3]);
+    params.background_color[0] = color.redF();
+    params.background_color[1] = color.greenF();
+    params.background_color[2] = color.blueF();
+    params.background_color[3] = color.alphaF();
 
-    doneCurrent();
-
-    update();
+    post_params();
 }
 
 const QColor & GLWidget::get_background_color()
 {
-    static QColor bgqcolor =  QColor(background_color[0] * 255,
-                                     background_color[1] * 255,
-                                     background_color[2] * 255,
-                                     background_color[3] * 255);
+    static QColor bgqcolor =  QColor(params.background_color[0] * 255,
+                                     params.background_color[1] * 255,
+                                     params.background_color[2] * 255,
+                                     params.background_color[3] * 255);
 
     return bgqcolor;
 }
 
 void GLWidget::set_light_color(const QColor &color)
 {
-    light_color[0] = color.redF();
-    light_color[1] = color.greenF();
-    light_color[2] = color.blueF();
+    params.light_color[0] = color.redF();
+    params.light_color[1] = color.greenF();
+    params.light_color[2] = color.blueF();
 
-    update();
+    post_params();
 }
 
 const QColor & GLWidget::get_light_color()
 {
-    static QColor bgqcolor =  QColor(light_color[0] * 255,
-                                     light_color[1] * 255,
-                                     light_color[2] * 255);
+    static QColor bgqcolor =  QColor(params.light_color[0] * 255,
+                                     params.light_color[1] * 255,
+                                     params.light_color[2] * 255);
 
     return bgqcolor;
 }
 
 void GLWidget::set_ambient_reflectance(double ka)
 {
-    ambient_reflectance = ka;
-    update();
+    params.ambient_reflectance = ka;
+    post_params();
 }
 double GLWidget::get_ambient_reflectance()
 {
-    return ambient_reflectance;
+    return params.ambient_reflectance;
 }
 
 void GLWidget::set_diffuse_reflectance(double ka)
 {
-    diffuse_reflectance = ka;
-    update();
+    params.diffuse_reflectance = ka;
+    post_params();
 }
 double GLWidget::get_diffuse_reflectance()
 {
-    return diffuse_reflectance;
+    return params.diffuse_reflectance;
 }
 
 void GLWidget::set_specular_reflectance(double ka)
 {
-    specular_reflectance = ka;
-    update();
+    params.specular_reflectance = ka;
+    post_params();
 }
 double GLWidget::get_specular_reflectance()
 {
-    return specular_reflectance;
+    return params.specular_reflectance;
 }
 
 void GLWidget::new_transfer_function(float *data, int len)
 {
-    glDeleteTextures(1, &transfer_function);
-    transfer_function = load_transfer_function_from_data(data, len);
-
-    update();
+    update_transfer_function(data, len, 0, len-1);
 }
 
-// -----------------------------------------------------------------------
-//    TEXTURE LOADERS
-// -----------------------------------------------------------------------
-
-/* Load 8bit raw luminance data into a 3D texture */
-GLuint load_volume_texture_8bit(const char *path, GLuint w, GLuint h, GLuint d)
+/* keep our own copy and just remember what changed, the renderer
+ * uploads once per frame however many edits came in */
+void GLWidget::update_transfer_function(float *data, int len, int first, int last)
 {
-    /* FIXME: duplicated code */
-    FILE *f;
-    GLuint tex;
-
-    f = fopen(path, "rb");
-    if (!f) {
-        fprintf(stderr, "couldn't open: %s\n", path);
-        exit(1);
+    if (4 * len != params.tf.size()) {
+        params.tf.resize(4 * len);
+        first = 0;
+        last = len-1;
     }
 
-    size_t chunk = sizeof(uint8_t);
-    size_t len = w*h*d*chunk;
+    /* ours alone, see render_params_copy() */
+    first = CLAMP(first, 0, len-1);
+    last = CLAMP(last, first, len-1);
+    memcpy(params.tf.data() + 4*first, data + 4*first, 4 * (last-first+1) * sizeof(float));
 
-    uint8_t *volume_data;
-    volume_data = (uint8_t *) malloc(len);
+    params.tf_version++;
 
-    /* read the whole file at once, maybe I should read it chunk by
-     * chunk or byte by byte */
-    if (fread(volume_data, 1, len, f) != len) {
-        fprintf(stderr, "premature eof or reading error: %s\n", path);
-        exit(1);
+    if (params.tf_dirty_first < 0) {
+        params.tf_dirty_first = first;
+        params.tf_dirty_last = last;
+    } else {
+        params.tf_dirty_first = MIN(params.tf_dirty_first, first);
+        params.tf_dirty_last = MAX(params.tf_dirty_last, last);
     }
 
-    /* standard texture initialization, nothing fancy */
-    glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_3D, tex);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    /* align to single byte */
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    /* uint8_t -> GL_RED, late OpenGL deprecated luminance texture,
-     * you have to use a single channel now */
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_RED,
-                 w, h, d, 0, GL_RED, GL_UNSIGNED_BYTE, volume_data);
+    post_params();
+}
+
+void GLWidget::update_transfer_function_2d(float *data, int w, int h)
+{
+    params.tf2d.resize(4 * w * h);
+    params.tf2d_width = w;
+    params.tf2d_height = h;
 
-    free(volume_data);
+    memcpy(params.tf2d.data(), data, 4 * w * h * sizeof(float));
+    params.tf2d_version++;
 
-    return tex;
+    /* otherwise it goes with the next post */
+    if (params.tf_mode == 1)
+        post_params();
 }
 
-/* Load 16bit raw luminance data into a 3D texture
+void GLWidget::set_tf_mode(int mode)
+{
+    params.tf_mode = mode;
+    post_params();
+}
 
-   @shift: amount of padding bits to remove, most medical data comes
-   in 16bit textures but only the first 10 or 12 bit actually contain
-   any data
-*/
-GLuint load_volume_texture_16bit(const char *path, GLuint w, GLuint h, GLuint d, uint8_t shift)
+void GLWidget::set_fixed_step(bool enabled)
 {
-    /* FIXME: duplicated code */
-    FILE *f;
-    GLuint tex;
+    params.fixed_step = enabled;
+    post_params();
+}
 
-    f = fopen(path, "rb");
-    if (!f) {
-        fprintf(stderr, "couldn't open: %s\n", path);
-        exit(1);
-    }
+/* off: always sample the full resolution volume */
+void GLWidget::set_lod(bool enabled)
+{
+    params.lod = enabled;
+    post_params();
+}
 
-    size_t chunk = sizeof(uint16_t);
-    size_t len = w*h*d*chunk;
-    int array_len = w*h*d;
+const InitOptions &GLWidget::get_options()
+{
+    return opt;
+}
 
-    uint16_t *volume_data;
-    volume_data = (uint16_t *) malloc(len);
+/* the volume swaps in on the render thread, the window starts over
+ * on the new dataset's range */
+void GLWidget::set_dataset(int i)
+{
+    if (i < 0 || i >= opt.datasets.size() || i == params.dataset)
+        return;
 
-    if (fread(volume_data, 1, len, f) != len) {
-        fprintf(stderr, "premature eof or reading error: %s\n", path);
-        exit(1);
-    }
+    params.dataset = i;
+    session_select(&opt, i);
+    reset_window();
+}
+
+void GLWidget::set_series_frame(int i)
+{
+    if (i < 0 || i >= opt.series_frames || i == params.series_frame)
+        return;
+
+    params.series_frame = i;
+    post_params();
+
+    emit series_frame_changed(i);
+}
+
+void GLWidget::set_series_playing(bool playing)
+{
+    if (opt.series_frames < 1 || playing == params.series_playing)
+        return;
+
+    params.series_playing = playing;
+    post_params();
 
-    /* assume data is already saturated in the [0, 2^(bit_depth)]
-     * range and rescale it to fill 16bit */
-    /* maybe we should just rescale [min,max] to [0, 2^16] */
-    for (int i=0; i<array_len; i++) {
-        volume_data[i] <<= shift;
+    if (playing)
+        series_timer->start();
+    else
+        series_timer->stop();
+}
+
+void GLWidget::series_timer_timeout()
+{
+    set_series_frame((params.series_frame + 1) % opt.series_frames);
+}
+
+/* MASK_TOOL_*, rotating needs NONE */
+void GLWidget::set_mask_tool(int tool)
+{
+    mask_tool = opt.mask ? tool : MASK_TOOL_NONE;
+    mask_drawing = false;
+    mask_outline.clear();
+    setCursor(mask_tool == MASK_TOOL_NONE ? Qt::ArrowCursor : Qt::CrossCursor);
+    update();
+}
+
+void GLWidget::clear_mask()
+{
+    QMetaObject::invokeMethod(renderer, "mask_clear", Qt::QueuedConnection);
+}
+
+/* Hand the shape over in the view the renderer has now. Box and
+   lasso go as a coverage image, the renderer projects the voxels on
+   it, a flood as the ray under the click.
+*/
+void GLWidget::finish_mask_outline()
+{
+    QMatrix4x4 mvp = render_params_mvp(params, opt);
+
+    if (mask_tool == MASK_TOOL_FLOOD) {
+        QPointF p = mask_outline.last();
+        float x = 2.0f * p.x() / width() - 1.0f;
+        float y = 1.0f - 2.0f * p.y() / height();
+        QMatrix4x4 inv = mvp.inverted();
+        QVector3D from = inv.map(QVector3D(x, y, -1.0f));
+        QVector3D to = inv.map(QVector3D(x, y, 1.0f));
+
+        QMetaObject::invokeMethod(renderer, "mask_flood", Qt::QueuedConnection,
+                                  Q_ARG(QVector3D, from), Q_ARG(QVector3D, to));
+    } else if (mask_outline.size() > 2) {
+        QImage coverage(MAX(params.width, 1), MAX(params.height, 1), QImage::Format_RGB32);
+        coverage.fill(Qt::black);
+        QPainter painter(&coverage);
+        painter.setPen(Qt::white);
+        painter.setBrush(Qt::white);
+        painter.drawPolygon(mask_outline);
+        painter.end();
+
+        QMetaObject::invokeMethod(renderer, "mask_cut", Qt::QueuedConnection,
+                                  Q_ARG(QImage, coverage), Q_ARG(QMatrix4x4, mvp));
     }
 
-    /* standard init, nothing fancy */
-    glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_3D, tex);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
-    /* single byte row alignment */
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    /* uint16_t -> GL_R16, not really sure we need to enforce the
-     * 16bit internal format */
-    glTexImage3D(GL_TEXTURE_3D, 0, GL_R16,
-                 w, h, d, 0, GL_RED, GL_UNSIGNED_SHORT, volume_data);
-
-    free(volume_data);
-
-    return tex;
-}
-
-/* 3D texture loader wrapper */
-GLuint GLWidget::load_volume_texture(const char *path, GLuint w, GLuint h, GLuint d,
-                                     unsigned int bit_depth)
-{
-    switch (bit_depth) {
-    case 8:
-        return load_volume_texture_8bit(path, w, h, d);
-    case 10: /* not tested */
-    case 12:
-    case 16:
-        return load_volume_texture_16bit(path, w, h, d, 16 - bit_depth);
-    default:
-        fprintf(stderr, "unsupported bit depth: %d\n", bit_depth);
-        exit(1);
+    mask_drawing = false;
+    mask_outline.clear();
+    update();
+}
+
+/* the ray finish_mask_outline() floods along, the query as the
+ * renderer will sample it */
+bool GLWidget::pick(const QPointF &pos, int mode, ProbeHit *hit, bool *busy)
+{
+    VolumeProbe *probe = renderer->get_probe();
+    if (!probe)
+        return false;
+
+    float x = 2.0f * pos.x() / width() - 1.0f;
+    float y = 1.0f - 2.0f * pos.y() / height();
+    QMatrix4x4 inv = render_params_mvp(params, opt).inverted();
+
+    ProbeQuery q;
+    q.from = inv.map(QVector3D(x, y, -1.0f));
+    q.to = inv.map(QVector3D(x, y, 1.0f));
+    q.mode = mode;
+    q.tf = params.tf.constData();
+    q.tf_len = params.tf.size() / 4;
+    q.tf2d = params.tf2d.constData();
+    q.tf2d_width = params.tf2d_width;
+    q.tf2d_height = params.tf2d_height;
+    q.tf_mode = params.tf_mode;
+    q.window_level = params.window_level;
+    q.window_width = params.window_width;
+    q.sampling_rate = render_sampling_rate(params.fast_rendering ? QUALITY_PREVIEW : params.quality);
+    q.fixed_step = params.fixed_step;
+
+    return volume_probe_pick(probe, opt, q, hit, busy);
+}
+
+/* hover probe, mip shows the most opaque sample so that's the one to
+ * report. Never waits on the lock, a busy probe is tried again a bit
+ * later with wherever the mouse is by then */
+void GLWidget::hover_probe()
+{
+    QElapsedTimer timer;
+    timer.start();
+    ProbeHit hit;
+    bool busy;
+    bool found = pick(hover_position,
+                      params.compositing_mode == 1 ? PROBE_MAX_OPACITY : PROBE_FIRST_HIT,
+                      &hit, &busy);
+    if (busy) {
+        hover_timer->start();
+        return;
     }
+    emit probe_moved(found, hit, timer.nsecsElapsed() / 1e6);
 }
 
-/* 1D texture loader for transfer function */
-GLuint GLWidget::load_transfer_function_from_data(float *data, size_t sz)
+double GLWidget::get_window_level()
 {
-    /* if no data is given init a default linear ramp across rgb
-     * channels and a threshold alpha */
-    float *default_tf = NULL;
+    return params.window_level;
+}
 
-    if (data == NULL) {
-        default_tf = (float *) malloc(4 * sz * sizeof(float));
-        for (size_t i = 0; i < sz; i++) {
-            for (int j=0; j<3; j++)
-                default_tf[i*4 + j] = 0.0;
-        }
-    }
+double GLWidget::get_window_width()
+{
+    return params.window_width;
+}
 
-    GLuint tex;
-    glGenTextures(1, &tex);
-    glBindTexture(GL_TEXTURE_1D, tex);
-    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    /* TODO: explore different transfer function precisions */
-    glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA16F, sz, 0, GL_RGBA, GL_FLOAT,
-                 data != NULL ? data : default_tf);
-
-    if (default_tf != NULL)
-        free(default_tf);
-
-    return tex;
-}
-
-// -----------------------------------------------------------------------
-//    BUFFER, TARGETS, ETC
-// -----------------------------------------------------------------------
-
-/* target texture for the first rendering pass */
-void GLWidget::init_target_texture(int w, int h)
-{
-    /* check this shit */
-    glDeleteTextures(1, &target_texture);
-    glGenTextures(1, &target_texture);
-    glBindTexture(GL_TEXTURE_2D, target_texture);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    /* try to keep a good precision in the intermediate rendering steps */
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, w, h, 0, GL_RGBA, GL_FLOAT, NULL);
-}
-
-/* framebuffer object for two pass rendering */
-void GLWidget::init_fbo(int w, int h)
-{
-    glDeleteRenderbuffers(1, &db);
-    glDeleteFramebuffers(1, &fbo);
-
-    /* render buffer for face culling */
-    glGenRenderbuffers(1, &db);
-    glBindRenderbuffer(GL_RENDERBUFFER, db);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, w, h);
-
-    /* frame buffer for rendering */
-    glGenFramebuffers(1, &fbo);
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-    glFramebufferTexture2D(GL_FRAMEBUFFER,
-                           GL_COLOR_ATTACHMENT0,
-                           GL_TEXTURE_2D,
-                           target_texture,
-                           0);
-
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER,
-                              GL_DEPTH_ATTACHMENT,
-                              GL_RENDERBUFFER,
-                              db);
-
-    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-        fprintf(stderr, "Something wrong with the framebuffer... \n");
-        exit(1);
+/* only two uniforms change, fast enough to follow a drag */
+void GLWidget::set_window(double level, double width)
+{
+    params.window_level = level;
+    params.window_width = MAX(width, 1e-6);
+    post_params();
+
+    emit window_changed(params.window_level, params.window_width);
+}
+
+/* back to what we started with */
+void GLWidget::reset_window()
+{
+    double level, width;
+    window_default(opt, &level, &width);
+    set_window(level, width);
+}
+
+/* computed once while loading the volume */
+const Histogram &GLWidget::get_histogram()
+{
+    return histogram;
+}
+
+/* what the volume ended up as on the gpu */
+VolumeStorage GLWidget::get_storage()
+{
+    return storage;
+}
+
+size_t GLWidget::get_volume_bytes()
+{
+    return volume_bytes;
+}
+
+const QString &GLWidget::get_renderer_string()
+{
+    return renderer_string;
+}
+
+const QString &GLWidget::get_gl_version_string()
+{
+    return gl_version_string;
+}
+
+/* scripted navigation, same state the mouse handlers touch */
+void GLWidget::set_camera(const QQuaternion &rotation, float depth)
+{
+    params.rotation = rotation;
+    params.depth = depth;
+
+    post_params();
+}
+
+void GLWidget::set_frame_timing(bool enabled)
+{
+    params.frame_timing = enabled;
+    post_params();
+}
+
+/* milliseconds the renderer spent on the last frame */
+double GLWidget::get_last_cpu_time()
+{
+    return last_stats.paint;
+}
+
+/* milliseconds the gpu spent on the last frame, 0 if unavailable */
+double GLWidget::get_last_gpu_time()
+{
+    return last_stats.first_pass + last_stats.raycast;
+}
+
+/* stream a record per frame, csv or json lines, the profiler lives
+ * on the render thread */
+bool GLWidget::set_stats_log(const QString &path)
+{
+    bool ok = false;
+
+    QMetaObject::invokeMethod(renderer, "open_stats_log", Qt::BlockingQueuedConnection,
+                              Q_RETURN_ARG(bool, ok), Q_ARG(QString, path));
+
+    return ok;
+}
+
+void GLWidget::set_stats_overlay(bool show)
+{
+    stats_overlay = show;
+    stats_label->setVisible(show);
+}
+
+/* heatmap modes always collect them */
+void GLWidget::set_ray_stats(bool enabled)
+{
+    params.ray_stats = enabled;
+    post_params();
+}
+
+void GLWidget::renderer_initialized(const QString &renderer, const QString &gl_version)
+{
+    renderer_string = renderer;
+    gl_version_string = gl_version;
+}
+
+void GLWidget::volume_ready(int storage, qulonglong bytes)
+{
+    this->storage = (VolumeStorage) storage;
+    volume_bytes = bytes;
+}
+
+/* a new frame is waiting, blit it next time Qt paints */
+void GLWidget::frame_ready(quint64 serial)
+{
+    Q_UNUSED(serial);
+    update();
+}
+
+void GLWidget::update_stats_overlay(const FrameStats &s)
+{
+    static const char *compositing_names[] = {
+        "front to back", "mip", "mida", "ray start", "ray end", "ray dir",
+        "samples heatmap", "termination heatmap", "shading heatmap"
+    };
+    static const char *shading_names[] = {
+        "blinn-phong", "blinn-phong + edges", "toon", "none"
+    };
+
+    last_stats = s;
+
+    if (!stats_overlay)
+        return;
+
+    QString gpu_first = s.gpu_valid ? QString::number(s.first_pass, 'f', 2) : "n/a";
+    QString gpu_raycast = s.gpu_valid ? QString::number(s.raycast, 'f', 2) : "n/a";
+
+    QString text;
+    text += QString("first pass  %1 ms\n").arg(gpu_first, 8);
+    text += QString("raycast     %1 ms\n").arg(gpu_raycast, 8);
+    text += QString("upload      %1 ms\n").arg(s.upload, 8, 'f', 2);
+    text += QString("render cpu  %1 ms\n").arg(s.paint, 8, 'f', 2);
+    text += QString("compose     %1 ms\n").arg(s.compose, 8, 'f', 2);
+    text += QString("samples/vox %1\n").arg(s.sampling_rate, 8, 'f', 2);
+    if (s.rays_valid) {
+        text += QString("rays        %1\n").arg(s.rays, 8, 'f', 0);
+        text += QString("taken/ray   %1\n").arg(s.samples_taken, 8, 'f', 1);
+        text += QString("shaded/ray  %1\n").arg(s.samples_shaded, 8, 'f', 1);
+        text += QString("terminated  %1 %\n").arg(100.0 * s.terminated, 8, 'f', 1);
+        text += QString("saved       %1 %\n").arg(100.0 * s.samples_saved, 8, 'f', 1);
     }
+    text += QString("%1x%2 %3\n").arg(s.width).arg(s.height)
+        .arg(s.fast_rendering ? "interactive" : "still");
+    text += QString("%1, %2")
+        .arg(compositing_names[CLAMP(s.compositing_mode, 0, 8)])
+        .arg(shading_names[CLAMP(s.shading_mode, 0, 3)]);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    stats_label->setText(text);
+    stats_label->adjustSize();
 }
 
-/* (too) big do it all GL init function */
+/* the renderer gets its own context in our share group, created here
+ * like the surface, both need the gui thread, then the context moves
+ * over to the render thread */
 void GLWidget::initializeGL()
 {
-    /* QT way of enabling OGL API */
     initializeOpenGLFunctions();
 
-    printf("Renderer: %s\n", glGetString(GL_RENDERER));
-    printf("OpenGL version: %s\n", glGetString(GL_VERSION));
+    glGenFramebuffers(1, &blit_fbo);
 
-    set_fast_rendering(false);
+    surface = new QOffscreenSurface();
+    surface->setFormat(context()->format());
+    surface->create();
 
-    /* load textures */
-    volume_texture = load_volume_texture(opt.filename.toUtf8().data(),
-                                         opt.width, opt.height, opt.depth, opt.bit_depth);
-    transfer_function = load_transfer_function_from_data(NULL, 256);
-
-    /* init transformation matrices */
-    proj.setToIdentity(); // see resizeGL as it's viewport dependent
-
-    /* local to world */
-    model.setToIdentity();
-    /* I should probably get initial rotation from DICOM orientation data */
-    rotation = QQuaternion::fromEulerAngles(0, 0, 0);
-    // rotation = QQuaternion();
-    model.rotate(rotation);
-    /* draw in [0,1] because we want local coordinates easily mapped
-     * to colors, translate in [-0.5,0.5] to make camera transforms
-     * easier */
-    model.translate(-0.5, -0.5, -0.5);
-
-    /* simple view, just look at the center object */
-    view.setToIdentity();
-    view.lookAt({0,0,depth},{0,0,0},{0,1,0});
-
-    /* Geometry initialization, just a cube in [0,1] */
-    GLfloat vertices[24] = {
-        0.0, 0.0, 0.0,
-        0.0, 0.0, 1.0,
-        0.0, 1.0, 0.0,
-        0.0, 1.0, 1.0,
-        1.0, 0.0, 0.0,
-        1.0, 0.0, 1.0,
-        1.0, 1.0, 0.0,
-        1.0, 1.0, 1.0
-    };
-
-    /* triangle ordering, arbitrary? */
-    GLuint indices[36] = {
-        1,5,7, 7,3,1, 0,2,6,
-        6,4,0, 0,1,3, 3,2,0,
-        7,5,4, 4,6,7, 2,3,7,
-        7,6,2, 1,0,4, 4,5,1
-    };
+    QOpenGLContext *render_context = new QOpenGLContext();
+    render_context->setFormat(context()->format());
+    render_context->setShareContext(context());
+    if (!render_context->create()) {
+        fprintf(stderr, "couldn't create the render context\n");
+        exit(1);
+    }
+    render_context->moveToThread(render_thread);
 
-    /* load vertices and indices to gpu */
-    /* vertex buffer for vertices */
-    GLuint points_vbo = 0;
-    glGenBuffers(1, &points_vbo);
-    glBindBuffer(GL_ARRAY_BUFFER, points_vbo);
-    glBufferData(GL_ARRAY_BUFFER, 24 * sizeof(GLfloat), vertices, GL_STATIC_DRAW);
-
-    /* element buffer for indices */
-    GLuint points_ebo = 0;
-    glGenBuffers(1, &points_ebo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, points_ebo);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 36*sizeof(GLuint), indices, GL_STATIC_DRAW);
-
-    /* bind vertices to a vertex array */
-    vao = 0;
-    glGenVertexArrays(1, &vao);
-    glBindVertexArray(vao);
-    glBindBuffer(GL_ARRAY_BUFFER, points_vbo);
-    /* map vertex position to the first attrib, this will allow to
-     * retrieve the local coordinates in the vertex shader */
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
-
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, points_ebo);
-    glEnableVertexAttribArray(0);
-
-    /* enable alpha blending */
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    /* draw background */
-    glClearColor(background_color[0], background_color[1],
-                 background_color[2], background_color[3]);
-
-    /* initialize first pass shader */
-    /* see shaders source code for details */
-    /* this just shades our cube with color mapped to local position */
-    distance_shader = new QOpenGLShaderProgram;
-    distance_shader->addShaderFromSourceFile(QOpenGLShader::Vertex,
-                                             "shaders/firstpass.vert");
-    distance_shader->addShaderFromSourceFile(QOpenGLShader::Fragment,
-                                             "shaders/firstpass.frag");
-    distance_shader->link();
-
-    /* and this is where the volume rendering really happens */
-    raycast_shader = new QOpenGLShaderProgram;
-    raycast_shader->addShaderFromSourceFile(QOpenGLShader::Vertex,
-                                            "shaders/raycast.vert");
-    raycast_shader->addShaderFromSourceFile(QOpenGLShader::Fragment,
-                                            "shaders/raycast.frag");
-    raycast_shader->link();
-}
-
-/* draw our geometry with the proper culling */
-void GLWidget::render_cube(QOpenGLShaderProgram *shader, GLuint cull_face)
-{
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_CULL_FACE);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    /* scene transform happens in the shaders with modern GL */
-    GLint proj_loc = shader->uniformLocation("projection");
-    glUniformMatrix4fv(proj_loc, 1, GL_FALSE, (GLfloat *) proj.data());
-    GLint model_loc = shader->uniformLocation("model");
-    glUniformMatrix4fv(model_loc, 1, GL_FALSE, (GLfloat *) model.data());
-    GLint view_loc = shader->uniformLocation("view");
-    glUniformMatrix4fv(view_loc, 1, GL_FALSE, (GLfloat *) view.data());
-
-    glCullFace(cull_face);
-    glBindVertexArray(vao);
-    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+    renderer->set_surface(render_context, surface);
+    QMetaObject::invokeMethod(renderer, "init", Qt::QueuedConnection);
 }
 
+/* never renders, just blits the newest finished frame, stretched if
+ * it's from before a resize */
 void GLWidget::paintGL()
 {
-    /* backup current fbo as Qt might be doing something there */
-    GLint savedfbo;
-    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &savedfbo);
-
-    /* init model matrix */
-    model.setToIdentity();
-    model.rotate(rotation);
-    model.scale(opt.xscale, opt.yscale, opt.zscale);
-    model.translate(-0.5, -0.5, -0.5);
-
-    /* map framebuffer object for offscreen rendering */
-    glEnable(GL_DEPTH_TEST);
-    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    /* first pass: draw a colored cube with front face culling */
-    /* the colors will be the coordinates of the back face we can use
-     * as the end points for our raycasting integral */
-    distance_shader->bind();
-    render_cube(distance_shader, GL_FRONT);
-    distance_shader->release();
-
-
-    /* restore previous framebuffer, we'll render to screen now */
-    glBindFramebuffer(GL_FRAMEBUFFER, savedfbo > 0 ? savedfbo : 0);
-    raycast_shader->bind();
-
-    glEnable(GL_DEPTH_TEST);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    /* load for the raycasting fragment shader */
-    /* first pass target, now full with position data */
-    GLint tex_loc = raycast_shader->uniformLocation("backtex");
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, target_texture);
-    glUniform1i(tex_loc, 0);
-    /* volume data */
-    tex_loc = raycast_shader->uniformLocation("voltex");
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_3D, volume_texture);
-    glUniform1i(tex_loc, 1);
-    /* transfer function */
-    tex_loc = raycast_shader->uniformLocation("tftex");
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_1D, transfer_function);
-    glUniform1i(tex_loc, 2);
-
-    /* viewport size, needed to get normalized texture coordinates */
-    GLint screen_width_loc = raycast_shader->uniformLocation("screen_width");
-    GLint screen_height_loc = raycast_shader->uniformLocation("screen_height");
-    glUniform1f(screen_width_loc, (GLfloat) cur_width);
-    glUniform1f(screen_height_loc, (GLfloat) cur_height);
-
-    /* viewport size, needed to get normalized texture coordinates */
-    GLint scale_loc = raycast_shader->uniformLocation("scale");
-
-    GLfloat scale[3];
-    scale[0] = opt.xscale;
-    scale[1] = opt.yscale;
-    scale[2] = opt.zscale;
-    glUniform3fv(scale_loc, 1, scale);
-
-
-    /* how many samples we want in our ray integral */
-    GLint nsamples_loc = raycast_shader->uniformLocation("nsamples");
-    glUniform1f(nsamples_loc, (GLfloat) nsamples);
-
-    /* compositing mode (front to back, mip, mida), mida doesn't really work */
-    GLuint compositing_mode_loc = raycast_shader->uniformLocation("compositing_mode");
-    glUniform1i(compositing_mode_loc, (GLint) compositing_mode);
-
-    /* shading mode (blinn phong, toon, none) */
-    GLuint shading_mode_loc = raycast_shader->uniformLocation("shading_mode");
-    glUniform1i(shading_mode_loc, (GLint) shading_mode);
-
-    /* shading parameters */
-    GLint light_color_loc = raycast_shader->uniformLocation("light_color");
-    glUniform3fv(light_color_loc, 1, (GLfloat *) light_color);
-    GLint ka_loc = raycast_shader->uniformLocation("ka");
-    glUniform1f(ka_loc, ambient_reflectance);
-    GLint kd_loc = raycast_shader->uniformLocation("kd");
-    glUniform1f(kd_loc, diffuse_reflectance);
-    GLint ks_loc = raycast_shader->uniformLocation("ks");
-    glUniform1f(ks_loc, specular_reflectance);
-
-
-    /* second pass: render the cube again with backface culling, now
-     * the color data stores the starting position for our raycasting
-     * computation */
-    render_cube(raycast_shader, GL_BACK);
-    raycast_shader->release();
-}
-
-/* resize callback */
+    RenderedFrame f;
+
+    if (!renderer->acquire_frame(&f)) {
+        glClearColor(params.background_color[0], params.background_color[1],
+                     params.background_color[2], params.background_color[3]);
+        glClear(GL_COLOR_BUFFER_BIT);
+        return;
+    }
+
+    /* on the gpu, doesn't block us */
+    if (f.ready) {
+        glWaitSync(f.ready, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(f.ready);
+    }
+
+    int w = width() * devicePixelRatio();
+    int h = height() * devicePixelRatio();
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, blit_fbo);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, f.texture, 0);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, defaultFramebufferObject());
+    glBlitFramebuffer(0, 0, f.width, f.height, 0, 0, w, h, GL_COLOR_BUFFER_BIT,
+                      (f.width == w && f.height == h) ? GL_NEAREST : GL_LINEAR);
+    glBindFramebuffer(GL_FRAMEBUFFER, defaultFramebufferObject());
+
+    /* the renderer waits on it before drawing over this one */
+    GLsync released = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    renderer->release_frame(released);
+
+    /* the mask shape on top, not part of the frame */
+    if (mask_drawing && mask_outline.size() > 1) {
+        QPainter painter(this);
+        painter.setPen(QPen(Qt::yellow, 1, Qt::DashLine));
+        if (mask_tool == MASK_TOOL_LASSO)
+            painter.drawPolyline(mask_outline);
+        else
+            painter.drawPolygon(mask_outline);
+    }
+
+    /* a still frame still refining doesn't count */
+    if (f.complete && f.serial != presented_serial) {
+        presented_serial = f.serial;
+        if (f.serial == posted_serial)
+            emit frame_presented();
+    }
+}
+
+/* an image of any size from the current parameters, the widget
+ * doesn't get new frames until it's written */
+void GLWidget::export_poster(const QString &path, int width, int height)
+{
+    QMetaObject::invokeMethod(renderer, "export_poster", Qt::QueuedConnection,
+                              Q_ARG(QString, path), Q_ARG(int, width),
+                              Q_ARG(int, height));
+}
+
+/* frames along a camera path, see Renderer::record_sequence(), the
+ * widget doesn't get new frames until they're written */
+void GLWidget::record_sequence(const QString &pattern, CameraPath path, int frames,
+                               int width, int height)
+{
+    QMetaObject::invokeMethod(renderer, "record_sequence", Qt::QueuedConnection,
+                              Q_ARG(QString, pattern), Q_ARG(int, (int) path),
+                              Q_ARG(int, frames), Q_ARG(int, width),
+                              Q_ARG(int, height));
+}
+
+/* resize callback, the renderer resizes its targets with the next
+ * frame */
 void GLWidget::resizeGL(int w, int h)
 {
-    /* update viewport dependent stuff */
-    cur_width = w;
-    cur_height = h;
-    /* target texture and fbo */
-    init_target_texture(w, h);
-    init_fbo(w, h);
-    /* projection mapping */
-    proj.setToIdentity();
-    proj.perspective(67.0f, GLfloat(w) / h, 0.001f, 5.0f);
-    // proj.ortho(-0.1, 0.1, -0.1, 0.1, 0.001f, 5.0f);
+    params.width = w;
+    params.height = h;
+    post_params();
 }
 
 void GLWidget::mousePressEvent(QMouseEvent *event)
 {
     last_mouse_position = QVector2D(event->localPos());
+
+    /* the view stays put while drawing */
+    if (mask_tool != MASK_TOOL_NONE && event->button() == Qt::LeftButton) {
+        mask_drawing = true;
+        mask_outline.clear();
+        mask_outline << event->localPos();
+        return;
+    }
+
     set_fast_rendering(true);
 }
 
 void GLWidget::mouseReleaseEvent(QMouseEvent *event)
 {
-    Q_UNUSED(event);
+    if (mask_drawing && event->button() == Qt::LeftButton) {
+        finish_mask_outline();
+        return;
+    }
+
     set_fast_rendering(false);
 }
 
@@ -651,7 +759,7 @@ void GLWidget::mouseReleaseEvent(QMouseEvent *event)
 QVector3D GLWidget::arc_ball_vector(QVector2D v)
 {
     /* normalize in [-1, 1] (view space) */
-    QVector2D norm_v = 2.0f * v / QVector2D(cur_width, cur_height) - QVector2D(1.0, 1.0);
+    QVector2D norm_v = 2.0f * v / QVector2D(width(), height()) - QVector2D(1.0, 1.0);
 
     /* viewport y axis is top to bottom, view is cartesian */
     QVector3D P = { norm_v.x(), -norm_v.y(), 0 };
@@ -669,10 +777,48 @@ QVector3D GLWidget::arc_ball_vector(QVector2D v)
 
 void GLWidget::mouseMoveEvent(QMouseEvent *event)
 {
+    QVector2D cur_mouse_position = QVector2D(event->localPos());
+
+    /* window/level like on a light box: right to widen, down to raise
+     * the level, the widget spans the whole data range */
+    if (event->buttons() & Qt::RightButton) {
+        QVector2D delta = cur_mouse_position - last_mouse_position;
+        double range = fabs(opt.rescale_slope) * ((1 << opt.bit_depth) - 1);
+
+        last_mouse_position = cur_mouse_position;
+        set_window(params.window_level + delta.y() / height() * range,
+                   CLAMP(params.window_width + delta.x() / width() * range,
+                         range * 1e-3, range * 2.0));
+        return;
+    }
+
+    if (event->buttons() == Qt::NoButton) {
+        if (renderer->get_probe()) {
+            hover_position = event->localPos();
+            if (!hover_timer->isActive())
+                hover_probe();
+        }
+        return;
+    }
+
     if (!(event->buttons() & Qt::LeftButton))
         return;
 
-    QVector2D cur_mouse_position = QVector2D(event->localPos());
+    if (mask_drawing) {
+        QPointF first = mask_outline.first();
+        QPointF p = event->localPos();
+
+        if (mask_tool == MASK_TOOL_BOX) {
+            mask_outline.clear();
+            mask_outline << first << QPointF(p.x(), first.y()) << p << QPointF(first.x(), p.y());
+        } else if (mask_tool == MASK_TOOL_LASSO) {
+            mask_outline << p;
+        } else {
+            mask_outline.last() = p;
+        }
+        update();
+        return;
+    }
 
     /* simplified arcball, or something like that, only works for view
      * centered objects... enough for our simple mouse navigation */
@@ -688,10 +834,10 @@ void GLWidget::mouseMoveEvent(QMouseEvent *event)
     axis = QVector3D::crossProduct(vb, va);
 
     /* update rotation matrix */
-    rotation = QQuaternion::fromAxisAndAngle(axis, angle) * rotation;
+    params.rotation = QQuaternion::fromAxisAndAngle(axis, angle) * params.rotation;
 
     last_mouse_position = cur_mouse_position;
-    update();
+    post_params();
 }
 
 /* zoom in, zoom out with mouse wheel */
@@ -706,10 +852,10 @@ void GLWidget::wheelEvent(QWheelEvent *event)
     mouse_wheel_delta += event->delta();
 
     if (mouse_wheel_delta >= 120) {
-        depth -= 0.05;
+        params.depth -= 0.05;
         mouse_wheel_delta = 0;
     } else if (mouse_wheel_delta <= -120) {
-        depth += 0.05;
+        params.depth += 0.05;
         mouse_wheel_delta = 0;
     }
 
@@ -719,11 +865,9 @@ void GLWidget::wheelEvent(QWheelEvent *event)
      * rendering and get back to quality rendering when the
      * interaction ends, I could probably use this trick elsewhere */
     update_timer->start(250);
-    view.setToIdentity();
-    view.lookAt({0,0,depth},{0,0,0},{0,1,0});
 
     set_fast_rendering(true);
-    update(); /* extra update here... */
+    post_params(); /* extra post here... */
 }
 
 void GLWidget::update_timer_timeout()
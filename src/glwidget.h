@@ -24,22 +24,35 @@
 #define GLWIDGET_H
 
 #include <QOpenGLWidget>
-#include <QOpenGLFunctions>
-#include <QOpenGLVertexArrayObject>
 #include <QOpenGLFunctions_3_2_Core>
-#include <QOpenGLBuffer>
-#include <QOpenGLShaderProgram>
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QThread>
 #include <QMouseEvent>
-#include <QMatrix4x4>
 #include <QVector2D>
 #include <QQuaternion>
 #include <QColor>
 #include <QTimer>
+#include <QLabel>
+#include <QPolygonF>
 
 #include "util.h"
+#include "renderer.h"
+#include "camerapath.h"
+
+/* what the left button does, with --mask. Box and lasso cut what's
+ * inside the shape all the way through the view, flood cuts what's
+ * connected to the voxel under the click */
+enum {
+    MASK_TOOL_NONE,
+    MASK_TOOL_BOX,
+    MASK_TOOL_LASSO,
+    MASK_TOOL_FLOOD
+};
 
-QT_FORWARD_DECLARE_CLASS(QOpenGLShaderProgram)
-
+/* Input, overlay and the current rendering parameters, the frames
+ * themselves come from a Renderer on its own thread, all we do with
+ * them is blit */
 class GLWidget : public QOpenGLWidget, protected QOpenGLFunctions_3_2_Core
 {
     Q_OBJECT
@@ -59,6 +72,37 @@ public:
     double get_ambient_reflectance();
     double get_specular_reflectance();
 
+    const Histogram &get_histogram();
+    VolumeStorage get_storage();
+    size_t get_volume_bytes();
+
+    const QString &get_renderer_string();
+    const QString &get_gl_version_string();
+
+    void set_camera(const QQuaternion &rotation, float depth);
+
+    /* the current dataset's, see session_select() */
+    const InitOptions &get_options();
+
+    /* physical units, see window_map() in util.h */
+    double get_window_level();
+    double get_window_width();
+
+    /* per frame timings for benchmarking, gpu times are collected
+     * synchronously when frame timing is enabled, stalling the
+     * pipeline at every frame */
+    void set_frame_timing(bool enabled);
+    double get_last_cpu_time();
+    double get_last_gpu_time();
+
+    bool set_stats_log(const QString &path);
+
+    /* --probe: cast the view ray under @pos (widget coordinates) on
+     * the cpu, with the transfer function and steps of the next frame.
+     * @mode: PROBE_*, false on a miss or without the probe. @busy:
+     * see volume_probe_pick() */
+    bool pick(const QPointF &pos, int mode, ProbeHit *hit, bool *busy = NULL);
+
 public slots:
     void set_background_color(const QColor &color);
 
@@ -72,7 +116,51 @@ public slots:
 
     void set_fast_rendering(bool fr);
     void new_transfer_function(float *data, int len);
+    void update_transfer_function(float *data, int len, int first, int last);
+    void update_transfer_function_2d(float *data, int w, int h);
+    void set_tf_mode(int mode);
+    void set_fixed_step(bool enabled);
+    void set_lod(bool enabled);
+    void set_quality(int quality);
     void update_timer_timeout();
+    void set_stats_overlay(bool show);
+    void set_ray_stats(bool enabled);
+    void set_window(double level, double width);
+    void reset_window();
+    void set_dataset(int i);
+    void set_series_frame(int i);
+    void set_series_playing(bool playing);
+    void set_mask_tool(int tool);
+    void clear_mask();
+    void export_poster(const QString &path, int width, int height);
+    void record_sequence(const QString &pattern, CameraPath path, int frames,
+                         int width, int height);
+
+signals:
+    void histogram_ready(const Histogram &histogram);
+    void window_changed(double level, double width);
+    /* on the gpu, @resident if it was still there from before */
+    void dataset_ready(int dataset, bool resident, double ms);
+    /* couldn't be read, we're back on @current */
+    void dataset_failed(int dataset, int current);
+    /* asked for, and actually on screen, see Renderer */
+    void series_frame_changed(int frame);
+    void series_frame_shown(int frame, int late);
+    void mask_edited(qulonglong cut, qulonglong total, double ms);
+    /* what's under the cursor while hovering, @hit only if @found */
+    void probe_moved(bool found, const ProbeHit &hit, double ms);
+    /* on screen, rendered from everything set so far */
+    void frame_presented();
+    void export_progress(int done, int total);
+    void export_finished(bool ok, const QString &path);
+
+private slots:
+    void renderer_initialized(const QString &renderer, const QString &gl_version);
+    void volume_ready(int storage, qulonglong bytes);
+    void frame_ready(quint64 serial);
+    void update_stats_overlay(const FrameStats &stats);
+    void series_timer_timeout();
+    void hover_probe();
 
 protected:
     void initializeGL() Q_DECL_OVERRIDE;
@@ -84,58 +172,50 @@ protected:
     void wheelEvent(QWheelEvent *event) Q_DECL_OVERRIDE;
 
 private:
-    GLuint load_volume_texture(const char *path, GLuint w, GLuint h, GLuint d, unsigned int bit_depth);
-    GLuint load_transfer_function(const char *path);
-    GLuint load_transfer_function_from_data(float *data, size_t sz);
-    void init_target_texture(int w, int h);
-    void init_fbo(int w, int h);
-    void render_cube(QOpenGLShaderProgram *shader, GLuint cull_face);
+    void post_params();
     QVector3D arc_ball_vector(QVector2D v);
+    void finish_mask_outline();
 
     InitOptions opt;
 
-    QOpenGLShaderProgram *distance_shader;
-    QOpenGLShaderProgram *raycast_shader;
+    Renderer *renderer;
+    QThread *render_thread;
+    QOffscreenSurface *surface;
+    GLuint blit_fbo;
 
-    QMatrix4x4 proj;
-    QMatrix4x4 model;
-    QMatrix4x4 view;
+    /* what the next frame should look like, dirty transfer function
+     * ranges are reset on every post */
+    RenderParams params;
+    quint64 posted_serial;
+    quint64 presented_serial;
 
-    GLuint vao;
-    GLuint db;
-    GLuint fbo;
-    GLuint target_texture;
+    /* renderer side state, as last reported */
+    Histogram histogram;
+    VolumeStorage storage;
+    size_t volume_bytes;
+    FrameStats last_stats;
 
-    GLuint volume_texture;
-    GLuint transfer_function;
-
-    int cur_width;
-    int cur_height;
-
-    int x_angle;
-    int y_angle;
-    int z_angle;
-
-    bool fast_rendering;
-    int nsamples;
-
-    QPoint click_position;
-
-    QQuaternion rotation;
     QVector2D last_mouse_position;
     int mouse_wheel_delta;
 
-    float depth;
-
-    int shading_mode;
-    int compositing_mode;
-    float background_color[4];
-    float light_color[3]; /* no alpha here */
-    double ambient_reflectance;
-    double diffuse_reflectance;
-    double specular_reflectance;
+    /* shape being drawn with the mask tool, widget coordinates */
+    int mask_tool;
+    bool mask_drawing;
+    QPolygonF mask_outline;
 
     QTimer *update_timer;
+    QTimer *series_timer;
+
+    /* last hover position, tried again later while the renderer is
+     * editing the mask */
+    QPointF hover_position;
+    QTimer *hover_timer;
+
+    QString renderer_string;
+    QString gl_version_string;
+
+    QLabel *stats_label;
+    bool stats_overlay;
 };
 
 #endif
@@ -0,0 +1,203 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#include "gradient.h"
+#include "util.h"
+
+#include <QtConcurrent>
+
+#include <math.h>
+#include <string.h>
+
+/* largest possible central difference magnitude on [0, 1] data */
+#define GRADIENT_MAX 0.8660254f
+/* resolution for the percentile search */
+#define GRADIENT_BINS 4096
+#define GRADIENT_PERCENTILE 0.999
+
+/* slabs of slices processed in parallel, no need to synchronize
+ * anything as neighbors are only read */
+template <typename T>
+struct GradientSlab
+{
+    const T *data;
+    int w, h, d;
+    int z0, z1;
+    uint16_t *raw;   /* pass 1 output, GRADIENT_MAX mapped to 65535 */
+    T *out;          /* pass 2 output */
+    uint32_t scale;  /* pass 2, 16.16 fixed point raw to output */
+    int bits;        /* significant bits in data */
+    bool joint;
+};
+
+typedef QVector<quint64> GradientBins;
+
+template <typename T>
+static GradientBins gradient_raw(const GradientSlab<T> &s)
+{
+    GradientBins bins(GRADIENT_BINS);
+    const float norm = 0.5f / ((1u << s.bits) - 1) / GRADIENT_MAX * 65535.0f;
+    size_t sx = 1, sy = s.w, sz = (size_t) s.w * s.h;
+
+    for (int z=s.z0; z<s.z1; z++) {
+        size_t zl = z > 0 ? sz : 0;
+        size_t zh = z < s.d-1 ? sz : 0;
+
+        for (int y=0; y<s.h; y++) {
+            size_t yl = y > 0 ? sy : 0;
+            size_t yh = y < s.h-1 ? sy : 0;
+            size_t row = z * sz + y * sy;
+
+            for (int x=0; x<s.w; x++) {
+                size_t xl = x > 0 ? sx : 0;
+                size_t xh = x < s.w-1 ? sx : 0;
+                size_t i = row + x;
+
+                float gx = (float) s.data[i+xh] - (float) s.data[i-xl];
+                float gy = (float) s.data[i+yh] - (float) s.data[i-yl];
+                float gz = (float) s.data[i+zh] - (float) s.data[i-zl];
+
+                float g = sqrtf(gx*gx + gy*gy + gz*gz) * norm;
+                uint16_t r = (uint16_t) MIN(g, 65535.0f);
+
+                s.raw[i] = r;
+                bins[r >> 4]++;
+            }
+        }
+    }
+
+    return bins;
+}
+
+template <typename T>
+static GradientBins gradient_pack(const GradientSlab<T> &s)
+{
+    GradientBins joint;
+    const int shift = sizeof(T) * 8 - 8;
+    const int data_shift = s.bits - 8;
+    const uint32_t top = (T) ~(T) 0;
+
+    if (s.joint)
+        joint = GradientBins(HISTOGRAM_BINS * HISTOGRAM_BINS);
+
+    size_t first = (size_t) s.z0 * s.w * s.h;
+    size_t last = (size_t) s.z1 * s.w * s.h;
+
+    for (size_t i=first; i<last; i++) {
+        /* raw is 16 bit, scale is relative to the output depth */
+        uint32_t g = (uint32_t) (((uint64_t) s.raw[i] * s.scale) >> 16);
+        g = MIN(g, top);
+
+        s.out[2*i] = s.data[i];
+        s.out[2*i+1] = (T) g;
+
+        /* stray values past bits go to the last bin, like the 1D
+         * histogram */
+        if (s.joint) {
+            int v = MIN(s.data[i] >> data_shift, HISTOGRAM_BINS - 1);
+            joint[v * HISTOGRAM_BINS + (g >> shift)]++;
+        }
+    }
+
+    return joint;
+}
+
+static void gradient_merge(GradientBins &result, const GradientBins &bins)
+{
+    if (result.isEmpty()) {
+        result = bins;
+        return;
+    }
+
+    for (int i=0; i<bins.size(); i++)
+        result[i] += bins[i];
+}
+
+template <typename T>
+static void gradient_pack_generic(const T *data, int w, int h, int d, int bits,
+                                  T *out, Histogram *hist)
+{
+    size_t len = (size_t) w * h * d;
+    uint16_t *raw = (uint16_t *) malloc(len * sizeof(uint16_t));
+
+    QVector< GradientSlab<T> > slabs;
+    int nslabs = MIN(d, MAX(1, QThread::idealThreadCount() * 4));
+    for (int i=0; i<nslabs; i++) {
+        GradientSlab<T> s;
+        s.data = data;
+        s.w = w;
+        s.h = h;
+        s.d = d;
+        s.z0 = d * i / nslabs;
+        s.z1 = d * (i + 1) / nslabs;
+        s.raw = raw;
+        s.out = out;
+        s.scale = 0;
+        s.bits = bits;
+        s.joint = hist != NULL;
+        slabs << s;
+    }
+
+    GradientBins bins = QtConcurrent::blockingMappedReduced<GradientBins>(
+        slabs, gradient_raw<T>, gradient_merge);
+
+    /* percentile from the coarse histogram, top of its bin */
+    quint64 target = (quint64) (GRADIENT_PERCENTILE * len);
+    quint64 count = 0;
+    int p = 0;
+    for (p=0; p<bins.size()-1; p++) {
+        count += bins[p];
+        if (count >= target)
+            break;
+    }
+    uint32_t p_raw = MAX((uint32_t) (p + 1) << 4, 1u);
+
+    /* raw [0, p_raw] -> output [0, max] */
+    uint32_t top = (T) ~(T) 0;
+    uint32_t scale = (uint32_t) (((uint64_t) top << 16) / p_raw);
+    for (int i=0; i<slabs.size(); i++)
+        slabs[i].scale = scale;
+
+    GradientBins joint = QtConcurrent::blockingMappedReduced<GradientBins>(
+        slabs, gradient_pack<T>, gradient_merge);
+
+    free(raw);
+
+    if (hist) {
+        hist->joint = joint;
+        hist->joint_peak = 0;
+        for (int i=0; i<joint.size(); i++)
+            hist->joint_peak = MAX(hist->joint_peak, joint[i]);
+    }
+}
+
+void gradient_pack_8bit(const uint8_t *data, int w, int h, int d,
+                        uint8_t *out, Histogram *hist)
+{
+    gradient_pack_generic<uint8_t>(data, w, h, d, 8, out, hist);
+}
+
+void gradient_pack_16bit(const uint16_t *data, int w, int h, int d, int bits,
+                         uint16_t *out, Histogram *hist)
+{
+    gradient_pack_generic<uint16_t>(data, w, h, d, bits, out, hist);
+}
@@ -0,0 +1,46 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#ifndef GRADIENT_H
+#define GRADIENT_H
+
+#include <stdint.h>
+
+#include "histogram.h"
+
+/* Gradient magnitude by central differences, packed next to the
+ * intensity in a two channel volume (intensity, gradient) ready for
+ * upload as GL_RG8 / GL_RG16. Magnitudes are normalized so the 99.9th
+ * percentile fills the range, a handful of outliers would otherwise
+ * squeeze every real boundary at the bottom. Also fills the joint
+ * intensity/gradient histogram in @h if not NULL.
+
+   @out: 2*w*h*d elements
+*/
+void gradient_pack_8bit(const uint8_t *data, int w, int h, int d,
+                        uint8_t *out, Histogram *hist);
+/* 16 bit data as stored, @bits of it significant (10, 12 or 16), the
+ * gradient still fills the whole 16 bit range */
+void gradient_pack_16bit(const uint16_t *data, int w, int h, int d, int bits,
+                         uint16_t *out, Histogram *hist);
+
+#endif /* GRADIENT_H */
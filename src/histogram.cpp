@@ -0,0 +1,163 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#include "histogram.h"
+#include "util.h"
+
+#include <QThread>
+#include <QtConcurrent>
+
+#include <string.h>
+
+/* don't bother spawning threads for less than this */
+#define HISTOGRAM_CHUNK (1 << 20)
+
+/* bins below this fraction of a uniform bin count as empty */
+#define HISTOGRAM_EMPTY 0.01
+
+typedef struct _HistogramChunk
+{
+    const void *data;
+    size_t len;
+    int shift;     /* 16 bit only, raw value to bin */
+    uint16_t max;  /* 16 bit only, clamp */
+    bool wide;
+} HistogramChunk;
+
+typedef QVector<quint64> HistogramBins;
+
+/* four interleaved partial histograms, consecutive voxels mostly fall
+ * in the same bin and a single array would serialize on the
+ * increment, the loop body is branch free so the compiler can unroll
+ * and vectorize the index computation */
+static HistogramBins histogram_chunk(const HistogramChunk &c)
+{
+    quint64 partial[4][HISTOGRAM_BINS];
+    memset(partial, 0, sizeof(partial));
+
+    size_t n = c.len & ~((size_t) 3);
+
+    if (c.wide) {
+        const uint16_t *d = (const uint16_t *) c.data;
+        for (size_t i=0; i<n; i+=4) {
+            partial[0][MIN(d[i],   c.max) >> c.shift]++;
+            partial[1][MIN(d[i+1], c.max) >> c.shift]++;
+            partial[2][MIN(d[i+2], c.max) >> c.shift]++;
+            partial[3][MIN(d[i+3], c.max) >> c.shift]++;
+        }
+        for (size_t i=n; i<c.len; i++)
+            partial[0][MIN(d[i], c.max) >> c.shift]++;
+    } else {
+        const uint8_t *d = (const uint8_t *) c.data;
+        for (size_t i=0; i<n; i+=4) {
+            partial[0][d[i]]++;
+            partial[1][d[i+1]]++;
+            partial[2][d[i+2]]++;
+            partial[3][d[i+3]]++;
+        }
+        for (size_t i=n; i<c.len; i++)
+            partial[0][d[i]]++;
+    }
+
+    HistogramBins bins(HISTOGRAM_BINS);
+    for (int b=0; b<HISTOGRAM_BINS; b++)
+        bins[b] = partial[0][b] + partial[1][b] + partial[2][b] + partial[3][b];
+
+    return bins;
+}
+
+static void histogram_merge(HistogramBins &result, const HistogramBins &bins)
+{
+    if (result.isEmpty())
+        result = HistogramBins(HISTOGRAM_BINS);
+
+    for (int b=0; b<HISTOGRAM_BINS; b++)
+        result[b] += bins[b];
+}
+
+static void histogram_compute(const void *data, size_t len, bool wide,
+                              unsigned int bit_depth, Histogram *h)
+{
+    QVector<HistogramChunk> chunks;
+
+    size_t nchunks = MAX(1, QThread::idealThreadCount());
+    size_t chunk_len = MAX(HISTOGRAM_CHUNK, (len + nchunks - 1) / nchunks);
+    size_t elem = wide ? sizeof(uint16_t) : sizeof(uint8_t);
+
+    for (size_t start=0; start<len; start+=chunk_len) {
+        HistogramChunk c;
+        c.data = (const uint8_t *) data + start * elem;
+        c.len = MIN(chunk_len, len - start);
+        c.shift = bit_depth > 8 ? bit_depth - 8 : 0;
+        c.max = (1 << bit_depth) - 1;
+        c.wide = wide;
+        chunks << c;
+    }
+
+    h->bins = QtConcurrent::blockingMappedReduced<HistogramBins>(chunks, histogram_chunk,
+                                                                 histogram_merge);
+    if (h->bins.isEmpty())
+        h->bins = HistogramBins(HISTOGRAM_BINS);
+
+    h->total = 0;
+    h->peak = 0;
+    h->bit_depth = bit_depth;
+    h->joint.clear();
+    h->joint_peak = 0;
+    for (int b=0; b<HISTOGRAM_BINS; b++) {
+        h->total += h->bins[b];
+        h->peak = MAX(h->peak, h->bins[b]);
+    }
+}
+
+void histogram_compute_8bit(const uint8_t *data, size_t len, Histogram *h)
+{
+    histogram_compute(data, len, false, 8, h);
+}
+
+void histogram_compute_16bit(const uint16_t *data, size_t len,
+                             unsigned int bit_depth, Histogram *h)
+{
+    histogram_compute(data, len, true, CLAMP(bit_depth, 8, 16), h);
+}
+
+void histogram_range(const Histogram &h, float *lo, float *hi)
+{
+    *lo = 0.0;
+    *hi = 1.0;
+
+    if (h.total == 0 || h.bins.size() != HISTOGRAM_BINS)
+        return;
+
+    double threshold = HISTOGRAM_EMPTY * h.total / HISTOGRAM_BINS;
+
+    int first = 0;
+    while (first < HISTOGRAM_BINS-1 && h.bins[first] <= threshold)
+        first++;
+
+    int last = HISTOGRAM_BINS-1;
+    while (last > first && h.bins[last] <= threshold)
+        last--;
+
+    *lo = (float) first / HISTOGRAM_BINS;
+    *hi = (float) (last + 1) / HISTOGRAM_BINS;
+}
@@ -0,0 +1,57 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <QVector>
+#include <stdint.h>
+#include <stddef.h>
+
+/* bins over the normalized [0, 1] intensity range, same range the
+ * transfer function spans */
+#define HISTOGRAM_BINS 256
+
+typedef struct _Histogram
+{
+    QVector<quint64> bins;
+    quint64 total;
+    quint64 peak;        /* largest bin */
+    unsigned int bit_depth;
+
+    /* intensity (rows) by gradient magnitude (columns), filled while
+     * packing gradients, see gradient.h */
+    QVector<quint64> joint;
+    quint64 joint_peak;
+} Histogram;
+
+/* computed in parallel chunks, @bit_depth is the meaningful depth of
+ * the 16 bit data, values above it are clamped to the top bin */
+void histogram_compute_8bit(const uint8_t *data, size_t len, Histogram *h);
+void histogram_compute_16bit(const uint16_t *data, size_t len,
+                             unsigned int bit_depth, Histogram *h);
+
+/* normalized intensity range actually holding data, nearly empty
+ * bins on both ends are cut out */
+void histogram_range(const Histogram &h, float *lo, float *hi);
+
+#endif /* HISTOGRAM_H */
@@ -24,8 +24,26 @@
 #include <QSurfaceFormat>
 #include <QCommandLineParser>
 #include <QCommandLineOption>
+#include <QDir>
+
+#include <stdio.h>
 
 #include "window.h"
+#include "benchmark.h"
+#include "synthvolume.h"
+#include "volumestorage.h"
+#include "renderserver.h"
+#include "sortlast.h"
+#include "volumeseries.h"
+
+/* the other ranks, stopped once the window and its renderer are
+ * gone */
+static SortLast sort_last;
+
+static void close_sort_last()
+{
+    sort_last_close(&sort_last);
+}
 
 int main(int argc, char *argv[])
 {
@@ -63,6 +81,172 @@ int main(int argc, char *argv[])
                                      "12");
     parser.addOption(bit_depth_opt);
 
+    QCommandLineOption roi_opt(QStringList() << "roi",
+                               "Only load this box of the volume, in voxels, end exclusive",
+                               "x0,y0,z0,x1,y1,z1");
+    parser.addOption(roi_opt);
+
+    QCommandLineOption stride_opt(QStringList() << "stride",
+                                  "Only load every stride-th voxel along each axis",
+                                  "voxels",
+                                  "1");
+    parser.addOption(stride_opt);
+
+    QCommandLineOption rescale_opt(QStringList() << "rescale",
+                                   "Stored values to physical units, like the DICOM rescale slope and intercept",
+                                   "slope,intercept",
+                                   "1,0");
+    parser.addOption(rescale_opt);
+
+    QCommandLineOption window_opt(QStringList() << "window",
+                                  "Window the transfer function spans, in physical units, the whole data range by default",
+                                  "level,width");
+    parser.addOption(window_opt);
+
+    QCommandLineOption dataset_opt(QStringList() << "dataset",
+                                   "Another dataset for the session, can be repeated",
+                                   "path,width,height,depth,bitdepth[,xscale,yscale,zscale]");
+    parser.addOption(dataset_opt);
+
+    QCommandLineOption gpu_budget_opt(QStringList() << "gpu-budget",
+                                      "GPU memory for the volumes of the session, least recently viewed go first",
+                                      "MB",
+                                      "2048");
+    parser.addOption(gpu_budget_opt);
+
+    QCommandLineOption series_opt(QStringList() << "series",
+                                  "Time series of volumes the size of -s, a raw file per frame in a directory or all frames in one file",
+                                  "path/to/frames");
+    parser.addOption(series_opt);
+
+    QCommandLineOption fps_opt(QStringList() << "fps",
+                               "Time series playback rate",
+                               "frames",
+                               "10");
+    parser.addOption(fps_opt);
+
+    QCommandLineOption mask_opt(QStringList() << "mask",
+                                "Box, lasso and flood fill tools to cut parts of the volume away");
+    parser.addOption(mask_opt);
+
+    QCommandLineOption probe_opt(QStringList() << "probe",
+                                 "Keep the volume in memory for picking and the hover probe");
+    parser.addOption(probe_opt);
+
+    QCommandLineOption auto_range_opt(QStringList() << "auto-range",
+                                      "Fit the transfer function to the data range on load");
+    parser.addOption(auto_range_opt);
+
+    QCommandLineOption fixed_step_opt(QStringList() << "fixed-step",
+                                      "March rays with a fixed step instead of a fixed sample count");
+    parser.addOption(fixed_step_opt);
+
+    QCommandLineOption quality_opt(QStringList() << "q" << "quality",
+                                   "Sampling rate of still frames",
+                                   "preview,interactive,final",
+                                   "final");
+    parser.addOption(quality_opt);
+
+    QCommandLineOption no_lod_opt(QStringList() << "no-lod",
+                                  "Always sample the full resolution volume");
+    parser.addOption(no_lod_opt);
+
+    QCommandLineOption no_cache_opt(QStringList() << "no-cache",
+                                    "Don't read or write the preview cache");
+    parser.addOption(no_cache_opt);
+
+    QCommandLineOption no_shader_cache_opt(QStringList() << "no-shader-cache",
+                                           "Always compile the shaders from source");
+    parser.addOption(no_shader_cache_opt);
+
+    QCommandLineOption tile_size_opt(QStringList() << "tile-size",
+                                     "Render still frames in tiles, 0 for whole frames",
+                                     "pixels",
+                                     "256");
+    parser.addOption(tile_size_opt);
+
+    QCommandLineOption preclassify_opt(QStringList() << "preclassify",
+                                       "Apply the transfer function to the volume once edits settle",
+                                       "auto,always,never",
+                                       "auto");
+    parser.addOption(preclassify_opt);
+
+    QCommandLineOption storage_opt(QStringList() << "storage",
+                                   "GPU volume storage",
+                                   "native,linear8,equalized8,tf8,rgtc,packed12",
+                                   "native");
+    parser.addOption(storage_opt);
+
+    QCommandLineOption storage_report_opt(QStringList() << "storage-report",
+                                          "Compare the first frame against a native volume");
+    parser.addOption(storage_report_opt);
+
+    QCommandLineOption synth_opt(QStringList() << "synthetic",
+                                 "Generate a synthetic volume of the given size and bit depth",
+                                 "shells,noise,vessels,blocks");
+    parser.addOption(synth_opt);
+
+    QCommandLineOption bench_opt(QStringList() << "b" << "benchmark",
+                                 "Run the rendering benchmark and write results",
+                                 "results.json");
+    parser.addOption(bench_opt);
+
+    QCommandLineOption bench_frames_opt(QStringList() << "bench-frames",
+                                        "Frames per benchmark run",
+                                        "frames",
+                                        "120");
+    parser.addOption(bench_frames_opt);
+
+    QCommandLineOption stats_log_opt(QStringList() << "stats-log",
+                                     "Stream per frame statistics to a csv or json lines file",
+                                     "stats.csv");
+    parser.addOption(stats_log_opt);
+
+    QCommandLineOption record_opt(QStringList() << "record",
+                                  "Render a frame sequence along a camera path, numbered images if the name has a %d, raw rgb24 otherwise, then quit",
+                                  "frames/frame-%04d.png");
+    parser.addOption(record_opt);
+
+    QCommandLineOption record_path_opt(QStringList() << "record-path",
+                                       "Camera path of the recorded sequence",
+                                       "orbit,zoom",
+                                       "orbit");
+    parser.addOption(record_path_opt);
+
+    QCommandLineOption record_frames_opt(QStringList() << "record-frames",
+                                         "Frames in the recorded sequence",
+                                         "frames",
+                                         "360");
+    parser.addOption(record_frames_opt);
+
+    QCommandLineOption record_size_opt(QStringList() << "record-size",
+                                       "Size of the recorded frames",
+                                       "width,height",
+                                       "1920,1080");
+    parser.addOption(record_size_opt);
+
+    QCommandLineOption server_opt(QStringList() << "server",
+                                  "Serve frames over a local socket or a localhost tcp port instead of opening a window",
+                                  "name|port");
+    parser.addOption(server_opt);
+
+    QCommandLineOption workers_opt(QStringList() << "workers",
+                                   "Split the volume in slabs across this many processes, a power of two",
+                                   "processes",
+                                   "1");
+    parser.addOption(workers_opt);
+
+    /* what rank 0 passes to the processes it spawns */
+    QCommandLineOption worker_rank_opt(QStringList() << "worker-rank",
+                                       "Sort-last worker, internal", "rank");
+    worker_rank_opt.setFlags(QCommandLineOption::HiddenFromHelp);
+    parser.addOption(worker_rank_opt);
+
+    QCommandLineOption worker_key_opt(QStringList() << "worker-key",
+                                      "Sort-last shared segment, internal", "key");
+    worker_key_opt.setFlags(QCommandLineOption::HiddenFromHelp);
+    parser.addOption(worker_key_opt);
+
 
     parser.process(app);
 
@@ -85,18 +269,271 @@ int main(int argc, char *argv[])
     QString bit_depth = parser.value(bit_depth_opt);
     opt.bit_depth = bit_depth.toInt();
 
+    opt.roi_set = parser.isSet(roi_opt);
+    for (int k=0; k<6; k++)
+        opt.roi[k] = 0;
+    if (opt.roi_set) {
+        l = parser.value(roi_opt).split(",");
+        bool ok = l.size() == 6;
+        for (int k=0; k<l.size() && ok; k++)
+            opt.roi[k] = l[k].toUInt(&ok);
+        for (int k=0; k<3 && ok; k++)
+            ok = opt.roi[k] < opt.roi[k+3];
+        if (!ok) {
+            fprintf(stderr, "roi must be x0,y0,z0,x1,y1,z1 with x0 < x1, y0 < y1 and z0 < z1\n");
+            return 1;
+        }
+    }
+    opt.stride = parser.value(stride_opt).toUInt();
+    if (opt.stride < 1) {
+        fprintf(stderr, "stride must be at least 1\n");
+        return 1;
+    }
+
+    l = parser.value(rescale_opt).split(",");
+    bool slope_ok = false, intercept_ok = false;
+    opt.rescale_slope = l[0].toDouble(&slope_ok);
+    opt.rescale_intercept = l.size() > 1 ? l[1].toDouble(&intercept_ok) : 0.0;
+    if (!slope_ok || (l.size() > 1 && !intercept_ok) || opt.rescale_slope == 0.0) {
+        fprintf(stderr, "rescale must be slope,intercept with a non zero slope\n");
+        return 1;
+    }
+
+    opt.window_set = parser.isSet(window_opt);
+    opt.window_level = 0.0;
+    opt.window_width = 1.0;
+    if (opt.window_set) {
+        l = parser.value(window_opt).split(",");
+        bool level_ok = false, width_ok = false;
+        opt.window_level = l[0].toDouble(&level_ok);
+        if (l.size() > 1)
+            opt.window_width = l[1].toDouble(&width_ok);
+        if (!level_ok || !width_ok || opt.window_width <= 0.0) {
+            fprintf(stderr, "window must be level,width with a positive width\n");
+            return 1;
+        }
+    }
+
+    opt.auto_range = parser.isSet(auto_range_opt);
+    opt.fixed_step = parser.isSet(fixed_step_opt);
+    opt.lod = !parser.isSet(no_lod_opt);
+    /* benchmarks want the full volume from the first frame */
+    opt.cache = !parser.isSet(no_cache_opt) && !parser.isSet(bench_opt);
+    opt.shader_cache = !parser.isSet(no_shader_cache_opt);
+    opt.tile_size = qMax(parser.value(tile_size_opt).toInt(), 0);
+
+    QString quality = parser.value(quality_opt);
+    if (quality == "preview")
+        opt.quality = QUALITY_PREVIEW;
+    else if (quality == "interactive")
+        opt.quality = QUALITY_INTERACTIVE;
+    else if (quality == "final")
+        opt.quality = QUALITY_FINAL;
+    else {
+        fprintf(stderr, "unknown quality: %s\n", quality.toUtf8().data());
+        return 1;
+    }
+
+    QString preclassify = parser.value(preclassify_opt);
+    if (preclassify == "auto")
+        opt.preclassify = PRECLASSIFY_AUTO;
+    else if (preclassify == "always")
+        opt.preclassify = PRECLASSIFY_ALWAYS;
+    else if (preclassify == "never")
+        opt.preclassify = PRECLASSIFY_NEVER;
+    else {
+        fprintf(stderr, "unknown preclassify: %s\n", preclassify.toUtf8().data());
+        return 1;
+    }
+
+    VolumeStorage storage;
+    if (!volume_storage_from_string(parser.value(storage_opt), &storage)) {
+        fprintf(stderr, "unknown storage: %s\n",
+                parser.value(storage_opt).toUtf8().data());
+        return 1;
+    }
+    opt.storage = storage;
+    opt.storage_report = parser.isSet(storage_report_opt);
+
+    /* synthetic data goes through a temporary raw file, this way we
+     * also benchmark the same loading path real datasets take */
+    QString synth_label;
+    if (parser.isSet(synth_opt)) {
+        SynthKind kind;
+        if (!synth_kind_from_string(parser.value(synth_opt), &kind)) {
+            fprintf(stderr, "unknown synthetic volume: %s\n",
+                    parser.value(synth_opt).toUtf8().data());
+            return 1;
+        }
+
+        synth_label = synth_kind_to_string(kind);
+        opt.filename = QDir::temp().filePath(QString("qvrc-%1-%2x%3x%4-%5bit.raw")
+                                             .arg(synth_label)
+                                             .arg(opt.width).arg(opt.height).arg(opt.depth)
+                                             .arg(opt.bit_depth));
+
+        printf("generating %s\n", opt.filename.toUtf8().data());
+        if (!synth_volume_write(opt.filename, kind, opt.width, opt.height, opt.depth,
+                                opt.bit_depth))
+            return 1;
+    }
+
+    /* a series plays in place of the dataset, its first frame stands
+     * for it until then */
+    opt.file_offset = 0;
+    opt.series_frames = 0;
+    opt.fps = qMax(parser.value(fps_opt).toInt(), 1);
+    opt.mask = parser.isSet(mask_opt);
+    opt.probe = opt.mask || parser.isSet(probe_opt);
+    if (parser.isSet(series_opt)) {
+        opt.series = parser.value(series_opt);
+        if (!volume_series_probe(&opt))
+            return 1;
+    }
+
+    /* the session, the first one is what's on screen at startup */
+    SessionDataset first;
+    first.filename = opt.filename;
+    first.width = opt.width;
+    first.height = opt.height;
+    first.depth = opt.depth;
+    first.bit_depth = opt.bit_depth;
+    first.xscale = opt.xscale;
+    first.yscale = opt.yscale;
+    first.zscale = opt.zscale;
+    opt.datasets << first;
+    foreach (const QString &spec, parser.values(dataset_opt)) {
+        SessionDataset d;
+        if (!session_parse_dataset(spec, &d)) {
+            fprintf(stderr, "bad dataset: %s\n", spec.toUtf8().data());
+            return 1;
+        }
+        /* read on a pool thread later, a bad one mustn't get that far */
+        if (!session_check_dataset(d))
+            return 1;
+        opt.datasets << d;
+    }
+    opt.gpu_budget = qMax(parser.value(gpu_budget_opt).toInt(), 0);
+    session_select(&opt, 0);
+
+    opt.workers = parser.value(workers_opt).toInt();
+    opt.worker_rank = parser.value(worker_rank_opt).toInt();
+    opt.worker_key = parser.value(worker_key_opt);
+    if (opt.workers < 1 || opt.workers > SORT_LAST_MAX_WORKERS ||
+        (opt.workers & (opt.workers - 1)) || (unsigned int) opt.workers > opt.depth) {
+        fprintf(stderr, "workers must be a power of two up to %d and the volume depth\n",
+                SORT_LAST_MAX_WORKERS);
+        return 1;
+    }
+    if (opt.workers > 1) {
+        /* slabs are whole frames of their own, no previews, no
+         * mipmaps that would bleed across them, nothing to compare */
+        opt.tile_size = 0;
+        opt.cache = false;
+        opt.lod = false;
+        opt.storage_report = false;
+    }
+    if (opt.datasets.size() > 1 && opt.workers > 1) {
+        fprintf(stderr, "sort-last workers only render a single dataset\n");
+        return 1;
+    }
+    if (opt.series_frames > 0) {
+        if (opt.datasets.size() > 1 || opt.workers > 1) {
+            fprintf(stderr, "a series doesn't mix with other datasets or sort-last workers\n");
+            return 1;
+        }
+        /* every frame is new data, nothing to cache or compare, no
+         * time to build pyramids */
+        opt.cache = false;
+        opt.lod = false;
+        opt.storage_report = false;
+    }
+    if (opt.mask && (opt.datasets.size() > 1 || opt.series_frames > 0 || opt.workers > 1)) {
+        fprintf(stderr, "the mask is for a single volume, no other datasets, series or workers\n");
+        return 1;
+    }
+    if (opt.probe && (opt.datasets.size() > 1 || opt.series_frames > 0 || opt.workers > 1)) {
+        fprintf(stderr, "the probe is for a single volume, no other datasets, series or workers\n");
+        return 1;
+    }
+
     QSurfaceFormat fmt;
     fmt.setDepthBufferSize(24);
     // fmt.setSamples(4); // complicates everything with offscreen rendering
     fmt.setVersion(3, 2);
     fmt.setProfile(QSurfaceFormat::CoreProfile);
+    /* don't let vsync quantize the measurements */
+    if (parser.isSet(bench_opt))
+        fmt.setSwapInterval(0);
 
     QSurfaceFormat::setDefaultFormat(fmt);
 
+    if (parser.isSet(worker_rank_opt))
+        return sort_last_worker_exec(opt);
+
+    /* rank 0 is us, whatever we end up doing */
+    if (opt.workers > 1) {
+        if (!sort_last_spawn(&sort_last, opt))
+            return 1;
+        opt.worker_key = sort_last.shm->key();
+        qAddPostRoutine(close_sort_last);
+    }
+
+    if (parser.isSet(server_opt)) {
+        /* clients want whole frames */
+        opt.tile_size = 0;
+
+        RenderServer server(opt);
+        if (!server.listen(parser.value(server_opt)))
+            return 1;
+
+        return app.exec();
+    }
+
     Window window(opt);
     window.resize(window.sizeHint());
 
     window.show();
 
+    if (parser.isSet(stats_log_opt))
+        window.get_gl_widget()->set_stats_log(parser.value(stats_log_opt));
+
+    if (parser.isSet(bench_opt)) {
+        Benchmark *bench = new Benchmark(window.get_gl_widget(), opt,
+                                         parser.value(bench_opt),
+                                         parser.value(bench_frames_opt).toInt(),
+                                         &window);
+        bench->set_dataset_label(synth_label);
+        bench->start();
+    }
+
+    if (parser.isSet(record_opt)) {
+        CameraPath path;
+        if (!camera_path_from_string(parser.value(record_path_opt), &path)) {
+            fprintf(stderr, "unknown camera path: %s\n",
+                    parser.value(record_path_opt).toUtf8().data());
+            return 1;
+        }
+        QStringList size = parser.value(record_size_opt).split(",");
+        int record_width = size[0].toInt();
+        int record_height = size.value(1).toInt();
+        int record_frames = parser.value(record_frames_opt).toInt();
+        QString pattern = parser.value(record_opt);
+
+        /* start once the first frame is up, everything is loaded by
+         * then */
+        GLWidget *glwidget = window.get_gl_widget();
+        QMetaObject::Connection *started = new QMetaObject::Connection;
+        *started = QObject::connect(glwidget, &GLWidget::frame_presented, [=]() {
+                QObject::disconnect(*started);
+                delete started;
+                glwidget->record_sequence(pattern, path, record_frames,
+                                          record_width, record_height);
+            });
+        QObject::connect(glwidget, &GLWidget::export_finished, [&](bool ok) {
+                app.exit(ok ? 0 : 1);
+            });
+    }
+
     return app.exec();
 }
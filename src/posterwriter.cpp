@@ -0,0 +1,423 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#include "posterwriter.h"
+
+#include <QFileInfo>
+
+#include <stdio.h>
+#include <string.h>
+
+/* tiff tags we write, ascending as the spec wants them */
+#define TIFF_IMAGE_WIDTH        256
+#define TIFF_IMAGE_LENGTH       257
+#define TIFF_BITS_PER_SAMPLE    258
+#define TIFF_COMPRESSION        259
+#define TIFF_PHOTOMETRIC        262
+#define TIFF_SAMPLES_PER_PIXEL  277
+#define TIFF_PLANAR_CONFIG      284
+#define TIFF_TILE_WIDTH         322
+#define TIFF_TILE_LENGTH        323
+#define TIFF_TILE_OFFSETS       324
+#define TIFF_TILE_BYTE_COUNTS   325
+
+#define TIFF_SHORT 3
+#define TIFF_LONG  4
+
+#define TIFF_DEFLATE 8
+#define TIFF_RGB     2
+
+/* stored deflate blocks can't be longer */
+#define DEFLATE_STORED_MAX 65535
+
+static void put16le(QByteArray &b, quint16 v)
+{
+    b.append((char) (v & 0xff));
+    b.append((char) (v >> 8));
+}
+
+static void put32le(QByteArray &b, quint32 v)
+{
+    put16le(b, v & 0xffff);
+    put16le(b, v >> 16);
+}
+
+static void put32be(QByteArray &b, quint32 v)
+{
+    b.append((char) (v >> 24));
+    b.append((char) ((v >> 16) & 0xff));
+    b.append((char) ((v >> 8) & 0xff));
+    b.append((char) (v & 0xff));
+}
+
+static bool write_all(PosterWriter *w, const QByteArray &b)
+{
+    if (w->file.write(b) != b.size()) {
+        fprintf(stderr, "couldn't write %s: %s\n",
+                w->file.fileName().toUtf8().data(),
+                w->file.errorString().toUtf8().data());
+        return false;
+    }
+
+    return true;
+}
+
+/* top row first, rgb, the whole tile */
+static void tile_to_rgb(const QByteArray &rgba, int tile, uchar *out, int stride,
+                        int columns, int rows)
+{
+    const uchar *in = (const uchar *) rgba.constData();
+
+    for (int y=0; y<rows; y++) {
+        const uchar *src = in + (size_t) (tile - 1 - y) * tile * 4;
+        uchar *dst = out + (size_t) y * stride;
+        for (int x=0; x<columns; x++) {
+            dst[3*x + 0] = src[4*x + 0];
+            dst[3*x + 1] = src[4*x + 1];
+            dst[3*x + 2] = src[4*x + 2];
+        }
+    }
+}
+
+static quint32 crc32_update(quint32 crc, const uchar *data, size_t len)
+{
+    static quint32 table[256];
+    static bool table_ready = false;
+
+    if (!table_ready) {
+        for (quint32 n=0; n<256; n++) {
+            quint32 c = n;
+            for (int k=0; k<8; k++)
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            table[n] = c;
+        }
+        table_ready = true;
+    }
+
+    crc ^= 0xffffffff;
+    for (size_t i=0; i<len; i++)
+        crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+
+    return crc ^ 0xffffffff;
+}
+
+static quint32 adler32_update(quint32 adler, const uchar *data, size_t len)
+{
+    quint32 a = adler & 0xffff;
+    quint32 b = adler >> 16;
+
+    /* the largest run that can't overflow before the modulo */
+    while (len > 0) {
+        size_t n = len < 5552 ? len : 5552;
+        len -= n;
+        while (n--) {
+            a += *data++;
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+
+    return (b << 16) | a;
+}
+
+static bool png_chunk(PosterWriter *w, const char *type, const QByteArray &data)
+{
+    QByteArray chunk;
+    put32be(chunk, data.size());
+    chunk.append(type, 4);
+    chunk.append(data);
+    put32be(chunk, crc32_update(0, (const uchar *) chunk.constData() + 4,
+                                chunk.size() - 4));
+
+    return write_all(w, chunk);
+}
+
+static bool png_open(PosterWriter *w)
+{
+    static const char signature[8] = { '\x89', 'P', 'N', 'G', '\r', '\n', '\x1a', '\n' };
+
+    QByteArray ihdr;
+    put32be(ihdr, w->width);
+    put32be(ihdr, w->height);
+    ihdr.append((char) 8);      /* bits per channel */
+    ihdr.append((char) 2);      /* rgb */
+    ihdr.append((char) 0);      /* deflate */
+    ihdr.append((char) 0);      /* adaptive filtering */
+    ihdr.append((char) 0);      /* not interlaced */
+
+    /* zlib header, deflate with a 32k window, no dictionary */
+    QByteArray zhdr;
+    zhdr.append((char) 0x78);
+    zhdr.append((char) 0x01);
+
+    w->adler = 1;
+    w->next_tile = 0;
+
+    return write_all(w, QByteArray(signature, 8)) &&
+        png_chunk(w, "IHDR", ihdr) &&
+        png_chunk(w, "IDAT", zhdr);
+}
+
+/* a finished row of tiles as stored deflate blocks, filter type 0 is
+ * already in the band */
+static bool png_flush_band(PosterWriter *w)
+{
+    const uchar *data = (const uchar *) w->band.constData();
+    int len = w->band.size();
+
+    w->adler = adler32_update(w->adler, data, len);
+
+    QByteArray idat;
+    idat.reserve(len + (len / DEFLATE_STORED_MAX + 1) * 5);
+    for (int off=0; off<len; off+=DEFLATE_STORED_MAX) {
+        quint16 n = qMin(len - off, DEFLATE_STORED_MAX);
+        idat.append((char) 0x00);   /* not final, stored */
+        put16le(idat, n);
+        put16le(idat, ~n);
+        idat.append((const char *) data + off, n);
+    }
+
+    w->band = QByteArray();
+
+    return png_chunk(w, "IDAT", idat);
+}
+
+static bool png_write_tile(PosterWriter *w, int tx, int ty, const QByteArray &rgba)
+{
+    int rows = qMin(w->tile, w->height - ty * w->tile);
+    int stride = 1 + 3 * w->width;
+
+    /* rows can't be written out of order */
+    if (ty * w->tiles_x + tx != w->next_tile) {
+        fprintf(stderr, "png tiles must come by rows, got %d,%d\n", tx, ty);
+        return false;
+    }
+    w->next_tile++;
+
+    /* filter bytes stay 0, no filtering */
+    if (tx == 0)
+        w->band = QByteArray(rows * stride, 0);
+
+    int columns = qMin(w->tile, w->width - tx * w->tile);
+    uchar *out = (uchar *) w->band.data() + 1 + 3 * tx * w->tile;
+    tile_to_rgb(rgba, w->tile, out, stride, columns, rows);
+
+    if (tx < w->tiles_x - 1)
+        return true;
+
+    return png_flush_band(w);
+}
+
+static bool png_close(PosterWriter *w)
+{
+    /* empty final block, then the checksum of everything */
+    QByteArray end;
+    end.append((char) 0x01);
+    put16le(end, 0x0000);
+    put16le(end, 0xffff);
+    put32be(end, w->adler);
+
+    return png_chunk(w, "IDAT", end) &&
+        png_chunk(w, "IEND", QByteArray());
+}
+
+static bool tiff_open(PosterWriter *w)
+{
+    /* little endian, the ifd offset is filled in by tiff_close() */
+    QByteArray header("II", 2);
+    put16le(header, 42);
+    put32le(header, 0);
+
+    w->tile_offsets = QVector<quint32>(w->tiles_x * w->tiles_y, 0);
+    w->tile_bytes = QVector<quint32>(w->tiles_x * w->tiles_y, 0);
+
+    return write_all(w, header);
+}
+
+/* edge tiles are padded, readers crop them */
+static bool tiff_write_tile(PosterWriter *w, int tx, int ty, const QByteArray &rgba)
+{
+    QByteArray rgb(w->tile * w->tile * 3, 0);
+    tile_to_rgb(rgba, w->tile, (uchar *) rgb.data(), w->tile * 3, w->tile, w->tile);
+
+    /* qCompress() prepends the length, the rest is a zlib stream */
+    QByteArray z = qCompress(rgb, 6).mid(4);
+
+    qint64 offset = w->file.pos();
+    if (offset + z.size() > 0xffffffffLL) {
+        fprintf(stderr, "%s: over 4GB, that's too big for a tiff\n",
+                w->file.fileName().toUtf8().data());
+        return false;
+    }
+
+    int i = ty * w->tiles_x + tx;
+    w->tile_offsets[i] = offset;
+    w->tile_bytes[i] = z.size();
+
+    return write_all(w, z);
+}
+
+static void ifd_entry(QByteArray &ifd, quint16 tag, quint16 type, quint32 count, quint32 value)
+{
+    put16le(ifd, tag);
+    put16le(ifd, type);
+    put32le(ifd, count);
+    /* shorts are left justified in the value field */
+    if (type == TIFF_SHORT && count == 1) {
+        put16le(ifd, value);
+        put16le(ifd, 0);
+    } else {
+        put32le(ifd, value);
+    }
+}
+
+static bool tiff_close(PosterWriter *w)
+{
+    int n = w->tile_offsets.size();
+    for (int i=0; i<n; i++) {
+        if (!w->tile_bytes[i]) {
+            fprintf(stderr, "%s: tile %d never written\n",
+                    w->file.fileName().toUtf8().data(), i);
+            return false;
+        }
+    }
+
+    /* out of line values first, then the ifd word aligned after them */
+    QByteArray tail;
+    if (w->file.pos() & 1)
+        tail.append((char) 0);
+    quint32 base = w->file.pos() + tail.size();
+
+    quint32 bits_offset = base;
+    for (int c=0; c<3; c++)
+        put16le(tail, 8);
+
+    quint32 offsets_offset = base + 6;
+    for (int i=0; i<n; i++)
+        put32le(tail, w->tile_offsets[i]);
+
+    quint32 bytes_offset = offsets_offset + 4 * n;
+    for (int i=0; i<n; i++)
+        put32le(tail, w->tile_bytes[i]);
+
+    quint32 ifd_offset = bytes_offset + 4 * n;
+
+    /* a single tile fits in the entry itself */
+    if (n == 1) {
+        offsets_offset = w->tile_offsets[0];
+        bytes_offset = w->tile_bytes[0];
+    }
+
+    QByteArray ifd;
+    put16le(ifd, 11);
+    ifd_entry(ifd, TIFF_IMAGE_WIDTH, TIFF_LONG, 1, w->width);
+    ifd_entry(ifd, TIFF_IMAGE_LENGTH, TIFF_LONG, 1, w->height);
+    ifd_entry(ifd, TIFF_BITS_PER_SAMPLE, TIFF_SHORT, 3, bits_offset);
+    ifd_entry(ifd, TIFF_COMPRESSION, TIFF_SHORT, 1, TIFF_DEFLATE);
+    ifd_entry(ifd, TIFF_PHOTOMETRIC, TIFF_SHORT, 1, TIFF_RGB);
+    ifd_entry(ifd, TIFF_SAMPLES_PER_PIXEL, TIFF_SHORT, 1, 3);
+    ifd_entry(ifd, TIFF_PLANAR_CONFIG, TIFF_SHORT, 1, 1);
+    ifd_entry(ifd, TIFF_TILE_WIDTH, TIFF_LONG, 1, w->tile);
+    ifd_entry(ifd, TIFF_TILE_LENGTH, TIFF_LONG, 1, w->tile);
+    ifd_entry(ifd, TIFF_TILE_OFFSETS, TIFF_LONG, n, offsets_offset);
+    ifd_entry(ifd, TIFF_TILE_BYTE_COUNTS, TIFF_LONG, n, bytes_offset);
+    put32le(ifd, 0);    /* no more images */
+
+    if ((qint64) ifd_offset + ifd.size() > 0xffffffffLL) {
+        fprintf(stderr, "%s: over 4GB, that's too big for a tiff\n",
+                w->file.fileName().toUtf8().data());
+        return false;
+    }
+
+    if (!write_all(w, tail) || !write_all(w, ifd))
+        return false;
+
+    QByteArray first;
+    put32le(first, ifd_offset);
+
+    return w->file.seek(4) && write_all(w, first);
+}
+
+bool poster_open(PosterWriter *w, const QString &path, int width, int height, int tile)
+{
+    QString suffix = QFileInfo(path).suffix().toLower();
+    if (suffix == "tif" || suffix == "tiff") {
+        w->format = POSTER_TIFF;
+    } else if (suffix == "png") {
+        w->format = POSTER_PNG;
+    } else {
+        fprintf(stderr, "%s: don't know how to write that, try .tiff or .png\n",
+                path.toUtf8().data());
+        return false;
+    }
+
+    if (width <= 0 || height <= 0 || tile <= 0 || tile % 16) {
+        fprintf(stderr, "invalid poster size %dx%d, tile %d\n", width, height, tile);
+        return false;
+    }
+
+    w->width = width;
+    w->height = height;
+    w->tile = tile;
+    w->tiles_x = (width + tile - 1) / tile;
+    w->tiles_y = (height + tile - 1) / tile;
+
+    w->file.setFileName(path);
+    if (!w->file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        fprintf(stderr, "couldn't open %s: %s\n", path.toUtf8().data(),
+                w->file.errorString().toUtf8().data());
+        return false;
+    }
+
+    bool ok = w->format == POSTER_TIFF ? tiff_open(w) : png_open(w);
+    if (!ok)
+        w->file.close();
+
+    return ok;
+}
+
+bool poster_write_tile(PosterWriter *w, int tx, int ty, const QByteArray &rgba)
+{
+    if (tx < 0 || tx >= w->tiles_x || ty < 0 || ty >= w->tiles_y ||
+        rgba.size() < w->tile * w->tile * 4) {
+        fprintf(stderr, "invalid poster tile %d,%d\n", tx, ty);
+        return false;
+    }
+
+    if (w->format == POSTER_TIFF)
+        return tiff_write_tile(w, tx, ty, rgba);
+
+    return png_write_tile(w, tx, ty, rgba);
+}
+
+bool poster_close(PosterWriter *w)
+{
+    bool ok = w->format == POSTER_TIFF ? tiff_close(w) : png_close(w);
+
+    w->file.close();
+    w->band = QByteArray();
+    w->tile_offsets.clear();
+    w->tile_bytes.clear();
+
+    return ok;
+}
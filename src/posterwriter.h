@@ -0,0 +1,71 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#ifndef POSTER_WRITER_H
+#define POSTER_WRITER_H
+
+#include <QFile>
+#include <QString>
+#include <QVector>
+#include <QByteArray>
+
+typedef enum _PosterFormat {
+    POSTER_TIFF,
+    POSTER_PNG
+} PosterFormat;
+
+/* Streams an image bigger than we'd ever want in memory to disk, a
+   tile at a time. TIFF goes out as deflated tiles in whatever order
+   they come, PNG is written by rows so it buffers a row of tiles and
+   only takes them left to right, top to bottom. PNG rows are stored
+   uncompressed, there's no zlib here beyond qCompress() and that
+   can't stream, use TIFF for anything big.
+*/
+typedef struct _PosterWriter
+{
+    PosterFormat format;
+    QFile file;
+    int width;
+    int height;
+    int tile;           /* side, a multiple of 16 for TIFF */
+    int tiles_x;
+    int tiles_y;
+
+    /* tiff: where each tile ended up */
+    QVector<quint32> tile_offsets;
+    QVector<quint32> tile_bytes;
+
+    /* png: the tile we want next, the current row of tiles as
+     * filtered scanlines and the running checksum of the zlib stream */
+    int next_tile;
+    QByteArray band;
+    quint32 adler;
+} PosterWriter;
+
+/* format from the suffix, .tif, .tiff or .png */
+bool poster_open(PosterWriter *w, const QString &path, int width, int height, int tile);
+/* @rgba: tile x tile, bottom row first as glReadPixels() leaves it,
+ * parts past the image edge are dropped */
+bool poster_write_tile(PosterWriter *w, int tx, int ty, const QByteArray &rgba);
+bool poster_close(PosterWriter *w);
+
+#endif /* POSTER_WRITER_H */
@@ -28,6 +28,7 @@
 #include <QDir>
 
 #include "presetmanager.h"
+#include "util.h"
 
 Preset::Preset()
 {
@@ -41,10 +42,13 @@ Preset::Preset()
     alpha_points << new TransFuncPoint(QPointF(0.4, 1.0));
     alpha_points << new TransFuncPoint(QPointF(0.401, 0.0));
     alpha_points << new TransFuncPoint(QPointF(1.0, 0.0));
+
+    tf_2d = false;
 }
 
 Preset::Preset(const QString &path)
 {
+    tf_2d = false;
     loadJson(path);
 }
 
@@ -84,6 +88,22 @@ void Preset::saveJson(const QString &path)
 
     preset.insert("lut_points", lut_array);
 
+    QJsonArray region_array;
+    for (int i=0; i<regions_2d.size(); i++) {
+        QRectF r = regions_2d[i]->r;
+        QColor c = regions_2d[i]->c;
+        QJsonObject o;
+        o = QJsonObject({
+                { "intensity", QJsonArray({ r.left(), r.right() }) },
+                { "gradient", QJsonArray({ r.top(), r.bottom() }) },
+                { "color", QJsonValue::fromVariant(QColor(c.red(), c.green(), c.blue())) },
+                { "opacity", c.alphaF() }});
+        region_array.push_back(o);
+    }
+
+    preset.insert("tf_2d", tf_2d);
+    preset.insert("regions_2d", region_array);
+
     preset.insert("name", QJsonValue::fromVariant(name));
 
     doc = QJsonDocument(preset);
@@ -144,6 +164,24 @@ void Preset::loadJson(const QString &path)
         // qInfo() << "alpha: " << alpha_points[i]->p;
     }
     qSort(alpha_points.begin(), alpha_points.end(), trans_func_point_compare_x);
+
+    /* optional, older presets are 1D only */
+    tf_2d = obj["tf_2d"].toBool(false);
+
+    QJsonArray region_array = obj["regions_2d"].toArray();
+    for(int i=0; i<region_array.size(); i++) {
+        QJsonObject region = region_array[i].toObject();
+        QJsonArray intensity = region["intensity"].toArray();
+        QJsonArray gradient = region["gradient"].toArray();
+        QColor color = region["color"].toVariant().value<QColor>();
+        color.setAlphaF(qBound(0.0, region["opacity"].toDouble(1.0), 1.0));
+
+        QRectF r;
+        r.setCoords(intensity[0].toDouble(), gradient[0].toDouble(),
+                    intensity[1].toDouble(), gradient[1].toDouble());
+
+        regions_2d << new TransFuncRegion(r.normalized(), color);
+    }
 }
 
 PresetManager::PresetManager(const QString &presets_dir)
@@ -195,3 +233,47 @@ void TransFuncPoint::set_point(QPointF point) {
 void TransFuncPoint::set_color(QColor color) {
     this->c = color;
 }
+
+TransFuncRegion::TransFuncRegion(QRectF r, QColor c) {
+    this->r = r;
+    this->c = c;
+    selected = false;
+}
+
+bool TransFuncRegion::is_selected() {
+    return selected;
+}
+
+void TransFuncRegion::set_selected(bool status) {
+    selected = status;
+}
+
+/* same piecewise linear interpolation the editor areas do */
+void preset_to_rgba(Preset *p, float *rgba, int len)
+{
+    for (int i=0; i<p->lut_points.size()-1; i++) {
+        int x1 = p->lut_points[i]->p.x() * (len-1);
+        int x2 = p->lut_points[i+1]->p.x() * (len-1);
+        QColor c1 = p->lut_points[i]->c;
+        QColor c2 = p->lut_points[i+1]->c;
+
+        for (int j=x1; j<=x2; j++) {
+            float x = x2 > x1 ? (float)(j - x1)/(float)(x2-x1) : 0.0;
+            rgba[4*j] = lerp(c1.redF(), c2.redF(), x);
+            rgba[4*j+1] = lerp(c1.greenF(), c2.greenF(), x);
+            rgba[4*j+2] = lerp(c1.blueF(), c2.blueF(), x);
+        }
+    }
+
+    for (int i=0; i<p->alpha_points.size()-1; i++) {
+        int x1 = p->alpha_points[i]->p.x() * (len-1);
+        int x2 = p->alpha_points[i+1]->p.x() * (len-1);
+        float y1 = 1.0 - p->alpha_points[i]->p.y();
+        float y2 = 1.0 - p->alpha_points[i+1]->p.y();
+
+        for (int j=x1; j<=x2; j++) {
+            float x = x2 > x1 ? (float)(j - x1)/(float)(x2-x1) : 0.0;
+            rgba[4*j+3] = lerp(y1, y2, x);
+        }
+    }
+}
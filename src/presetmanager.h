@@ -30,6 +30,7 @@
 #include <QJsonArray>
 #include <QVector>
 #include <QPointF>
+#include <QRectF>
 #include <QColor>
 
 class TransFuncPoint : public QObject
@@ -61,6 +62,24 @@ inline bool trans_func_point_compare_x(TransFuncPoint *p1, TransFuncPoint *p2)
     return p1->p.x() <= p2->p.x();
 }
 
+/* rectangle of a 2D transfer function, normalized intensity along
+ * x, normalized gradient magnitude along y, opacity peaks at the
+ * center intensity and fades out towards the sides */
+class TransFuncRegion
+{
+public:
+    TransFuncRegion(QRectF r, QColor c);
+
+    QRectF r;
+    QColor c;    /* alpha is the peak opacity */
+
+    bool is_selected();
+    void set_selected(bool status);
+
+private:
+    bool selected;
+};
+
 /* yeah i know it's nothing more than a struct */
 /* who cares */
 class Preset: public QObject
@@ -81,6 +100,9 @@ public:
     QVector<TransFuncPoint *> lut_points;
     QVector<TransFuncPoint *> alpha_points;
 
+    bool tf_2d;
+    QVector<TransFuncRegion *> regions_2d;
+
     void saveJson(const QString &path);
     void loadJson(const QString &path);
 
@@ -107,5 +129,8 @@ private:
     QDir dir;
 };
 
+/* 1D table of @len rgba entries from the preset points, what the
+ * editor would send */
+void preset_to_rgba(Preset *p, float *rgba, int len);
 
 #endif // PRESET_MANAGER_H
@@ -0,0 +1,3904 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#include "renderer.h"
+#include "gradient.h"
+#include "posterwriter.h"
+#include "framesequence.h"
+#include "camerapath.h"
+#include "shadercache.h"
+
+#include <QtConcurrent>
+#include <QFile>
+#include <QThreadPool>
+#include <QQueue>
+#include <QTimer>
+
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* samples per voxel crossed by the ray, for each quality level */
+static const float sampling_rates[] = {
+    0.5,   /* QUALITY_PREVIEW */
+    1.0,   /* QUALITY_INTERACTIVE */
+    4.0    /* QUALITY_FINAL */
+};
+
+/* poster tiles, a row of them is all a png export keeps in memory */
+#define POSTER_TILE 512
+/* frame sequence readbacks in flight, the gpu renders frame n+2
+ * while frame n is copied out */
+#define RECORD_RING 3
+
+
+/* what a fresh view looks like */
+void render_params_init(RenderParams *params, const InitOptions &opt)
+{
+    params->serial = 0;
+    params->width = 1;
+    params->height = 1;
+
+    params->fast_rendering = false;
+    params->quality = CLAMP(opt.quality, (int) QUALITY_PREVIEW, (int) QUALITY_FINAL);
+
+    /* default eye depth */
+    params->depth = 1.1f;
+    /* I should probably get initial rotation from DICOM orientation data */
+    params->rotation = QQuaternion::fromEulerAngles(0, 0, 0);
+
+    /* front to back dvr and blinn phong shading */
+    params->compositing_mode = 0;
+    params->shading_mode = 0;
+
+    /* black background */
+    params->background_color[0] = 0.0;
+    params->background_color[1] = 0.0;
+    params->background_color[2] = 0.0;
+    params->background_color[3] = 1.0;
+
+    /* white spotlight */
+    params->light_color[0] = 1.0;
+    params->light_color[1] = 1.0;
+    params->light_color[2] = 1.0;
+
+    /* material */
+    params->ambient_reflectance = 0.05;
+    params->diffuse_reflectance = 0.3;
+    params->specular_reflectance = 0.45;
+
+    params->fixed_step = opt.fixed_step;
+    params->lod = opt.lod;
+    params->ray_stats = false;
+    params->frame_timing = false;
+
+    window_default(opt, &params->window_level, &params->window_width);
+
+    params->tf_version = 0;
+    params->tf_dirty_first = -1;
+    params->tf_dirty_last = -1;
+    params->tf2d_width = 0;
+    params->tf2d_height = 0;
+    params->tf2d_version = 0;
+    params->tf_mode = 0;
+
+    params->dataset = 0;
+    params->series_frame = 0;
+    params->series_playing = false;
+}
+
+void render_params_copy(RenderParams *dst, const RenderParams &src, int first, int last)
+{
+    QVector<float> tf, tf2d;
+    quint64 tf2d_version = dst->tf2d_version;
+
+    /* the assignment would share src's tables, keep ours aside */
+    tf.swap(dst->tf);
+    tf2d.swap(dst->tf2d);
+    *dst = src;
+    dst->tf.swap(tf);
+    dst->tf2d.swap(tf2d);
+
+    int len = src.tf.size() / 4;
+    if (dst->tf.size() != src.tf.size()) {
+        dst->tf.resize(src.tf.size());
+        first = 0;
+        last = len - 1;
+    }
+    first = MAX(first, 0);
+    last = MIN(last, len - 1);
+    if (first <= last)
+        memcpy(dst->tf.data() + 4*first, src.tf.constData() + 4*first,
+               4 * (last - first + 1) * sizeof(float));
+
+    if (tf2d_version != src.tf2d_version || dst->tf2d.size() != src.tf2d.size()) {
+        dst->tf2d.resize(src.tf2d.size());
+        memcpy(dst->tf2d.data(), src.tf2d.constData(), src.tf2d.size() * sizeof(float));
+    }
+}
+
+/* same matrices render_frame() and render_first_pass() build */
+QMatrix4x4 render_params_mvp(const RenderParams &params, const InitOptions &opt)
+{
+    QMatrix4x4 proj, view, model;
+
+    proj.perspective(67.0f, GLfloat(MAX(params.width, 1)) / MAX(params.height, 1),
+                     0.001f, 5.0f);
+    view.lookAt({0,0,params.depth},{0,0,0},{0,1,0});
+    model.rotate(params.rotation);
+    model.scale(opt.xscale, opt.yscale, opt.zscale);
+    model.translate(-0.5, -0.5, -0.5);
+
+    return proj * view * model;
+}
+
+/* no GL here, init() runs on the render thread once there's a
+ * context for it */
+Renderer::Renderer(const InitOptions &opt)
+{
+    this->opt = opt;
+
+    context = NULL;
+    surface = NULL;
+    gl_ready = false;
+    have_params = false;
+    posted_serial = 0;
+    spare = NULL;
+    inflight_first = -1;
+    inflight_last = -1;
+
+    front = -1;
+    for (int i=0; i<2; i++) {
+        result_texture[i] = 0;
+        result_fbo[i] = 0;
+        result_db[i] = 0;
+        result_width[i] = 0;
+        result_height[i] = 0;
+        result_serial[i] = 0;
+        result_complete[i] = false;
+        result_ready[i] = 0;
+        result_released[i] = 0;
+    }
+
+    distance_shader = NULL;
+    raycast_shader = NULL;
+    vao = 0;
+    db = 0;
+    fbo = 0;
+    target_texture = 0;
+    cur_width = 0;
+    cur_height = 0;
+
+    tile_next = 0;
+    tile_serial = 0;
+    tile_cpu_time = 0.0;
+    tile_fence = 0;
+    export_fast_rendering = false;
+
+    slab_mode = opt.workers > 1;
+    sort_last.shm = NULL;
+    slab_first = 0;
+    slab_end = opt.depth;
+    slab_tex_first = 0;
+    slab_tex_end = opt.depth;
+    slab_warned = false;
+    if (slab_mode) {
+        /* trilinear filtering plus the central differences */
+        int ghost = 2 + (int) ceil(0.005 * opt.zscale * opt.depth);
+        sort_last_slab(opt.worker_rank, opt.workers, opt.depth, &slab_first, &slab_end);
+        slab_tex_first = MAX(slab_first - ghost, 0);
+        slab_tex_end = MIN(slab_end + ghost, (int) opt.depth);
+    }
+
+    qRegisterMetaType<Histogram>();
+    qRegisterMetaType<FrameStats>();
+
+    profiler = new FrameProfiler(this);
+    connect(profiler, &FrameProfiler::stats_ready,
+            this, &Renderer::stats_ready);
+
+    stats_width = 0;
+    stats_height = 0;
+    stats_fbo = 0;
+    stats_read_fbo = 0;
+    stats_color = 0;
+    stats_tex[0] = stats_tex[1] = 0;
+    stats_db = 0;
+    stats_pbo[0] = stats_pbo[1] = 0;
+    stats_fence[0] = stats_fence[1] = 0;
+    stats_slot = 0;
+    memset(&last_ray_stats, 0, sizeof(FrameStats));
+
+    transfer_function = 0;
+    tf_texture_len = 0;
+    tf_dirty_first = -1;
+    tf_dirty_last = -1;
+
+    transfer_function_2d = 0;
+    tf2d_dirty = false;
+
+    tf_cache_clock = 0;
+    for (int i=0; i<TF_CACHE_SIZE; i++) {
+        tf_cache[i].tex = 0;
+        tf_cache[i].table = -1;
+        tf_cache[i].dirty_first = -1;
+        tf_cache[i].dirty_last = -1;
+    }
+    tf_corrected = NULL;
+    tf_corrected_len = 0;
+
+    volume_texture = 0;
+    storage = STORAGE_NATIVE;
+    volume_format = VOLUME_FORMAT_NORMALIZED;
+    volume_bytes = 0;
+    dequant_texture = 0;
+    volume_data = NULL;
+    requantizer = NULL;
+    quant_mode = -1;
+    quant_version = 0;
+    quant_scale = 0.0;
+    quant_offset = 0.0;
+    reference_texture = 0;
+
+    volume_wide = false;
+    volume_shift = 0;
+    mip_filter = PYRAMID_BOX;
+    mip_bytes = 0;
+    lod = opt.lod;
+
+    volume_loader = NULL;
+    loader_wide = false;
+
+    dataset = 0;
+    view_clock = 0;
+    dataset_unreadable.fill(false, opt.datasets.size());
+    preloader = NULL;
+    preload_dataset = -1;
+
+    series = NULL;
+    series_texture[0] = series_texture[1] = 0;
+    series_front = 0;
+    series_shown[0] = series_shown[1] = -1;
+    series_pbo = 0;
+    series_late = 0;
+    series_late_frame = -1;
+    series_histogram_frame = -1;
+    series_poll_pending = false;
+
+    classify_shader = NULL;
+    volume_version = 0;
+    preclassified = false;
+    classified_texture = 0;
+    classified_bytes = 0;
+    for (int i=0; i<3; i++)
+        classified_size[i] = 0;
+    memset(&classified_key, 0, sizeof(ClassifyKey));
+    memset(&classify_pending_key, 0, sizeof(ClassifyKey));
+    classify_fbo = 0;
+    classify_poll_pending = false;
+    classify_warned = false;
+
+    mask = NULL;
+    mask_texture = 0;
+    mask_version = 0;
+
+    probe = NULL;
+    if (opt.probe) {
+        probe = new VolumeProbe;
+        volume_probe_init(probe);
+    }
+}
+
+/* GL resources are gone already, see shutdown() */
+Renderer::~Renderer()
+{
+    delete mailbox.fetchAndStoreOrdered(NULL);
+    delete recycled.fetchAndStoreOrdered(NULL);
+    delete spare;
+
+    free(tf_corrected);
+    free(volume_data);
+    pyramid_free(&mips[0]);
+    pyramid_free(&mips[1]);
+
+    if (mask) {
+        volume_mask_free(mask);
+        delete mask;
+    }
+    if (probe) {
+        volume_probe_free(probe);
+        delete probe;
+    }
+}
+
+void Renderer::set_surface(QOpenGLContext *context, QOffscreenSurface *surface)
+{
+    this->context = context;
+    this->surface = surface;
+}
+
+/* A message the render thread didn't take yet is stale, the new one
+   replaces it. The transfer function range it marked dirty carries
+   over, the renderer never saw it.
+
+   Single producer: the render thread only ever swaps NULL in, so
+   nothing can sneak in between taking the stale message and storing
+   the new one.
+*/
+quint64 Renderer::post(RenderParams &params)
+{
+    RenderParams *msg = spare;
+    spare = NULL;
+    if (!msg)
+        msg = recycled.fetchAndStoreOrdered(NULL);
+    if (!msg)
+        msg = new RenderParams();
+
+    /* what the renderer hasn't seen yet: the edits since the last
+     * post and, unless we know it was taken, the previous message's */
+    int own_first = params.tf_dirty_first, own_last = params.tf_dirty_last;
+    if (posted_serial == 0) {
+        own_first = 0;
+        own_last = params.tf.size() / 4 - 1;
+    }
+    int first = own_first, last = own_last;
+    if (inflight_first >= 0) {
+        first = first < 0 ? inflight_first : MIN(first, inflight_first);
+        last = MAX(last, inflight_last);
+    }
+
+    render_params_copy(msg, params, first, last);
+    msg->tf_dirty_first = first;
+    msg->tf_dirty_last = last;
+    msg->serial = ++posted_serial;
+
+    RenderParams *stale = mailbox.fetchAndStoreOrdered(msg);
+    if (stale) {
+        spare = stale;
+        inflight_first = first;
+        inflight_last = last;
+    } else {
+        inflight_first = own_first;
+        inflight_last = own_last;
+    }
+
+    params.tf_dirty_first = -1;
+    params.tf_dirty_last = -1;
+
+    /* one wake up in the queue is enough, it takes whatever is
+     * newest when it runs */
+    if (wake_pending.testAndSetOrdered(0, 1))
+        QMetaObject::invokeMethod(this, "render_pending", Qt::QueuedConnection);
+
+    return posted_serial;
+}
+
+bool Renderer::acquire_frame(RenderedFrame *frame)
+{
+    exchange_lock.lock();
+
+    if (front < 0) {
+        exchange_lock.unlock();
+        return false;
+    }
+
+    frame->texture = result_texture[front];
+    frame->width = result_width[front];
+    frame->height = result_height[front];
+    frame->serial = result_serial[front];
+    frame->complete = result_complete[front];
+    frame->ready = result_ready[front];
+    result_ready[front] = 0;
+
+    return true;
+}
+
+/* @released: signaled once the gpu is done reading the frame, the
+ * render thread waits on it before drawing over it */
+void Renderer::release_frame(GLsync released)
+{
+    if (result_released[front])
+        glDeleteSync(result_released[front]);
+    result_released[front] = released;
+
+    exchange_lock.unlock();
+}
+
+/* result target @i, color only is what the widget sees, depth for
+ * the passes */
+void Renderer::init_result_target(int i, int w, int h)
+{
+    if (!result_fbo[i]) {
+        glGenTextures(1, &result_texture[i]);
+        glGenRenderbuffers(1, &result_db[i]);
+        glGenFramebuffers(1, &result_fbo[i]);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, result_texture[i]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    glBindRenderbuffer(GL_RENDERBUFFER, result_db[i]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, w, h);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, result_fbo[i]);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, result_texture[i], 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, result_db[i]);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Something wrong with the result framebuffer... \n");
+        exit(1);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    result_width[i] = w;
+    result_height[i] = h;
+}
+
+/* flush so the widget context can wait on the fence, then swap,
+ * @complete is false for a still frame with tiles to go */
+void Renderer::publish_frame(int i, bool complete)
+{
+    GLsync ready = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+
+    exchange_lock.lock();
+    if (result_ready[i])
+        glDeleteSync(result_ready[i]);
+    result_ready[i] = ready;
+    result_serial[i] = p.serial;
+    result_complete[i] = complete;
+    front = i;
+    exchange_lock.unlock();
+
+    emit frame_ready(p.serial);
+}
+
+float render_sampling_rate(int quality)
+{
+    return sampling_rates[CLAMP(quality, (int) QUALITY_PREVIEW, (int) QUALITY_FINAL)];
+}
+
+/* samples per voxel crossed by the ray, interaction always drops to
+ * preview */
+float Renderer::get_sampling_rate()
+{
+    return render_sampling_rate(p.fast_rendering ? QUALITY_PREVIEW : p.quality);
+}
+
+/* world space step for fixed step rendering, the smallest voxel side
+ * divided by the sampling rate */
+float Renderer::get_world_step()
+{
+    float voxel = MIN(MIN(opt.xscale / opt.width, opt.yscale / opt.height),
+                      opt.zscale / opt.depth);
+
+    return voxel / get_sampling_rate();
+}
+
+/* stream a record per frame, csv or json lines */
+bool Renderer::open_stats_log(const QString &path)
+{
+    return profiler->open_log(path);
+}
+
+/* Take the newest parameters and whatever changed with them. Dirty
+ * ranges accumulate until the upload, a frame might be skipped
+ * before that (no volume yet) */
+void Renderer::apply_params(RenderParams *params)
+{
+    if (params->tf_dirty_first >= 0) {
+        if (tf_dirty_first < 0) {
+            tf_dirty_first = params->tf_dirty_first;
+            tf_dirty_last = params->tf_dirty_last;
+        } else {
+            tf_dirty_first = MIN(tf_dirty_first, params->tf_dirty_first);
+            tf_dirty_last = MAX(tf_dirty_last, params->tf_dirty_last);
+        }
+
+        /* and for every corrected 1D table, each catches up the next
+         * time its step is used. One already behind by an unknown range
+         * stays that way and gets redone whole */
+        for (int i=0; i<TF_CACHE_SIZE; i++) {
+            TFCacheEntry &e = tf_cache[i];
+            if (e.table != 0)
+                continue;
+            if (e.dirty_first >= 0) {
+                e.dirty_first = MIN(e.dirty_first, params->tf_dirty_first);
+                e.dirty_last = MAX(e.dirty_last, params->tf_dirty_last);
+            } else if (have_params && e.version == p.tf_version) {
+                e.dirty_first = params->tf_dirty_first;
+                e.dirty_last = params->tf_dirty_last;
+            }
+        }
+    }
+
+    if (!have_params || params->tf2d_version != p.tf2d_version)
+        tf2d_dirty = !params->tf2d.isEmpty();
+
+    /* counters from the other mode are meaningless */
+    if (have_params && params->ray_stats != p.ray_stats)
+        last_ray_stats.rays_valid = false;
+
+    /* our own tables, never shared with the message */
+    render_params_copy(&p, *params, params->tf_dirty_first, params->tf_dirty_last);
+    p.tf_dirty_first = -1;
+    p.tf_dirty_last = -1;
+    have_params = true;
+
+    /* coarse levels of a slab don't line up with the neighbours */
+    lod = p.lod && !slab_mode;
+    profiler->set_blocking(p.frame_timing);
+}
+
+/* back to post(), one is enough, it doesn't wait for more */
+void Renderer::recycle_params(RenderParams *params)
+{
+    delete recycled.fetchAndStoreOrdered(params);
+}
+
+/* queued by post(), frames only ever render from the newest params */
+void Renderer::render_pending()
+{
+    /* clear first, a post() after the take below wakes us again */
+    wake_pending.storeRelease(0);
+
+    /* init() picks it up */
+    if (!gl_ready)
+        return;
+
+    RenderParams *params = mailbox.fetchAndStoreOrdered(NULL);
+    if (!params)
+        return;
+
+    apply_params(params);
+    recycle_params(params);
+
+    render_frame();
+}
+
+/* Transfer function with the opacity correction for @step already
+   applied, computed once per table version and step size. Interactive
+   and still frames have their own entry, so switching between them
+   is just a texture swap. An entry for the same step only redoes the
+   range edited since, a new step or size redoes the whole table.
+
+   @table: 0 for the 1D table, 1 for the 2D one
+*/
+GLuint Renderer::corrected_transfer_function(int table, float step)
+{
+    const float *src = table == 1 ? p.tf2d.constData() : p.tf.constData();
+    quint64 version = table == 1 ? p.tf2d_version : p.tf_version;
+    int w = table == 1 ? p.tf2d_width : p.tf.size() / 4;
+    int h = table == 1 ? p.tf2d_height : 1;
+
+    /* hit, stale entry for the same step or least recently used */
+    TFCacheEntry *e = NULL;
+    for (int i=0; i<TF_CACHE_SIZE; i++) {
+        if (tf_cache[i].table == table && tf_cache[i].step == step) {
+            e = &tf_cache[i];
+            break;
+        }
+        if (!e || tf_cache[i].table < 0 ||
+            (e->table >= 0 && tf_cache[i].last_used < e->last_used))
+            e = &tf_cache[i];
+    }
+
+    e->last_used = tf_cache_clock++;
+    if (e->table == table && e->step == step && e->version == version)
+        return e->tex;
+
+    int n = w * h;
+    if (n > tf_corrected_len) {
+        tf_corrected = (float *) realloc(tf_corrected, 4 * n * sizeof(float));
+        tf_corrected_len = n;
+    }
+
+    GLenum target = table == 1 ? GL_TEXTURE_2D : GL_TEXTURE_1D;
+    bool realloc_tex = e->tex == 0 || e->table != table || e->width != w || e->height != h;
+    bool partial = !realloc_tex && table == 0 && e->step == step && e->dirty_first >= 0;
+    int first = partial ? CLAMP(e->dirty_first, 0, n - 1) : 0;
+    int last = partial ? CLAMP(e->dirty_last, first, n - 1) : n - 1;
+
+    /* same correction the shader does per sample, reference step is
+     * 1/200 */
+    float exponent = step * 200.0;
+    for (int i=first; i<=last; i++) {
+        tf_corrected[4*i] = src[4*i];
+        tf_corrected[4*i+1] = src[4*i+1];
+        tf_corrected[4*i+2] = src[4*i+2];
+        tf_corrected[4*i+3] = 1.0 - pow(1.0 - CLAMP(src[4*i+3], 0.0f, 1.0f), exponent);
+    }
+
+    if (e->tex == 0)
+        glGenTextures(1, &e->tex);
+
+    profiler->begin_upload();
+    glBindTexture(target, e->tex);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (realloc_tex) {
+        glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        if (table == 1)
+            glTexImage2D(target, 0, GL_RGBA16F, w, h, 0, GL_RGBA, GL_FLOAT, tf_corrected);
+        else
+            glTexImage1D(target, 0, GL_RGBA16F, w, 0, GL_RGBA, GL_FLOAT, tf_corrected);
+    } else {
+        if (table == 1)
+            glTexSubImage2D(target, 0, 0, 0, w, h, GL_RGBA, GL_FLOAT, tf_corrected);
+        else
+            glTexSubImage1D(target, 0, first, last - first + 1, GL_RGBA, GL_FLOAT,
+                            tf_corrected + 4*first);
+    }
+    profiler->end_upload();
+
+    e->table = table;
+    e->step = step;
+    e->version = version;
+    e->width = w;
+    e->height = h;
+    e->dirty_first = -1;
+    e->dirty_last = -1;
+
+    return e->tex;
+}
+
+/* in place, only the dirty range unless the size changed, the 2D
+ * table is small enough to always go whole */
+void Renderer::upload_transfer_function()
+{
+    if (tf_dirty_first < 0 && !tf2d_dirty)
+        return;
+
+    profiler->begin_upload();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    if (tf2d_dirty) {
+        glBindTexture(GL_TEXTURE_2D, transfer_function_2d);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, p.tf2d_width, p.tf2d_height, 0,
+                     GL_RGBA, GL_FLOAT, p.tf2d.constData());
+        tf2d_dirty = false;
+    }
+
+    if (tf_dirty_first >= 0) {
+        glBindTexture(GL_TEXTURE_1D, transfer_function);
+        int tf_len = p.tf.size() / 4;
+        if (tf_len != tf_texture_len) {
+            glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA16F, tf_len, 0, GL_RGBA, GL_FLOAT,
+                         p.tf.constData());
+            tf_texture_len = tf_len;
+        } else {
+            glTexSubImage1D(GL_TEXTURE_1D, 0, tf_dirty_first, tf_dirty_last - tf_dirty_first + 1,
+                            GL_RGBA, GL_FLOAT, p.tf.constData() + 4*tf_dirty_first);
+        }
+
+        tf_dirty_first = -1;
+        tf_dirty_last = -1;
+    }
+
+    profiler->end_upload();
+}
+// -----------------------------------------------------------------------
+//    TEXTURE LOADERS
+// -----------------------------------------------------------------------
+
+/* Read the box of a raw volume, every stride-th voxel of it, see
+   session_select(). The file is mapped, only the pages holding rows we
+   need are ever touched, where it can't be (no address space for it)
+   the rows are read one by one.
+
+   @voxel: bytes per voxel
+   Returns NULL if the file can't be read, it might be a dataset of
+   the session read ahead on a pool thread, the caller decides.
+*/
+static void *read_raw_box(const InitOptions &o, size_t voxel)
+{
+    QFile f(o.filename);
+    if (!f.open(QIODevice::ReadOnly)) {
+        fprintf(stderr, "couldn't open: %s\n", o.filename.toUtf8().data());
+        return NULL;
+    }
+
+    size_t fw = o.file_width, fh = o.file_height;
+    qint64 file_size = (qint64) (fw * fh * o.file_depth * voxel);
+    if (f.size() < o.file_offset + file_size) {
+        fprintf(stderr, "premature eof or reading error: %s\n", o.filename.toUtf8().data());
+        return NULL;
+    }
+
+    size_t w = o.width, h = o.height, d = o.depth;
+    size_t stride = o.stride;
+    size_t span = ((w - 1) * stride + 1) * voxel;
+    uint8_t *out = (uint8_t *) malloc(w * h * d * voxel);
+
+    uchar *map = f.map(o.file_offset, file_size);
+    QByteArray row;
+    if (!map)
+        row.resize(span);
+
+    for (size_t z=0; z<d; z++) {
+        size_t fz = o.box[2] + z * stride;
+        for (size_t y=0; y<h; y++) {
+            size_t fy = o.box[1] + y * stride;
+            qint64 offset = (qint64) (((fz * fh + fy) * fw + o.box[0]) * voxel);
+            const uint8_t *src;
+
+            if (map) {
+                src = map + offset;
+            } else {
+                if (!f.seek(o.file_offset + offset) ||
+                    f.read(row.data(), span) != (qint64) span) {
+                    fprintf(stderr, "premature eof or reading error: %s\n",
+                            o.filename.toUtf8().data());
+                    free(out);
+                    return NULL;
+                }
+                src = (const uint8_t *) row.constData();
+            }
+
+            uint8_t *dst = out + (z * h + y) * w * voxel;
+            if (stride == 1) {
+                memcpy(dst, src, w * voxel);
+            } else {
+                for (size_t x=0; x<w; x++)
+                    memcpy(dst + x * voxel, src + x * stride * voxel, voxel);
+            }
+        }
+    }
+
+    if (map)
+        f.unmap(map);
+
+    /* not for every frame of a series */
+    if ((o.roi_set || stride > 1) && o.series_frames == 0)
+        printf("Read %.1f MB of %.1f MB: box %u,%u,%u-%u,%u,%u, stride %u\n",
+               w * h * d * voxel / 1048576.0, file_size / 1048576.0,
+               o.box[0], o.box[1], o.box[2], o.box[3], o.box[4], o.box[5], o.stride);
+
+    return out;
+}
+
+/* Read 8bit raw luminance data, returns (intensity, gradient) pairs */
+uint8_t *read_volume_8bit(const InitOptions &o, Histogram *hist)
+{
+    size_t len = (size_t) o.width * o.height * o.depth;
+    uint8_t *volume_data = (uint8_t *) read_raw_box(o, sizeof(uint8_t));
+    if (!volume_data)
+        return NULL;
+
+    histogram_compute_8bit(volume_data, len, hist);
+
+    /* red holds the intensity, green the gradient magnitude for 2D
+     * transfer functions */
+    uint8_t *packed = (uint8_t *) malloc(2 * len);
+    gradient_pack_8bit(volume_data, o.width, o.height, o.depth, packed, hist);
+
+    free(volume_data);
+
+    return packed;
+}
+
+/* Read 16bit raw luminance data, returns (intensity, gradient) pairs
+
+   Most medical data comes in 16bit textures but only the first 10 or
+   12 bit (o.bit_depth) actually contain any data. Values stay as
+   stored, the shader normalizes them, see intensity_map()
+*/
+uint16_t *read_volume_16bit(const InitOptions &o, Histogram *hist)
+{
+    size_t len = (size_t) o.width * o.height * o.depth;
+    uint16_t *volume_data = (uint16_t *) read_raw_box(o, sizeof(uint16_t));
+    if (!volume_data)
+        return NULL;
+
+    /* values past bit_depth are clamped */
+    histogram_compute_16bit(volume_data, len, o.bit_depth, hist);
+
+    /* gradient magnitude in green */
+    uint16_t *packed = (uint16_t *) malloc(2 * len * sizeof(uint16_t));
+    gradient_pack_16bit(volume_data, o.width, o.height, o.depth, o.bit_depth, packed, hist);
+
+    free(volume_data);
+
+    return packed;
+}
+
+/* standard 3D texture init, nothing fancy, integer textures only
+ * work with nearest filtering */
+GLuint Renderer::new_volume_texture(GLint filter)
+{
+    GLuint tex;
+
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_3D, tex);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAG_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, filter);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+    /* align to single byte */
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    return tex;
+}
+
+/* Encode @pv->rg for @pv->storage and build both pyramids from it,
+   all on the cpu, safe on a pool thread. Again with a fallback storage
+   if the driver turns down the first one, see upload_prepared().
+*/
+static void encode_volume(PreparedVolume *pv)
+{
+    VolumeStorage s = pv->storage;
+    int w = pv->w, h = pv->h, d = pv->d;
+    size_t n = (size_t) w * h * d;
+    const void *rg = pv->rg;
+    bool wide = pv->wide;
+    uint8_t *linear = NULL;
+
+    /* uncompressed version of what ends up on the gpu, the mip
+     * levels are built from it */
+    const void *level0 = rg;
+    bool level0_wide = wide;
+
+    pv->stored = NULL;
+    pv->stored_size = volume_storage_size(s, wide, w, h, d);
+
+    switch (s) {
+    case STORAGE_NATIVE:
+        break;
+    case STORAGE_LINEAR8:
+        pv->stored = malloc(2 * n);
+        storage_encode_linear8((const uint16_t *) rg, n, (uint8_t *) pv->stored);
+        level0 = pv->stored;
+        level0_wide = false;
+        break;
+    case STORAGE_EQUALIZED8:
+    case STORAGE_TF8: {
+        /* tf8 starts equalized, the transfer function isn't there yet */
+        uint8_t lut[STORAGE_FINE_BINS];
+        pv->stored = malloc(2 * n);
+        storage_build_codebook((const uint16_t *) rg, n, NULL, lut, pv->dequant);
+        storage_encode_codes((const uint16_t *) rg, n, lut, (uint8_t *) pv->stored);
+        /* codes are monotonic in the intensity, filtering them is
+         * close enough */
+        level0 = pv->stored;
+        level0_wide = false;
+        break;
+    }
+    case STORAGE_PACKED12:
+        pv->stored = malloc(2 * n);
+        storage_encode_packed12((const uint16_t *) rg, n, (uint16_t *) pv->stored);
+        break;
+    case STORAGE_RGTC: {
+        const uint8_t *rg8 = (const uint8_t *) rg;
+        if (wide) {
+            linear = (uint8_t *) malloc(2 * n);
+            storage_encode_linear8((const uint16_t *) rg, n, linear);
+            rg8 = linear;
+        }
+        pv->stored = malloc(pv->stored_size);
+        storage_encode_rgtc(rg8, w, h, d, (uint8_t *) pv->stored);
+        level0 = rg8;
+        level0_wide = false;
+        break;
+    }
+    }
+
+    /* both filters in the storage format, switching with the
+     * compositing mode is just an upload */
+    for (int f=0; f<2; f++) {
+        pyramid_free(&pv->mips[f]);
+        pyramid_build(level0, level0_wide, w, h, d, (PyramidFilter) f, &pv->mips[f]);
+
+        for (int i=0; i<pv->mips[f].size(); i++) {
+            PyramidLevel &l = pv->mips[f][i];
+            size_t ln = (size_t) l.w * l.h * l.d;
+            void *encoded = NULL;
+
+            if (s == STORAGE_RGTC) {
+                l.size = volume_storage_size(STORAGE_RGTC, false, l.w, l.h, l.d);
+                encoded = malloc(l.size);
+                storage_encode_rgtc((const uint8_t *) l.data, l.w, l.h, l.d,
+                                    (uint8_t *) encoded);
+            } else if (s == STORAGE_PACKED12) {
+                l.size = 2 * ln;
+                encoded = malloc(l.size);
+                storage_encode_packed12((const uint16_t *) l.data, ln, (uint16_t *) encoded);
+            }
+
+            if (encoded) {
+                free(l.data);
+                l.data = encoded;
+            }
+        }
+    }
+    free(linear);
+
+    pv->have_error = s != STORAGE_NATIVE;
+    if (pv->have_error)
+        storage_error(rg, wide, w, h, d, s, pv->stored, pv->dequant, &pv->error);
+}
+
+/* Everything upload_volume() does before it touches gl: the storage
+   asked for on the command line, or something the data can do, and
+   the encoded volume with its pyramids.
+
+   @rg: takes ownership, passed on to @pv
+   @wide: @rg holds uint16_t pairs, uint8_t otherwise
+*/
+static void prepare_volume(const InitOptions &o, void *rg, bool wide, int w, int h, int d,
+                           PreparedVolume *pv)
+{
+    VolumeStorage s = (VolumeStorage) o.storage;
+    size_t n = (size_t) w * h * d;
+
+    /* nothing to quantize in 8 bit data */
+    if (!wide && s != STORAGE_NATIVE && s != STORAGE_RGTC) {
+        fprintf(stderr, "%s storage needs more than 8 bit, keeping the volume native\n",
+                volume_storage_to_string(s).toUtf8().data());
+        s = STORAGE_NATIVE;
+    }
+
+    /* native textures take the values as stored, the shader scales
+     * them. The encoders spend their bits on the top of the 16, so
+     * everything else still gets shifted up */
+    pv->shift = 0;
+    if (wide && s != STORAGE_NATIVE && o.bit_depth < 16) {
+        uint16_t *v = (uint16_t *) rg;
+        uint16_t top = (1 << o.bit_depth) - 1;
+        pv->shift = 16 - o.bit_depth;
+        for (size_t i=0; i<n; i++)
+            v[2*i] = MIN(v[2*i], top) << pv->shift;
+    }
+
+    pv->rg = rg;
+    pv->wide = wide;
+    pv->w = w;
+    pv->h = h;
+    pv->d = d;
+    pv->storage = s;
+    encode_volume(pv);
+}
+
+/* level 0 of @pv to a new texture, in a fallback storage if the
+ * driver says no. The encoders ran already, only the transfer is
+ * timed */
+GLuint Renderer::upload_prepared(PreparedVolume *pv)
+{
+    for (;;) {
+        VolumeStorage s = pv->storage;
+        const void *data = pv->stored ? pv->stored : pv->rg;
+        GLuint tex = new_volume_texture(s == STORAGE_PACKED12 ? GL_NEAREST : GL_LINEAR);
+
+        profiler->begin_upload();
+        switch (s) {
+        case STORAGE_NATIVE:
+            /* uint8_t -> GL_RG8, uint16_t -> GL_RG16 */
+            glTexImage3D(GL_TEXTURE_3D, 0, pv->wide ? GL_RG16 : GL_RG8, pv->w, pv->h, pv->d, 0,
+                         GL_RG, pv->wide ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE, data);
+            break;
+        case STORAGE_LINEAR8:
+        case STORAGE_EQUALIZED8:
+        case STORAGE_TF8:
+            glTexImage3D(GL_TEXTURE_3D, 0, GL_RG8, pv->w, pv->h, pv->d, 0,
+                         GL_RG, GL_UNSIGNED_BYTE, data);
+            break;
+        case STORAGE_PACKED12:
+            glTexImage3D(GL_TEXTURE_3D, 0, GL_R16UI, pv->w, pv->h, pv->d, 0,
+                         GL_RED_INTEGER, GL_UNSIGNED_SHORT, data);
+            break;
+        case STORAGE_RGTC:
+            /* the spec only allows RGTC in 2D arrays, most drivers
+             * take 3D textures anyway */
+            while (glGetError() != GL_NO_ERROR)
+                ;
+            glCompressedTexImage3D(GL_TEXTURE_3D, 0, GL_COMPRESSED_RG_RGTC2,
+                                   pv->w, pv->h, pv->d, 0, pv->stored_size, data);
+            break;
+        }
+        profiler->end_upload();
+
+        if (s != STORAGE_RGTC || glGetError() == GL_NO_ERROR)
+            return tex;
+
+        /* encoded again on this thread, rare enough */
+        glDeleteTextures(1, &tex);
+        pv->storage = pv->wide ? STORAGE_LINEAR8 : STORAGE_NATIVE;
+        fprintf(stderr, "no RGTC 3D textures on this driver, falling back to %s\n",
+                volume_storage_to_string(pv->storage).toUtf8().data());
+        free(pv->stored);
+        encode_volume(pv);
+    }
+}
+
+/* Upload the (intensity, gradient) volume in the storage asked for on
+   the command line, falling back to something the driver or the data
+   can do. Prints how much we saved and what it cost.
+
+   @rg: takes ownership
+   @wide: @rg holds uint16_t pairs, uint8_t otherwise
+*/
+GLuint Renderer::upload_volume(void *rg, bool wide, GLuint w, GLuint h, GLuint d)
+{
+    PreparedVolume pv;
+    prepare_volume(opt, rg, wide, w, h, d, &pv);
+
+    return upload_volume(&pv);
+}
+
+/* the gl half, @pv is left empty */
+GLuint Renderer::upload_volume(PreparedVolume *pv)
+{
+    GLuint tex = upload_prepared(pv);
+    VolumeStorage s = pv->storage;
+    void *rg = pv->rg;
+    bool wide = pv->wide;
+    int w = pv->w, h = pv->h, d = pv->d;
+    size_t n = (size_t) w * h * d;
+
+    volume_texture = tex;
+    volume_wide = wide;
+    volume_shift = pv->shift;
+    storage = s;
+    volume_format = volume_storage_format(s);
+    volume_bytes = volume_storage_size(s, wide, w, h, d);
+
+    if (s == STORAGE_EQUALIZED8 || s == STORAGE_TF8) {
+        memcpy(dequant, pv->dequant, sizeof(dequant));
+        profiler->begin_upload();
+        upload_dequant_table(&dequant_texture, dequant);
+        profiler->end_upload();
+    }
+
+    mip_bytes = 0;
+    for (int f=0; f<2; f++) {
+        pyramid_free(&mips[f]);
+        mips[f] = pv->mips[f];
+        pv->mips[f].clear();
+    }
+    for (int i=0; i<mips[mip_filter].size(); i++)
+        mip_bytes += mips[mip_filter][i].size;
+    upload_mips();
+
+    size_t native_bytes = volume_storage_size(STORAGE_NATIVE, wide, w, h, d);
+    printf("Volume storage: %s, %.1f MB instead of %.1f MB (%.2fx), mipmaps %.1f MB\n",
+           volume_storage_to_string(s).toUtf8().data(),
+           volume_bytes / 1048576.0, native_bytes / 1048576.0,
+           (double) native_bytes / volume_bytes, mip_bytes / 1048576.0);
+
+    if (s != STORAGE_NATIVE) {
+        printf("Intensity error: rmse %.5f, max %.5f, psnr %.1f dB\n",
+               pv->error.rmse, pv->error.max_error, pv->error.psnr);
+
+        /* native copy to compare renderings against, dropped after
+         * the first frame, no mipmaps so compare with lod off */
+        if (opt.storage_report) {
+            reference_texture = new_volume_texture(GL_LINEAR);
+            glTexImage3D(GL_TEXTURE_3D, 0, wide ? GL_RG16 : GL_RG8, w, h, d, 0,
+                         GL_RG, wide ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE, rg);
+        }
+    }
+
+    free(pv->stored);
+    pv->stored = NULL;
+    pv->rg = NULL;
+
+    /* requantized on the cpu every time the transfer function
+     * changes */
+    if (s == STORAGE_TF8) {
+        finish_requantize(false);
+        free(volume_data);
+        volume_data = (uint16_t *) rg;
+        quant_mode = -1;
+    }
+
+    /* the values as stored, shift included, before any encoding. The
+     * probe takes rg unless tf8 kept it */
+    if (probe) {
+        void *copy = rg;
+        if (s == STORAGE_TF8) {
+            copy = malloc(n * 2 * sizeof(uint16_t));
+            memcpy(copy, rg, n * 2 * sizeof(uint16_t));
+        }
+        probe->mask = mask ? mask->data : NULL;
+        volume_probe_set_volume(probe, copy, wide, volume_shift, w, h, d);
+    } else if (s != STORAGE_TF8) {
+        free(rg);
+    }
+    volume_version++;
+
+    return tex;
+}
+
+/* levels past the first of @levels to the bound texture, same format
+ * as level 0 */
+void Renderer::upload_pyramid(VolumeStorage s, bool wide, const QVector<PyramidLevel> &levels)
+{
+    profiler->begin_upload();
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    for (int i=0; i<levels.size(); i++) {
+        const PyramidLevel &l = levels[i];
+
+        switch (s) {
+        case STORAGE_NATIVE:
+            glTexImage3D(GL_TEXTURE_3D, i+1, wide ? GL_RG16 : GL_RG8,
+                         l.w, l.h, l.d, 0,
+                         GL_RG, wide ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE, l.data);
+            break;
+        case STORAGE_LINEAR8:
+        case STORAGE_EQUALIZED8:
+        case STORAGE_TF8:
+            glTexImage3D(GL_TEXTURE_3D, i+1, GL_RG8, l.w, l.h, l.d, 0,
+                         GL_RG, GL_UNSIGNED_BYTE, l.data);
+            break;
+        case STORAGE_RGTC:
+            glCompressedTexImage3D(GL_TEXTURE_3D, i+1, GL_COMPRESSED_RG_RGTC2,
+                                   l.w, l.h, l.d, 0, l.size, l.data);
+            break;
+        case STORAGE_PACKED12:
+            glTexImage3D(GL_TEXTURE_3D, i+1, GL_R16UI, l.w, l.h, l.d, 0,
+                         GL_RED_INTEGER, GL_UNSIGNED_SHORT, l.data);
+            break;
+        }
+    }
+
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, levels.size());
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER,
+                    s == STORAGE_PACKED12 ? GL_NEAREST_MIPMAP_NEAREST
+                                          : GL_LINEAR_MIPMAP_LINEAR);
+    profiler->end_upload();
+}
+
+/* the current filter's levels to the volume texture */
+void Renderer::upload_mips()
+{
+    glBindTexture(GL_TEXTURE_3D, volume_texture);
+    upload_pyramid(storage, volume_wide, mips[mip_filter]);
+}
+
+/* maxima for mip and mida, averages for everything else */
+void Renderer::update_mip_filter()
+{
+    int filter = (p.compositing_mode == 1 || p.compositing_mode == 2) ? PYRAMID_MAX : PYRAMID_BOX;
+
+    if (filter != mip_filter) {
+        mip_filter = filter;
+        upload_mips();
+    }
+}
+
+/* raw file to (intensity, gradient) pairs, uint16_t ones if @wide,
+ * NULL if it can't be read */
+void *read_volume(const InitOptions &o, bool *wide, Histogram *hist)
+{
+    switch (o.bit_depth) {
+    case 8:
+        *wide = false;
+        return read_volume_8bit(o, hist);
+    case 10: /* not tested */
+    case 12:
+    case 16:
+        *wide = true;
+        return read_volume_16bit(o, hist);
+    default:
+        fprintf(stderr, "unsupported bit depth: %d\n", o.bit_depth);
+        return NULL;
+    }
+}
+
+/* 3D texture loader wrapper, shows the cached preview and loads the
+ * rest in the background if we've seen the dataset before. 0 if the
+ * file can't be read, nothing changed then */
+GLuint Renderer::load_volume_texture()
+{
+    GLuint w = opt.width, h = opt.height, d = opt.depth;
+
+    VolumeCache cache;
+    if (opt.cache && volume_cache_read(opt, &cache)) {
+        histogram = cache.histogram;
+        GLuint tex = upload_preview(cache);
+        printf("Preview %dx%dx%d from cache, intensity %.3f-%.3f, data range %.3f-%.3f\n",
+               cache.preview.w, cache.preview.h, cache.preview.d,
+               cache.min, cache.max, cache.range_lo, cache.range_hi);
+        volume_cache_free(&cache);
+
+        load_volume_async();
+        return tex;
+    }
+
+    bool wide;
+    Histogram hist;
+    void *rg = read_volume(opt, &wide, &hist);
+    if (!rg)
+        return 0;
+    histogram = hist;
+
+    /* cold open, next time will be faster. The preview comes from the
+     * values as read, before upload_volume() shifts and frees them,
+     * the writer only gets that */
+    VolumeCache cache_out;
+    if (opt.cache && volume_cache_build(opt, rg, wide, histogram, &cache_out)) {
+        InitOptions o = opt;
+        cache_writers.addFuture(QtConcurrent::run([=]() mutable {
+            volume_cache_write(o, cache_out);
+            volume_cache_free(&cache_out);
+        }));
+    }
+
+    /* gradients and histogram from the whole volume, only our slab
+     * goes to the gpu */
+    if (slab_mode) {
+        size_t slice = (size_t) w * h * 2 * (wide ? 2 : 1);
+        memmove(rg, (uint8_t *) rg + slice * slab_tex_first,
+                slice * (slab_tex_end - slab_tex_first));
+        d = slab_tex_end - slab_tex_first;
+    }
+
+    return upload_volume(rg, wide, w, h, d);
+}
+
+/* coarse level from the cache, plain native storage and no mipmaps
+ * until the real thing is in */
+GLuint Renderer::upload_preview(const VolumeCache &cache)
+{
+    const PyramidLevel &l = cache.preview;
+    GLuint tex = new_volume_texture(GL_LINEAR);
+
+    profiler->begin_upload();
+    glTexImage3D(GL_TEXTURE_3D, 0, cache.wide ? GL_RG16 : GL_RG8, l.w, l.h, l.d, 0,
+                 GL_RG, cache.wide ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE, l.data);
+    profiler->end_upload();
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
+
+    volume_texture = tex;
+    storage = STORAGE_NATIVE;
+    volume_format = VOLUME_FORMAT_NORMALIZED;
+    volume_wide = cache.wide;
+    volume_shift = 0;
+    volume_bytes = l.size;
+    volume_version++;
+
+    return tex;
+}
+
+/* full resolution volume off the render thread too, we keep drawing
+ * the preview until full_volume_ready() swaps it in */
+void Renderer::load_volume_async()
+{
+    InitOptions o = opt;
+    Histogram *hist = &loader_histogram;
+    bool *wide = &loader_wide;
+
+    loader_timer.start();
+    volume_loader = new QFutureWatcher<void *>(this);
+    connect(volume_loader, &QFutureWatcher<void *>::finished,
+            this, &Renderer::full_volume_ready);
+    volume_loader->setFuture(QtConcurrent::run([=]() {
+        return read_volume(o, wide, hist);
+    }));
+}
+
+void Renderer::full_volume_ready()
+{
+    if (!volume_loader)
+        return;
+
+    finish_volume_loading();
+
+    if (have_params)
+        render_frame();
+}
+
+/* swap the full resolution volume in for the preview, waits for it
+ * if it's not there yet */
+void Renderer::finish_volume_loading()
+{
+    if (!volume_loader)
+        return;
+
+    /* we might get here before the watcher had a chance to tell us */
+    volume_loader->disconnect(this);
+    volume_loader->waitForFinished();
+
+    void *rg = volume_loader->result();
+    GLuint preview = volume_texture;
+
+    /* the file went away since the cache saw it */
+    if (!rg) {
+        fprintf(stderr, "keeping the preview of %s\n", opt.filename.toUtf8().data());
+        volume_loader->deleteLater();
+        volume_loader = NULL;
+        return;
+    }
+
+    histogram = loader_histogram;
+    upload_volume(rg, loader_wide, opt.width, opt.height, opt.depth);
+    glDeleteTextures(1, &preview);
+    emit histogram_ready(histogram);
+    emit volume_ready(storage, volume_bytes);
+
+    printf("Full resolution volume in %.1f ms\n", loader_timer.nsecsElapsed() / 1e6);
+
+    volume_loader->deleteLater();
+    volume_loader = NULL;
+}
+
+/* Show dataset @i of the session. The one we're leaving stays on the
+   gpu as it is, coming back to it is just swapping the state in
+   again, until the budget says otherwise. Datasets that aren't
+   resident load like the first one did, through the preview cache.
+*/
+void Renderer::switch_dataset(int i)
+{
+    if (i == dataset || i < 0 || i >= opt.datasets.size() || dataset_unreadable[i])
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    /* read ahead already, or about to be */
+    if (preloader && preload_dataset == i) {
+        preloader->waitForFinished();
+        preload_ready();
+        if (dataset_unreadable[i]) {
+            emit dataset_failed(i, dataset);
+            return;
+        }
+    }
+
+    ResidentVolume r;
+    stash_volume(&r);
+    r.last_viewed = ++view_clock;
+    resident << r;
+
+    int previous = dataset;
+    dataset = i;
+    session_select(&opt, i);
+    slab_tex_first = 0;
+    slab_tex_end = opt.depth;
+
+    int k = find_resident(i);
+    if (k >= 0) {
+        restore_volume(&resident[k]);
+        resident.remove(k);
+    } else if (!load_volume_texture()) {
+        /* back to the one we were looking at, it's the last one we
+         * parked */
+        fprintf(stderr, "couldn't load dataset %d, staying on %d\n", i, previous);
+        dataset_unreadable[i] = true;
+        dataset = previous;
+        session_select(&opt, previous);
+        slab_tex_first = 0;
+        slab_tex_end = opt.depth;
+        restore_volume(&resident.last());
+        resident.removeLast();
+        emit dataset_failed(i, previous);
+        return;
+    }
+    evict_volumes();
+
+    double ms = timer.nsecsElapsed() / 1e6;
+    printf("Dataset %d (%s) %s in %.1f ms\n", i, opt.filename.toUtf8().data(),
+           k >= 0 ? "was resident" : "loaded", ms);
+
+    emit histogram_ready(histogram);
+    emit volume_ready(storage, volume_bytes);
+    emit dataset_ready(i, k >= 0, ms);
+
+    preload_next();
+}
+
+/* Move the current volume and everything derived from it to @r, the
+   renderer is left without one. The native reference copy is a one
+   off, it doesn't come along.
+*/
+void Renderer::stash_volume(ResidentVolume *r)
+{
+    finish_volume_loading();
+    /* made for this volume, the next time it's on screen will do */
+    finish_requantize(false);
+
+    r->dataset = dataset;
+    r->last_viewed = 0;
+    r->texture = volume_texture;
+    r->histogram = histogram;
+    r->storage = storage;
+    r->format = volume_format;
+    r->wide = volume_wide;
+    r->shift = volume_shift;
+    r->bytes = volume_bytes;
+    r->dequant_texture = dequant_texture;
+    memcpy(r->dequant, dequant, sizeof(dequant));
+    r->data = volume_data;
+    r->quant_mode = quant_mode;
+    r->quant_version = quant_version;
+    r->quant_scale = quant_scale;
+    r->quant_offset = quant_offset;
+    r->mip_filter = mip_filter;
+    r->mip_bytes = mip_bytes;
+    for (int f=0; f<2; f++) {
+        r->mips[f] = mips[f];
+        mips[f].clear();
+    }
+
+    volume_texture = 0;
+    dequant_texture = 0;
+    volume_data = NULL;
+    volume_bytes = 0;
+    mip_bytes = 0;
+    quant_mode = -1;
+
+    if (reference_texture) {
+        glDeleteTextures(1, &reference_texture);
+        reference_texture = 0;
+    }
+}
+
+/* the other way around, @r is left empty */
+void Renderer::restore_volume(ResidentVolume *r)
+{
+    volume_texture = r->texture;
+    histogram = r->histogram;
+    storage = r->storage;
+    volume_format = r->format;
+    volume_wide = r->wide;
+    volume_shift = r->shift;
+    volume_bytes = r->bytes;
+    dequant_texture = r->dequant_texture;
+    memcpy(dequant, r->dequant, sizeof(dequant));
+    volume_data = r->data;
+    quant_mode = r->quant_mode;
+    quant_version = r->quant_version;
+    quant_scale = r->quant_scale;
+    quant_offset = r->quant_offset;
+    /* update_mip_filter() catches up with the compositing mode */
+    mip_filter = r->mip_filter;
+    mip_bytes = r->mip_bytes;
+    for (int f=0; f<2; f++) {
+        mips[f] = r->mips[f];
+        r->mips[f].clear();
+    }
+
+    r->texture = 0;
+    r->dequant_texture = 0;
+    r->data = NULL;
+    volume_version++;
+}
+
+void Renderer::free_resident(ResidentVolume *r)
+{
+    glDeleteTextures(1, &r->texture);
+    glDeleteTextures(1, &r->dequant_texture);
+    free(r->data);
+    pyramid_free(&r->mips[0]);
+    pyramid_free(&r->mips[1]);
+
+    r->texture = 0;
+    r->dequant_texture = 0;
+    r->data = NULL;
+}
+
+/* slot in the resident list, -1 if dataset @i isn't there */
+int Renderer::find_resident(int i)
+{
+    for (int k=0; k<resident.size(); k++)
+        if (resident[k].dataset == i)
+            return k;
+
+    return -1;
+}
+
+/* least recently viewed volumes go until what's left fits, the one on
+ * screen stays whatever it costs */
+void Renderer::evict_volumes()
+{
+    size_t budget = (size_t) opt.gpu_budget << 20;
+    size_t total = volume_bytes + mip_bytes;
+    for (int k=0; k<resident.size(); k++)
+        total += resident[k].bytes + resident[k].mip_bytes;
+
+    while (total > budget && !resident.isEmpty()) {
+        int lru = 0;
+        for (int k=1; k<resident.size(); k++)
+            if (resident[k].last_viewed < resident[lru].last_viewed)
+                lru = k;
+
+        ResidentVolume &r = resident[lru];
+        size_t bytes = r.bytes + r.mip_bytes;
+        printf("Evicted dataset %d, %.1f MB\n", r.dataset, bytes / 1048576.0);
+
+        total -= bytes;
+        free_resident(&r);
+        resident.remove(lru);
+    }
+}
+
+/* what the volume of @o will take on the gpu: 8 bit data ends up
+ * native whatever was asked for, mipmaps add about a seventh */
+static size_t volume_gpu_estimate(const InitOptions &o)
+{
+    bool wide = o.bit_depth > 8;
+    VolumeStorage s = (VolumeStorage) o.storage;
+    if (!wide && s != STORAGE_RGTC)
+        s = STORAGE_NATIVE;
+
+    size_t bytes = volume_storage_size(s, wide, o.width, o.height, o.depth);
+    return bytes + bytes / 7;
+}
+
+/* read the next dataset of the session off the render thread, it's
+ * uploaded next to the current one once it's in, see preload_ready().
+ * Only if it fits with what's resident already, a volume nobody
+ * looked at yet isn't worth evicting one for */
+void Renderer::preload_next()
+{
+    int n = opt.datasets.size();
+    if (n < 2 || preloader || opt.gpu_budget == 0)
+        return;
+
+    int next = (dataset + 1) % n;
+    if (find_resident(next) >= 0 || dataset_unreadable[next])
+        return;
+
+    InitOptions o = opt;
+    session_select(&o, next);
+
+    /* the current one might still be its preview */
+    size_t total = volume_loader ? volume_gpu_estimate(opt) : volume_bytes + mip_bytes;
+    for (int k=0; k<resident.size(); k++)
+        total += resident[k].bytes + resident[k].mip_bytes;
+    if (total + volume_gpu_estimate(o) > ((size_t) opt.gpu_budget << 20))
+        return;
+
+    Histogram *hist = &preload_histogram;
+
+    preload_dataset = next;
+    preloader = new QFutureWatcher<PreparedVolume *>(this);
+    connect(preloader, &QFutureWatcher<PreparedVolume *>::finished,
+            this, &Renderer::preload_ready);
+    preloader->setFuture(QtConcurrent::run([=]() -> PreparedVolume * {
+        bool wide;
+        void *rg = read_volume(o, &wide, hist);
+        if (!rg)
+            return NULL;
+
+        PreparedVolume *pv = new PreparedVolume;
+        prepare_volume(o, rg, wide, o.width, o.height, o.depth, pv);
+        return pv;
+    }));
+}
+
+static void free_prepared(PreparedVolume *pv)
+{
+    if (!pv)
+        return;
+
+    free(pv->rg);
+    free(pv->stored);
+    pyramid_free(&pv->mips[0]);
+    pyramid_free(&pv->mips[1]);
+    delete pv;
+}
+
+/* Park the read ahead volume on the gpu, never viewed so it's the
+   first to go. It's encoded with its mipmaps already, all that's left
+   here are the uploads, the volume on screen isn't touched.
+*/
+void Renderer::preload_ready()
+{
+    if (!preloader || !preloader->isFinished())
+        return;
+
+    preloader->disconnect(this);
+    PreparedVolume *pv = preloader->result();
+    int next = preload_dataset;
+    preloader->deleteLater();
+    preloader = NULL;
+    preload_dataset = -1;
+
+    /* told when it's asked for, see switch_dataset() */
+    if (!pv) {
+        dataset_unreadable[next] = true;
+        return;
+    }
+    if (next == dataset || find_resident(next) >= 0) {
+        free_prepared(pv);
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    ResidentVolume r;
+    r.dataset = next;
+    r.last_viewed = 0;
+    r.texture = upload_prepared(pv);
+    r.histogram = preload_histogram;
+    r.storage = pv->storage;
+    r.format = volume_storage_format(pv->storage);
+    r.wide = pv->wide;
+    r.shift = pv->shift;
+    r.bytes = volume_storage_size(pv->storage, pv->wide, pv->w, pv->h, pv->d);
+    r.dequant_texture = 0;
+    memcpy(r.dequant, pv->dequant, sizeof(r.dequant));
+    if (pv->storage == STORAGE_EQUALIZED8 || pv->storage == STORAGE_TF8) {
+        profiler->begin_upload();
+        upload_dequant_table(&r.dequant_texture, r.dequant);
+        profiler->end_upload();
+    }
+
+    /* tf8 requantizes from it once it's on screen */
+    r.data = NULL;
+    if (pv->storage == STORAGE_TF8) {
+        r.data = (uint16_t *) pv->rg;
+        pv->rg = NULL;
+    }
+    r.quant_mode = -1;
+    r.quant_version = 0;
+    r.quant_scale = 0;
+    r.quant_offset = 0;
+
+    r.mip_filter = mip_filter;
+    r.mip_bytes = 0;
+    for (int f=0; f<2; f++) {
+        r.mips[f] = pv->mips[f];
+        pv->mips[f].clear();
+    }
+    for (int i=0; i<r.mips[r.mip_filter].size(); i++)
+        r.mip_bytes += r.mips[r.mip_filter][i].size;
+    glBindTexture(GL_TEXTURE_3D, r.texture);
+    upload_pyramid(r.storage, r.wide, r.mips[r.mip_filter]);
+    resident << r;
+
+    free_prepared(pv);
+
+    printf("Dataset %d (%s) read ahead, uploaded in %.1f ms\n", next,
+           opt.datasets[next].filename.toUtf8().data(), timer.nsecsElapsed() / 1e6);
+
+    evict_volumes();
+}
+
+/* Two textures for the series, native storage with no mipmaps:
+   pyramids, compressed or requantized copies are all derived from the
+   whole volume and would have to be rebuilt for every frame. The
+   first frame is the only one we ever wait for.
+*/
+GLuint Renderer::init_series()
+{
+    GLuint w = opt.width, h = opt.height, d = opt.depth;
+    bool wide = opt.bit_depth > 8;
+
+    if (opt.storage != STORAGE_NATIVE)
+        fprintf(stderr, "%s storage doesn't work with a series, keeping it native\n",
+                volume_storage_to_string((VolumeStorage) opt.storage).toUtf8().data());
+
+    series = new VolumeSeries;
+    volume_series_open(series, opt);
+
+    for (int t=0; t<2; t++) {
+        series_texture[t] = new_volume_texture(GL_LINEAR);
+        glTexImage3D(GL_TEXTURE_3D, 0, wide ? GL_RG16 : GL_RG8, w, h, d, 0,
+                     GL_RG, wide ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, 0);
+    }
+    glGenBuffers(1, &series_pbo);
+
+    storage = STORAGE_NATIVE;
+    volume_format = VOLUME_FORMAT_NORMALIZED;
+    volume_wide = wide;
+    volume_shift = 0;
+    volume_bytes = 2 * volume_storage_size(STORAGE_NATIVE, wide, w, h, d);
+
+    upload_series_frame(volume_series_acquire(series, 0, true), 0);
+    series_front = 0;
+    histogram = series_histogram[0];
+    volume_texture = series_texture[0];
+
+    return volume_texture;
+}
+
+/* Bricks of @f that differ from what texture @t holds, packed one
+   after the other in the pixel buffer, then each to its place. The
+   buffer is orphaned first, the driver hands us fresh memory while
+   the previous upload might still be reading the old one. Releases
+   @f, the copy is ours by then.
+*/
+void Renderer::upload_series_frame(SeriesFrame *f, int t)
+{
+    size_t w = opt.width, h = opt.height;
+    size_t voxel = f->wide ? 4 : 2;
+
+    QVector<int> dirty;
+    size_t bytes = 0;
+    for (int k=0; k<f->bricks.size(); k++) {
+        if (series_shown[t] >= 0 && series_bricks[t][k] == f->bricks[k])
+            continue;
+
+        int box[6];
+        volume_series_brick(series, k, box);
+        dirty << k;
+        bytes += (size_t) (box[3] - box[0]) * (box[4] - box[1]) * (box[5] - box[2]) * voxel;
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, series_pbo);
+    uint8_t *dst = NULL;
+    if (bytes) {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+        dst = (uint8_t *) glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                                           GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (!dst) {
+            fprintf(stderr, "couldn't map the series pixel buffer\n");
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            volume_series_release(series, f);
+            return;
+        }
+    }
+
+    const uint8_t *rg = (const uint8_t *) f->rg;
+    foreach (int k, dirty) {
+        int box[6];
+        volume_series_brick(series, k, box);
+        size_t row = (box[3] - box[0]) * voxel;
+        for (int z=box[2]; z<box[5]; z++) {
+            for (int y=box[1]; y<box[4]; y++) {
+                memcpy(dst, rg + (((size_t) z * h + y) * w + box[0]) * voxel, row);
+                dst += row;
+            }
+        }
+    }
+
+    if (bytes) {
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+        /* offsets into the bound buffer */
+        profiler->begin_upload();
+        glBindTexture(GL_TEXTURE_3D, series_texture[t]);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        size_t offset = 0;
+        foreach (int k, dirty) {
+            int box[6];
+            volume_series_brick(series, k, box);
+            glTexSubImage3D(GL_TEXTURE_3D, 0, box[0], box[1], box[2],
+                            box[3] - box[0], box[4] - box[1], box[5] - box[2],
+                            GL_RG, f->wide ? GL_UNSIGNED_SHORT : GL_UNSIGNED_BYTE,
+                            (const void *) offset);
+            offset += (size_t) (box[3] - box[0]) * (box[4] - box[1]) * (box[5] - box[2]) * voxel;
+        }
+        profiler->end_upload();
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    series_shown[t] = f->index;
+    series_bricks[t] = f->bricks;
+    series_histogram[t] = f->histogram;
+    volume_series_release(series, f);
+}
+
+/* Put p.series_frame on screen if the reader has it, keep what we
+   have otherwise, playback never waits on the disk. The frame after
+   it goes to the other texture right away, asking for it next is
+   just a swap.
+*/
+void Renderer::show_series_frame()
+{
+    if (!series)
+        return;
+
+    int i = CLAMP(p.series_frame, 0, series->frames - 1);
+    int back = series_front ^ 1;
+    volume_series_seek(series, i);
+
+    if (series_shown[series_front] != i) {
+        bool ready = series_shown[back] == i;
+        if (!ready) {
+            SeriesFrame *f = volume_series_acquire(series, i, false);
+            if (f) {
+                upload_series_frame(f, back);
+                ready = true;
+            }
+        }
+
+        if (ready) {
+            series_front = back;
+            volume_texture = series_texture[back];
+            histogram = series_histogram[back];
+            volume_version++;
+            emit series_frame_shown(i, series_late);
+        } else {
+            if (series_late_frame != i) {
+                series_late_frame = i;
+                series_late++;
+            }
+            /* comes up as soon as it's in */
+            if (!series_poll_pending) {
+                series_poll_pending = true;
+                QTimer::singleShot(5, this, &Renderer::series_poll);
+            }
+        }
+    }
+
+    if (series_shown[series_front] == i) {
+        int next = (i + 1) % series->frames;
+        back = series_front ^ 1;
+        if (series_shown[back] != next) {
+            SeriesFrame *f = volume_series_acquire(series, next, false);
+            if (f)
+                upload_series_frame(f, back);
+        }
+    }
+
+    /* the editor refits to a new histogram, not while playing */
+    if (!p.series_playing && series_shown[series_front] != series_histogram_frame) {
+        series_histogram_frame = series_shown[series_front];
+        emit histogram_ready(histogram);
+    }
+}
+
+/* the frame asked for wasn't read yet, draw it once it is, unless
+ * something else did already */
+void Renderer::series_poll()
+{
+    series_poll_pending = false;
+
+    if (!gl_ready || !have_params || series_shown[series_front] == p.series_frame)
+        return;
+
+    SeriesFrame *f = volume_series_acquire(series, p.series_frame, false);
+    if (!f) {
+        series_poll_pending = true;
+        QTimer::singleShot(5, this, &Renderer::series_poll);
+        return;
+    }
+
+    upload_series_frame(f, series_front ^ 1);
+    render_frame();
+}
+
+/* 256 entries, code -> normalized intensity */
+void Renderer::upload_dequant_table(GLuint *texture, const float *table)
+{
+    if (!*texture) {
+        glGenTextures(1, texture);
+        glBindTexture(GL_TEXTURE_1D, *texture);
+        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+
+    glBindTexture(GL_TEXTURE_1D, *texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_R32F, STORAGE_CODES, 0, GL_RED, GL_FLOAT, table);
+}
+
+/* the codes, their mipmaps and the error report, on a pool thread:
+ * @table is a snapshot, @rg stays until finish_requantize() */
+static Requantization *requantize(Requantization *q, QVector<float> table, int table_width,
+                                  int table_height, const uint16_t *rg, int w, int h, int d,
+                                  bool report)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    /* 2D tables: the most opaque entry of each intensity column */
+    const float *tf = table.constData();
+    float *columns = NULL;
+    int len = table_width;
+    if (table_height > 1) {
+        columns = (float *) calloc(4 * table_width, sizeof(float));
+        for (int y=0; y<table_height; y++)
+            for (int x=0; x<table_width; x++)
+                for (int c=0; c<4; c++)
+                    columns[4*x+c] = MAX(columns[4*x+c], tf[4*(y*table_width+x)+c]);
+        tf = columns;
+    }
+
+    float importance[STORAGE_FINE_BINS];
+    uint8_t lut[STORAGE_FINE_BINS];
+    storage_tf_importance(tf, len, q->scale, q->offset, importance);
+    free(columns);
+
+    size_t n = (size_t) w * h * d;
+    q->codes = (uint8_t *) malloc(2 * n);
+    storage_build_codebook(rg, n, importance, lut, q->dequant);
+    storage_encode_codes(rg, n, lut, q->codes);
+
+    /* tf8 levels are never encoded further, see encode_volume() */
+    for (int f=0; f<2; f++)
+        pyramid_build(q->codes, false, w, h, d, (PyramidFilter) f, &q->mips[f]);
+
+    q->have_error = report;
+    if (report)
+        storage_error(rg, true, w, h, d, STORAGE_TF8, q->codes, q->dequant, &q->error);
+
+    q->ms = timer.nsecsElapsed() / 1e6;
+
+    return q;
+}
+
+/* tf8 storage: spend the codes where the transfer function needs
+   them, redone whenever it changes while we're not interacting. The
+   encoding and the mipmaps are done on a pool thread, the old codes
+   stay on screen until requantize_ready() uploads the new ones, then
+   the next frame starts over if the table changed meanwhile.
+
+   @wait: for exports, return with the codes for the current table in
+*/
+void Renderer::requantize_volume(bool wait)
+{
+    const QVector<float> &table = p.tf_mode == 1 ? p.tf2d : p.tf;
+    quint64 version = p.tf_mode == 1 ? p.tf2d_version : p.tf_version;
+
+    /* the table is over windowed intensities, the codes over stored
+     * ones */
+    float scale, offset;
+    intensity_map(&scale, &offset);
+
+    if (!volume_data || table.isEmpty())
+        return;
+
+    for (;;) {
+        if (!requantizer) {
+            if (quant_mode == p.tf_mode && quant_version == version &&
+                quant_scale == scale && quant_offset == offset)
+                return;
+
+            Requantization *q = new Requantization;
+            q->tf_mode = p.tf_mode;
+            q->version = version;
+            q->scale = scale;
+            q->offset = offset;
+
+            int tw = p.tf_mode == 1 ? p.tf2d_width : p.tf.size() / 4;
+            int th = p.tf_mode == 1 ? p.tf2d_height : 1;
+            const uint16_t *rg = volume_data;
+            int w = opt.width, h = opt.height, d = slab_tex_end - slab_tex_first;
+            bool report = opt.storage_report;
+
+            requantizer = new QFutureWatcher<Requantization *>(this);
+            connect(requantizer, &QFutureWatcher<Requantization *>::finished,
+                    this, &Renderer::requantize_ready);
+            requantizer->setFuture(QtConcurrent::run([=]() {
+                return requantize(q, table, tw, th, rg, w, h, d, report);
+            }));
+        }
+
+        if (!wait)
+            return;
+        finish_requantize(true);
+    }
+}
+
+void Renderer::requantize_ready()
+{
+    if (!requantizer)
+        return;
+
+    finish_requantize(true);
+
+    if (have_params)
+        render_frame();
+}
+
+/* wait for the codes in flight and upload them, or drop them if the
+ * volume they were made from is going away */
+void Renderer::finish_requantize(bool adopt)
+{
+    if (!requantizer)
+        return;
+
+    /* we might get here before the watcher had a chance to tell us */
+    requantizer->disconnect(this);
+    requantizer->waitForFinished();
+    Requantization *q = requantizer->result();
+    requantizer->deleteLater();
+    requantizer = NULL;
+
+    if (adopt) {
+        int d = slab_tex_end - slab_tex_first;
+
+        memcpy(dequant, q->dequant, sizeof(dequant));
+        profiler->begin_upload();
+        glBindTexture(GL_TEXTURE_3D, volume_texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage3D(GL_TEXTURE_3D, 0, 0, 0, 0, opt.width, opt.height, d,
+                        GL_RG, GL_UNSIGNED_BYTE, q->codes);
+        upload_dequant_table(&dequant_texture, dequant);
+        profiler->end_upload();
+
+        mip_bytes = 0;
+        for (int f=0; f<2; f++) {
+            pyramid_free(&mips[f]);
+            mips[f] = q->mips[f];
+            q->mips[f].clear();
+        }
+        for (int i=0; i<mips[mip_filter].size(); i++)
+            mip_bytes += mips[mip_filter][i].size;
+        upload_mips();
+
+        if (q->have_error)
+            printf("Requantized for the transfer function in %.1f ms, "
+                   "intensity rmse %.5f, psnr %.1f dB\n", q->ms, q->error.rmse, q->error.psnr);
+        else
+            printf("Requantized for the transfer function in %.1f ms\n", q->ms);
+
+        quant_mode = q->tf_mode;
+        quant_version = q->version;
+        quant_scale = q->scale;
+        quant_offset = q->offset;
+        volume_version++;
+    }
+
+    free(q->codes);
+    pyramid_free(&q->mips[0]);
+    pyramid_free(&q->mips[1]);
+    delete q;
+}
+
+/* normalized texture sample to transfer function coordinate, for
+ * sample_volume() in the raycaster */
+void Renderer::intensity_map(float *scale, float *offset)
+{
+    double stored_max = (volume_wide ? 65535.0 : 255.0) / (1 << volume_shift);
+
+    window_map(opt, p.window_level, p.window_width, stored_max, scale, offset);
+}
+
+static bool classify_key_equal(const ClassifyKey &a, const ClassifyKey &b)
+{
+    return a.volume_version == b.volume_version && a.tf_mode == b.tf_mode &&
+        a.tf_version == b.tf_version && a.window_level == b.window_level &&
+        a.window_width == b.window_width && a.mask_version == b.mask_version;
+}
+
+/* Post-classification while the transfer function, the window or
+   the volume keep changing, a pre-classified copy once they've stayed
+   the same for PRECLASSIFY_SETTLE_MS and the copy fits, back to
+   post-classification the moment any of them changes again. Only
+   front to back compositing, the others want the intensity.
+*/
+void Renderer::update_classification()
+{
+    preclassified = false;
+
+    bool empty = (p.tf_mode == 1 ? p.tf2d : p.tf).isEmpty();
+    bool front_to_back = p.compositing_mode == 0 || p.compositing_mode >= 6;
+    if (opt.preclassify == PRECLASSIFY_NEVER || slab_mode || empty || !front_to_back)
+        return;
+
+    ClassifyKey key;
+    key.volume_version = volume_version;
+    key.tf_mode = p.tf_mode;
+    key.tf_version = p.tf_mode == 1 ? p.tf2d_version : p.tf_version;
+    key.window_level = p.window_level;
+    key.window_width = p.window_width;
+    key.mask_version = mask_version;
+
+    /* any change starts the clock over */
+    if (!classify_key_equal(key, classify_pending_key)) {
+        classify_pending_key = key;
+        classify_timer.start();
+    }
+
+    if (classified_texture && classify_key_equal(key, classified_key)) {
+        preclassified = true;
+        return;
+    }
+
+    if (opt.preclassify == PRECLASSIFY_AUTO) {
+        /* still dragging, the frame after the release gets here again */
+        if (p.fast_rendering)
+            return;
+
+        qint64 left = PRECLASSIFY_SETTLE_MS - classify_timer.elapsed();
+        if (left > 0) {
+            if (!classify_poll_pending) {
+                classify_poll_pending = true;
+                QTimer::singleShot((int) left, this, &Renderer::classify_poll);
+            }
+            return;
+        }
+    }
+
+    /* mipmaps add a seventh */
+    size_t bytes = (size_t) opt.width * opt.height * opt.depth * 8 * 8 / 7;
+    if (!classification_fits(bytes)) {
+        if (!classify_warned)
+            printf("No room for a %.1f MB pre-classified volume, classifying per sample\n",
+                   bytes / 1048576.0);
+        classify_warned = true;
+        return;
+    }
+
+    classify_volume();
+    classified_key = key;
+    preclassified = true;
+}
+
+/* Next to everything else of the session within --gpu-budget, and
+   within what the driver says is free when it tells us (NVX and ATI
+   extensions), keeping a quarter of that for everyone else. The copy
+   we already have is going to be replaced.
+*/
+bool Renderer::classification_fits(size_t bytes)
+{
+    size_t used = volume_bytes + mip_bytes;
+    for (int k=0; k<resident.size(); k++)
+        used += resident[k].bytes + resident[k].mip_bytes;
+
+    if (used + bytes > (size_t) opt.gpu_budget * 1048576)
+        return false;
+
+    GLint free_kb = -1;
+    if (context->hasExtension("GL_NVX_gpu_memory_info")) {
+        /* GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX */
+        glGetIntegerv(0x9049, &free_kb);
+    } else if (context->hasExtension("GL_ATI_meminfo")) {
+        /* TEXTURE_FREE_MEMORY_ATI, largest block and friends after
+         * the total */
+        GLint info[4];
+        glGetIntegerv(0x87FC, info);
+        free_kb = info[0];
+    }
+
+    if (free_kb < 0)
+        return true;
+
+    return bytes <= (size_t) free_kb * 1024 * 3 / 4 + classified_bytes;
+}
+
+/* The transfer function applied to every voxel on the gpu, a slice
+   at a time into the layers of an rgba16f volume, through the same
+   storage decoding and window the raycaster uses (CLASSIFY in the
+   shaders). Colors are stored opacity weighted, so filtering and the
+   mipmaps never bleed the color of transparent voxels into their
+   neighbours, and half floats keep the low opacities 8 bits would
+   round away. The table is never the opacity corrected one, the
+   raycaster corrects per sample, so the copy doesn't depend on the
+   step and survives quality changes. Filtering colors instead of
+   intensities blurs sharp transfer function features a bit more,
+   that's the price of a single fetch per sample.
+*/
+void Renderer::classify_volume()
+{
+    int w = opt.width, h = opt.height, d = opt.depth;
+
+    if (!classified_texture || classified_size[0] != w ||
+        classified_size[1] != h || classified_size[2] != d) {
+        glDeleteTextures(1, &classified_texture);
+        classified_texture = new_volume_texture(GL_LINEAR);
+        glTexImage3D(GL_TEXTURE_3D, 0, GL_RGBA16F, w, h, d, 0, GL_RGBA, GL_HALF_FLOAT, NULL);
+        classified_size[0] = w;
+        classified_size[1] = h;
+        classified_size[2] = d;
+        classified_bytes = (size_t) w * h * d * 8 * 8 / 7;
+    }
+
+    if (!classify_fbo)
+        glGenFramebuffers(1, &classify_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, classify_fbo);
+    glViewport(0, 0, w, h);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_CULL_FACE);
+    glDisable(GL_BLEND);
+
+    classify_shader->bind();
+    bind_volume(classify_shader, false);
+    GLint slice_loc = classify_shader->uniformLocation("slice");
+    glBindVertexArray(vao);
+
+    for (int z=0; z<d; z++) {
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                                  classified_texture, 0, z);
+        glUniform1f(slice_loc, (z + 0.5f) / d);
+        /* the z = 0 face of the cube, see the indices in init() */
+        glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, (void *) (3 * sizeof(GLuint)));
+    }
+
+    classify_shader->release();
+    glEnable(GL_BLEND);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, cur_width, cur_height);
+
+    /* box filtered, lod picks from them like from the volume ones */
+    glBindTexture(GL_TEXTURE_3D, classified_texture);
+    glGenerateMipmap(GL_TEXTURE_3D);
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+    /* a render pass, not an upload, none of the timings have it */
+    printf("Pre-classified %dx%dx%d, %.1f MB\n", w, h, d, classified_bytes / 1048576.0);
+}
+
+/* the edits may have settled, see update_classification() */
+void Renderer::classify_poll()
+{
+    classify_poll_pending = false;
+
+    if (!gl_ready || !have_params || preclassified)
+        return;
+
+    /* edited again meanwhile */
+    qint64 left = PRECLASSIFY_SETTLE_MS - classify_timer.elapsed();
+    if (left > 0) {
+        classify_poll_pending = true;
+        QTimer::singleShot((int) left, this, &Renderer::classify_poll);
+        return;
+    }
+
+    render_frame();
+}
+
+/* all kept, the mipmaps too, edits only ever update parts of it */
+void Renderer::init_mask()
+{
+    mask = new VolumeMask;
+    volume_mask_init(mask, opt.width, opt.height, opt.depth);
+
+    mask_texture = new_volume_texture(GL_LINEAR);
+    glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, mask->w, mask->h, mask->d, 0,
+                 GL_RED, GL_UNSIGNED_BYTE, mask->data);
+    for (int i=0; i<mask->mips.size(); i++) {
+        const PyramidLevel &l = mask->mips[i];
+        glTexImage3D(GL_TEXTURE_3D, i+1, GL_R8, l.w, l.h, l.d, 0,
+                     GL_RED, GL_UNSIGNED_BYTE, l.data);
+    }
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MAX_LEVEL, mask->mips.size());
+    glTexParameteri(GL_TEXTURE_3D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+    printf("Mask: %.1f MB, mipmaps %.1f MB\n",
+           (double) mask->w * mask->h * mask->d / 1048576.0, mask->mip_bytes / 1048576.0);
+}
+
+/* @box out of a @w x @h x whatever level in memory, no copy */
+void Renderer::upload_mask_box(int level, const void *data, int w, int h, const int box[6])
+{
+    if (box[3] <= box[0] || box[4] <= box[1] || box[5] <= box[2])
+        return;
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, w);
+    glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, h);
+    glTexSubImage3D(GL_TEXTURE_3D, level, box[0], box[1], box[2],
+                    box[3] - box[0], box[4] - box[1], box[5] - box[2],
+                    GL_RED, GL_UNSIGNED_BYTE,
+                    (const uint8_t *) data + ((size_t) box[2] * h + box[1]) * w + box[0]);
+}
+
+/* the dirty bricks and what's under them in each mip level, the
+ * coarse levels whole */
+void Renderer::upload_mask()
+{
+    volume_mask_update_mips(mask);
+
+    glBindTexture(GL_TEXTURE_3D, mask_texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    for (int k=0; k<mask->dirty.size(); k++) {
+        if (!mask->dirty[k])
+            continue;
+
+        int box[6];
+        volume_mask_brick(mask, k, box);
+        upload_mask_box(0, mask->data, mask->w, mask->h, box);
+
+        for (int i=0; i<MIN(mask->mips.size(), MASK_BRICK_LEVELS); i++) {
+            const PyramidLevel &l = mask->mips[i];
+            int lbox[6];
+            volume_mask_level_box(mask, i, box, lbox);
+            upload_mask_box(i+1, l.data, l.w, l.h, lbox);
+        }
+
+        mask->dirty[k] = 0;
+    }
+
+    for (int i=MASK_BRICK_LEVELS; i<mask->mips.size(); i++) {
+        const PyramidLevel &l = mask->mips[i];
+        int lbox[6] = { 0, 0, 0, l.w, l.h, l.d };
+        upload_mask_box(i+1, l.data, l.w, l.h, lbox);
+    }
+
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_IMAGE_HEIGHT, 0);
+
+    mask_version++;
+}
+
+/* upload, tell and show it, accounted to the next frame */
+void Renderer::finish_mask_edit(size_t cut, const QElapsedTimer &timer)
+{
+    int bricks = 0;
+    for (int k=0; k<mask->dirty.size(); k++)
+        bricks += mask->dirty[k];
+
+    profiler->begin_upload();
+    upload_mask();
+    profiler->end_upload();
+
+    double ms = timer.nsecsElapsed() / 1e6;
+    printf("Mask: %llu voxels cut, %d bricks uploaded in %.1f ms\n",
+           (unsigned long long) cut, bricks, ms);
+    emit mask_edited(cut, mask->cut, ms);
+
+    if (have_params)
+        render_frame();
+}
+
+void Renderer::mask_cut(const QImage &coverage, const QMatrix4x4 &mvp)
+{
+    if (!gl_ready || !mask)
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    size_t cut = volume_mask_cut_view(mask, mvp, coverage, &probe->lock);
+    finish_mask_edit(cut, timer);
+}
+
+/* the bottom of the window is the threshold, what you see is what
+ * gets filled */
+void Renderer::mask_flood(const QVector3D &from, const QVector3D &to)
+{
+    if (!gl_ready || !mask || !have_params)
+        return;
+
+    /* we're the only writer, the probe locks are for the gui */
+    if (!probe->rg) {
+        fprintf(stderr, "no intensities yet, the volume is still loading\n");
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    double bottom = (p.window_level - p.window_width / 2.0 - opt.rescale_intercept) /
+        opt.rescale_slope;
+    uint16_t threshold = CLAMP(ceil(bottom), 0.0, (double) ((1 << opt.bit_depth) - 1));
+    threshold <<= probe->shift;
+
+    int seed[3];
+    size_t cut = 0;
+    if (volume_mask_seed(mask, probe, from, to, threshold, seed))
+        cut = volume_mask_flood(mask, probe, seed, threshold, &probe->lock);
+
+    finish_mask_edit(cut, timer);
+}
+
+void Renderer::mask_clear()
+{
+    if (!gl_ready || !mask)
+        return;
+
+    QElapsedTimer timer;
+    timer.start();
+
+    volume_mask_clear(mask, &probe->lock);
+    finish_mask_edit(0, timer);
+}
+
+/* 1D texture loader for transfer function */
+GLuint Renderer::load_transfer_function_from_data(float *data, size_t sz)
+{
+    /* if no data is given init a default linear ramp across rgb
+     * channels and a threshold alpha */
+    float *default_tf = NULL;
+
+    if (data == NULL) {
+        default_tf = (float *) malloc(4 * sz * sizeof(float));
+        for (size_t i = 0; i < sz; i++) {
+            for (int j=0; j<3; j++)
+                default_tf[i*4 + j] = 0.0;
+        }
+    }
+
+    GLuint tex;
+    glGenTextures(1, &tex);
+    glBindTexture(GL_TEXTURE_1D, tex);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    /* TODO: explore different transfer function precisions */
+    glTexImage1D(GL_TEXTURE_1D, 0, GL_RGBA16F, sz, 0, GL_RGBA, GL_FLOAT,
+                 data != NULL ? data : default_tf);
+
+    if (default_tf != NULL)
+        free(default_tf);
+
+    return tex;
+}
+
+// -----------------------------------------------------------------------
+//    BUFFER, TARGETS, ETC
+// -----------------------------------------------------------------------
+
+/* target texture for the first rendering pass */
+void Renderer::init_target_texture(int w, int h)
+{
+    /* check this shit */
+    glDeleteTextures(1, &target_texture);
+    glGenTextures(1, &target_texture);
+    glBindTexture(GL_TEXTURE_2D, target_texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    /* try to keep a good precision in the intermediate rendering steps */
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, w, h, 0, GL_RGBA, GL_FLOAT, NULL);
+}
+
+/* framebuffer object for two pass rendering */
+void Renderer::init_fbo(int w, int h)
+{
+    glDeleteRenderbuffers(1, &db);
+    glDeleteFramebuffers(1, &fbo);
+
+    /* render buffer for face culling */
+    glGenRenderbuffers(1, &db);
+    glBindRenderbuffer(GL_RENDERBUFFER, db);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, w, h);
+
+    /* frame buffer for rendering */
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER,
+                           GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D,
+                           target_texture,
+                           0);
+
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER,
+                              GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER,
+                              db);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Something wrong with the framebuffer... \n");
+        exit(1);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+/* offscreen targets for ray statistics, power of two sized so that
+ * mipmapping the counters gives an exact average */
+void Renderer::init_stats_targets(int w, int h)
+{
+    int pw = 1, ph = 1;
+    while (pw < w) pw <<= 1;
+    while (ph < h) ph <<= 1;
+
+    if (stats_fbo && pw == stats_width && ph == stats_height)
+        return;
+
+    stats_width = pw;
+    stats_height = ph;
+
+    if (!stats_fbo) {
+        glGenFramebuffers(1, &stats_fbo);
+        glGenFramebuffers(1, &stats_read_fbo);
+        glGenTextures(1, &stats_color);
+        glGenTextures(2, stats_tex);
+        glGenRenderbuffers(1, &stats_db);
+
+        glGenBuffers(2, stats_pbo);
+        for (int i=0; i<2; i++) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, stats_pbo[i]);
+            glBufferData(GL_PIXEL_PACK_BUFFER, 8 * sizeof(float), NULL, GL_STREAM_READ);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    }
+
+    /* visible color, blitted to the result target after the raycast */
+    glBindTexture(GL_TEXTURE_2D, stats_color);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, pw, ph, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+    /* counters, full float or the sums won't survive the reduction */
+    for (int i=0; i<2; i++) {
+        glBindTexture(GL_TEXTURE_2D, stats_tex[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, pw, ph, 0, GL_RGBA, GL_FLOAT, NULL);
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+
+    glBindRenderbuffer(GL_RENDERBUFFER, stats_db);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, pw, ph);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, stats_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, stats_color, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1,
+                           GL_TEXTURE_2D, stats_tex[0], 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2,
+                           GL_TEXTURE_2D, stats_tex[1], 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, stats_db);
+
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        fprintf(stderr, "Something wrong with the statistics framebuffer... \n");
+        exit(1);
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    /* pending readbacks refer to the old size */
+    for (int i=0; i<2; i++) {
+        if (stats_fence[i])
+            glDeleteSync(stats_fence[i]);
+        stats_fence[i] = 0;
+    }
+}
+
+/* reduce the counters to one texel with mipmapping, then read it
+ * back asynchronously through a pixel buffer, the previous frame
+ * result is picked up only if the gpu is already done with it */
+void Renderer::reduce_ray_stats()
+{
+    int level = 0;
+    for (int s = MAX(stats_width, stats_height); s > 1; s >>= 1)
+        level++;
+
+    for (int i=0; i<2; i++) {
+        glBindTexture(GL_TEXTURE_2D, stats_tex[i]);
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+
+    int prev = stats_slot ^ 1;
+    if (stats_fence[prev]) {
+        GLenum status = glClientWaitSync(stats_fence[prev], 0, 0);
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, stats_pbo[prev]);
+            float *v = (float *) glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                                  8 * sizeof(float), GL_MAP_READ_BIT);
+            if (v) {
+                /* averages times pixel count give the sums */
+                double n = (double) stats_width * stats_height;
+                double rays = v[3] * n;
+                double taken = v[0] * n;
+                double potential = v[4] * n;
+
+                last_ray_stats.rays_valid = rays > 0.5;
+                last_ray_stats.rays = rays;
+                if (last_ray_stats.rays_valid) {
+                    last_ray_stats.samples_taken = taken / rays;
+                    last_ray_stats.samples_shaded = v[1] * n / rays;
+                    last_ray_stats.terminated = v[2] * n / rays;
+                    last_ray_stats.samples_saved = potential > 0 ? 1.0 - taken / potential : 0.0;
+                }
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+        glDeleteSync(stats_fence[prev]);
+        stats_fence[prev] = 0;
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, stats_read_fbo);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, stats_pbo[stats_slot]);
+    for (int i=0; i<2; i++) {
+        glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, stats_tex[i], level);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT,
+                     (GLvoid *) (i * 4 * sizeof(float)));
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+    stats_fence[stats_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    stats_slot = prev;
+}
+
+/* (too) big do it all GL init function, on the render thread */
+void Renderer::init()
+{
+    if (!context->makeCurrent(surface)) {
+        fprintf(stderr, "couldn't make the render context current\n");
+        exit(1);
+    }
+
+    /* QT way of enabling OGL API */
+    initializeOpenGLFunctions();
+
+    printf("Renderer: %s\n", glGetString(GL_RENDERER));
+    printf("OpenGL version: %s\n", glGetString(GL_VERSION));
+
+    emit initialized(QString((const char *) glGetString(GL_RENDERER)),
+                     QString((const char *) glGetString(GL_VERSION)));
+
+    profiler->init();
+
+    if (slab_mode && !sort_last_attach(&sort_last, opt))
+        exit(1);
+
+    /* before the volume, the probe needs the mask data */
+    if (opt.mask)
+        init_mask();
+
+    /* load textures */
+    QElapsedTimer timer;
+    timer.start();
+    volume_texture = opt.series_frames > 0 ? init_series() : load_volume_texture();
+    if (!volume_texture)
+        exit(1);
+    transfer_function = load_transfer_function_from_data(NULL, 256);
+    tf_texture_len = 256;
+
+    /* empty until the editor sends something */
+    float empty_2d[4] = { 0.0, 0.0, 0.0, 0.0 };
+    glGenTextures(1, &transfer_function_2d);
+    glBindTexture(GL_TEXTURE_2D, transfer_function_2d);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, 1, 1, 0, GL_RGBA, GL_FLOAT, empty_2d);
+    printf("Volume loaded in %.1f ms\n", timer.nsecsElapsed() / 1e6);
+    if (slab_mode) {
+        printf("Slab %d-%d of %d, ghost slices %d-%d\n", slab_first, slab_end,
+               (int) opt.depth, slab_tex_first, slab_tex_end);
+        /* the first frame would only time out on the others */
+        if (opt.worker_rank == 0)
+            sort_last_wait_ready(&sort_last);
+    }
+    emit histogram_ready(histogram);
+    emit volume_ready(storage, volume_bytes);
+    series_histogram_frame = 0;
+    preload_next();
+
+    /* init transformation matrices */
+    proj.setToIdentity(); // see render_frame() as it's viewport dependent
+
+    /* local to world */
+    model.setToIdentity();
+    /* draw in [0,1] because we want local coordinates easily mapped
+     * to colors, translate in [-0.5,0.5] to make camera transforms
+     * easier */
+    model.translate(-0.5, -0.5, -0.5);
+
+    /* Geometry initialization, just a cube in [0,1] */
+    GLfloat vertices[24] = {
+        0.0, 0.0, 0.0,
+        0.0, 0.0, 1.0,
+        0.0, 1.0, 0.0,
+        0.0, 1.0, 1.0,
+        1.0, 0.0, 0.0,
+        1.0, 0.0, 1.0,
+        1.0, 1.0, 0.0,
+        1.0, 1.0, 1.0
+    };
+
+    /* triangle ordering, arbitrary? */
+    GLuint indices[36] = {
+        1,5,7, 7,3,1, 0,2,6,
+        6,4,0, 0,1,3, 3,2,0,
+        7,5,4, 4,6,7, 2,3,7,
+        7,6,2, 1,0,4, 4,5,1
+    };
+
+    /* load vertices and indices to gpu */
+    /* vertex buffer for vertices */
+    GLuint points_vbo = 0;
+    glGenBuffers(1, &points_vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, points_vbo);
+    glBufferData(GL_ARRAY_BUFFER, 24 * sizeof(GLfloat), vertices, GL_STATIC_DRAW);
+
+    /* element buffer for indices */
+    GLuint points_ebo = 0;
+    glGenBuffers(1, &points_ebo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, points_ebo);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 36*sizeof(GLuint), indices, GL_STATIC_DRAW);
+
+    /* bind vertices to a vertex array */
+    vao = 0;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, points_vbo);
+    /* map vertex position to the first attrib, this will allow to
+     * retrieve the local coordinates in the vertex shader */
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, NULL);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, points_ebo);
+    glEnableVertexAttribArray(0);
+
+    /* enable alpha blending */
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    /* initialize first pass shader */
+    /* see shaders source code for details */
+    /* this just shades our cube with color mapped to local position */
+    distance_shader = shader_cache_program("firstpass", QByteArray(), opt.shader_cache);
+
+    /* and this is where the volume rendering really happens */
+    raycast_shader = shader_cache_program("raycast", QByteArray(), opt.shader_cache);
+
+    /* same sources, the transfer function over slices of the volume */
+    classify_shader = shader_cache_program("raycast", "#define CLASSIFY\n", opt.shader_cache);
+
+    if (!distance_shader || !raycast_shader || !classify_shader)
+        exit(1);
+
+    gl_ready = true;
+
+    /* whatever the gui posted while we were loading */
+    render_pending();
+}
+
+/* clean up resources, on the render thread before it quits */
+void Renderer::shutdown()
+{
+    /* let it commit, it's the whole point of the cold open */
+    cache_writers.waitForFinished();
+
+    /* nobody's going to want it now */
+    finish_requantize(false);
+    if (volume_loader) {
+        volume_loader->waitForFinished();
+        free(volume_loader->result());
+        delete volume_loader;
+        volume_loader = NULL;
+    }
+    if (preloader) {
+        preloader->waitForFinished();
+        free_prepared(preloader->result());
+        delete preloader;
+        preloader = NULL;
+    }
+    if (series) {
+        volume_series_close(series);
+        delete series;
+        series = NULL;
+    }
+
+    sort_last_close(&sort_last);
+
+    if (!gl_ready) {
+        delete context;
+        context = NULL;
+        return;
+    }
+
+    context->makeCurrent(surface);
+
+    delete profiler;
+    profiler = NULL;
+    delete distance_shader;
+    delete raycast_shader;
+    delete classify_shader;
+
+    glDeleteTextures(1, &volume_texture);
+    if (series_pbo) {
+        /* the other one is volume_texture */
+        glDeleteTextures(1, &series_texture[series_front ^ 1]);
+        glDeleteBuffers(1, &series_pbo);
+    }
+    for (int k=0; k<resident.size(); k++)
+        free_resident(&resident[k]);
+    resident.clear();
+    glDeleteTextures(1, &transfer_function);
+    glDeleteTextures(1, &target_texture);
+    glDeleteRenderbuffers(1, &db);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteVertexArrays(1, &vao);
+
+    if (tile_fence)
+        glDeleteSync(tile_fence);
+
+    for (int i=0; i<2; i++) {
+        if (result_ready[i])
+            glDeleteSync(result_ready[i]);
+        if (result_released[i])
+            glDeleteSync(result_released[i]);
+    }
+    glDeleteTextures(2, result_texture);
+    glDeleteRenderbuffers(2, result_db);
+    glDeleteFramebuffers(2, result_fbo);
+
+    for (int i=0; i<2; i++) {
+        if (stats_fence[i])
+            glDeleteSync(stats_fence[i]);
+    }
+    glDeleteBuffers(2, stats_pbo);
+    glDeleteTextures(2, stats_tex);
+    glDeleteTextures(1, &stats_color);
+    glDeleteRenderbuffers(1, &stats_db);
+    glDeleteFramebuffers(1, &stats_fbo);
+    glDeleteFramebuffers(1, &stats_read_fbo);
+
+    glDeleteTextures(1, &transfer_function_2d);
+    for (int i=0; i<TF_CACHE_SIZE; i++)
+        glDeleteTextures(1, &tf_cache[i].tex);
+
+    glDeleteTextures(1, &dequant_texture);
+    glDeleteTextures(1, &reference_texture);
+    glDeleteTextures(1, &classified_texture);
+    glDeleteFramebuffers(1, &classify_fbo);
+    glDeleteTextures(1, &mask_texture);
+
+    context->doneCurrent();
+    gl_ready = false;
+
+    delete context;
+    context = NULL;
+}
+
+/* draw our geometry with the proper culling */
+void Renderer::render_cube(QOpenGLShaderProgram *shader, GLuint cull_face)
+{
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_CULL_FACE);
+
+    /* scene transform happens in the shaders with modern GL */
+    GLint proj_loc = shader->uniformLocation("projection");
+    glUniformMatrix4fv(proj_loc, 1, GL_FALSE, (GLfloat *) proj.data());
+    GLint model_loc = shader->uniformLocation("model");
+    glUniformMatrix4fv(model_loc, 1, GL_FALSE, (GLfloat *) model.data());
+    GLint view_loc = shader->uniformLocation("view");
+    glUniformMatrix4fv(view_loc, 1, GL_FALSE, (GLfloat *) view.data());
+    /* z range of the cube, just our slab in sort-last mode */
+    GLint slab_loc = shader->uniformLocation("slab");
+    glUniform2f(slab_loc, (float) slab_first / opt.depth, (float) slab_end / opt.depth);
+
+    glCullFace(cull_face);
+    glBindVertexArray(vao);
+    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+}
+
+/* the widget might still be reading what we're about to draw over,
+ * the fence it left says when it's done */
+int Renderer::acquire_back_buffer()
+{
+    exchange_lock.lock();
+    int back = front < 0 ? 0 : front ^ 1;
+    GLsync released = result_released[back];
+    result_released[back] = 0;
+    exchange_lock.unlock();
+
+    if (released) {
+        glWaitSync(released, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(released);
+    }
+
+    if (result_width[back] != cur_width || result_height[back] != cur_height)
+        init_result_target(back, cur_width, cur_height);
+
+    return back;
+}
+
+/* One frame from the current params into the back result target,
+ * handed to the widget when done. Still frames go in tiles, see
+ * render_tiles() */
+void Renderer::render_frame()
+{
+    QElapsedTimer cpu_timer;
+    cpu_timer.start();
+
+    /* whatever was left of the previous still frame is stale */
+    if (tile_next < tiles.size())
+        abort_tiles();
+
+    /* viewport dependent stuff */
+    int w = MAX(p.width, 1);
+    int h = MAX(p.height, 1);
+    if (w != cur_width || h != cur_height) {
+        cur_width = w;
+        cur_height = h;
+        /* target texture and fbo */
+        init_target_texture(w, h);
+        init_fbo(w, h);
+        /* projection mapping */
+        proj.setToIdentity();
+        proj.perspective(67.0f, GLfloat(w) / h, 0.001f, 5.0f);
+    }
+
+    int back = acquire_back_buffer();
+
+    /* simple view, just look at the center object */
+    view.setToIdentity();
+    view.lookAt({0,0,p.depth},{0,0,0},{0,1,0});
+
+    /* accounted to this frame */
+    switch_dataset(p.dataset);
+    show_series_frame();
+    upload_transfer_function();
+    if (storage == STORAGE_TF8 && !p.fast_rendering)
+        requantize_volume(false);
+    update_mip_filter();
+    update_classification();
+
+    FrameStats info;
+    info.sampling_rate = get_sampling_rate();
+    info.width = cur_width;
+    info.height = cur_height;
+    info.compositing_mode = p.compositing_mode;
+    info.shading_mode = p.shading_mode;
+    info.fast_rendering = p.fast_rendering;
+    info.rays_valid = false;
+    /* counters of a single slab are no use */
+    bool collect_stats = (p.ray_stats || p.compositing_mode >= 6) && !slab_mode;
+    if (collect_stats) {
+        info.rays_valid = last_ray_stats.rays_valid;
+        info.rays = last_ray_stats.rays;
+        info.samples_taken = last_ray_stats.samples_taken;
+        info.samples_shaded = last_ray_stats.samples_shaded;
+        info.terminated = last_ray_stats.terminated;
+        info.samples_saved = last_ray_stats.samples_saved;
+    }
+    profiler->begin_frame(info);
+
+    glViewport(0, 0, w, h);
+    glClearColor(p.background_color[0], p.background_color[1],
+                 p.background_color[2], p.background_color[3]);
+
+    if (reference_texture && !(p.tf_mode == 1 ? p.tf2d : p.tf).isEmpty())
+        report_rendering_error(result_fbo[back]);
+
+    /* interactive frames are cheap enough in one go, ray statistics
+     * want the whole frame and benchmarks time whole frames, playback
+     * wouldn't get past the first tiles */
+    bool tiled = opt.tile_size > 0 && !p.fast_rendering && !collect_stats &&
+        !p.frame_timing && !p.series_playing &&
+        (w > opt.tile_size || h > opt.tile_size);
+
+    if (!tiled) {
+        if (slab_mode)
+            render_slabs(back);
+        else
+            render_volume(result_fbo[back], collect_stats, true);
+
+        profiler->end_frame(cpu_timer.nsecsElapsed() / 1e6);
+
+        publish_frame(back, true);
+        profiler->frame_swapped();
+        return;
+    }
+
+    /* ray end points for the whole frame now, they're cheap */
+    render_first_pass();
+    profiler->end_pass();
+
+    build_tiles(w, h);
+    tile_serial = p.serial;
+    tile_cpu_time = cpu_timer.nsecsElapsed() / 1e6;
+
+    render_tile(back);
+}
+
+/* centre out, what the user is looking at refines first */
+void Renderer::build_tiles(int w, int h)
+{
+    int size = opt.tile_size;
+
+    tiles.clear();
+    tile_next = 0;
+
+    for (int y=0; y<h; y+=size)
+        for (int x=0; x<w; x+=size)
+            tiles << QRect(x, y, MIN(size, w-x), MIN(size, h-y));
+
+    QPointF c(w / 2.0, h / 2.0);
+    qSort(tiles.begin(), tiles.end(), [=](const QRect &a, const QRect &b) {
+        QPointF pa = QRectF(a).center() - c;
+        QPointF pb = QRectF(b).center() - c;
+        return QPointF::dotProduct(pa, pa) < QPointF::dotProduct(pb, pb);
+    });
+}
+
+/* Next tile of the still frame, queued after the previous one so
+   anything posted meanwhile gets through the event loop first and
+   aborts the rest.
+
+   @serial: of the params the frame started from, stale calls are
+   ignored
+*/
+void Renderer::render_tiles(quint64 serial)
+{
+    if (serial != tile_serial || tile_next >= tiles.size() || mailbox.loadAcquire())
+        return;
+
+    /* a single tile in flight, otherwise the next interactive frame
+     * would queue up on the gpu behind the whole still frame */
+    if (tile_fence) {
+        while (glClientWaitSync(tile_fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                1000000000) == GL_TIMEOUT_EXPIRED)
+            ;
+        glDeleteSync(tile_fence);
+        tile_fence = 0;
+    }
+
+    /* new params might have come in while we waited */
+    if (mailbox.loadAcquire())
+        return;
+
+    render_tile(acquire_back_buffer());
+}
+
+/* Start over from what's on screen, stretched if the size changed,
+ * raycast the next tile on top and show the lot */
+void Renderer::render_tile(int back)
+{
+    QElapsedTimer cpu_timer;
+    cpu_timer.start();
+
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, result_fbo[back]);
+    if (front >= 0 && front != back) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, result_fbo[front]);
+        glBlitFramebuffer(0, 0, result_width[front], result_height[front],
+                          0, 0, cur_width, cur_height, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+    } else {
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+
+    const QRect &t = tiles[tile_next++];
+
+    glViewport(0, 0, cur_width, cur_height);
+    glEnable(GL_SCISSOR_TEST);
+    glScissor(t.x(), t.y(), t.width(), t.height());
+    render_raycast(result_fbo[back], false);
+    glDisable(GL_SCISSOR_TEST);
+
+    bool done = tile_next >= tiles.size();
+    if (!done)
+        tile_fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+    tile_cpu_time += cpu_timer.nsecsElapsed() / 1e6;
+    if (done)
+        profiler->end_frame(tile_cpu_time);
+
+    publish_frame(back, done);
+
+    if (done) {
+        profiler->frame_swapped();
+        tiles.clear();
+        tile_next = 0;
+    } else {
+        QMetaObject::invokeMethod(this, "render_tiles", Qt::QueuedConnection,
+                                  Q_ARG(quint64, tile_serial));
+    }
+}
+
+void Renderer::abort_tiles()
+{
+    tiles.clear();
+    tile_next = 0;
+
+    if (tile_fence) {
+        glDeleteSync(tile_fence);
+        tile_fence = 0;
+    }
+
+    profiler->abort_frame();
+}
+
+/* Everything up to date and at full quality for an export, false if
+ * there's nothing to render yet. The widget gets no new frames until
+ * end_export() */
+bool Renderer::begin_export()
+{
+    /* what the user is looking at, posted or not */
+    RenderParams *params = mailbox.fetchAndStoreOrdered(NULL);
+    if (params) {
+        apply_params(params);
+        recycle_params(params);
+    }
+
+    if (!gl_ready || !have_params) {
+        fprintf(stderr, "nothing to export yet\n");
+        return false;
+    }
+
+    /* exports render their own targets, the other slabs never see
+     * them */
+    if (slab_mode) {
+        fprintf(stderr, "exports don't work with --workers\n");
+        return false;
+    }
+
+    if (tile_next < tiles.size())
+        abort_tiles();
+
+    /* no coarse preview in an export */
+    switch_dataset(p.dataset);
+    show_series_frame();
+    finish_volume_loading();
+
+    export_fast_rendering = p.fast_rendering;
+    p.fast_rendering = false;
+
+    upload_transfer_function();
+    if (storage == STORAGE_TF8)
+        requantize_volume(true);
+    update_mip_filter();
+    update_classification();
+
+    return true;
+}
+
+/* back to the widget */
+void Renderer::end_export()
+{
+    p.fast_rendering = export_fast_rendering;
+    cur_width = 0;
+    cur_height = 0;
+    render_frame();
+}
+
+/* passes and an RGBA8 target of @w x @h, render_frame() sets the
+ * passes back to the widget size */
+GLuint Renderer::new_export_target(int w, int h, GLuint *color, GLuint *depth)
+{
+    GLuint out_fbo;
+
+    cur_width = w;
+    cur_height = h;
+    init_target_texture(w, h);
+    init_fbo(w, h);
+
+    glGenTextures(1, color);
+    glBindTexture(GL_TEXTURE_2D, *color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glGenRenderbuffers(1, depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, *depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT, w, h);
+    glGenFramebuffers(1, &out_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, out_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *color, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, *depth);
+
+    glViewport(0, 0, w, h);
+    glClearColor(p.background_color[0], p.background_color[1],
+                 p.background_color[2], p.background_color[3]);
+
+    return out_fbo;
+}
+
+void Renderer::delete_export_target(GLuint out_fbo, GLuint color, GLuint depth)
+{
+    glDeleteFramebuffers(1, &out_fbo);
+    glDeleteRenderbuffers(1, &depth);
+    glDeleteTextures(1, &color);
+}
+
+/* wait for a readback and copy it out, the buffer can only be unmapped
+ * from this thread so the encoders get a copy */
+QByteArray Renderer::map_readback(GLuint pbo, GLsync fence, int bytes)
+{
+    while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                            1000000000) == GL_TIMEOUT_EXPIRED)
+        ;
+    glDeleteSync(fence);
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo);
+    void *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+    QByteArray pixels((const char *) data, bytes);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+
+    return pixels;
+}
+
+/* Render @width x @height in sub frustum tiles and stream them to
+   @path, see posterwriter.h. The gpu renders a tile while a pool
+   thread encodes the previous one, readbacks go through a pair of
+   pixel buffers.
+*/
+void Renderer::export_poster(const QString &path, int width, int height)
+{
+    if (!begin_export()) {
+        emit export_finished(false, path);
+        return;
+    }
+
+    GLint max_size = 0;
+    glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &max_size);
+    int tile = MIN(POSTER_TILE, max_size & ~15);
+
+    PosterWriter writer;
+    if (!poster_open(&writer, path, width, height, tile)) {
+        emit export_finished(false, path);
+        end_export();
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    GLuint color, depth;
+    GLuint out_fbo = new_export_target(tile, tile, &color, &depth);
+
+    int tile_bytes = tile * tile * 4;
+    GLuint pbo[2];
+    GLsync fence[2] = { 0, 0 };
+    glGenBuffers(2, pbo);
+    for (int i=0; i<2; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, tile_bytes, NULL, GL_STREAM_READ);
+    }
+
+    view.setToIdentity();
+    view.lookAt({0,0,p.depth},{0,0,0},{0,1,0});
+
+    /* same frustum as the widget at this aspect ratio, each tile takes
+     * its slice, the pixel footprint the lod is picked from follows */
+    float z_near = 0.001f;
+    float z_far = 5.0f;
+    float top = z_near * tanf(67.0f / 2.0f * M_PI / 180.0f);
+    float right = top * width / height;
+
+    int total = writer.tiles_x * writer.tiles_y;
+    QFuture<bool> encoder;
+    bool encoding = false;
+    bool ok = true;
+
+    for (int i=0; i<=total && ok; i++) {
+        /* render and read back this tile... */
+        if (i < total) {
+            int tx = i % writer.tiles_x;
+            int ty = i / writer.tiles_x;
+
+            proj.setToIdentity();
+            proj.frustum(-right + 2.0f * right * tx * tile / width,
+                         -right + 2.0f * right * (tx + 1) * tile / width,
+                         top - 2.0f * top * (ty + 1) * tile / height,
+                         top - 2.0f * top * ty * tile / height,
+                         z_near, z_far);
+
+            render_volume(out_fbo, false, false);
+
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, out_fbo);
+            glReadBuffer(GL_COLOR_ATTACHMENT0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i % 2]);
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+            glReadPixels(0, 0, tile, tile, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            fence[i % 2] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+        }
+
+        /* ...while the previous one goes to the encoder */
+        if (i > 0) {
+            int j = (i - 1) % 2;
+            QByteArray rgba = map_readback(pbo[j], fence[j], tile_bytes);
+            fence[j] = 0;
+
+            /* one tile encoding at a time, tiles come in order */
+            if (encoding)
+                ok = encoder.result();
+            if (!ok)
+                break;
+
+            encoder = QtConcurrent::run(poster_write_tile, &writer,
+                                        (i - 1) % writer.tiles_x,
+                                        (i - 1) / writer.tiles_x, rgba);
+            encoding = true;
+
+            emit export_progress(i, total);
+        }
+    }
+
+    if (encoding)
+        ok = encoder.result() && ok;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    for (int i=0; i<2; i++) {
+        if (fence[i])
+            glDeleteSync(fence[i]);
+    }
+    glDeleteBuffers(2, pbo);
+    delete_export_target(out_fbo, color, depth);
+
+    ok = poster_close(&writer) && ok;
+    if (ok)
+        printf("Poster %dx%d written to %s in %.1f s\n", width, height,
+               path.toUtf8().data(), timer.nsecsElapsed() / 1e9);
+    else
+        QFile::remove(path);
+
+    emit export_finished(ok, path);
+
+    end_export();
+}
+
+/* Fly @frames frames of @width x @height along a camera path and
+   write them out, see framesequence.h. Readbacks go through a ring of
+   pixel buffers, frames are encoded on a pool of threads, a couple of
+   frames per thread at most are waiting for it.
+
+   @path: CameraPath
+*/
+void Renderer::record_sequence(const QString &pattern, int path, int frames,
+                               int width, int height)
+{
+    if (!begin_export()) {
+        emit export_finished(false, pattern);
+        return;
+    }
+
+    GLint max_size = 0;
+    glGetIntegerv(GL_MAX_RENDERBUFFER_SIZE, &max_size);
+    if (width <= 0 || height <= 0 || width > max_size || height > max_size || frames <= 0) {
+        fprintf(stderr, "can't record %d frames of %dx%d, at most %dx%d\n",
+                frames, width, height, max_size, max_size);
+        emit export_finished(false, pattern);
+        end_export();
+        return;
+    }
+
+    FrameSequence seq;
+    if (!frame_sequence_open(&seq, pattern, width, height)) {
+        emit export_finished(false, pattern);
+        end_export();
+        return;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    GLuint color, depth;
+    GLuint out_fbo = new_export_target(width, height, &color, &depth);
+
+    proj.setToIdentity();
+    proj.perspective(67.0f, GLfloat(width) / height, 0.001f, 5.0f);
+
+    int frame_bytes = width * height * 4;
+    GLuint pbo[RECORD_RING];
+    GLsync fence[RECORD_RING];
+    glGenBuffers(RECORD_RING, pbo);
+    for (int i=0; i<RECORD_RING; i++) {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i]);
+        glBufferData(GL_PIXEL_PACK_BUFFER, frame_bytes, NULL, GL_STREAM_READ);
+        fence[i] = 0;
+    }
+
+    QThreadPool pool;
+    pool.setMaxThreadCount(MAX(QThread::idealThreadCount(), 1));
+    int max_jobs = 2 * pool.maxThreadCount();
+    QQueue<QFuture<bool> > jobs;
+
+    QQuaternion rotation = p.rotation;
+    float eye_depth = p.depth;
+    bool ok = true;
+
+    for (int i=0; i<frames + RECORD_RING - 1 && ok; i++) {
+        /* render frame i... */
+        if (i < frames) {
+            camera_path_pose((CameraPath) path, i, frames, &p.rotation, &p.depth);
+            view.setToIdentity();
+            view.lookAt({0,0,p.depth},{0,0,0},{0,1,0});
+
+            render_volume(out_fbo, false, false);
+
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, out_fbo);
+            glReadBuffer(GL_COLOR_ATTACHMENT0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, pbo[i % RECORD_RING]);
+            glPixelStorei(GL_PACK_ALIGNMENT, 4);
+            glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            fence[i % RECORD_RING] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+        }
+
+        /* ...and encode the oldest one in the ring */
+        int done = i - (RECORD_RING - 1);
+        if (done < 0)
+            continue;
+
+        int j = done % RECORD_RING;
+        QByteArray rgba = map_readback(pbo[j], fence[j], frame_bytes);
+        fence[j] = 0;
+
+        while (jobs.size() >= max_jobs && ok)
+            ok = jobs.dequeue().result();
+
+        jobs.enqueue(QtConcurrent::run(&pool, frame_sequence_write, &seq, done, rgba));
+
+        emit export_progress(done + 1, frames);
+    }
+
+    while (!jobs.isEmpty())
+        ok = jobs.dequeue().result() && ok;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    for (int i=0; i<RECORD_RING; i++) {
+        if (fence[i])
+            glDeleteSync(fence[i]);
+    }
+    glDeleteBuffers(RECORD_RING, pbo);
+    delete_export_target(out_fbo, color, depth);
+
+    ok = frame_sequence_close(&seq) && ok;
+    if (ok) {
+        double secs = timer.nsecsElapsed() / 1e9;
+        printf("%d frames of %dx%d written to %s in %.1f s (%.1f fps)\n", frames,
+               width, height, pattern.toUtf8().data(), secs, frames / secs);
+    }
+
+    emit export_finished(ok, pattern);
+
+    p.rotation = rotation;
+    p.depth = eye_depth;
+    end_export();
+}
+
+/* Our slab premultiplied over transparent black into the result
+   target, then binary swap with the other ranks. Rank 0 gets the
+   whole frame back over the background, the others are done once
+   their rows are composited.
+*/
+void Renderer::render_slabs(int back)
+{
+    int w = cur_width;
+    int h = cur_height;
+    int rank = opt.worker_rank;
+
+    if ((size_t) w * h > SORT_LAST_MAX_PIXELS) {
+        if (!slab_warned)
+            fprintf(stderr, "frames past %d pixels aren't composited, only our slab is shown\n",
+                    SORT_LAST_MAX_PIXELS);
+        slab_warned = true;
+        render_volume(result_fbo[back], false, true);
+        return;
+    }
+
+    /* the others render theirs meanwhile */
+    if (rank == 0)
+        publish_slab_params();
+
+    glClearColor(0.0, 0.0, 0.0, 0.0);
+    glDisable(GL_BLEND);
+    render_volume(result_fbo[back], false, true);
+    glEnable(GL_BLEND);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, result_fbo[back]);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, sort_last_image(&sort_last, rank));
+
+    /* the eye in [0,1] volume coordinates, see render_first_pass() */
+    QVector3D eye = model.inverted() * QVector3D(0, 0, p.depth);
+    bool ok = sort_last_composite(&sort_last, w, h, eye.z(), p.compositing_mode == 1);
+    if (rank != 0 || !ok)
+        return;
+
+    slab_final.resize(4 * w * h);
+    if (!sort_last_gather(&sort_last, w, h, p.background_color, slab_final.data()))
+        return;
+
+    glBindTexture(GL_TEXTURE_2D, result_texture[back]);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE,
+                    slab_final.constData());
+}
+
+/* rank 0: the current params to the shared segment, tables only when
+ * they changed */
+void Renderer::publish_slab_params()
+{
+    SlabParams *s = &sort_last.header->params;
+
+    s->width = cur_width;
+    s->height = cur_height;
+    s->rotation[0] = p.rotation.scalar();
+    s->rotation[1] = p.rotation.x();
+    s->rotation[2] = p.rotation.y();
+    s->rotation[3] = p.rotation.z();
+    s->depth = p.depth;
+
+    s->compositing_mode = p.compositing_mode;
+    s->shading_mode = p.shading_mode;
+    memcpy(s->background_color, p.background_color, sizeof(s->background_color));
+    memcpy(s->light_color, p.light_color, sizeof(s->light_color));
+    s->ambient_reflectance = p.ambient_reflectance;
+    s->diffuse_reflectance = p.diffuse_reflectance;
+    s->specular_reflectance = p.specular_reflectance;
+
+    s->fast_rendering = p.fast_rendering;
+    s->quality = p.quality;
+    s->fixed_step = p.fixed_step;
+    s->window_level = p.window_level;
+    s->window_width = p.window_width;
+    s->tf_mode = p.tf_mode;
+
+    if (sort_last.frame == 0 || s->tf_version != p.tf_version) {
+        s->tf_len = MIN(p.tf.size() / 4, SORT_LAST_MAX_TF);
+        memcpy(s->tf, p.tf.constData(), 4 * sizeof(float) * s->tf_len);
+        s->tf_version = p.tf_version;
+    }
+
+    if (sort_last.frame == 0 || s->tf2d_version != p.tf2d_version) {
+        if (p.tf2d_width * p.tf2d_height <= SORT_LAST_MAX_TF2D) {
+            s->tf2d_width = p.tf2d_width;
+            s->tf2d_height = p.tf2d_height;
+            memcpy(s->tf2d, p.tf2d.constData(),
+                   4 * sizeof(float) * p.tf2d_width * p.tf2d_height);
+        } else {
+            fprintf(stderr, "2D transfer function too big for the other slabs\n");
+            s->tf2d_width = 0;
+            s->tf2d_height = 0;
+        }
+        s->tf2d_version = p.tf2d_version;
+    }
+
+    sort_last_publish(&sort_last);
+}
+
+/* workers: what rank 0 published, as if it was posted */
+RenderParams *Renderer::take_slab_params()
+{
+    const SlabParams *s = &sort_last.header->params;
+    RenderParams *params = new RenderParams;
+
+    render_params_init(params, opt);
+    params->serial = sort_last.frame;
+    params->width = s->width;
+    params->height = s->height;
+    params->rotation = QQuaternion(s->rotation[0], s->rotation[1],
+                                   s->rotation[2], s->rotation[3]);
+    params->depth = s->depth;
+
+    params->compositing_mode = s->compositing_mode;
+    params->shading_mode = s->shading_mode;
+    memcpy(params->background_color, s->background_color, sizeof(s->background_color));
+    memcpy(params->light_color, s->light_color, sizeof(s->light_color));
+    params->ambient_reflectance = s->ambient_reflectance;
+    params->diffuse_reflectance = s->diffuse_reflectance;
+    params->specular_reflectance = s->specular_reflectance;
+
+    params->fast_rendering = s->fast_rendering;
+    params->quality = s->quality;
+    params->fixed_step = s->fixed_step;
+    params->window_level = s->window_level;
+    params->window_width = s->window_width;
+    params->tf_mode = s->tf_mode;
+
+    params->tf_version = s->tf_version;
+    if (!have_params || s->tf_version != p.tf_version) {
+        params->tf = QVector<float>(4 * s->tf_len);
+        memcpy(params->tf.data(), s->tf, 4 * sizeof(float) * s->tf_len);
+        if (s->tf_len > 0) {
+            params->tf_dirty_first = 0;
+            params->tf_dirty_last = s->tf_len - 1;
+        }
+    } else {
+        params->tf = p.tf;
+    }
+
+    params->tf2d_version = s->tf2d_version;
+    params->tf2d_width = s->tf2d_width;
+    params->tf2d_height = s->tf2d_height;
+    if (!have_params || s->tf2d_version != p.tf2d_version) {
+        params->tf2d = QVector<float>(4 * s->tf2d_width * s->tf2d_height);
+        memcpy(params->tf2d.data(), s->tf2d, sizeof(float) * params->tf2d.size());
+    } else {
+        params->tf2d = p.tf2d;
+    }
+
+    return params;
+}
+
+/* Workers: frames come through the shared segment instead of the
+   mailbox. Keeps the render thread until rank 0 quits, there's
+   nothing else for it to do in a worker
+*/
+void Renderer::serve_slabs()
+{
+    sort_last_ready(&sort_last);
+
+    while (sort_last_wait_frame(&sort_last)) {
+        RenderParams *params = take_slab_params();
+        apply_params(params);
+        delete params;
+
+        render_frame();
+    }
+
+    emit slabs_finished();
+}
+
+/* both passes, to @out_fbo directly or through the statistics targets */
+void Renderer::render_volume(GLuint out_fbo, bool collect_stats, bool profile)
+{
+    render_first_pass();
+
+    if (profile)
+        profiler->end_pass();
+
+    render_raycast(out_fbo, collect_stats);
+}
+
+/* ray end points for the whole viewport, tiles share them */
+void Renderer::render_first_pass()
+{
+    /* init model matrix */
+    model.setToIdentity();
+    model.rotate(p.rotation);
+    model.scale(opt.xscale, opt.yscale, opt.zscale);
+    model.translate(-0.5, -0.5, -0.5);
+
+    /* map framebuffer object for offscreen rendering */
+    glEnable(GL_DEPTH_TEST);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    /* first pass: draw a colored cube with front face culling */
+    /* the colors will be the coordinates of the back face we can use
+     * as the end points for our raycasting integral */
+    distance_shader->bind();
+    render_cube(distance_shader, GL_FRONT);
+    distance_shader->release();
+}
+
+/* the volume and the transfer function as the raycaster samples
+ * them, classify_volume() applies them the same way.
+ * @corrected_tables: the opacity corrected ones with a fixed step */
+void Renderer::bind_volume(QOpenGLShaderProgram *shader, bool corrected_tables)
+{
+    /* volume data, the packed storage is an integer texture and
+     * needs its own sampler */
+    bool packed = volume_format == VOLUME_FORMAT_PACKED12;
+    GLint tex_loc = shader->uniformLocation("voltex");
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_3D, packed ? 0 : volume_texture);
+    glUniform1i(tex_loc, 1);
+    tex_loc = shader->uniformLocation("voltex_packed");
+    glActiveTexture(GL_TEXTURE5);
+    glBindTexture(GL_TEXTURE_3D, packed ? volume_texture : 0);
+    glUniform1i(tex_loc, 5);
+    /* code -> intensity for the 8 bit quantized storages */
+    tex_loc = shader->uniformLocation("dequant");
+    glActiveTexture(GL_TEXTURE4);
+    glBindTexture(GL_TEXTURE_1D, dequant_texture);
+    glUniform1i(tex_loc, 4);
+    GLint volume_format_loc = shader->uniformLocation("volume_format");
+    glUniform1i(volume_format_loc, volume_format);
+    /* mip levels the raycaster may pick from, none without lod */
+    GLint max_lod_loc = shader->uniformLocation("max_lod");
+    glUniform1f(max_lod_loc, lod ? mips[mip_filter].size() : 0.0);
+    /* fixed step: same world space step for every ray, with the
+     * opacity correction baked into the table */
+    float step = get_world_step();
+    bool corrected = corrected_tables && p.fixed_step &&
+        !(p.tf_mode == 1 ? p.tf2d : p.tf).isEmpty();
+    GLuint tf_tex = transfer_function;
+    GLuint tf2d_tex = transfer_function_2d;
+    if (corrected && p.tf_mode == 1)
+        tf2d_tex = corrected_transfer_function(1, step);
+    else if (corrected)
+        tf_tex = corrected_transfer_function(0, step);
+
+    /* transfer function */
+    tex_loc = shader->uniformLocation("tftex");
+    glActiveTexture(GL_TEXTURE2);
+    glBindTexture(GL_TEXTURE_1D, tf_tex);
+    glUniform1i(tex_loc, 2);
+    /* 2D transfer function, intensity x gradient magnitude */
+    tex_loc = shader->uniformLocation("tf2dtex");
+    glActiveTexture(GL_TEXTURE3);
+    glBindTexture(GL_TEXTURE_2D, tf2d_tex);
+    glUniform1i(tex_loc, 3);
+    GLint tf_mode_loc = shader->uniformLocation("tf_mode");
+    glUniform1i(tf_mode_loc, p.tf_mode);
+    GLint fixed_step_loc = shader->uniformLocation("fixed_step");
+    glUniform1i(fixed_step_loc, p.fixed_step ? 1 : 0);
+    GLint tf_corrected_loc = shader->uniformLocation("tf_corrected");
+    glUniform1i(tf_corrected_loc, corrected ? 1 : 0);
+
+    /* z offset and extent of the texture in volume coordinates */
+    GLint slab_texture_loc = shader->uniformLocation("slab_texture");
+    glUniform2f(slab_texture_loc, (float) slab_tex_first / opt.depth,
+                (float) (slab_tex_end - slab_tex_first) / opt.depth);
+    /* window/level, no texture traffic for it */
+    GLfloat map_scale, map_offset;
+    intensity_map(&map_scale, &map_offset);
+    GLint intensity_map_loc = shader->uniformLocation("intensity_map");
+    glUniform2f(intensity_map_loc, map_scale, map_offset);
+    /* cuts, opacities times the mask, no fetch while there's none */
+    tex_loc = shader->uniformLocation("masktex");
+    glActiveTexture(GL_TEXTURE7);
+    glBindTexture(GL_TEXTURE_3D, mask_texture);
+    glUniform1i(tex_loc, 7);
+    GLint masked_loc = shader->uniformLocation("masked");
+    glUniform1i(masked_loc, mask && mask->cut > 0 ? 1 : 0);
+}
+
+/* the expensive pass, only touches the scissor box when the scissor
+ * test is on, clear included */
+void Renderer::render_raycast(GLuint out_fbo, bool collect_stats)
+{
+    if (collect_stats) {
+        /* raycast offscreen with the counter attachments, blending
+         * would mess with the counters */
+        static const GLenum draw_buffers[3] = {
+            GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2
+        };
+        static const GLfloat zero[4] = { 0.0, 0.0, 0.0, 0.0 };
+
+        init_stats_targets(cur_width, cur_height);
+        glBindFramebuffer(GL_FRAMEBUFFER, stats_fbo);
+        glDrawBuffers(3, draw_buffers);
+        glClearBufferfv(GL_COLOR, 0, p.background_color);
+        glClearBufferfv(GL_COLOR, 1, zero);
+        glClearBufferfv(GL_COLOR, 2, zero);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        glDisablei(GL_BLEND, 1);
+        glDisablei(GL_BLEND, 2);
+    } else {
+        /* straight to the result target now */
+        glBindFramebuffer(GL_FRAMEBUFFER, out_fbo);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+    raycast_shader->bind();
+
+    glEnable(GL_DEPTH_TEST);
+
+    /* load for the raycasting fragment shader */
+    /* first pass target, now full with position data */
+    GLint tex_loc = raycast_shader->uniformLocation("backtex");
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, target_texture);
+    glUniform1i(tex_loc, 0);
+    bind_volume(raycast_shader, !preclassified);
+    /* the transfer function already applied, see classify_volume() */
+    tex_loc = raycast_shader->uniformLocation("classtex");
+    glActiveTexture(GL_TEXTURE6);
+    glBindTexture(GL_TEXTURE_3D, preclassified ? classified_texture : 0);
+    glUniform1i(tex_loc, 6);
+    GLint preclassified_loc = raycast_shader->uniformLocation("preclassified");
+    glUniform1i(preclassified_loc, preclassified ? 1 : 0);
+
+    /* viewport size, needed to get normalized texture coordinates */
+    GLint screen_width_loc = raycast_shader->uniformLocation("screen_width");
+    GLint screen_height_loc = raycast_shader->uniformLocation("screen_height");
+    glUniform1f(screen_width_loc, (GLfloat) cur_width);
+    glUniform1f(screen_height_loc, (GLfloat) cur_height);
+
+    /* viewport size, needed to get normalized texture coordinates */
+    GLint scale_loc = raycast_shader->uniformLocation("scale");
+
+    GLfloat scale[3];
+    scale[0] = opt.xscale;
+    scale[1] = opt.yscale;
+    scale[2] = opt.zscale;
+    glUniform3fv(scale_loc, 1, scale);
+
+
+    /* how many samples we want in our ray integral, per voxel */
+    GLint rate_loc = raycast_shader->uniformLocation("sampling_rate");
+    glUniform1f(rate_loc, get_sampling_rate());
+    GLint volume_size_loc = raycast_shader->uniformLocation("volume_size");
+    glUniform3f(volume_size_loc, opt.width, opt.height, opt.depth);
+    GLint world_step_loc = raycast_shader->uniformLocation("world_step");
+    glUniform1f(world_step_loc, get_world_step());
+    /* shading is the expensive part, skip it while interacting */
+    GLint shading_loc = raycast_shader->uniformLocation("shading");
+    glUniform1i(shading_loc, p.fast_rendering ? 0 : 1);
+
+    /* compositing mode (front to back, mip, mida), mida doesn't really work */
+    GLuint compositing_mode_loc = raycast_shader->uniformLocation("compositing_mode");
+    glUniform1i(compositing_mode_loc, (GLint) p.compositing_mode);
+
+    /* shading mode (blinn phong, toon, none) */
+    GLuint shading_mode_loc = raycast_shader->uniformLocation("shading_mode");
+    glUniform1i(shading_mode_loc, (GLint) p.shading_mode);
+
+    /* shading parameters */
+    GLint light_color_loc = raycast_shader->uniformLocation("light_color");
+    glUniform3fv(light_color_loc, 1, (GLfloat *) p.light_color);
+    GLint ka_loc = raycast_shader->uniformLocation("ka");
+    glUniform1f(ka_loc, p.ambient_reflectance);
+    GLint kd_loc = raycast_shader->uniformLocation("kd");
+    glUniform1f(kd_loc, p.diffuse_reflectance);
+    GLint ks_loc = raycast_shader->uniformLocation("ks");
+    glUniform1f(ks_loc, p.specular_reflectance);
+
+
+    /* second pass: render the cube again with backface culling, now
+     * the color data stores the starting position for our raycasting
+     * computation */
+    render_cube(raycast_shader, GL_BACK);
+    raycast_shader->release();
+
+    if (collect_stats) {
+        glEnablei(GL_BLEND, 1);
+        glEnablei(GL_BLEND, 2);
+
+        /* visible result to the result target */
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, stats_fbo);
+        glReadBuffer(GL_COLOR_ATTACHMENT0);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, out_fbo);
+        glBlitFramebuffer(0, 0, cur_width, cur_height,
+                          0, 0, cur_width, cur_height,
+                          GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+        reduce_ray_stats();
+        glBindFramebuffer(GL_FRAMEBUFFER, out_fbo);
+    }
+
+}
+
+/* Render the same frame from the native volume and from the stored
+   one and compare, once, as soon as there's a transfer function.
+   Only with --storage-report, the native copy costs as much memory as
+   we're trying to save.
+*/
+void Renderer::report_rendering_error(GLuint out_fbo)
+{
+    GLuint stored_texture = volume_texture;
+    int stored_format = volume_format;
+    size_t len = (size_t) 4 * cur_width * cur_height;
+    uint8_t *pixels[2];
+
+    /* the reference has no mipmaps, and the stored volume is what
+     * we compare, not its classified copy */
+    bool saved_lod = lod;
+    bool saved_preclassified = preclassified;
+    lod = false;
+    preclassified = false;
+
+    for (int k=0; k<2; k++) {
+        volume_texture = k == 0 ? reference_texture : stored_texture;
+        volume_format = k == 0 ? VOLUME_FORMAT_NORMALIZED : stored_format;
+        render_volume(out_fbo, false, false);
+
+        pixels[k] = (uint8_t *) malloc(len);
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, out_fbo);
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glReadPixels(0, 0, cur_width, cur_height, GL_RGBA, GL_UNSIGNED_BYTE, pixels[k]);
+    }
+
+    volume_texture = stored_texture;
+    volume_format = stored_format;
+    lod = saved_lod;
+    preclassified = saved_preclassified;
+
+    /* color only, alpha is whatever the blending left */
+    double sum = 0.0;
+    int max_error = 0;
+    for (size_t i=0; i<len; i+=4) {
+        for (int c=0; c<3; c++) {
+            int e = abs(pixels[0][i+c] - pixels[1][i+c]);
+            sum += e * e;
+            max_error = MAX(max_error, e);
+        }
+    }
+
+    double rmse = len ? sqrt(sum / (len / 4 * 3)) / 255.0 : 0.0;
+    printf("Rendering error (%s vs native, %dx%d): rmse %.5f, max %d/255, psnr %.1f dB\n",
+           volume_storage_to_string(storage).toUtf8().data(), cur_width, cur_height,
+           rmse, max_error, rmse > 0.0 ? 20.0 * log10(1.0 / rmse) : INFINITY);
+
+    free(pixels[0]);
+    free(pixels[1]);
+
+    glDeleteTextures(1, &reference_texture);
+    reference_texture = 0;
+}
@@ -0,0 +1,593 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <QObject>
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QOpenGLFunctions_3_2_Core>
+#include <QOpenGLShaderProgram>
+#include <QMatrix4x4>
+#include <QQuaternion>
+#include <QImage>
+#include <QVector3D>
+#include <QVector>
+#include <QRect>
+#include <QMutex>
+#include <QAtomicPointer>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QFutureSynchronizer>
+
+#include "util.h"
+#include "frameprofiler.h"
+#include "histogram.h"
+#include "volumestorage.h"
+#include "volumepyramid.h"
+#include "volumecache.h"
+#include "sortlast.h"
+#include "volumeseries.h"
+#include "volumemask.h"
+#include "volumeprobe.h"
+
+/* sampling rate presets, still frames */
+enum {
+    QUALITY_PREVIEW,
+    QUALITY_INTERACTIVE,
+    QUALITY_FINAL
+};
+
+/* when to sample a pre-classified rgba volume instead of the volume
+ * and the transfer function, see update_classification() */
+enum {
+    PRECLASSIFY_AUTO,
+    PRECLASSIFY_ALWAYS,
+    PRECLASSIFY_NEVER
+};
+
+/* the transfer function has to stay put this long before we spend a
+ * pass over the volume on it */
+#define PRECLASSIFY_SETTLE_MS 1500
+
+/* opacity corrected transfer function tables, a couple of step sizes
+ * for each of the 1D and 2D tables is all we ever need */
+#define TF_CACHE_SIZE 4
+
+typedef struct _TFCacheEntry
+{
+    GLuint tex;
+    int table;          /* 0: 1D, 1: 2D, -1: unused */
+    float step;
+    quint64 version;    /* of the source table */
+    quint64 last_used;
+    int width;
+    int height;
+    /* 1D entries: range edited since the table was corrected, -1 when
+     * unknown, see Renderer::apply_params() */
+    int dirty_first;
+    int dirty_last;
+} TFCacheEntry;
+
+/* Everything a frame depends on that the gui can change, posted whole
+ * to the render thread. Each side keeps its own transfer function
+ * tables and only the edited range travels, see render_params_copy() */
+typedef struct _RenderParams
+{
+    quint64 serial;     /* assigned by Renderer::post() */
+
+    int width;
+    int height;
+
+    QQuaternion rotation;
+    float depth;
+
+    int compositing_mode;
+    int shading_mode;
+    float background_color[4];
+    float light_color[3]; /* no alpha here */
+    double ambient_reflectance;
+    double diffuse_reflectance;
+    double specular_reflectance;
+
+    bool fast_rendering;
+    int quality;
+    bool fixed_step;
+    bool lod;
+    bool ray_stats;
+    bool frame_timing;
+
+    /* physical units, see window_map() in util.h, changing it costs no
+     * upload */
+    double window_level;
+    double window_width;
+
+    int dataset;        /* of the session, see switch_dataset() */
+
+    /* time point of a series, see show_series_frame() */
+    int series_frame;
+    bool series_playing;
+
+    /* rgba, 4 floats per entry, and the range changed since the last
+     * message the renderer took, -1 when clean */
+    QVector<float> tf;
+    quint64 tf_version;
+    int tf_dirty_first;
+    int tf_dirty_last;
+
+    QVector<float> tf2d;
+    int tf2d_width;
+    int tf2d_height;
+    quint64 tf2d_version;
+    int tf_mode;
+} RenderParams;
+
+void render_params_init(RenderParams *params, const InitOptions &opt);
+/* everything in @src but the tables, which keep their own storage:
+ * entries @first..@last of the 1D one (all of it if the size changed)
+ * and the 2D one if its version did. Same sizes never allocate */
+void render_params_copy(RenderParams *dst, const RenderParams &src, int first, int last);
+/* volume coordinates to clip space, what the raycaster sees */
+QMatrix4x4 render_params_mvp(const RenderParams &params, const InitOptions &opt);
+/* samples per voxel crossed by the ray, see Renderer::get_sampling_rate() */
+float render_sampling_rate(int quality);
+
+/* A volume of the session we're not looking at, parked on the gpu
+ * with everything derived from it, the renderer state it was swapped
+ * out of */
+typedef struct _ResidentVolume
+{
+    int dataset;
+    quint64 last_viewed;
+
+    GLuint texture;
+    Histogram histogram;
+    VolumeStorage storage;
+    int format;
+    bool wide;
+    int shift;
+    size_t bytes;
+    GLuint dequant_texture;
+    float dequant[STORAGE_CODES];
+    uint16_t *data;
+    int quant_mode;
+    quint64 quant_version;
+    float quant_scale;
+    float quant_offset;
+    QVector<PyramidLevel> mips[2];
+    int mip_filter;
+    size_t mip_bytes;
+} ResidentVolume;
+
+/* A volume read and encoded off the render thread, everything
+ * upload_volume() needs but the gl calls */
+typedef struct _PreparedVolume
+{
+    void *rg;           /* as read, shifted for the encoders */
+    bool wide;
+    int w, h, d;
+    VolumeStorage storage;
+    int shift;
+    void *stored;       /* level 0 as uploaded, NULL if it's rg */
+    size_t stored_size;
+    float dequant[STORAGE_CODES];
+    QVector<PyramidLevel> mips[2];
+    bool have_error;
+    StorageError error;
+} PreparedVolume;
+
+/* everything the pre-classified volume depends on */
+typedef struct _ClassifyKey
+{
+    quint64 volume_version;
+    int tf_mode;
+    quint64 tf_version;     /* of the table in use */
+    double window_level;
+    double window_width;
+    quint64 mask_version;
+} ClassifyKey;
+
+/* tf8 codes for a transfer function, encoded on a pool thread with
+ * their mipmaps, see Renderer::requantize_volume() */
+typedef struct _Requantization
+{
+    int tf_mode;        /* what they were made for */
+    quint64 version;
+    float scale;
+    float offset;
+
+    uint8_t *codes;
+    float dequant[STORAGE_CODES];
+    QVector<PyramidLevel> mips[2];
+    bool have_error;    /* --storage-report only */
+    StorageError error;
+    double ms;
+} Requantization;
+
+/* what the widget needs to blit the newest finished frame */
+typedef struct _RenderedFrame
+{
+    GLuint texture;
+    int width;
+    int height;
+    quint64 serial;     /* of the params it was rendered from */
+    bool complete;      /* false while a still frame is refining */
+    GLsync ready;       /* wait on it before reading, 0 if already
+                         * waited on, the caller deletes it */
+} RenderedFrame;
+
+/* crossing threads in queued signals */
+Q_DECLARE_METATYPE(Histogram)
+Q_DECLARE_METATYPE(FrameStats)
+
+/* The raycaster, on its own thread with a context shared with the
+   widget. Frames go to one of two offscreen result textures, the
+   widget blits the other one, so the gui never waits for a frame.
+
+   Parameters come in through a single slot mailbox: post() swaps the
+   new set in and whatever the render thread didn't get to yet is
+   dropped, at most one frame is ever pending behind the one being
+   rendered. Messages are recycled, taken ones come back through
+   another slot and dropped ones are reused right away, so editing
+   allocates nothing once a few are around.
+*/
+class Renderer : public QObject, protected QOpenGLFunctions_3_2_Core
+{
+    Q_OBJECT
+
+public:
+    Renderer(const InitOptions &opt);
+    ~Renderer();
+
+    /* gui thread: the context must be shared with the widget one and
+     * already moved to our thread, we own it from now on. The surface
+     * stays with the caller, surfaces live on the gui thread */
+    void set_surface(QOpenGLContext *context, QOffscreenSurface *surface);
+
+    /* gui thread, copies @params into a message and marks its tables
+     * clean, returns the serial the frame will be tagged with */
+    quint64 post(RenderParams &params);
+
+    /* gui thread, with the widget context current. The front frame
+     * stays ours until release_frame(), the render thread can't swap
+     * buffers meanwhile, so only issue the blit in between */
+    bool acquire_frame(RenderedFrame *frame);
+    void release_frame(GLsync released);
+
+    /* --probe: the cpu copy of the volume, NULL without it. Any
+     * thread, see volume_probe_pick() */
+    VolumeProbe *get_probe() { return probe; }
+
+public slots:
+    void init();
+    void shutdown();
+    void render_pending();
+    bool open_stats_log(const QString &path);
+    void render_tiles(quint64 serial);
+    void export_poster(const QString &path, int width, int height);
+    void record_sequence(const QString &pattern, int path, int frames,
+                         int width, int height);
+    void serve_slabs();
+    /* --mask: cut what projects through @mvp onto the set pixels of
+     * @coverage, or everything connected to the first voxel at least
+     * as bright as the bottom of the window along @from-@to, volume
+     * coordinates, see volumemask.h */
+    void mask_cut(const QImage &coverage, const QMatrix4x4 &mvp);
+    void mask_flood(const QVector3D &from, const QVector3D &to);
+    void mask_clear();
+
+signals:
+    void initialized(const QString &renderer, const QString &gl_version);
+    void histogram_ready(const Histogram &histogram);
+    void volume_ready(int storage, qulonglong bytes);
+    void dataset_ready(int dataset, bool resident, double ms);
+    /* @dataset couldn't be read, @current is still on screen */
+    void dataset_failed(int dataset, int current);
+    /* @late: frames so far that weren't read in time */
+    void series_frame_shown(int frame, int late);
+    /* @cut: voxels cut by the edit, @total: by all of them */
+    void mask_edited(qulonglong cut, qulonglong total, double ms);
+    void stats_ready(const FrameStats &stats);
+    void frame_ready(quint64 serial);
+    void export_progress(int done, int total);
+    void export_finished(bool ok, const QString &path);
+    void slabs_finished();
+
+private slots:
+    void full_volume_ready();
+    void preload_ready();
+    void requantize_ready();
+    void series_poll();
+    void classify_poll();
+
+private:
+    void apply_params(RenderParams *params);
+    void recycle_params(RenderParams *params);
+    void render_frame();
+    int acquire_back_buffer();
+    void build_tiles(int w, int h);
+    void render_tile(int back);
+    void abort_tiles();
+    void init_result_target(int i, int w, int h);
+    void publish_frame(int i, bool complete);
+    bool begin_export();
+    void end_export();
+    GLuint new_export_target(int w, int h, GLuint *color, GLuint *depth);
+    void delete_export_target(GLuint out_fbo, GLuint color, GLuint depth);
+    QByteArray map_readback(GLuint pbo, GLsync fence, int bytes);
+    void render_slabs(int back);
+    void publish_slab_params();
+    RenderParams *take_slab_params();
+
+    GLuint load_volume_texture();
+    GLuint new_volume_texture(GLint filter);
+    GLuint upload_volume(void *rg, bool wide, GLuint w, GLuint h, GLuint d);
+    GLuint upload_volume(PreparedVolume *pv);
+    GLuint upload_prepared(PreparedVolume *pv);
+    GLuint upload_preview(const VolumeCache &cache);
+    void load_volume_async();
+    void finish_volume_loading();
+    void switch_dataset(int i);
+    void stash_volume(ResidentVolume *r);
+    void restore_volume(ResidentVolume *r);
+    void free_resident(ResidentVolume *r);
+    int find_resident(int i);
+    void evict_volumes();
+    void preload_next();
+    GLuint init_series();
+    void upload_series_frame(SeriesFrame *f, int t);
+    void show_series_frame();
+    void upload_dequant_table(GLuint *texture, const float *table);
+    void upload_pyramid(VolumeStorage s, bool wide, const QVector<PyramidLevel> &levels);
+    void upload_mips();
+    void update_mip_filter();
+    void requantize_volume(bool wait);
+    void finish_requantize(bool adopt);
+    void intensity_map(float *scale, float *offset);
+    void update_classification();
+    bool classification_fits(size_t bytes);
+    void classify_volume();
+    void bind_volume(QOpenGLShaderProgram *shader, bool corrected_tables);
+    void init_mask();
+    void upload_mask_box(int level, const void *data, int w, int h, const int box[6]);
+    void upload_mask();
+    void finish_mask_edit(size_t cut, const QElapsedTimer &timer);
+    void report_rendering_error(GLuint out_fbo);
+    GLuint load_transfer_function_from_data(float *data, size_t sz);
+    void init_target_texture(int w, int h);
+    void init_fbo(int w, int h);
+    void render_cube(QOpenGLShaderProgram *shader, GLuint cull_face);
+    void render_volume(GLuint out_fbo, bool collect_stats, bool profile);
+    void render_first_pass();
+    void render_raycast(GLuint out_fbo, bool collect_stats);
+    void init_stats_targets(int w, int h);
+    void reduce_ray_stats();
+    void upload_transfer_function();
+    float get_sampling_rate();
+    float get_world_step();
+    GLuint corrected_transfer_function(int table, float step);
+
+    InitOptions opt;
+
+    QOpenGLContext *context;
+    QOffscreenSurface *surface;
+    bool gl_ready;
+
+    /* newest parameters the gui posted, NULL once taken */
+    QAtomicPointer<RenderParams> mailbox;
+    QAtomicInt wake_pending;
+    /* taken and applied, back to the gui for the next post() */
+    QAtomicPointer<RenderParams> recycled;
+    /* gui thread only: a dropped message to reuse, and the 1D table
+     * range of the one in the mailbox, it might get dropped too */
+    quint64 posted_serial;
+    RenderParams *spare;
+    int inflight_first;
+    int inflight_last;
+
+    /* the set the current frame renders from */
+    RenderParams p;
+    bool have_params;
+
+    /* double buffered results, the lock guards the swap and the
+     * widget blit, never a whole frame */
+    QMutex exchange_lock;
+    int front;
+    GLuint result_texture[2];
+    GLuint result_fbo[2];
+    GLuint result_db[2];
+    int result_width[2];
+    int result_height[2];
+    quint64 result_serial[2];
+    bool result_complete[2];
+    GLsync result_ready[2];
+    GLsync result_released[2];
+
+    QOpenGLShaderProgram *distance_shader;
+    QOpenGLShaderProgram *raycast_shader;
+    QOpenGLShaderProgram *classify_shader;
+
+    QMatrix4x4 proj;
+    QMatrix4x4 model;
+    QMatrix4x4 view;
+
+    GLuint vao;
+    GLuint db;
+    GLuint fbo;
+    GLuint target_texture;
+
+    GLuint volume_texture;
+    Histogram histogram;
+
+    /* storage actually in use, the one asked for might not be
+     * supported by the driver or make sense for the data */
+    VolumeStorage storage;
+    int volume_format;
+    bool volume_wide;
+    int volume_shift;   /* bits the intensity was moved up on upload */
+    size_t volume_bytes;
+    GLuint dequant_texture;
+    float dequant[STORAGE_CODES];
+    /* tf8 only: 16 bit copy to requantize from, codes for the table
+     * in use are made in the background while the old ones show */
+    uint16_t *volume_data;
+    QFutureWatcher<Requantization *> *requantizer;
+    int quant_mode;
+    quint64 quant_version;
+    float quant_scale;
+    float quant_offset;
+    /* native copy for the one off rendering error report */
+    GLuint reference_texture;
+    /* bumped whenever what's in volume_texture changes */
+    quint64 volume_version;
+
+    /* pre-classification: the volume through the transfer function,
+     * rgba, rebuilt once edits settle, see update_classification() */
+    bool preclassified;
+    GLuint classified_texture;
+    size_t classified_bytes;
+    int classified_size[3];
+    ClassifyKey classified_key;
+    ClassifyKey classify_pending_key;
+    QElapsedTimer classify_timer;   /* since the key last changed */
+    GLuint classify_fbo;
+    bool classify_poll_pending;
+    bool classify_warned;
+
+    /* cuts, the cpu copy is edited and the bricks it marks dirty
+     * uploaded, with their part of each mip level */
+    VolumeMask *mask;
+    GLuint mask_texture;
+    quint64 mask_version;
+
+    /* what's on the gpu once more, for rays cast on the cpu, the
+     * mask edits and the gui picks share it */
+    VolumeProbe *probe;
+
+    /* cpu side pyramids for both filters, the one matching the
+     * compositing mode is on the gpu, the raycaster picks a level
+     * from the voxel footprint on screen */
+    QVector<PyramidLevel> mips[2];
+    int mip_filter;
+    size_t mip_bytes;
+    bool lod;
+
+    /* full resolution volume loading behind the cached preview */
+    QFutureWatcher<void *> *volume_loader;
+    Histogram loader_histogram;
+    bool loader_wide;
+    QElapsedTimer loader_timer;
+    /* cold opens write the preview cache in the background, nobody
+     * waits for them but shutdown() */
+    QFutureSynchronizer<void> cache_writers;
+
+    /* session: volumes of the other datasets stay on the gpu until
+     * the budget runs out, least recently viewed go first, the next
+     * one in the list is read ahead while we look at this one */
+    int dataset;
+    quint64 view_clock;
+    QVector<ResidentVolume> resident;
+    QVector<bool> dataset_unreadable;   /* tried once, not again */
+    QFutureWatcher<PreparedVolume *> *preloader;
+    int preload_dataset;
+    Histogram preload_histogram;
+
+    /* time series: the frame on screen is in one texture, the next
+     * one goes to the other through the pixel buffer, each knows the
+     * bricks it holds so only the ones that changed are uploaded */
+    VolumeSeries *series;
+    GLuint series_texture[2];
+    int series_front;
+    int series_shown[2];        /* frame in each texture, -1 for none */
+    QVector<quint64> series_bricks[2];
+    Histogram series_histogram[2];
+    GLuint series_pbo;
+    int series_late;
+    int series_late_frame;      /* last one counted */
+    int series_histogram_frame; /* last one the editor got */
+    bool series_poll_pending;
+    GLuint transfer_function;
+
+    /* range of the 1D table changed since the last upload, -1 when
+     * clean, the table itself is in the params */
+    int tf_texture_len;
+    int tf_dirty_first;
+    int tf_dirty_last;
+
+    /* 2D transfer function, uploaded whole when dirty */
+    GLuint transfer_function_2d;
+    bool tf2d_dirty;
+
+    /* fixed world space step, opacity correction baked into cached
+     * tables instead of a pow per sample */
+    quint64 tf_cache_clock;
+    TFCacheEntry tf_cache[TF_CACHE_SIZE];
+    float *tf_corrected;
+    int tf_corrected_len;
+
+    int cur_width;
+    int cur_height;
+
+    /* still frame split in screen tiles, raycast one per event loop
+     * iteration so new params can cut in, see render_tiles() */
+    QVector<QRect> tiles;
+    int tile_next;
+    quint64 tile_serial;
+    double tile_cpu_time;
+    GLsync tile_fence;
+
+    /* sort-last: only a slab of the volume along z is ours, the
+     * texture has a few ghost slices past it on each side for the
+     * filtering and the gradients, see sortlast.h */
+    bool slab_mode;
+    SortLast sort_last;
+    int slab_first;
+    int slab_end;
+    int slab_tex_first;
+    int slab_tex_end;
+    QVector<uchar> slab_final;
+    bool slab_warned;
+
+    /* what the interaction state was before an export */
+    bool export_fast_rendering;
+
+    FrameProfiler *profiler;
+
+    /* ray cost statistics: the raycast pass goes to an offscreen
+     * power of two target with extra counter attachments, mipmaps
+     * reduce them to a single texel which we read back a frame late */
+    int stats_width;
+    int stats_height;
+    GLuint stats_fbo;
+    GLuint stats_read_fbo;
+    GLuint stats_color;
+    GLuint stats_tex[2];
+    GLuint stats_db;
+    GLuint stats_pbo[2];
+    GLsync stats_fence[2];
+    int stats_slot;
+    FrameStats last_ray_stats;
+};
+
+#endif /* RENDERER_H */
@@ -0,0 +1,532 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#include "renderserver.h"
+#include "presetmanager.h"
+#include "transfuncwidget.h"
+
+#include <QBuffer>
+#include <QDataStream>
+#include <QDir>
+#include <QFileInfo>
+#include <QImage>
+#include <QLocalSocket>
+#include <QTcpSocket>
+#include <QtConcurrent>
+
+#include <stdio.h>
+
+/* anything bigger is a broken client */
+#define SERVER_MAX_MESSAGE (64 << 20)
+/* frames queued on a slow client are stale, drop new ones past this */
+#define SERVER_MAX_BACKLOG (32 << 20)
+
+#define SERVER_JPEG_QUALITY 90
+
+/* on a pool thread, flips and encodes in place */
+static ServerFrame encode_frame(ServerFrame f)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QImage image(f.width, f.height, QImage::Format_RGB888);
+    const uchar *in = (const uchar *) f.pixels.constData();
+    for (int y=0; y<f.height; y++) {
+        const uchar *src = in + (size_t) (f.height - 1 - y) * f.width * 4;
+        uchar *dst = image.scanLine(y);
+        for (int x=0; x<f.width; x++) {
+            dst[3*x + 0] = src[4*x + 0];
+            dst[3*x + 1] = src[4*x + 1];
+            dst[3*x + 2] = src[4*x + 2];
+        }
+    }
+
+    QByteArray data;
+    if (f.encoding == ENCODING_RAW) {
+        data.reserve(f.width * f.height * 3);
+        for (int y=0; y<f.height; y++)
+            data.append((const char *) image.constScanLine(y), f.width * 3);
+    } else {
+        QBuffer buffer(&data);
+        buffer.open(QIODevice::WriteOnly);
+        image.save(&buffer, f.encoding == ENCODING_PNG ? "PNG" : "JPG",
+                   f.encoding == ENCODING_PNG ? -1 : SERVER_JPEG_QUALITY);
+    }
+
+    f.pixels = data;
+    f.encode_time = timer.nsecsElapsed() / 1e6;
+
+    return f;
+}
+
+RenderServer::RenderServer(const InitOptions &opt)
+{
+    this->opt = opt;
+
+    render_params_init(&params, opt);
+    params.width = 512;
+    params.height = 512;
+
+    /* something to look at until the client sends its own */
+    Preset preset;
+    params.tf.fill(0.0, 4 * TF_CHANNEL_SIZE);
+    preset_to_rgba(&preset, params.tf.data(), TF_CHANNEL_SIZE);
+    params.tf_version = 1;
+    params.tf_dirty_first = 0;
+    params.tf_dirty_last = TF_CHANNEL_SIZE - 1;
+    encoding = ENCODING_JPEG;
+    request = 0;
+    client_time = 0;
+    request_timer.start();
+
+    preview_serial = 0;
+    final_serial = 0;
+    read_serial = 0;
+    have_waiting = false;
+
+    local_server = NULL;
+    tcp_server = NULL;
+    client = NULL;
+
+    encoder = new QFutureWatcher<ServerFrame>(this);
+    connect(encoder, &QFutureWatcher<ServerFrame>::finished,
+            this, &RenderServer::encode_done);
+
+    /* our context only reads frames back, the renderer has its own
+     * on its own thread */
+    QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+
+    surface = new QOffscreenSurface();
+    surface->setFormat(format);
+    surface->create();
+    render_surface = new QOffscreenSurface();
+    render_surface->setFormat(format);
+    render_surface->create();
+
+    context = new QOpenGLContext();
+    context->setFormat(format);
+    if (!context->create() || !context->makeCurrent(surface)) {
+        fprintf(stderr, "couldn't create the server context\n");
+        exit(1);
+    }
+    initializeOpenGLFunctions();
+    glGenFramebuffers(1, &read_fbo);
+    glGenBuffers(1, &read_pbo);
+    read_pbo_size = 0;
+
+    QOpenGLContext *render_context = new QOpenGLContext();
+    render_context->setFormat(format);
+    render_context->setShareContext(context);
+    if (!render_context->create()) {
+        fprintf(stderr, "couldn't create the render context\n");
+        exit(1);
+    }
+
+    render_thread = new QThread(this);
+    renderer = new Renderer(opt);
+    renderer->moveToThread(render_thread);
+    render_context->moveToThread(render_thread);
+    renderer->set_surface(render_context, render_surface);
+
+    connect(renderer, &Renderer::initialized,
+            this, &RenderServer::renderer_initialized);
+    connect(renderer, &Renderer::frame_ready,
+            this, &RenderServer::frame_ready);
+
+    render_thread->start();
+    QMetaObject::invokeMethod(renderer, "init", Qt::QueuedConnection);
+}
+
+RenderServer::~RenderServer()
+{
+    encoder->waitForFinished();
+
+    QMetaObject::invokeMethod(renderer, "shutdown", Qt::BlockingQueuedConnection);
+    render_thread->quit();
+    render_thread->wait();
+    delete renderer;
+    delete render_surface;
+
+    context->makeCurrent(surface);
+    glDeleteFramebuffers(1, &read_fbo);
+    glDeleteBuffers(1, &read_pbo);
+    context->doneCurrent();
+    delete context;
+    delete surface;
+}
+
+bool RenderServer::listen(const QString &address)
+{
+    bool is_port;
+    int port = address.toInt(&is_port);
+
+    if (is_port) {
+        tcp_server = new QTcpServer(this);
+        connect(tcp_server, &QTcpServer::newConnection,
+                this, &RenderServer::new_connection);
+        if (!tcp_server->listen(QHostAddress::LocalHost, port)) {
+            fprintf(stderr, "couldn't listen on port %d: %s\n", port,
+                    tcp_server->errorString().toUtf8().data());
+            return false;
+        }
+        printf("Listening on localhost:%d\n", tcp_server->serverPort());
+        return true;
+    }
+
+    local_server = new QLocalServer(this);
+    connect(local_server, &QLocalServer::newConnection,
+            this, &RenderServer::new_connection);
+    /* left over from a crash */
+    QLocalServer::removeServer(address);
+    if (!local_server->listen(address)) {
+        fprintf(stderr, "couldn't listen on %s: %s\n", address.toUtf8().data(),
+                local_server->errorString().toUtf8().data());
+        return false;
+    }
+    printf("Listening on %s\n", local_server->fullServerName().toUtf8().data());
+
+    return true;
+}
+
+void RenderServer::renderer_initialized(const QString &renderer, const QString &gl_version)
+{
+    Q_UNUSED(gl_version);
+
+    renderer_string = renderer;
+    if (client)
+        send_info();
+}
+
+/* one client at a time, the renderer can't serve two views */
+void RenderServer::new_connection()
+{
+    QIODevice *socket;
+    if (tcp_server)
+        socket = tcp_server->nextPendingConnection();
+    else
+        socket = local_server->nextPendingConnection();
+
+    if (client) {
+        fprintf(stderr, "already serving a client, dropping the new one\n");
+        socket->close();
+        socket->deleteLater();
+        return;
+    }
+
+    client = socket;
+    inbox.clear();
+    connect(client, SIGNAL(readyRead()), this, SLOT(client_ready_read()));
+    connect(client, SIGNAL(disconnected()), this, SLOT(client_disconnected()));
+
+    printf("Client connected\n");
+    send_info();
+    request_frame();
+}
+
+void RenderServer::client_disconnected()
+{
+    printf("Client disconnected\n");
+
+    client->deleteLater();
+    client = NULL;
+    preview_serial = 0;
+    final_serial = 0;
+    have_waiting = false;
+}
+
+/* everything that came in at once is applied before posting, a burst
+ * of camera updates renders only the last one */
+void RenderServer::client_ready_read()
+{
+    bool changed = false;
+
+    inbox.append(client->readAll());
+
+    while (inbox.size() >= 4) {
+        QDataStream in(inbox);
+        in.setByteOrder(QDataStream::LittleEndian);
+        quint32 len;
+        in >> len;
+
+        if (len < 1 || len > SERVER_MAX_MESSAGE) {
+            fprintf(stderr, "bad message length %u, dropping the client\n", len);
+            client->close();
+            return;
+        }
+        if ((quint32) inbox.size() < 4 + len)
+            break;
+
+        quint8 type = inbox[4];
+        QByteArray payload = inbox.mid(5, len - 1);
+        inbox.remove(0, 4 + len);
+
+        if (!handle_message(type, payload, &changed)) {
+            fprintf(stderr, "bad message %u, dropping the client\n", type);
+            client->close();
+            return;
+        }
+    }
+
+    if (changed)
+        request_frame();
+}
+
+bool RenderServer::handle_message(quint8 type, const QByteArray &payload, bool *changed)
+{
+    QDataStream in(payload);
+    in.setByteOrder(QDataStream::LittleEndian);
+    in.setFloatingPointPrecision(QDataStream::SinglePrecision);
+
+    if (type == SERVER_MSG_VIEWPORT) {
+        quint32 w, h;
+        in >> w >> h;
+        params.width = CLAMP((int) w, 16, 8192);
+        params.height = CLAMP((int) h, 16, 8192);
+        *changed = true;
+        return in.status() == QDataStream::Ok;
+    }
+
+    if (type == SERVER_MSG_PING) {
+        quint64 t;
+        in >> t;
+        QByteArray pong;
+        QDataStream out(&pong, QIODevice::WriteOnly);
+        out.setByteOrder(QDataStream::LittleEndian);
+        out << t;
+        send(SERVER_MSG_PONG, pong);
+        return in.status() == QDataStream::Ok;
+    }
+
+    /* the rest are requests */
+    in >> request >> client_time;
+    request_timer.start();
+    *changed = true;
+
+    switch (type) {
+    case SERVER_MSG_CAMERA: {
+        float w, x, y, z, depth;
+        in >> w >> x >> y >> z >> depth;
+        params.rotation = QQuaternion(w, x, y, z).normalized();
+        params.depth = CLAMP(depth, 0.1f, 4.0f);
+        break;
+    }
+    case SERVER_MSG_TF: {
+        quint32 n;
+        in >> n;
+        if (n < 2 || n > 65536 || (quint32) payload.size() < 16 + 16 * n)
+            return false;
+        params.tf.resize(4 * n);
+        for (quint32 i=0; i<4*n; i++)
+            in >> params.tf[i];
+        params.tf_version++;
+        params.tf_dirty_first = 0;
+        params.tf_dirty_last = n - 1;
+        params.tf_mode = 0;
+        break;
+    }
+    case SERVER_MSG_PRESET: {
+        QString name = QString::fromUtf8(payload.mid(12));
+        QString path = QDir("presets").filePath(name);
+        if (name.contains("..") || !QFileInfo(path).isFile()) {
+            fprintf(stderr, "no such preset: %s\n", name.toUtf8().data());
+            return true;
+        }
+        Preset preset(path);
+        params.tf.fill(0.0, 4 * TF_CHANNEL_SIZE);
+        preset_to_rgba(&preset, params.tf.data(), TF_CHANNEL_SIZE);
+        params.tf_version++;
+        params.tf_dirty_first = 0;
+        params.tf_dirty_last = TF_CHANNEL_SIZE - 1;
+        params.tf_mode = 0;
+        break;
+    }
+    case SERVER_MSG_QUALITY: {
+        quint8 quality, compositing, shading, enc;
+        in >> quality >> compositing >> shading >> enc;
+        params.quality = CLAMP((int) quality, (int) QUALITY_PREVIEW, (int) QUALITY_FINAL);
+        params.compositing_mode = CLAMP((int) compositing, 0, 2);
+        params.shading_mode = CLAMP((int) shading, 0, 3);
+        encoding = CLAMP((int) enc, (int) ENCODING_JPEG, (int) ENCODING_RAW);
+        break;
+    }
+    default:
+        return false;
+    }
+
+    return in.status() == QDataStream::Ok;
+}
+
+/* preview first, frame_ready() posts the final one once it's in */
+void RenderServer::request_frame()
+{
+    params.fast_rendering = true;
+    preview_serial = renderer->post(params);
+    final_serial = 0;
+}
+
+void RenderServer::frame_ready(quint64 serial)
+{
+    Q_UNUSED(serial);
+
+    if (!client)
+        return;
+
+    context->makeCurrent(surface);
+
+    RenderedFrame f;
+    if (!renderer->acquire_frame(&f))
+        return;
+
+    if (f.ready) {
+        glWaitSync(f.ready, 0, GL_TIMEOUT_IGNORED);
+        glDeleteSync(f.ready);
+    }
+
+    /* queued signals can come after the frame they were for was
+     * replaced, and superseded requests aren't worth sending */
+    int stage;
+    if (f.serial == final_serial)
+        stage = STAGE_FINAL;
+    else if (f.serial == preview_serial)
+        stage = STAGE_PREVIEW;
+    else
+        stage = -1;
+
+    if (stage < 0 || !f.complete || f.serial <= read_serial) {
+        renderer->release_frame(0);
+        return;
+    }
+    read_serial = f.serial;
+
+    int bytes = f.width * f.height * 4;
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fbo);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, f.texture, 0);
+    glReadBuffer(GL_COLOR_ATTACHMENT0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, read_pbo);
+    if (bytes > read_pbo_size) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+        read_pbo_size = bytes;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, f.width, f.height, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, 0, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+
+    GLsync released = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    renderer->release_frame(released);
+
+    /* the final frame renders while we copy and encode the preview */
+    if (stage == STAGE_PREVIEW) {
+        params.fast_rendering = false;
+        final_serial = renderer->post(params);
+    }
+
+    ServerFrame frame;
+    void *data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+    frame.pixels = QByteArray((const char *) data, bytes);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    frame.width = f.width;
+    frame.height = f.height;
+    frame.request = request;
+    frame.client_time = client_time;
+    frame.stage = stage;
+    frame.encoding = encoding;
+    frame.render_time = request_timer.nsecsElapsed() / 1e6;
+    frame.encode_time = 0.0;
+
+    start_encode(frame);
+}
+
+/* one at a time, a frame that comes in meanwhile replaces whatever
+ * was waiting */
+void RenderServer::start_encode(const ServerFrame &frame)
+{
+    if (encoder->isRunning()) {
+        waiting = frame;
+        have_waiting = true;
+        return;
+    }
+
+    encoder->setFuture(QtConcurrent::run(encode_frame, frame));
+}
+
+void RenderServer::encode_done()
+{
+    ServerFrame f = encoder->result();
+
+    if (have_waiting) {
+        have_waiting = false;
+        encoder->setFuture(QtConcurrent::run(encode_frame, waiting));
+        waiting = ServerFrame();
+    }
+
+    if (!client)
+        return;
+
+    /* a slow client only gets what it can keep up with, the final
+     * frame of the newest request always goes */
+    bool newest = f.request == request && f.stage == STAGE_FINAL;
+    if (client->bytesToWrite() > SERVER_MAX_BACKLOG && !newest)
+        return;
+
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out.setFloatingPointPrecision(QDataStream::SinglePrecision);
+    out << f.request << f.client_time << (quint8) f.stage << (quint8) f.encoding
+        << (quint32) f.width << (quint32) f.height
+        << (float) f.render_time << (float) f.encode_time;
+    payload.append(f.pixels);
+
+    send(SERVER_MSG_FRAME, payload);
+}
+
+void RenderServer::send(quint8 type, const QByteArray &payload)
+{
+    if (!client)
+        return;
+
+    QByteArray header;
+    QDataStream out(&header, QIODevice::WriteOnly);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out << (quint32) (payload.size() + 1) << type;
+
+    client->write(header);
+    client->write(payload);
+}
+
+void RenderServer::send_info()
+{
+    QByteArray payload;
+    QDataStream out(&payload, QIODevice::WriteOnly);
+    out.setByteOrder(QDataStream::LittleEndian);
+    out << (quint32) SERVER_PROTOCOL_VERSION
+        << (quint32) opt.width << (quint32) opt.height << (quint32) opt.depth;
+    payload.append(renderer_string.toUtf8());
+
+    send(SERVER_MSG_INFO, payload);
+}
@@ -0,0 +1,158 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include <QObject>
+#include <QThread>
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+#include <QOpenGLFunctions_3_2_Core>
+#include <QLocalServer>
+#include <QTcpServer>
+#include <QIODevice>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+
+#include "util.h"
+#include "renderer.h"
+
+#define SERVER_PROTOCOL_VERSION 1
+
+/* Protocol, little endian. Every message is a u32 length of what
+   follows, a u8 type and the payload. Requests start with a u32
+   request id and a u64 client timestamp, frames rendered from them
+   echo both back, see tools/qvrc_client.py
+*/
+enum {
+    /* client to server */
+    SERVER_MSG_VIEWPORT = 1,    /* u32 width, u32 height */
+    SERVER_MSG_CAMERA,          /* request, f32 rotation w x y z, f32 eye depth */
+    SERVER_MSG_TF,              /* request, u32 entries, f32 rgba per entry */
+    SERVER_MSG_PRESET,          /* request, utf8 preset file in presets/ */
+    SERVER_MSG_QUALITY,         /* request, u8 quality, u8 compositing mode,
+                                 * u8 shading mode, u8 encoding */
+    SERVER_MSG_PING,            /* u64 client timestamp */
+
+    /* server to client */
+    SERVER_MSG_INFO = 0x80,     /* u32 version, u32 volume width, height,
+                                 * depth, utf8 gl renderer */
+    SERVER_MSG_FRAME,           /* request, u8 stage, u8 encoding, u32 width,
+                                 * u32 height, f32 ms from the request to
+                                 * the readback, f32 encoding ms, image */
+    SERVER_MSG_PONG             /* u64 client timestamp */
+};
+
+typedef enum _FrameEncoding {
+    ENCODING_JPEG,
+    ENCODING_PNG,
+    ENCODING_RAW                /* rgb24, top row first */
+} FrameEncoding;
+
+/* every request gets a preview first, then the full quality frame */
+enum {
+    STAGE_PREVIEW,
+    STAGE_FINAL
+};
+
+/* a frame read back from the renderer on its way to the client */
+typedef struct _ServerFrame
+{
+    QByteArray pixels;  /* rgba as read back, then the encoded image */
+    int width;
+    int height;
+    quint32 request;
+    quint64 client_time;
+    int stage;
+    int encoding;
+    double render_time;
+    double encode_time;
+} ServerFrame;
+
+/* The renderer without a window, driven by a single client over a
+   local socket or a localhost tcp port. Requests that come in
+   together are merged before anything is posted and the renderer's
+   mailbox drops whatever it didn't get to, one frame encodes at a
+   time and only the newest one waits behind it.
+*/
+class RenderServer : public QObject, protected QOpenGLFunctions_3_2_Core
+{
+    Q_OBJECT
+
+public:
+    RenderServer(const InitOptions &opt);
+    ~RenderServer();
+
+    /* a port number listens on localhost, anything else is a local
+     * socket name or path */
+    bool listen(const QString &address);
+
+private slots:
+    void renderer_initialized(const QString &renderer, const QString &gl_version);
+    void new_connection();
+    void client_ready_read();
+    void client_disconnected();
+    void frame_ready(quint64 serial);
+    void encode_done();
+
+private:
+    bool handle_message(quint8 type, const QByteArray &payload, bool *changed);
+    void request_frame();
+    void start_encode(const ServerFrame &frame);
+    void send(quint8 type, const QByteArray &payload);
+    void send_info();
+
+    InitOptions opt;
+
+    Renderer *renderer;
+    QThread *render_thread;
+    QOpenGLContext *context;
+    QOffscreenSurface *surface;
+    QOffscreenSurface *render_surface;
+    GLuint read_fbo;
+    GLuint read_pbo;
+    int read_pbo_size;
+    QString renderer_string;
+
+    QLocalServer *local_server;
+    QTcpServer *tcp_server;
+    QIODevice *client;
+    QByteArray inbox;
+
+    /* what the client asked for so far, and the newest request */
+    RenderParams params;
+    int encoding;
+    quint32 request;
+    quint64 client_time;
+    QElapsedTimer request_timer;
+
+    quint64 preview_serial;
+    quint64 final_serial;
+    quint64 read_serial;
+
+    QFutureWatcher<ServerFrame> *encoder;
+    ServerFrame waiting;
+    bool have_waiting;
+};
+
+#endif /* RENDER_SERVER_H */
@@ -0,0 +1,250 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#include "shadercache.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <stdio.h>
+
+#define SHADER_CACHE_MAGIC 0x71767273 /* qvrs */
+#define SHADER_CACHE_VERSION 1
+
+/* ARB_get_program_binary, core in 4.1, the 3.2 headers don't have
+ * it */
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+
+typedef void (QOPENGLF_APIENTRYP GetProgramBinaryProc)(GLuint program, GLsizei size,
+                                                      GLsizei *length, GLenum *format,
+                                                      void *binary);
+typedef void (QOPENGLF_APIENTRYP ProgramBinaryProc)(GLuint program, GLenum format,
+                                                   const void *binary, GLsizei length);
+typedef void (QOPENGLF_APIENTRYP ProgramParameteriProc)(GLuint program, GLenum pname,
+                                                       GLint value);
+
+typedef struct _BinaryFunctions
+{
+    GetProgramBinaryProc get_program_binary;
+    ProgramBinaryProc program_binary;
+    ProgramParameteriProc program_parameteri;
+} BinaryFunctions;
+
+static bool resolve_binary_functions(QOpenGLContext *context, BinaryFunctions *f)
+{
+    if (context->format().version() < qMakePair(4, 1) &&
+        !context->hasExtension("GL_ARB_get_program_binary"))
+        return false;
+
+    f->get_program_binary = (GetProgramBinaryProc)
+        context->getProcAddress("glGetProgramBinary");
+    f->program_binary = (ProgramBinaryProc)
+        context->getProcAddress("glProgramBinary");
+    f->program_parameteri = (ProgramParameteriProc)
+        context->getProcAddress("glProgramParameteri");
+
+    return f->get_program_binary && f->program_binary && f->program_parameteri;
+}
+
+/* built in source, with @defines after the #version line, it has to
+ * stay first */
+static QByteArray read_source(const QString &path, const QByteArray &defines)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        fprintf(stderr, "couldn't read shader: %s\n", path.toUtf8().data());
+        return QByteArray();
+    }
+
+    QByteArray source = file.readAll();
+    if (!defines.isEmpty()) {
+        int version = source.indexOf("#version");
+        int eol = version < 0 ? -1 : source.indexOf('\n', version);
+        source.insert(eol + 1, defines);
+    }
+
+    return source;
+}
+
+/* everything a binary depends on, a driver update changes the
+ * version string */
+static QString cache_key(const QByteArray &vertex, const QByteArray &fragment)
+{
+    QOpenGLFunctions *gl = QOpenGLContext::currentContext()->functions();
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(vertex);
+    hash.addData(fragment);
+
+    return QString("%1|%2|%3|%4")
+        .arg(QString(hash.result().toHex()))
+        .arg((const char *) gl->glGetString(GL_VENDOR))
+        .arg((const char *) gl->glGetString(GL_RENDERER))
+        .arg((const char *) gl->glGetString(GL_VERSION));
+}
+
+static QString cache_path(const QString &key)
+{
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    QByteArray hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1);
+
+    return QDir(dir).filePath(QString("shaders/%1.qvrshader").arg(QString(hash.toHex())));
+}
+
+static QOpenGLShaderProgram *load_binary(const BinaryFunctions *f, const QString &key)
+{
+    QFile file(cache_path(key));
+    if (!file.open(QIODevice::ReadOnly))
+        return NULL;
+
+    QDataStream in(&file);
+    quint32 magic, version, format;
+    QString stored_key;
+    QByteArray binary;
+    in >> magic >> version;
+    if (magic != SHADER_CACHE_MAGIC || version != SHADER_CACHE_VERSION)
+        return NULL;
+
+    /* hash collisions, however unlikely */
+    in >> stored_key;
+    if (stored_key != key)
+        return NULL;
+
+    in >> format >> binary;
+    if (in.status() != QDataStream::Ok || binary.isEmpty())
+        return NULL;
+
+    QOpenGLFunctions *gl = QOpenGLContext::currentContext()->functions();
+    QOpenGLShaderProgram *program = new QOpenGLShaderProgram;
+    program->create();
+    f->program_binary(program->programId(), format, binary.constData(), binary.size());
+    /* an unknown format is an error, not just a failed link */
+    while (gl->glGetError() != GL_NO_ERROR)
+        ;
+
+    /* with no shaders attached link() only checks the status the
+     * binary left, false when the driver rejected it */
+    if (!program->link()) {
+        delete program;
+        return NULL;
+    }
+
+    return program;
+}
+
+static void save_binary(const BinaryFunctions *f, GLuint program, const QString &key)
+{
+    QOpenGLFunctions *gl = QOpenGLContext::currentContext()->functions();
+    GLint length = 0;
+    gl->glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+
+    QByteArray binary(length, 0);
+    GLenum format = 0;
+    f->get_program_binary(program, length, &length, &format, binary.data());
+    if (length <= 0)
+        return;
+    binary.resize(length);
+
+    QString path = cache_path(key);
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    /* sort-last workers might be writing the same one */
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        fprintf(stderr, "couldn't write the shader cache: %s\n", path.toUtf8().data());
+        return;
+    }
+
+    QDataStream out(&file);
+    out << (quint32) SHADER_CACHE_MAGIC << (quint32) SHADER_CACHE_VERSION << key;
+    out << (quint32) format << binary;
+    file.commit();
+}
+
+QOpenGLShaderProgram *shader_cache_program(const QString &name, const QByteArray &defines,
+                                           bool use_cache)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QByteArray vertex = read_source(QString(":/shaders/%1.vert").arg(name), defines);
+    QByteArray fragment = read_source(QString(":/shaders/%1.frag").arg(name), defines);
+    if (vertex.isEmpty() || fragment.isEmpty())
+        return NULL;
+
+    BinaryFunctions f;
+    bool binaries = use_cache &&
+        resolve_binary_functions(QOpenGLContext::currentContext(), &f);
+    QString key;
+
+    if (binaries) {
+        key = cache_key(vertex, fragment);
+        QOpenGLShaderProgram *program = load_binary(&f, key);
+        if (program) {
+            printf("Shader %s from the cache in %.1f ms\n", name.toUtf8().data(),
+                   timer.nsecsElapsed() / 1e6);
+            return program;
+        }
+    }
+
+    QOpenGLShaderProgram *program = new QOpenGLShaderProgram;
+    if (!program->addShaderFromSourceCode(QOpenGLShader::Vertex, vertex) ||
+        !program->addShaderFromSourceCode(QOpenGLShader::Fragment, fragment)) {
+        fprintf(stderr, "couldn't compile shader %s\n", name.toUtf8().data());
+        delete program;
+        return NULL;
+    }
+
+    /* some drivers only keep a binary around when asked before
+     * linking */
+    if (binaries)
+        f.program_parameteri(program->programId(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
+    if (!program->link()) {
+        fprintf(stderr, "couldn't link shader %s:\n%s\n", name.toUtf8().data(),
+                program->log().toUtf8().data());
+        delete program;
+        return NULL;
+    }
+
+    printf("Shader %s compiled in %.1f ms\n", name.toUtf8().data(),
+           timer.nsecsElapsed() / 1e6);
+
+    if (binaries)
+        save_binary(&f, program->programId(), key);
+
+    return program;
+}
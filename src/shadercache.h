@@ -0,0 +1,49 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+#include <QString>
+#include <QByteArray>
+#include <QOpenGLShaderProgram>
+
+/* Linked program binaries in the user cache directory, one file per
+   program, keyed by the sources (defines included), the driver vendor,
+   renderer and version. Sources are built in as resources (see
+   shaders.qrc), so we don't depend on the working directory.
+
+   Drivers without program binaries, binaries the driver rejects (an
+   update it didn't tell us about) and any other miss just compile
+   from source and refresh the cache.
+*/
+
+/* With the context current. @name: shaders/@name.vert and .frag
+   @defines: "#define ...\n" lines, go right after #version
+   @use_cache: false to always compile and never write
+
+   NULL if the sources don't compile or link, the log is on stderr
+*/
+QOpenGLShaderProgram *shader_cache_program(const QString &name, const QByteArray &defines,
+                                           bool use_cache);
+
+#endif /* SHADER_CACHE_H */
@@ -0,0 +1,399 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#include "sortlast.h"
+#include "renderer.h"
+#include "volumestorage.h"
+
+#include <QCoreApplication>
+#include <QElapsedTimer>
+#include <QThread>
+#include <QOpenGLContext>
+#include <QOffscreenSurface>
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* a rank that doesn't move for this long is gone */
+#define SORT_LAST_TIMEOUT_MS 10000
+/* loading can take a while longer */
+#define SORT_LAST_LOAD_TIMEOUT_MS 120000
+
+/* images start on a cache line */
+static size_t header_size()
+{
+    return (sizeof(SortLastHeader) + 63) & ~(size_t) 63;
+}
+
+static size_t segment_size(int workers)
+{
+    return header_size() + (size_t) workers * SORT_LAST_MAX_PIXELS * 4;
+}
+
+static int log2i(int n)
+{
+    int l = 0;
+    while ((1 << l) < n)
+        l++;
+    return l;
+}
+
+/* spin a little, then sleep, compositing rounds are short but frames
+ * can take a while */
+static bool wait_progress(SortLast *sl, int rank, int stage)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    for (int spins = 0; sl->header->progress[rank].loadAcquire() < stage; spins++) {
+        if (timer.elapsed() > SORT_LAST_TIMEOUT_MS) {
+            fprintf(stderr, "sort-last: rank %d didn't show up for frame %d\n",
+                    rank, sl->frame);
+            return false;
+        }
+        if (spins < 1000)
+            QThread::yieldCurrentThread();
+        else
+            QThread::usleep(100);
+    }
+
+    return true;
+}
+
+void sort_last_slab(int rank, int workers, int depth, int *first, int *end)
+{
+    *first = rank * depth / workers;
+    *end = (rank + 1) * depth / workers;
+}
+
+bool sort_last_spawn(SortLast *sl, const InitOptions &opt)
+{
+    QString key = QString("qvrc-sortlast-%1").arg(QCoreApplication::applicationPid());
+
+    sl->shm = new QSharedMemory(key);
+    if (!sl->shm->create(segment_size(opt.workers))) {
+        fprintf(stderr, "couldn't create the sort-last segment: %s\n",
+                sl->shm->errorString().toUtf8().data());
+        delete sl->shm;
+        sl->shm = NULL;
+        return false;
+    }
+    memset(sl->shm->data(), 0, header_size());
+
+    sl->header = (SortLastHeader *) sl->shm->data();
+    sl->images = (uchar *) sl->shm->data() + header_size();
+    sl->rank = 0;
+    sl->workers = opt.workers;
+    sl->rounds = log2i(opt.workers);
+    sl->depth = opt.depth;
+    sl->frame = 0;
+    sl->parent = 0;
+
+    /* only what it takes to load the same volume, the rest comes with
+     * every frame */
+    const SessionDataset &ds = opt.datasets[0];
+    QStringList common;
+    common << "-f" << ds.filename
+           << "-s" << QString("%1,%2,%3").arg(ds.width).arg(ds.height).arg(ds.depth)
+           << "-x" << QString("%1,%2,%3").arg(ds.xscale, 0, 'g', 9)
+                                         .arg(ds.yscale, 0, 'g', 9).arg(ds.zscale, 0, 'g', 9)
+           << "-d" << QString::number(ds.bit_depth)
+           << "--stride" << QString::number(opt.stride)
+           << "--rescale" << QString("%1,%2").arg(opt.rescale_slope, 0, 'g', 17)
+                                             .arg(opt.rescale_intercept, 0, 'g', 17)
+           << "--storage" << volume_storage_to_string((VolumeStorage) opt.storage)
+           << "--workers" << QString::number(opt.workers)
+           << "--worker-key" << key;
+    if (!opt.shader_cache)
+        common << "--no-shader-cache";
+    if (opt.roi_set)
+        common << "--roi" << QString("%1,%2,%3,%4,%5,%6")
+            .arg(opt.roi[0]).arg(opt.roi[1]).arg(opt.roi[2])
+            .arg(opt.roi[3]).arg(opt.roi[4]).arg(opt.roi[5]);
+
+    for (int i=1; i<opt.workers; i++) {
+        QProcess *process = new QProcess;
+        process->setProcessChannelMode(QProcess::ForwardedChannels);
+        process->start(QCoreApplication::applicationFilePath(),
+                       QStringList(common) << "--worker-rank" << QString::number(i));
+        if (!process->waitForStarted()) {
+            fprintf(stderr, "couldn't start sort-last worker %d: %s\n", i,
+                    process->errorString().toUtf8().data());
+            delete process;
+            sort_last_close(sl);
+            return false;
+        }
+        sl->processes << process;
+    }
+
+    printf("Sort-last: %d processes, %.1f MB shared\n", opt.workers,
+           segment_size(opt.workers) / 1048576.0);
+
+    return true;
+}
+
+bool sort_last_attach(SortLast *sl, const InitOptions &opt)
+{
+    sl->shm = new QSharedMemory(opt.worker_key);
+    if (!sl->shm->attach()) {
+        fprintf(stderr, "couldn't attach to the sort-last segment %s: %s\n",
+                opt.worker_key.toUtf8().data(), sl->shm->errorString().toUtf8().data());
+        delete sl->shm;
+        sl->shm = NULL;
+        return false;
+    }
+    if ((size_t) sl->shm->size() < segment_size(opt.workers)) {
+        fprintf(stderr, "sort-last segment too small for %d workers\n", opt.workers);
+        sort_last_close(sl);
+        return false;
+    }
+
+    sl->header = (SortLastHeader *) sl->shm->data();
+    sl->images = (uchar *) sl->shm->data() + header_size();
+    sl->rank = opt.worker_rank;
+    sl->workers = opt.workers;
+    sl->rounds = log2i(opt.workers);
+    sl->depth = opt.depth;
+    sl->frame = 0;
+    sl->parent = getppid();
+
+    return true;
+}
+
+void sort_last_close(SortLast *sl)
+{
+    if (!sl->shm)
+        return;
+
+    if (!sl->processes.isEmpty()) {
+        sl->header->quit.storeRelease(1);
+        for (int i=0; i<sl->processes.size(); i++) {
+            QProcess *process = sl->processes[i];
+            if (!process->waitForFinished(5000)) {
+                fprintf(stderr, "sort-last worker %d didn't quit, killing it\n", i + 1);
+                process->kill();
+                process->waitForFinished();
+            }
+            delete process;
+        }
+        sl->processes.clear();
+    }
+
+    sl->shm->detach();
+    delete sl->shm;
+    sl->shm = NULL;
+    sl->header = NULL;
+    sl->images = NULL;
+}
+
+uchar *sort_last_image(SortLast *sl, int rank)
+{
+    return sl->images + (size_t) rank * SORT_LAST_MAX_PIXELS * 4;
+}
+
+void sort_last_ready(SortLast *sl)
+{
+    sl->header->ready.fetchAndAddOrdered(1);
+}
+
+bool sort_last_wait_ready(SortLast *sl)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    while (sl->header->ready.loadAcquire() < sl->workers - 1) {
+        if (timer.elapsed() > SORT_LAST_LOAD_TIMEOUT_MS) {
+            fprintf(stderr, "sort-last: only %d of %d workers loaded their slab\n",
+                    sl->header->ready.loadAcquire(), sl->workers - 1);
+            return false;
+        }
+        QThread::msleep(10);
+    }
+
+    return true;
+}
+
+void sort_last_publish(SortLast *sl)
+{
+    sl->header->frame.storeRelease(++sl->frame);
+}
+
+bool sort_last_wait_frame(SortLast *sl)
+{
+    for (int spins = 0; sl->header->frame.loadAcquire() <= sl->frame; spins++) {
+        if (sl->header->quit.loadAcquire())
+            return false;
+        /* reparented, rank 0 died without telling us */
+        if (getppid() != sl->parent)
+            return false;
+        if (spins < 1000)
+            QThread::yieldCurrentThread();
+        else
+            QThread::usleep(200);
+    }
+
+    sl->frame = sl->header->frame.loadAcquire();
+
+    return true;
+}
+
+/* premultiplied @front over @back, the sum can't really overflow but
+ * shading pushes colors past the alpha */
+static inline void over(const uchar *front, const uchar *back, uchar *out)
+{
+    int t = 255 - front[3];
+    int c[4];
+
+    for (int i=0; i<4; i++)
+        c[i] = front[i] + (back[i] * t + 127) / 255;
+    for (int i=0; i<4; i++)
+        out[i] = MIN(c[i], 255);
+}
+
+bool sort_last_composite(SortLast *sl, int width, int height, float eye_z, bool max)
+{
+    uchar *mine = sort_last_image(sl, sl->rank);
+    int stride = sl->rounds + 1;
+    int y0 = 0;
+    int y1 = height;
+
+    for (int k=0; k<sl->rounds; k++) {
+        int stage = sl->frame * stride + k;
+        int partner = sl->rank ^ (1 << k);
+
+        sl->header->progress[sl->rank].storeRelease(stage);
+        if (!wait_progress(sl, partner, stage))
+            return false;
+
+        /* the lower rank of the pair keeps the lower half of the rows
+         * both are working on, the partner does the other */
+        bool upper = (sl->rank >> k) & 1;
+        int mid = (y0 + y1) / 2;
+        if (upper)
+            y0 = mid;
+        else
+            y1 = mid;
+
+        /* both sides are 2^k contiguous slabs by now, the plane
+         * between them decides which one is in front */
+        int first, end;
+        sort_last_slab(((sl->rank >> k) | 1) << k, sl->workers, sl->depth, &first, &end);
+        bool lower_in_front = eye_z < (float) first / sl->depth;
+        bool in_front = upper != lower_in_front;
+
+        const uchar *theirs = sort_last_image(sl, partner);
+        size_t begin = (size_t) y0 * width * 4;
+        size_t stop = (size_t) y1 * width * 4;
+        for (size_t i=begin; i<stop; i+=4) {
+            if (max) {
+                if (theirs[i+3] > mine[i+3])
+                    memcpy(mine + i, theirs + i, 4);
+            } else if (in_front) {
+                over(mine + i, theirs + i, mine + i);
+            } else {
+                over(theirs + i, mine + i, mine + i);
+            }
+        }
+    }
+
+    sl->header->progress[sl->rank].storeRelease(sl->frame * stride + sl->rounds);
+
+    return true;
+}
+
+bool sort_last_gather(SortLast *sl, int width, int height,
+                      const float *background, uchar *out)
+{
+    int done = sl->frame * (sl->rounds + 1) + sl->rounds;
+
+    /* same as blending the single process result over the
+     * background, the raycaster doesn't premultiply for that */
+    int bg[4];
+    for (int c=0; c<4; c++)
+        bg[c] = CLAMP((int) (background[c] * 255.0f + 0.5f), 0, 255);
+
+    for (int r=0; r<sl->workers; r++) {
+        if (!wait_progress(sl, r, done))
+            return false;
+
+        /* the rows it ended up with, see sort_last_composite() */
+        int y0 = 0;
+        int y1 = height;
+        for (int k=0; k<sl->rounds; k++) {
+            int mid = (y0 + y1) / 2;
+            if ((r >> k) & 1)
+                y0 = mid;
+            else
+                y1 = mid;
+        }
+
+        const uchar *in = sort_last_image(sl, r);
+        size_t begin = (size_t) y0 * width * 4;
+        size_t stop = (size_t) y1 * width * 4;
+        for (size_t i=begin; i<stop; i+=4) {
+            int a = in[i+3];
+            for (int c=0; c<4; c++)
+                out[i+c] = (in[i+c] * a + bg[c] * (255 - a) + 127) / 255;
+        }
+    }
+
+    return true;
+}
+
+int sort_last_worker_exec(const InitOptions &opt)
+{
+    QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+
+    QOffscreenSurface surface;
+    surface.setFormat(format);
+    surface.create();
+
+    QOpenGLContext *context = new QOpenGLContext();
+    context->setFormat(format);
+    if (!context->create()) {
+        fprintf(stderr, "couldn't create the worker context\n");
+        return 1;
+    }
+
+    QThread thread;
+    Renderer *renderer = new Renderer(opt);
+    renderer->moveToThread(&thread);
+    context->moveToThread(&thread);
+    renderer->set_surface(context, &surface);
+
+    QObject::connect(renderer, &Renderer::slabs_finished,
+                     qApp, &QCoreApplication::quit, Qt::QueuedConnection);
+
+    thread.start();
+    QMetaObject::invokeMethod(renderer, "init", Qt::QueuedConnection);
+    QMetaObject::invokeMethod(renderer, "serve_slabs", Qt::QueuedConnection);
+
+    int ret = qApp->exec();
+
+    QMetaObject::invokeMethod(renderer, "shutdown", Qt::BlockingQueuedConnection);
+    thread.quit();
+    thread.wait();
+    delete renderer;
+
+    return ret;
+}
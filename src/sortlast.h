@@ -0,0 +1,156 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#ifndef SORT_LAST_H
+#define SORT_LAST_H
+
+#include <QSharedMemory>
+#include <QProcess>
+#include <QAtomicInt>
+#include <QList>
+
+#include "util.h"
+
+/* Sort-last parallel rendering: the volume is cut in slabs along z,
+   one per process, every process raycasts its slab into a
+   premultiplied RGBA image and binary-swap composites them in
+   visibility order. Rank 0 is the one with the window (or the
+   server), it spawns the others and gathers the final image.
+
+   Everything goes through a single shared memory segment: a header
+   with the frame parameters and the progress of each rank, then one
+   full frame image per rank. No messages, ranks wait on each other's
+   progress counters.
+*/
+
+#define SORT_LAST_MAX_WORKERS 16
+/* images in the segment are allocated for this, bigger frames aren't
+ * composited */
+#define SORT_LAST_MAX_PIXELS (3840 * 2160)
+#define SORT_LAST_MAX_TF 4096
+#define SORT_LAST_MAX_TF2D (256 * 256)
+
+/* what a worker needs of RenderParams, flat so it fits in the
+ * segment */
+typedef struct _SlabParams
+{
+    int width;
+    int height;
+    float rotation[4];  /* w x y z */
+    float depth;
+
+    int compositing_mode;
+    int shading_mode;
+    float background_color[4];
+    float light_color[3];
+    float ambient_reflectance;
+    float diffuse_reflectance;
+    float specular_reflectance;
+
+    int fast_rendering;
+    int quality;
+    int fixed_step;
+    double window_level;
+    double window_width;
+
+    quint64 tf_version;
+    int tf_len;
+    float tf[4 * SORT_LAST_MAX_TF];
+
+    quint64 tf2d_version;
+    int tf2d_width;
+    int tf2d_height;
+    int tf_mode;
+    float tf2d[4 * SORT_LAST_MAX_TF2D];
+} SlabParams;
+
+typedef struct _SortLastHeader
+{
+    QBasicAtomicInt frame;      /* params below are for this frame */
+    QBasicAtomicInt quit;
+    QBasicAtomicInt ready;      /* workers done loading */
+    /* f * (rounds + 1) + k: the image of frame f is ready for
+     * compositing round k, k == rounds when done with it */
+    QBasicAtomicInt progress[SORT_LAST_MAX_WORKERS];
+    SlabParams params;
+} SortLastHeader;
+
+typedef struct _SortLast
+{
+    QSharedMemory *shm;
+    SortLastHeader *header;
+    uchar *images;
+
+    int rank;
+    int workers;
+    int rounds;         /* log2(workers) */
+    int depth;          /* of the whole volume, in voxels */
+    int frame;          /* the one this rank is working on */
+    qint64 parent;      /* workers quit when it's gone */
+
+    /* rank 0 only */
+    QList<QProcess *> processes;
+} SortLast;
+
+/* voxel range along z rank @rank owns, [*first, *end) */
+void sort_last_slab(int rank, int workers, int depth, int *first, int *end);
+
+/* rank 0: create the segment and start the other ranks */
+bool sort_last_spawn(SortLast *sl, const InitOptions &opt);
+/* any rank, the renderer side */
+bool sort_last_attach(SortLast *sl, const InitOptions &opt);
+/* rank 0 tells the others to quit and waits for them */
+void sort_last_close(SortLast *sl);
+
+uchar *sort_last_image(SortLast *sl, int rank);
+
+/* workers once their slab is loaded, rank 0 waits for all of them
+ * before the first frame */
+void sort_last_ready(SortLast *sl);
+bool sort_last_wait_ready(SortLast *sl);
+
+/* rank 0: params are in the header, go */
+void sort_last_publish(SortLast *sl);
+/* other ranks: block until there's a new frame, false when it's
+ * time to quit */
+bool sort_last_wait_frame(SortLast *sl);
+
+/* Binary swap this rank's image with the others, afterwards it holds
+   the final pixels of its share of the rows. False if some rank
+   didn't show up in time.
+
+   @eye_z: of the camera, in [0,1] volume coordinates, slabs nearer to
+   it go in front
+   @max: keep the most opaque pixel (mip) instead of compositing front
+   to back
+*/
+bool sort_last_composite(SortLast *sl, int width, int height, float eye_z, bool max);
+
+/* rank 0: everybody's rows composited over @background into @out,
+ * rgba8 bottom up like glReadPixels */
+bool sort_last_gather(SortLast *sl, int width, int height,
+                      const float *background, uchar *out);
+
+/* the whole life of a worker process, see main() */
+int sort_last_worker_exec(const InitOptions &opt);
+
+#endif /* SORT_LAST_H */
@@ -0,0 +1,323 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#include "synthvolume.h"
+#include "util.h"
+
+#include <QVector>
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#define NOISE_CELL    16
+#define BLOCK_CELLS   8
+#define VESSEL_COUNT  24
+#define VESSEL_STEPS  48
+
+/* we want the same volume on every machine and every run, so no
+ * rand() here, just a tiny integer hash */
+static uint32_t hash3(int x, int y, int z, uint32_t seed)
+{
+    uint32_t h = seed * 0x9e3779b9u;
+    h ^= (uint32_t) x * 0x85ebca6bu;
+    h = (h << 13) | (h >> 19);
+    h ^= (uint32_t) y * 0xc2b2ae35u;
+    h = (h << 13) | (h >> 19);
+    h ^= (uint32_t) z * 0x27d4eb2fu;
+    h ^= h >> 16;
+    h *= 0x7feb352du;
+    h ^= h >> 15;
+    h *= 0x846ca68bu;
+    h ^= h >> 16;
+    return h;
+}
+
+static float hash3f(int x, int y, int z, uint32_t seed)
+{
+    return (hash3(x, y, z, seed) & 0xffffff) / (float) 0xffffff;
+}
+
+/* smooth trilinear value noise on a NOISE_CELL lattice */
+static float value_noise(float x, float y, float z, uint32_t seed)
+{
+    int ix = floorf(x), iy = floorf(y), iz = floorf(z);
+    float fx = smoothstep(0.0, 1.0, x - ix);
+    float fy = smoothstep(0.0, 1.0, y - iy);
+    float fz = smoothstep(0.0, 1.0, z - iz);
+
+    float c[2][2];
+    for (int j=0; j<2; j++) {
+        for (int k=0; k<2; k++) {
+            c[j][k] = lerp(hash3f(ix, iy+j, iz+k, seed),
+                           hash3f(ix+1, iy+j, iz+k, seed), fx);
+        }
+    }
+
+    return lerp(lerp(c[0][0], c[1][0], fy),
+                lerp(c[0][1], c[1][1], fy), fz);
+}
+
+typedef struct _Segment
+{
+    float a[3];
+    float b[3];
+    float radius;
+    float value;
+} Segment;
+
+/* random walks starting near the volume center, kind of looks like a
+ * vessel tree if you don't stare at it too long */
+static QVector<Segment> vessel_segments(unsigned int w, unsigned int h, unsigned int d,
+                                        uint32_t seed)
+{
+    QVector<Segment> segments;
+    float size = MIN(MIN(w, h), d);
+
+    for (int v=0; v<VESSEL_COUNT; v++) {
+        float p[3] = { w * (0.3f + 0.4f * hash3f(v, 0, 0, seed)),
+                       h * (0.3f + 0.4f * hash3f(v, 1, 0, seed)),
+                       d * (0.3f + 0.4f * hash3f(v, 2, 0, seed)) };
+        float dir[3] = { hash3f(v, 3, 0, seed) - 0.5f,
+                         hash3f(v, 4, 0, seed) - 0.5f,
+                         hash3f(v, 5, 0, seed) - 0.5f };
+        float radius = size * (0.008f + 0.012f * hash3f(v, 6, 0, seed));
+        float value = 0.5f + 0.5f * hash3f(v, 7, 0, seed);
+        float step = size / VESSEL_STEPS;
+
+        for (int s=0; s<VESSEL_STEPS; s++) {
+            Segment seg;
+            float len;
+
+            /* wiggle direction a bit at every step */
+            for (int k=0; k<3; k++)
+                dir[k] += 0.6f * (hash3f(v, s, k + 8, seed) - 0.5f);
+            len = sqrtf(dir[0]*dir[0] + dir[1]*dir[1] + dir[2]*dir[2]);
+            if (len < 1e-6f)
+                len = 1.0f;
+
+            for (int k=0; k<3; k++) {
+                seg.a[k] = p[k];
+                p[k] += dir[k] / len * step;
+                seg.b[k] = p[k];
+            }
+            seg.radius = MAX(radius, 1.0f);
+            seg.value = value;
+            segments << seg;
+
+            /* vessels get thinner going down the tree */
+            radius *= 0.985f;
+        }
+    }
+
+    return segments;
+}
+
+static float segment_distance(const Segment &s, float x, float y, float z)
+{
+    float ab[3] = { s.b[0] - s.a[0], s.b[1] - s.a[1], s.b[2] - s.a[2] };
+    float ap[3] = { x - s.a[0], y - s.a[1], z - s.a[2] };
+    float ab2 = ab[0]*ab[0] + ab[1]*ab[1] + ab[2]*ab[2];
+    float t = ab2 > 0 ? (ap[0]*ab[0] + ap[1]*ab[1] + ap[2]*ab[2]) / ab2 : 0;
+    t = CLAMP(t, 0.0f, 1.0f);
+
+    float dx = ap[0] - t * ab[0];
+    float dy = ap[1] - t * ab[1];
+    float dz = ap[2] - t * ab[2];
+
+    return sqrtf(dx*dx + dy*dy + dz*dz);
+}
+
+/* fill one z slice with normalized [0,1] intensities */
+static void synth_slice(float *slice, SynthKind kind,
+                        unsigned int w, unsigned int h, unsigned int d,
+                        unsigned int z, uint32_t seed,
+                        const QVector<Segment> &segments)
+{
+    switch (kind) {
+    case SYNTH_SHELLS: {
+        static const float radii[4] = { 0.2f, 0.4f, 0.6f, 0.8f };
+        static const float values[4] = { 0.4f, 0.6f, 0.8f, 1.0f };
+        const float thickness = 0.03f;
+
+        for (unsigned int y=0; y<h; y++) {
+            for (unsigned int x=0; x<w; x++) {
+                float px = 2.0f * (x + 0.5f) / w - 1.0f;
+                float py = 2.0f * (y + 0.5f) / h - 1.0f;
+                float pz = 2.0f * (z + 0.5f) / d - 1.0f;
+                float r = sqrtf(px*px + py*py + pz*pz);
+                float v = r < 0.9f ? 0.1f : 0.0f;
+
+                for (int i=0; i<4; i++) {
+                    float dr = (r - radii[i]) / thickness;
+                    v = MAX(v, values[i] * expf(-dr * dr));
+                }
+                slice[y*w + x] = v;
+            }
+        }
+        break;
+    }
+    case SYNTH_NOISE:
+        for (unsigned int y=0; y<h; y++) {
+            for (unsigned int x=0; x<w; x++) {
+                float v = 0.65f * value_noise((float) x / NOISE_CELL,
+                                              (float) y / NOISE_CELL,
+                                              (float) z / NOISE_CELL, seed);
+                v += 0.35f * value_noise(x * 2.5f / NOISE_CELL,
+                                         y * 2.5f / NOISE_CELL,
+                                         z * 2.5f / NOISE_CELL, seed + 1);
+                slice[y*w + x] = v;
+            }
+        }
+        break;
+    case SYNTH_VESSELS:
+        for (unsigned int i=0; i<w*h; i++)
+            slice[i] = 0.02f;
+
+        /* rasterize only the segments crossing this slice */
+        foreach (const Segment &s, segments) {
+            float zmin = MIN(s.a[2], s.b[2]) - s.radius;
+            float zmax = MAX(s.a[2], s.b[2]) + s.radius;
+            if (z + 0.5f < zmin || z + 0.5f > zmax)
+                continue;
+
+            int x0 = MAX(0, (int) (MIN(s.a[0], s.b[0]) - s.radius));
+            int x1 = MIN((int) w - 1, (int) (MAX(s.a[0], s.b[0]) + s.radius));
+            int y0 = MAX(0, (int) (MIN(s.a[1], s.b[1]) - s.radius));
+            int y1 = MIN((int) h - 1, (int) (MAX(s.a[1], s.b[1]) + s.radius));
+
+            for (int y=y0; y<=y1; y++) {
+                for (int x=x0; x<=x1; x++) {
+                    float dist = segment_distance(s, x + 0.5f, y + 0.5f, z + 0.5f);
+                    if (dist > s.radius)
+                        continue;
+                    /* brighter core, soft wall */
+                    float v = s.value * (1.0f - 0.5f * dist / s.radius);
+                    slice[y*w + x] = MAX(slice[y*w + x], v);
+                }
+            }
+        }
+        break;
+    case SYNTH_BLOCKS: {
+        unsigned int cw = MAX(1u, w / BLOCK_CELLS);
+        unsigned int ch = MAX(1u, h / BLOCK_CELLS);
+        unsigned int cd = MAX(1u, d / BLOCK_CELLS);
+        unsigned int cz = z / cd;
+        unsigned int lz = z % cd;
+
+        for (unsigned int y=0; y<h; y++) {
+            for (unsigned int x=0; x<w; x++) {
+                unsigned int cx = x / cw, cy = y / ch;
+                unsigned int lx = x % cw, ly = y % ch;
+                /* each box fills 60-90% of its cell */
+                float fill = 0.6f + 0.3f * hash3f(cx, cy, cz, seed);
+                unsigned int mx = (1.0f - fill) * 0.5f * cw;
+                unsigned int my = (1.0f - fill) * 0.5f * ch;
+                unsigned int mz = (1.0f - fill) * 0.5f * cd;
+                bool inside = lx >= mx && lx < cw - mx &&
+                              ly >= my && ly < ch - my &&
+                              lz >= mz && lz < cd - mz;
+
+                slice[y*w + x] = inside ?
+                    0.3f + 0.7f * hash3f(cx, cy, cz, seed + 1) : 0.05f;
+            }
+        }
+        break;
+    }
+    }
+}
+
+bool synth_kind_from_string(const QString &name, SynthKind *kind)
+{
+    if (name == "shells")
+        *kind = SYNTH_SHELLS;
+    else if (name == "noise")
+        *kind = SYNTH_NOISE;
+    else if (name == "vessels")
+        *kind = SYNTH_VESSELS;
+    else if (name == "blocks")
+        *kind = SYNTH_BLOCKS;
+    else
+        return false;
+
+    return true;
+}
+
+QString synth_kind_to_string(SynthKind kind)
+{
+    switch (kind) {
+    case SYNTH_SHELLS:  return "shells";
+    case SYNTH_NOISE:   return "noise";
+    case SYNTH_VESSELS: return "vessels";
+    case SYNTH_BLOCKS:  return "blocks";
+    }
+
+    return QString();
+}
+
+/* generate slice by slice so we never hold the whole volume in
+ * memory, big sizes are exactly what we want to benchmark */
+bool synth_volume_write(const QString &path, SynthKind kind,
+                        unsigned int w, unsigned int h, unsigned int d,
+                        unsigned int bit_depth, unsigned int seed)
+{
+    FILE *f = fopen(path.toUtf8().data(), "wb");
+    if (!f) {
+        fprintf(stderr, "couldn't open for writing: %s\n", path.toUtf8().data());
+        return false;
+    }
+
+    QVector<Segment> segments;
+    if (kind == SYNTH_VESSELS)
+        segments = vessel_segments(w, h, d, seed);
+
+    float maxval = (float) ((1u << bit_depth) - 1);
+    float *slice = (float *) malloc(w * h * sizeof(float));
+    uint8_t *out8 = (uint8_t *) malloc(w * h * sizeof(uint8_t));
+    uint16_t *out16 = (uint16_t *) malloc(w * h * sizeof(uint16_t));
+    bool ok = true;
+
+    for (unsigned int z=0; z<d && ok; z++) {
+        synth_slice(slice, kind, w, h, d, z, seed, segments);
+
+        if (bit_depth == 8) {
+            for (unsigned int i=0; i<w*h; i++)
+                out8[i] = (uint8_t) (CLAMP(slice[i], 0.0f, 1.0f) * maxval + 0.5f);
+            ok = fwrite(out8, sizeof(uint8_t), w*h, f) == w*h;
+        } else {
+            for (unsigned int i=0; i<w*h; i++)
+                out16[i] = (uint16_t) (CLAMP(slice[i], 0.0f, 1.0f) * maxval + 0.5f);
+            ok = fwrite(out16, sizeof(uint16_t), w*h, f) == w*h;
+        }
+    }
+
+    if (!ok)
+        fprintf(stderr, "writing error: %s\n", path.toUtf8().data());
+
+    free(slice);
+    free(out8);
+    free(out16);
+    fclose(f);
+
+    return ok;
+}
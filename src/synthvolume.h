@@ -0,0 +1,51 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#ifndef SYNTH_VOLUME_H
+#define SYNTH_VOLUME_H
+
+#include <QString>
+
+/* synthetic datasets for benchmarking, each one stresses the
+ * raycaster in a different way:
+ *   shells:  concentric spheres, lots of shading, moderate early termination
+ *   noise:   smooth value noise, semi transparent everywhere, worst case
+ *   vessels: thin random tubes in empty space, mostly empty rays
+ *   blocks:  dense opaque boxes, rays terminate almost immediately */
+typedef enum _SynthKind
+{
+    SYNTH_SHELLS,
+    SYNTH_NOISE,
+    SYNTH_VESSELS,
+    SYNTH_BLOCKS
+} SynthKind;
+
+bool synth_kind_from_string(const QString &name, SynthKind *kind);
+QString synth_kind_to_string(SynthKind kind);
+
+/* write a raw volume with the same layout load_volume_texture
+ * expects, returns false on I/O errors */
+bool synth_volume_write(const QString &path, SynthKind kind,
+                        unsigned int w, unsigned int h, unsigned int d,
+                        unsigned int bit_depth, unsigned int seed = 1);
+
+#endif /* SYNTH_VOLUME_H */
@@ -0,0 +1,349 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#include "transfunc2darea.h"
+#include "util.h"
+#include <QPainter>
+#include <QPen>
+#include <QColorDialog>
+#include <QMouseEvent>
+#include <QKeyEvent>
+
+#include <math.h>
+#include <string.h>
+
+TransFunc2DArea::TransFunc2DArea(PresetManager *pm)
+{
+    prman = pm;
+
+    Preset *p = prman->presets[prman->selected];
+    regions = p->regions_2d;
+
+    active_region = -1;
+    drag = DRAG_NONE;
+    handle_radius = 5.0;
+    histogram_scale = 1.0;
+    histogram_offset = 0.0;
+
+    tf_size = TF2D_SIZE;
+    tf_data = (float *) malloc(4 * tf_size * tf_size * sizeof(float));
+    tf_accum = (float *) malloc(4 * tf_size * tf_size * sizeof(float));
+
+    setFocusPolicy(Qt::ClickFocus);
+}
+
+TransFunc2DArea::~TransFunc2DArea()
+{
+    free(tf_data);
+    free(tf_accum);
+}
+
+QSize TransFunc2DArea::minimumSizeHint() const
+{
+    return QSize(100, 100);
+}
+
+QSize TransFunc2DArea::sizeHint() const
+{
+    return QSize(250, 200);
+}
+
+void TransFunc2DArea::update_preset(int i)
+{
+    Preset *p = prman->presets[i];
+    regions = p->regions_2d;
+
+    active_region = -1;
+    update_transfer_function();
+    update();
+}
+
+/* log scaled joint histogram, rows are intensities, columns gradient
+ * magnitudes, drawn with gradient going up */
+void TransFunc2DArea::set_histogram(const Histogram &h)
+{
+    if (h.joint.size() != HISTOGRAM_BINS * HISTOGRAM_BINS || h.joint_peak == 0)
+        return;
+
+    histogram_image = QImage(HISTOGRAM_BINS, HISTOGRAM_BINS, QImage::Format_ARGB32);
+    double peak = log(1.0 + h.joint_peak);
+
+    for (int g=0; g<HISTOGRAM_BINS; g++) {
+        QRgb *line = (QRgb *) histogram_image.scanLine(HISTOGRAM_BINS-1-g);
+        for (int i=0; i<HISTOGRAM_BINS; i++) {
+            double v = log(1.0 + h.joint[i * HISTOGRAM_BINS + g]) / peak;
+            line[i] = qRgba(0, 0, 0, (int) (v * 200));
+        }
+    }
+
+    update();
+}
+
+/* intensities go where the window maps them, gradients stay */
+void TransFunc2DArea::set_histogram_window(float scale, float offset)
+{
+    histogram_scale = scale;
+    histogram_offset = offset;
+    update();
+}
+
+/* regions are composited over each other in order, opacity is a tent
+ * along intensity so regions can overlap smoothly */
+void TransFunc2DArea::update_transfer_function()
+{
+    int n = tf_size;
+    memset(tf_accum, 0, 4 * n * n * sizeof(float));
+
+    for (int k=0; k<regions.size(); k++) {
+        QRectF r = regions[k]->r;
+        QColor c = regions[k]->c;
+
+        int x0 = CLAMP((int) ceil(r.left() * (n-1)), 0, n-1);
+        int x1 = CLAMP((int) floor(r.right() * (n-1)), 0, n-1);
+        int y0 = CLAMP((int) ceil(r.top() * (n-1)), 0, n-1);
+        int y1 = CLAMP((int) floor(r.bottom() * (n-1)), 0, n-1);
+        qreal cx = r.center().x();
+        qreal hw = MAX(r.width() / 2.0, 1e-6);
+
+        for (int x=x0; x<=x1; x++) {
+            float t = 1.0 - fabs((qreal) x / (n-1) - cx) / hw;
+            float a = c.alphaF() * CLAMP(t, 0.0f, 1.0f);
+
+            for (int y=y0; y<=y1; y++) {
+                float *acc = tf_accum + 4 * (y * n + x);
+                float w = (1.0 - acc[3]) * a;
+                acc[0] += w * c.redF();
+                acc[1] += w * c.greenF();
+                acc[2] += w * c.blueF();
+                acc[3] += w;
+            }
+        }
+    }
+
+    /* the raycaster wants straight, non premultiplied colors */
+    for (int i=0; i<n*n; i++) {
+        float a = tf_accum[4*i+3];
+        for (int j=0; j<3; j++)
+            tf_data[4*i+j] = a > 0.0 ? tf_accum[4*i+j] / a : 0.0;
+        tf_data[4*i+3] = a;
+    }
+
+    prman->presets[prman->selected]->regions_2d = regions;
+
+    emit transfer_function_ready(tf_data, n, n);
+}
+
+QPointF TransFunc2DArea::to_norm(QPointF p)
+{
+    return QPointF(qBound(0.0, p.x() / width(), 1.0),
+                   qBound(0.0, 1.0 - p.y() / height(), 1.0));
+}
+
+QPointF TransFunc2DArea::to_widget(QPointF p)
+{
+    return QPointF(p.x() * width(), (1.0 - p.y()) * height());
+}
+
+QRectF TransFunc2DArea::region_rect(TransFuncRegion *region)
+{
+    QPointF a = to_widget(QPointF(region->r.left(), region->r.top()));
+    QPointF b = to_widget(QPointF(region->r.right(), region->r.bottom()));
+
+    return QRectF(a, b).normalized();
+}
+
+/* topmost first */
+int TransFunc2DArea::region_at(QPointF p)
+{
+    for (int i=regions.size()-1; i>=0; i--) {
+        if (region_rect(regions[i]).contains(p))
+            return i;
+    }
+
+    return -1;
+}
+
+void TransFunc2DArea::select_region(int idx)
+{
+    for (int i=0; i<regions.size(); i++)
+        regions[i]->set_selected(i == idx);
+
+    active_region = idx;
+}
+
+void TransFunc2DArea::paintEvent(QPaintEvent *)
+{
+    QPainter painter(this);
+    painter.setRenderHint(QPainter::Antialiasing);
+
+    QBrush checker = QBrush(QColor(0, 0, 0, 120));
+    checker.setStyle(Qt::CrossPattern);
+    painter.fillRect(rect(), checker);
+
+    if (!histogram_image.isNull()) {
+        qreal x0 = histogram_offset * width();
+        qreal x1 = (histogram_offset + histogram_scale) * width();
+        painter.save();
+        painter.setClipRect(rect());
+        if (x1 < x0)
+            painter.drawImage(QRectF(x1, 0, x0 - x1, height()),
+                              histogram_image.mirrored(true, false));
+        else
+            painter.drawImage(QRectF(x0, 0, x1 - x0, height()), histogram_image);
+        painter.restore();
+    }
+
+    for (int i=0; i<regions.size(); i++) {
+        QRectF r = region_rect(regions[i]);
+        QColor fill = regions[i]->c;
+        fill.setAlphaF(0.2 + 0.5 * fill.alphaF());
+
+        QPen pen = QPen(QColor(20, 20, 50));
+        if (i == active_region)
+            pen.setWidth(2);
+        painter.setPen(pen);
+        painter.setBrush(fill);
+        painter.drawRect(r);
+
+        if (i == active_region) {
+            painter.setBrush(QColor(255, 255, 255));
+            painter.drawEllipse(r.bottomRight(), handle_radius, handle_radius);
+        }
+    }
+}
+
+/* drag the corner handle to resize, inside to move, anywhere else
+ * to draw a new region */
+void TransFunc2DArea::mousePressEvent(QMouseEvent *e)
+{
+    drag_start = e->localPos();
+
+    if (active_region >= 0) {
+        QPointF corner = region_rect(regions[active_region]).bottomRight();
+        if (QLineF(corner, drag_start).length() <= 2 * handle_radius) {
+            drag = DRAG_RESIZE;
+            drag_rect = regions[active_region]->r;
+            return;
+        }
+    }
+
+    select_region(region_at(drag_start));
+
+    if (active_region >= 0) {
+        drag = DRAG_MOVE;
+        drag_rect = regions[active_region]->r;
+    } else if (e->button() == Qt::LeftButton) {
+        QPointF p = to_norm(drag_start);
+        regions << new TransFuncRegion(QRectF(p, p), QColor(255, 255, 255, 128));
+        select_region(regions.size()-1);
+        drag = DRAG_RESIZE;
+        drag_rect = regions[active_region]->r;
+    }
+
+    update();
+}
+
+void TransFunc2DArea::mouseMoveEvent(QMouseEvent *e)
+{
+    if (drag == DRAG_NONE || active_region < 0)
+        return;
+
+    QPointF d = to_norm(e->localPos()) - to_norm(drag_start);
+    QRectF r = drag_rect;
+
+    if (drag == DRAG_MOVE) {
+        r.translate(d);
+        /* keep it inside, don't shrink it */
+        r.moveLeft(qBound(0.0, r.left(), 1.0 - r.width()));
+        r.moveTop(qBound(0.0, r.top(), 1.0 - r.height()));
+    } else {
+        /* handle sits at high intensity, low gradient */
+        QPointF start = QPointF(drag_rect.right(), drag_rect.top());
+        QPointF end = start + d;
+        QPointF other = QPointF(drag_rect.left(), drag_rect.bottom());
+        end.setX(qBound(0.0, end.x(), 1.0));
+        end.setY(qBound(0.0, end.y(), 1.0));
+        r = QRectF(other, end).normalized();
+    }
+
+    regions[active_region]->r = r;
+
+    emit fast_rendering_hint(true);
+
+    update_transfer_function();
+    update();
+}
+
+void TransFunc2DArea::mouseReleaseEvent(QMouseEvent *e)
+{
+    Q_UNUSED(e);
+
+    /* a click on empty space, not a region */
+    if (drag == DRAG_RESIZE && active_region >= 0) {
+        QRectF r = regions[active_region]->r;
+        if (r.width() < 0.01 || r.height() < 0.01) {
+            delete regions[active_region];
+            regions.remove(active_region);
+            select_region(-1);
+            update_transfer_function();
+        }
+    }
+
+    drag = DRAG_NONE;
+    emit fast_rendering_hint(false);
+
+    update();
+}
+
+void TransFunc2DArea::mouseDoubleClickEvent(QMouseEvent *e)
+{
+    Q_UNUSED(e);
+
+    if (active_region < 0)
+        return;
+
+    const QColor color = QColorDialog::getColor(regions[active_region]->c, this,
+                                                "Select Color",
+                                                QColorDialog::ShowAlphaChannel |
+                                                QColorDialog::DontUseNativeDialog);
+    if (color.isValid())
+        regions[active_region]->c = color;
+
+    drag = DRAG_NONE;
+
+    update_transfer_function();
+    update();
+}
+
+void TransFunc2DArea::keyReleaseEvent(QKeyEvent *e)
+{
+    if ((e->key() == Qt::Key_Delete) && (active_region >= 0)) {
+        delete regions[active_region];
+        regions.remove(active_region);
+        select_region(-1);
+
+        update_transfer_function();
+        update();
+    }
+    else
+        QWidget::keyReleaseEvent(e);
+}
@@ -0,0 +1,95 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#ifndef TRANS_FUNC_2DAREA_H
+#define TRANS_FUNC_2DAREA_H
+
+#include <QWidget>
+#include <QColor>
+#include <QImage>
+#include <QPaintEvent>
+
+#include "presetmanager.h"
+#include "histogram.h"
+
+#define TF2D_SIZE 256
+
+/* Drawing area for 2D transfer functions, regions are painted over
+ * the joint intensity/gradient histogram */
+class TransFunc2DArea : public QWidget
+{
+    Q_OBJECT
+
+public:
+    TransFunc2DArea(PresetManager *pm);
+    ~TransFunc2DArea();
+
+    QSize minimumSizeHint() const Q_DECL_OVERRIDE;
+    QSize sizeHint() const Q_DECL_OVERRIDE;
+
+    void update_transfer_function();
+
+public slots:
+    void update_preset(int i);
+    void set_histogram(const Histogram &h);
+    void set_histogram_window(float scale, float offset);
+
+signals:
+    void transfer_function_ready(float *tf_data, int w, int h);
+    void fast_rendering_hint(bool hint);
+
+protected:
+    void paintEvent(QPaintEvent *);
+    void mousePressEvent(QMouseEvent *e) Q_DECL_OVERRIDE;
+    void mouseMoveEvent(QMouseEvent *e) Q_DECL_OVERRIDE;
+    void mouseReleaseEvent(QMouseEvent *e) Q_DECL_OVERRIDE;
+    void mouseDoubleClickEvent(QMouseEvent *e) Q_DECL_OVERRIDE;
+    void keyReleaseEvent(QKeyEvent *e) Q_DECL_OVERRIDE;
+
+private:
+    QPointF to_norm(QPointF p);
+    QPointF to_widget(QPointF p);
+    QRectF region_rect(TransFuncRegion *region);
+    int region_at(QPointF p);
+    void select_region(int i);
+
+    PresetManager *prman;
+    QVector<TransFuncRegion *> regions;
+    int active_region;
+
+    /* what the current drag does */
+    enum { DRAG_NONE, DRAG_MOVE, DRAG_RESIZE } drag;
+    QPointF drag_start;
+    QRectF drag_rect;
+
+    QImage histogram_image;
+    float histogram_scale;
+    float histogram_offset;
+
+    float *tf_data;
+    float *tf_accum;   /* premultiplied while compositing regions */
+    int tf_size;
+
+    qreal handle_radius;
+};
+
+#endif // TRANS_FUNC_2DAREA_H
@@ -31,6 +31,8 @@
 #include <QPen>
 #include <QColorDialog>
 
+#include <math.h>
+
 /* color gradient widget */
 TransFuncAlphaArea::TransFuncAlphaArea(PresetManager *pm)
 {
@@ -43,6 +45,14 @@ TransFuncAlphaArea::TransFuncAlphaArea(PresetManager *pm)
 
     tf_len = TF_CHANNEL_SIZE;
     tf_data = (float *) malloc(tf_len * sizeof(float));
+    memset(tf_data, 0, tf_len * sizeof(float));
+
+    histogram.total = 0;
+    histogram.peak = 0;
+    histogram.bit_depth = 0;
+    histogram_log = false;
+    histogram_scale = 1.0;
+    histogram_offset = 0.0;
 
     setFocusPolicy(Qt::ClickFocus);
 }
@@ -57,24 +67,50 @@ void TransFuncAlphaArea::update_preset(int i)
     update();
 }
 
+void TransFuncAlphaArea::set_histogram(const Histogram &h)
+{
+    histogram = h;
+    update();
+}
+
+void TransFuncAlphaArea::set_histogram_log(bool log_scale)
+{
+    histogram_log = log_scale;
+    update();
+}
+
+/* bins sit where the window maps them */
+void TransFuncAlphaArea::set_histogram_window(float scale, float offset)
+{
+    histogram_scale = scale;
+    histogram_offset = offset;
+    update();
+}
+
 TransFuncAlphaArea::~TransFuncAlphaArea() {
     free(tf_data);
 }
 
-void TransFuncAlphaArea::update_transfer_function()
+void TransFuncAlphaArea::update_transfer_range(qreal from, qreal to)
 {
+    int first, last;
+    texel_range(from, to, tf_len, &first, &last);
+
     for (int i=0; i<points.size()-1; i++) {
         int x1 = points.at(i)->p.x() * (tf_len-1);
         int x2 = points.at(i+1)->p.x() * (tf_len-1);
 
+        if (x2 < first || x1 > last)
+            continue;
+
         float y1 = (1.0-points.at(i)->p.y());
         float y2 = (1.0-points.at(i+1)->p.y());
 
         // printf("x1: %d x2: %d\n", x1, x2);
         // printf("y1: %f y2: %f\n", y1, y2);
 
-        for (int j=x1; j<=x2; j++) {
-            float x = (float)(j - x1)/(float)(x2-x1);
+        for (int j=MAX(x1, first); j<=MIN(x2, last); j++) {
+            float x = x2 > x1 ? (float)(j - x1)/(float)(x2-x1) : 0.0;
             // x = smoothstep(0.0, 1.0, x);
             tf_data[j] = lerp(y1, y2, x);
         }
@@ -82,7 +118,7 @@ void TransFuncAlphaArea::update_transfer_function()
 
     prman->presets[prman->selected]->alpha_points = points;
 
-    emit transfer_function_ready(tf_data, tf_len);
+    emit transfer_function_ready(tf_data, first, last);
 }
 
 void TransFuncAlphaArea::paintEvent(QPaintEvent *)
@@ -101,6 +137,32 @@ void TransFuncAlphaArea::paintEvent(QPaintEvent *)
     checker.setStyle(Qt::CrossPattern);
     painter.fillRect(drawing_area, checker);
 
+    /* data distribution behind the curve, log scale brings out the
+     * small peaks buried under the background */
+    if (histogram.peak > 0) {
+        int nbins = histogram.bins.size();
+        double peak = histogram_log ? log(1.0 + histogram.peak) : histogram.peak;
+        qreal bw = (qreal) drawing_area.width() / nbins * histogram_scale;
+        qreal x0 = drawing_area.left() + histogram_offset * drawing_area.width();
+        qreal bottom = drawing_area.bottom();
+
+        QPainterPath hpath;
+        hpath.moveTo(x0, bottom);
+        for (int i=0; i<nbins; i++) {
+            double v = histogram_log ? log(1.0 + histogram.bins[i]) : histogram.bins[i];
+            qreal y = bottom - v / peak * drawing_area.height();
+            hpath.lineTo(x0 + i * bw, y);
+            hpath.lineTo(x0 + (i + 1) * bw, y);
+        }
+        hpath.lineTo(x0 + nbins * bw, bottom);
+        hpath.closeSubpath();
+
+        painter.save();
+        painter.setClipRect(drawing_area);
+        painter.fillPath(hpath, QColor(60, 60, 90, 90));
+        painter.restore();
+    }
+
     QPainterPath path;
     path.moveTo(norm_to_rect(points[0]->p, drawing_area));
     for (int i=1; i<points.size(); i++) {
@@ -161,11 +223,9 @@ void TransFuncAlphaArea::mouseMoveEvent(QMouseEvent *e)
     if ((active_point == 0) || (active_point == points.size()-1))
         newpos.setX(points[active_point]->p.x());
 
-    points[active_point]->set_point(newpos);
-
     emit fast_rendering_hint(true);
 
-    update_transfer_function();
+    move_active_point(newpos);
     update();
 }
 
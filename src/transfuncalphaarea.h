@@ -31,6 +31,7 @@
 #include "presetmanager.h"
 #include "transfuncwidget.h"
 #include "transfuncarea.h"
+#include "histogram.h"
 
 /* Drawing area for the color gradient */
 class TransFuncAlphaArea : public TransFuncArea
@@ -41,13 +42,16 @@ public:
     TransFuncAlphaArea(PresetManager *pr);
     ~TransFuncAlphaArea();
 
-    void update_transfer_function();
+    void update_transfer_range(qreal from, qreal to) Q_DECL_OVERRIDE;
 
 public slots:
     void update_preset(int i);
+    void set_histogram(const Histogram &h);
+    void set_histogram_log(bool log_scale);
+    void set_histogram_window(float scale, float offset);
 
 signals:
-    void transfer_function_ready(float *tf_data, int sz);
+    void transfer_function_ready(float *tf_data, int first, int last);
 
 protected:
     void paintEvent(QPaintEvent *);
@@ -59,6 +63,12 @@ protected:
 private:
     float *tf_data;
     int tf_len;
+
+    Histogram histogram;
+    bool histogram_log;
+    /* histogram bin to transfer function coordinate, the window */
+    float histogram_scale;
+    float histogram_offset;
 };
 
 #endif // TRANS_FUNC_ALPHAAREA_H
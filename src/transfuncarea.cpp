@@ -22,6 +22,7 @@
 
 #include "transfuncwidget.h"
 #include "transfuncarea.h"
+#include "util.h"
 #include <QVBoxLayout>
 #include <QLabel>
 #include <QPaintEvent>
@@ -104,6 +105,49 @@ int TransFuncArea::set_selected_idx(int idx)
     return idx;
 }
 
+void TransFuncArea::update_transfer_function()
+{
+    update_transfer_range(0.0, 1.0);
+}
+
+/* texels to recompute for a normalized range, a texel either side to
+ * be safe with rounding */
+void TransFuncArea::texel_range(qreal from, qreal to, int len,
+                                int *first, int *last)
+{
+    *first = CLAMP((int) (from * (len-1)) - 1, 0, len-1);
+    *last = CLAMP((int) (to * (len-1)) + 1, 0, len-1);
+}
+
+/* move the selected point, only the segments between its neighbors,
+ * before and after the move, need to be recomputed */
+void TransFuncArea::move_active_point(QPointF newpos)
+{
+    qreal old_x = points[active_point]->p.x();
+    points[active_point]->set_point(newpos);
+
+    qSort(points.begin(), points.end(), trans_func_point_compare_x);
+    active_point = get_selected_idx();
+
+    qreal from = MIN(old_x, newpos.x());
+    qreal to = MAX(old_x, newpos.x());
+
+    qreal left = 0.0;
+    qreal right = 1.0;
+    for (int i=0; i<points.size(); i++) {
+        if (i == active_point)
+            continue;
+
+        qreal x = points[i]->p.x();
+        if (x <= from)
+            left = MAX(left, x);
+        if (x >= to)
+            right = MIN(right, x);
+    }
+
+    update_transfer_range(left, right);
+}
+
 void TransFuncArea::mousePressEvent(QMouseEvent *e)
 {
     active_point = set_selected_idx(click_to_point(e->pos()));
@@ -125,3 +169,24 @@ void TransFuncArea::mouseReleaseEvent(QMouseEvent *e)
 
     update();
 }
+
+/* stretch the inner points over [lo, hi], side points stay where
+ * they are, fitting twice gives the same result */
+void TransFuncArea::fit_range(float lo, float hi)
+{
+    if (points.size() < 3 || hi <= lo)
+        return;
+
+    qreal first = points[1]->p.x();
+    qreal last = points[points.size()-2]->p.x();
+
+    for (int i=1; i<points.size()-1; i++) {
+        QPointF p = points[i]->p;
+        qreal t = last > first ? (p.x() - first) / (last - first) : 0.5;
+        p.setX(lo + t * (hi - lo));
+        points[i]->set_point(p);
+    }
+
+    update_transfer_function();
+    update();
+}
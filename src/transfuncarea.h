@@ -47,6 +47,14 @@ public:
     QSize minimumSizeHint() const Q_DECL_OVERRIDE;
     QSize sizeHint() const Q_DECL_OVERRIDE;
 
+    /* recompute the transfer function segments within the
+     * normalized [from, to] range */
+    virtual void update_transfer_range(qreal from, qreal to) = 0;
+    void update_transfer_function();
+
+public slots:
+    void fit_range(float lo, float hi);
+
 signals:
     void fast_rendering_hint(bool hint);
 
@@ -57,6 +65,8 @@ protected:
     int click_to_point(QPointF click);
     int get_selected_idx();
     int set_selected_idx(int i);
+    void move_active_point(QPointF newpos);
+    void texel_range(qreal from, qreal to, int len, int *first, int *last);
 
 
     PresetManager *prman;
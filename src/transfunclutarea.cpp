@@ -62,12 +62,18 @@ TransFuncLutArea::~TransFuncLutArea() {
     free(tf_data);
 }
 
-void TransFuncLutArea::update_transfer_function()
+void TransFuncLutArea::update_transfer_range(qreal from, qreal to)
 {
+    int first, last;
+    texel_range(from, to, tf_len, &first, &last);
+
     for (int i=0; i<points.size()-1; i++) {
         int x1 = points.at(i)->p.x() * (tf_len-1);
         int x2 = points.at(i+1)->p.x() * (tf_len-1);
 
+        if (x2 < first || x1 > last)
+            continue;
+
         float r1 = points.at(i)->c.redF();
         float r2 = points.at(i+1)->c.redF();
         float g1 = points.at(i)->c.greenF();
@@ -75,8 +81,8 @@ void TransFuncLutArea::update_transfer_function()
         float b1 = points.at(i)->c.blueF();
         float b2 = points.at(i+1)->c.blueF();
 
-        for (int j=x1; j<=x2; j++) {
-            float x = (float)(j - x1)/(float)(x2-x1);
+        for (int j=MAX(x1, first); j<=MIN(x2, last); j++) {
+            float x = x2 > x1 ? (float)(j - x1)/(float)(x2-x1) : 0.0;
             // x = smoothstep(0.0, 1.0, x);
             tf_data[3*j] = lerp(r1, r2, x);
             tf_data[3*j+1] = lerp(g1, g2, x);
@@ -86,7 +92,7 @@ void TransFuncLutArea::update_transfer_function()
 
     prman->presets[prman->selected]->lut_points = points;
 
-    emit transfer_function_ready(tf_data, tf_len);
+    emit transfer_function_ready(tf_data, first, last);
 }
 
 void TransFuncLutArea::paintEvent(QPaintEvent *)
@@ -169,11 +175,9 @@ void TransFuncLutArea::mouseMoveEvent(QMouseEvent *e)
     if ((active_point == 0) || (active_point == points.size()-1))
         newpos.setX(points[active_point]->p.x());
 
-    points[active_point]->set_point(newpos);
-
     emit fast_rendering_hint(true);
 
-    update_transfer_function();
+    move_active_point(newpos);
     update();
 }
 
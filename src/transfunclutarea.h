@@ -42,13 +42,13 @@ public:
     TransFuncLutArea(PresetManager *prman);
     ~TransFuncLutArea();
 
-    void update_transfer_function();
+    void update_transfer_range(qreal from, qreal to) Q_DECL_OVERRIDE;
 
 public slots:
     void update_preset(int i);
 
 signals:
-    void transfer_function_ready(float *tf_data, int sz);
+    void transfer_function_ready(float *tf_data, int first, int last);
 
 protected:
     void paintEvent(QPaintEvent *);
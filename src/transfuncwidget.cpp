@@ -23,11 +23,14 @@
 #include "transfuncwidget.h"
 #include "transfunclutarea.h"
 #include "transfuncalphaarea.h"
+#include "transfunc2darea.h"
+#include "util.h"
 #include <QVBoxLayout>
 #include <QHBoxLayout>
 #include <QLabel>
 #include <QSlider>
 #include <QPushButton>
+#include <QCheckBox>
 #include <QDebug>
 
 
@@ -37,22 +40,54 @@ TransFuncWidget::TransFuncWidget(PresetManager *pm)
 
     tf_len = TF_CHANNEL_SIZE;
     tf_data = (float *) malloc(4 * tf_len * sizeof(float));
-    memset(tf_data, 0, tf_len * sizeof(float));
+    memset(tf_data, 0, 4 * tf_len * sizeof(float));
 
     // this->setFrameStyle(QFrame::StyledPanel);
 
     QVBoxLayout *vlayout = new QVBoxLayout();
+    QVBoxLayout *layout_1d = new QVBoxLayout();
+    QVBoxLayout *layout_2d = new QVBoxLayout();
+    page_1d = new QWidget();
+    page_2d = new QWidget();
+    check_2d = new QCheckBox("2D (intensity × gradient magnitude)");
+    QLabel *label_2d = new QLabel("Regions");
+    area_2d = new TransFunc2DArea(prman);
     QLabel *lutlabel = new QLabel("Color map");
     QLabel *alphalabel = new QLabel("Opacity");
-    TransFuncLutArea *lut = new TransFuncLutArea(prman);
-    TransFuncAlphaArea *alpha = new TransFuncAlphaArea(prman);
+    QCheckBox *logcheck = new QCheckBox("Log");
+    QPushButton *fitbutton = new QPushButton("Fit");
+    fitbutton->setToolTip("Fit the transfer function to the data range");
+    QHBoxLayout *alphalayout = new QHBoxLayout();
+    lut = new TransFuncLutArea(prman);
+    alpha = new TransFuncAlphaArea(prman);
+
+    histogram.total = 0;
+    histogram.peak = 0;
+    histogram.bit_depth = 0;
+    histogram_scale = 1.0;
+    histogram_offset = 0.0;
+    auto_range = false;
 
     setSizePolicy(QSizePolicy(QSizePolicy::Expanding, QSizePolicy::Maximum));
 
-    vlayout->addWidget(lutlabel);
-    vlayout->addWidget(lut);
-    vlayout->addWidget(alphalabel);
-    vlayout->addWidget(alpha);
+    layout_1d->setMargin(0);
+    layout_1d->addWidget(lutlabel);
+    layout_1d->addWidget(lut);
+    alphalayout->addWidget(alphalabel, 1);
+    alphalayout->addWidget(logcheck);
+    alphalayout->addWidget(fitbutton);
+    layout_1d->addLayout(alphalayout);
+    layout_1d->addWidget(alpha);
+    page_1d->setLayout(layout_1d);
+
+    layout_2d->setMargin(0);
+    layout_2d->addWidget(label_2d);
+    layout_2d->addWidget(area_2d);
+    page_2d->setLayout(layout_2d);
+
+    vlayout->addWidget(check_2d);
+    vlayout->addWidget(page_1d);
+    vlayout->addWidget(page_2d);
 
     connect(lut, &TransFuncLutArea::transfer_function_ready,
             this, &TransFuncWidget::new_rgb_data, Qt::QueuedConnection);
@@ -64,14 +99,34 @@ TransFuncWidget::TransFuncWidget(PresetManager *pm)
             this, &TransFuncWidget::forward_fast_rendering_hint);
     connect(alpha, &TransFuncAlphaArea::fast_rendering_hint,
             this, &TransFuncWidget::forward_fast_rendering_hint);
+    connect(area_2d, &TransFunc2DArea::transfer_function_ready,
+            this, &TransFuncWidget::transfer_function_2d_ready, Qt::QueuedConnection);
+    connect(area_2d, &TransFunc2DArea::fast_rendering_hint,
+            this, &TransFuncWidget::forward_fast_rendering_hint);
 
     connect(this, &TransFuncWidget::preset_selected,
             lut, &TransFuncLutArea::update_preset);
     connect(this, &TransFuncWidget::preset_selected,
             alpha, &TransFuncAlphaArea::update_preset);
+    connect(this, &TransFuncWidget::preset_selected,
+            area_2d, &TransFunc2DArea::update_preset);
+
+    connect(check_2d, &QCheckBox::toggled,
+            this, &TransFuncWidget::set_2d_mode);
+
+    connect(logcheck, &QCheckBox::toggled,
+            alpha, &TransFuncAlphaArea::set_histogram_log);
+    connect(fitbutton, &QPushButton::clicked,
+            this, &TransFuncWidget::fit_range);
 
     lut->update_transfer_function();
     alpha->update_transfer_function();
+    area_2d->update_transfer_function();
+
+    bool preset_2d = prman->presets[prman->selected]->tf_2d;
+    check_2d->setChecked(preset_2d);
+    page_1d->setVisible(!preset_2d);
+    page_2d->setVisible(preset_2d);
 
     setLayout(vlayout);
 }
@@ -85,14 +140,71 @@ void TransFuncWidget::update_preset(int i)
     prman->selected = i;
 
     emit preset_selected(i);
+
+    /* presets remember their mode */
+    check_2d->setChecked(prman->presets[i]->tf_2d);
 }
 
-void TransFuncWidget::new_rgb_data(float *rgb_data, int len)
+void TransFuncWidget::set_2d_mode(bool enabled)
 {
-    /* don't trust len, still not sure what to do with it */
-    Q_UNUSED(len);
+    prman->presets[prman->selected]->tf_2d = enabled;
+
+    page_1d->setVisible(!enabled);
+    page_2d->setVisible(enabled);
+
+    emit tf_mode_changed(enabled ? 1 : 0);
+}
+
+int TransFuncWidget::get_tf_mode()
+{
+    return check_2d->isChecked() ? 1 : 0;
+}
+
+void TransFuncWidget::set_auto_range(bool enabled)
+{
+    auto_range = enabled;
+}
 
-    for (int i=0; i<tf_len; i++) {
+void TransFuncWidget::set_histogram(const Histogram &h)
+{
+    histogram = h;
+    alpha->set_histogram(h);
+    area_2d->set_histogram(h);
+
+    if (auto_range)
+        fit_range();
+}
+
+/* squeeze both color and opacity points in the range holding data,
+ * no point spending transfer function resolution on empty ranges */
+void TransFuncWidget::fit_range()
+{
+    float lo, hi;
+    histogram_range(histogram, &lo, &hi);
+
+    /* through the window, what's outside of it saturates anyway */
+    float a = CLAMP(lo * histogram_scale + histogram_offset, 0.0f, 1.0f);
+    float b = CLAMP(hi * histogram_scale + histogram_offset, 0.0f, 1.0f);
+    if (a == b)
+        return;
+
+    lut->fit_range(MIN(a, b), MAX(a, b));
+    alpha->fit_range(MIN(a, b), MAX(a, b));
+}
+
+/* @scale, @offset: histogram coordinate to transfer function
+ * coordinate, see window_map() */
+void TransFuncWidget::set_histogram_window(float scale, float offset)
+{
+    histogram_scale = scale;
+    histogram_offset = offset;
+    alpha->set_histogram_window(scale, offset);
+    area_2d->set_histogram_window(scale, offset);
+}
+
+void TransFuncWidget::new_rgb_data(float *rgb_data, int first, int last)
+{
+    for (int i=first; i<=last; i++) {
         memcpy(tf_data+i*4, rgb_data+i*3, 3*sizeof(float));
     }
 
@@ -102,16 +214,13 @@ void TransFuncWidget::new_rgb_data(float *rgb_data, int len)
 
     // printf("new rgb data\n");
 
-    emit transfer_function_ready(tf_data, tf_len);
+    emit transfer_function_ready(tf_data, tf_len, first, last);
 }
 
-void TransFuncWidget::new_alpha_data(float *alpha_data, int len)
+void TransFuncWidget::new_alpha_data(float *alpha_data, int first, int last)
 {
-    /* don't trust len, still not sure what to do with it */
-    Q_UNUSED(len);
-
-    for (int i=0; i<tf_len; i++) {
-        memcpy(tf_data+i*4+3, alpha_data+i, 1*sizeof(float));
+    for (int i=first; i<=last; i++) {
+        tf_data[i*4+3] = alpha_data[i];
     }
 
     // for (int i=0; i<tf_len; i++)
@@ -119,7 +228,7 @@ void TransFuncWidget::new_alpha_data(float *alpha_data, int len)
     // printf("\n\n");
     // printf("new alpha data\n");
 
-    emit transfer_function_ready(tf_data, tf_len);
+    emit transfer_function_ready(tf_data, tf_len, first, last);
 }
 
 void TransFuncWidget::forward_fast_rendering_hint(bool hint)
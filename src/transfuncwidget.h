@@ -31,6 +31,12 @@
 #include <QSettings>
 
 #include "presetmanager.h"
+#include "histogram.h"
+
+class TransFuncLutArea;
+class TransFuncAlphaArea;
+class TransFunc2DArea;
+class QCheckBox;
 
 #define TF_CHANNEL_SIZE 4096
 
@@ -46,15 +52,26 @@ public:
 
     void update_preset(int i);
 
+    /* fit the transfer function to the data range as soon as the
+     * histogram shows up */
+    void set_auto_range(bool enabled);
+
+    /* 0: 1D lookup, 1: 2D intensity x gradient magnitude lookup */
+    int get_tf_mode();
 
 public slots:
-    void new_rgb_data(float *rgb_data, int len);
-    void new_alpha_data(float *alpha_data, int len);
+    void new_rgb_data(float *rgb_data, int first, int last);
+    void new_alpha_data(float *alpha_data, int first, int last);
     void forward_fast_rendering_hint(bool hint);
+    void set_histogram(const Histogram &h);
+    void fit_range();
+    void set_histogram_window(float scale, float offset);
+    void set_2d_mode(bool enabled);
 
 signals:
     void preset_selected(int i);
-    void transfer_function_ready(float *tf_data, int len);
+    /* only [first, last] changed since the previous emission */
+    void transfer_function_ready(float *tf_data, int len, int first, int last);
     void fast_rendering_hint(bool hint);
 
 private:
@@ -62,6 +79,17 @@ private:
     QSettings *settings;
     float *tf_data;
     int tf_len;
+
+    TransFuncLutArea *lut;
+    TransFuncAlphaArea *alpha;
+    TransFunc2DArea *area_2d;
+    QCheckBox *check_2d;
+    QWidget *page_1d;
+    QWidget *page_2d;
+    Histogram histogram;
+    float histogram_scale;
+    float histogram_offset;
+    bool auto_range;
 };
 
 #endif // TRANS_FUNC_WIDGET_H
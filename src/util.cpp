@@ -22,6 +22,11 @@
 
 #include "util.h"
 
+#include <QStringList>
+#include <QFileInfo>
+
+#include <stdio.h>
+
 double smoothstep(double edge0, double edge1, double x)
 {
     double t = CLAMP ((x - edge0) / (edge1 - edge0), 0.0f, 1.0f);
@@ -32,3 +37,122 @@ double lerp(double edge0, double edge1, double x)
 {
     return edge0 + x * (edge1 - edge0);
 }
+
+/* path,width,height,depth,bit_depth[,xscale,yscale,zscale] */
+bool session_parse_dataset(const QString &spec, SessionDataset *d)
+{
+    QStringList l = spec.split(",");
+    if (l.size() != 5 && l.size() != 8)
+        return false;
+
+    bool ok[8] = { true, true, true, true, true, true, true, true };
+    d->filename = l[0];
+    d->width = l[1].toUInt(&ok[1]);
+    d->height = l[2].toUInt(&ok[2]);
+    d->depth = l[3].toUInt(&ok[3]);
+    d->bit_depth = l[4].toUInt(&ok[4]);
+    d->xscale = l.size() > 5 ? l[5].toFloat(&ok[5]) : 1.0f;
+    d->yscale = l.size() > 5 ? l[6].toFloat(&ok[6]) : 1.0f;
+    d->zscale = l.size() > 5 ? l[7].toFloat(&ok[7]) : 1.0f;
+
+    for (int i=0; i<8; i++)
+        if (!ok[i])
+            return false;
+
+    return !d->filename.isEmpty() && d->width && d->height && d->depth;
+}
+
+bool session_check_dataset(const SessionDataset &d)
+{
+    if (d.bit_depth != 8 && d.bit_depth != 10 && d.bit_depth != 12 && d.bit_depth != 16) {
+        fprintf(stderr, "unsupported bit depth %u: %s\n", d.bit_depth,
+                d.filename.toUtf8().data());
+        return false;
+    }
+
+    QFileInfo info(d.filename);
+    if (!info.isFile()) {
+        fprintf(stderr, "couldn't open: %s\n", d.filename.toUtf8().data());
+        return false;
+    }
+
+    qint64 size = (qint64) d.width * d.height * d.depth * (d.bit_depth > 8 ? 2 : 1);
+    if (info.size() < size) {
+        fprintf(stderr, "%s is %lld bytes, %ux%ux%u at %u bit needs %lld\n",
+                d.filename.toUtf8().data(), (long long) info.size(),
+                d.width, d.height, d.depth, d.bit_depth, (long long) size);
+        return false;
+    }
+
+    return true;
+}
+
+/* Make dataset @i the current one, everything reading the volume
+   goes through the flat fields. The roi is clamped to the dataset,
+   the scales shrink with it so the box keeps its physical size and
+   place in the volume, stride or not.
+*/
+void session_select(InitOptions *opt, int i)
+{
+    const SessionDataset &d = opt->datasets[i];
+    unsigned int size[3] = { d.width, d.height, d.depth };
+    float extent[3] = { d.xscale, d.yscale, d.zscale };
+    unsigned int dims[3];
+    float scales[3];
+
+    for (int k=0; k<3; k++) {
+        unsigned int first = opt->roi_set ? MIN(opt->roi[k], size[k] - 1) : 0;
+        unsigned int end = opt->roi_set ? CLAMP(opt->roi[k+3], first + 1, size[k]) : size[k];
+
+        opt->box[k] = first;
+        opt->box[k+3] = end;
+        dims[k] = (end - first + opt->stride - 1) / opt->stride;
+        scales[k] = extent[k] * dims[k] * opt->stride / size[k];
+    }
+
+    opt->filename = d.filename;
+    opt->file_width = d.width;
+    opt->file_height = d.height;
+    opt->file_depth = d.depth;
+    opt->width = dims[0];
+    opt->height = dims[1];
+    opt->depth = dims[2];
+    opt->bit_depth = d.bit_depth;
+    opt->xscale = scales[0];
+    opt->yscale = scales[1];
+    opt->zscale = scales[2];
+}
+
+/* startup window, all of [0, 2^bit_depth - 1] in physical units if
+ * none was asked for */
+void window_default(const InitOptions &opt, double *level, double *width)
+{
+    if (opt.window_set) {
+        *level = opt.window_level;
+        *width = opt.window_width;
+        return;
+    }
+
+    double top = opt.rescale_slope * ((1 << opt.bit_depth) - 1);
+    double lo = opt.rescale_intercept + MIN(top, 0.0);
+    double hi = opt.rescale_intercept + MAX(top, 0.0);
+
+    *level = 0.5 * (lo + hi);
+    *width = MAX(hi - lo, 1e-6);
+}
+
+/* Stored value to transfer function coordinate as scale and offset,
+   the window maps to [0, 1].
+
+   @stored_max: stored value a normalized texture sample of 1.0 stands
+   for, 65535 for 16 bit textures but only 4095 for a histogram over
+   12 bits
+*/
+void window_map(const InitOptions &opt, double level, double width,
+                double stored_max, float *scale, float *offset)
+{
+    width = MAX(width, 1e-6);
+
+    *scale = stored_max * opt.rescale_slope / width;
+    *offset = (opt.rescale_intercept - level) / width + 0.5;
+}
@@ -24,6 +24,8 @@
 #define UTIL_H
 
 #include <QString>
+#include <QStringList>
+#include <QVector>
 
 #define MIN(X,Y) (((X) < (Y)) ? (X) : (Y))
 #define MAX(X,Y) (((X) > (Y)) ? (X) : (Y))
@@ -33,6 +35,19 @@ double smoothstep(double edge0, double edge1, double x);
 double lerp(double edge0, double edge1, double x);
 
 
+/* one dataset of a session, what it takes to read it */
+typedef struct _SessionDataset
+{
+    QString filename;
+    unsigned int width;
+    unsigned int height;
+    unsigned int depth;
+    unsigned int bit_depth;
+    float xscale;
+    float yscale;
+    float zscale;
+} SessionDataset;
+
 typedef struct _InitOptions
 {
     QString filename;
@@ -43,9 +58,74 @@ typedef struct _InitOptions
 
     unsigned int bit_depth;
 
+    /* width, height, depth and the scales above are what we load, the
+     * box of the file (first x, y, z, end x, y, z, in file voxels)
+     * every stride voxels, see session_select() */
+    unsigned int file_width;
+    unsigned int file_height;
+    unsigned int file_depth;
+    bool roi_set;
+    unsigned int roi[6];    /* as asked for, clamped into box */
+    unsigned int box[6];
+    unsigned int stride;
+    qint64 file_offset; /* where the volume starts in the file */
+
+    /* stored values to physical units (hounsfield for ct), and the
+     * window the transfer function spans at startup in those units,
+     * the whole data range unless window_set */
+    double rescale_slope;
+    double rescale_intercept;
+    bool window_set;
+    double window_level;
+    double window_width;
+
     float xscale;
     float yscale;
     float zscale;
+
+    bool auto_range;
+    bool fixed_step;
+    int quality;        /* QUALITY_* in renderer.h */
+    int storage;        /* VolumeStorage in volumestorage.h */
+    bool storage_report;
+    bool lod;
+    bool cache;         /* sidecar preview cache, see volumecache.h */
+    bool shader_cache;  /* program binaries, see shadercache.h */
+    int tile_size;      /* still frame tiles in pixels, 0 for whole frames */
+    int preclassify;    /* PRECLASSIFY_* in renderer.h */
+
+    /* every dataset of the session, the command line one first, the
+     * fields above are the current one's, see session_select() */
+    QVector<SessionDataset> datasets;
+    int gpu_budget;     /* MB for volumes, the one on screen always fits */
+
+    /* time series, a directory or a multi frame file, played back at
+     * fps, see volumeseries.h */
+    QString series;
+    QStringList series_files;
+    int series_frames;  /* 0 for a single volume */
+    int fps;
+
+    /* cutting tools, see volumemask.h, they need the probe for
+     * flood fills */
+    bool mask;
+    /* the volume stays in memory for picking, see volumeprobe.h */
+    bool probe;
+
+    /* sort-last: processes rendering a slab each, 1 for none, see
+     * sortlast.h */
+    int workers;
+    int worker_rank;
+    QString worker_key; /* of the shared segment */
 } InitOptions;
 
+bool session_parse_dataset(const QString &spec, SessionDataset *d);
+/* the file is there and holds the whole volume, says why not */
+bool session_check_dataset(const SessionDataset &d);
+void session_select(InitOptions *opt, int i);
+
+void window_default(const InitOptions &opt, double *level, double *width);
+void window_map(const InitOptions &opt, double level, double width,
+                double stored_max, float *scale, float *offset);
+
 #endif /* UTIL_H */
@@ -0,0 +1,268 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#include "volumecache.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QtConcurrent>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CACHE_MAGIC 0x71767263 /* qvrc */
+#define CACHE_VERSION 2
+
+/* a slice of the preview and the source voxels under it */
+typedef struct _PreviewSlice
+{
+    const void *src;
+    bool wide;
+    int sw, sh, sd;     /* source size */
+    PyramidLevel *dst;
+    int shift;          /* log2 of the block side */
+    int z;              /* preview slice */
+    unsigned int lo;    /* intensity extremes of the block */
+    unsigned int hi;
+} PreviewSlice;
+
+/* everything that changes what we'd load, empty if the dataset is
+ * gone */
+static QString cache_key(const InitOptions &opt)
+{
+    QFileInfo info(opt.filename);
+    if (!info.exists())
+        return QString();
+
+    return QString("%1|%2|%3|%4x%5x%6|%7|%8,%9,%10-%11,%12,%13/%14")
+        .arg(info.absoluteFilePath())
+        .arg(info.size())
+        .arg(info.lastModified().toMSecsSinceEpoch())
+        .arg(opt.file_width).arg(opt.file_height).arg(opt.file_depth)
+        .arg(opt.bit_depth)
+        .arg(opt.box[0]).arg(opt.box[1]).arg(opt.box[2])
+        .arg(opt.box[3]).arg(opt.box[4]).arg(opt.box[5])
+        .arg(opt.stride);
+}
+
+static QString cache_path(const QString &key)
+{
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    QByteArray hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1);
+
+    return QDir(dir).filePath(QString("%1.qvrcache").arg(QString(hash.toHex())));
+}
+
+bool volume_cache_read(const InitOptions &opt, VolumeCache *cache)
+{
+    cache->preview.data = NULL;
+
+    QString key = cache_key(opt);
+    if (key.isEmpty())
+        return false;
+
+    QFile file(cache_path(key));
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+
+    QDataStream in(&file);
+    quint32 magic, version;
+    QString stored_key;
+    in >> magic >> version;
+    if (magic != CACHE_MAGIC || version != CACHE_VERSION)
+        return false;
+
+    /* hash collisions, however unlikely */
+    in >> stored_key;
+    if (stored_key != key)
+        return false;
+
+    Histogram &h = cache->histogram;
+    quint32 bit_depth;
+    qint32 w, hh, d;
+    quint64 size;
+    in >> h.bins >> h.total >> h.peak >> bit_depth >> h.joint >> h.joint_peak;
+    h.bit_depth = bit_depth;
+    in >> cache->min >> cache->max >> cache->range_lo >> cache->range_hi;
+    in >> cache->wide >> w >> hh >> d >> size;
+
+    if (in.status() != QDataStream::Ok || h.bins.size() != HISTOGRAM_BINS ||
+        size != (quint64) 2 * w * hh * d * (cache->wide ? 2 : 1))
+        return false;
+
+    PyramidLevel &l = cache->preview;
+    l.w = w;
+    l.h = hh;
+    l.d = d;
+    l.size = size;
+    l.data = malloc(l.size);
+    if (in.readRawData((char *) l.data, l.size) != (int) l.size) {
+        free(l.data);
+        l.data = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+/* Each preview voxel averages a block of 2^shift source voxels on a
+   side, the last one on each axis also takes whatever the sizing
+   rounded away. Sums a slice at a time, the source is read once, in
+   order.
+*/
+template <typename T>
+static void preview_slice(PreviewSlice &s)
+{
+    const T *src = (const T *) s.src;
+    const PyramidLevel &l = *s.dst;
+    T *dst = (T *) l.data + 2 * (size_t) s.z * l.w * l.h;
+    int z0 = s.z << s.shift;
+    int z1 = s.z == l.d - 1 ? s.sd : (s.z + 1) << s.shift;
+
+    QVector<quint64> acc(2 * l.w * l.h, 0);
+    unsigned int lo = 0xffff, hi = 0;
+
+    for (int z=z0; z<z1; z++) {
+        for (int y=0; y<s.sh; y++) {
+            const T *row = src + 2 * ((size_t) z * s.sh + y) * s.sw;
+            quint64 *a = acc.data() + 2 * (size_t) MIN(y >> s.shift, l.h - 1) * l.w;
+            for (int x=0; x<s.sw; x++) {
+                int px = MIN(x >> s.shift, l.w - 1);
+                a[2*px] += row[2*x];
+                a[2*px+1] += row[2*x+1];
+                lo = MIN(lo, (unsigned int) row[2*x]);
+                hi = MAX(hi, (unsigned int) row[2*x]);
+            }
+        }
+    }
+
+    for (int y=0; y<l.h; y++) {
+        int ny = (y == l.h - 1 ? s.sh : (y + 1) << s.shift) - (y << s.shift);
+        for (int x=0; x<l.w; x++) {
+            int nx = (x == l.w - 1 ? s.sw : (x + 1) << s.shift) - (x << s.shift);
+            quint64 count = (quint64) nx * ny * (z1 - z0);
+            size_t i = 2 * ((size_t) y * l.w + x);
+            dst[i] = (acc[i] + count / 2) / count;
+            dst[i+1] = (acc[i+1] + count / 2) / count;
+        }
+    }
+
+    s.lo = lo;
+    s.hi = hi;
+}
+
+static void preview_slice_any(PreviewSlice &s)
+{
+    if (s.wide)
+        preview_slice<uint16_t>(s);
+    else
+        preview_slice<uint8_t>(s);
+}
+
+bool volume_cache_build(const InitOptions &opt, const void *rg, bool wide,
+                        const Histogram &hist, VolumeCache *cache)
+{
+    cache->preview.data = NULL;
+
+    /* small enough to load in no time anyway */
+    int w = opt.width, h = opt.height, d = opt.depth;
+    if (MAX(MAX(w, h), d) <= CACHE_PREVIEW_SIZE)
+        return false;
+
+    /* the first pyramid level that fits, same sizing as the mipmaps */
+    int shift = 0;
+    while (MAX(MAX(MAX(1, w >> shift), MAX(1, h >> shift)), MAX(1, d >> shift)) >
+           CACHE_PREVIEW_SIZE)
+        shift++;
+
+    PyramidLevel &l = cache->preview;
+    l.w = MAX(1, w >> shift);
+    l.h = MAX(1, h >> shift);
+    l.d = MAX(1, d >> shift);
+    l.size = (size_t) 2 * l.w * l.h * l.d * (wide ? 2 : 1);
+    l.data = malloc(l.size);
+
+    QVector<PreviewSlice> slices;
+    for (int z=0; z<l.d; z++) {
+        PreviewSlice s = { rg, wide, w, h, d, &l, shift, z, 0, 0 };
+        slices << s;
+    }
+    QtConcurrent::blockingMap(slices, preview_slice_any);
+
+    unsigned int lo = wide ? 65535 : 255, hi = 0;
+    for (int z=0; z<slices.size(); z++) {
+        lo = MIN(lo, slices[z].lo);
+        hi = MAX(hi, slices[z].hi);
+    }
+
+    /* as stored, bit_depth bits of it */
+    float scale = (1 << opt.bit_depth) - 1;
+    cache->histogram = hist;
+    cache->min = lo / scale;
+    cache->max = hi / scale;
+    histogram_range(hist, &cache->range_lo, &cache->range_hi);
+    cache->wide = wide;
+
+    return true;
+}
+
+bool volume_cache_write(const InitOptions &opt, const VolumeCache &cache)
+{
+    QString key = cache_key(opt);
+    if (key.isEmpty())
+        return false;
+
+    QString path = cache_path(key);
+    QDir().mkpath(QFileInfo(path).absolutePath());
+
+    /* never leave a truncated cache behind */
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        fprintf(stderr, "couldn't write the cache: %s\n", path.toUtf8().data());
+        return false;
+    }
+
+    const Histogram &hist = cache.histogram;
+    QDataStream out(&file);
+    out << (quint32) CACHE_MAGIC << (quint32) CACHE_VERSION << key;
+    out << hist.bins << hist.total << hist.peak << (quint32) hist.bit_depth
+        << hist.joint << hist.joint_peak;
+    out << cache.min << cache.max << cache.range_lo << cache.range_hi;
+    const PyramidLevel &l = cache.preview;
+    out << cache.wide << (qint32) l.w << (qint32) l.h << (qint32) l.d << (quint64) l.size;
+    out.writeRawData((const char *) l.data, l.size);
+
+    return file.commit();
+}
+
+void volume_cache_free(VolumeCache *cache)
+{
+    free(cache->preview.data);
+    cache->preview.data = NULL;
+}
@@ -0,0 +1,65 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#ifndef VOLUME_CACHE_H
+#define VOLUME_CACHE_H
+
+#include <QString>
+#include <QVector>
+
+#include "util.h"
+#include "histogram.h"
+#include "volumepyramid.h"
+
+/* the largest side of the coarse level shown while the full volume
+ * loads */
+#define CACHE_PREVIEW_SIZE 128
+
+/* Sidecar cache in the user cache directory, one file per dataset,
+ * keyed by path, file size, mtime and the loading options. Holds the
+ * first box filtered pyramid level small enough for an instant
+ * preview and everything we derive from the whole volume. */
+typedef struct _VolumeCache
+{
+    Histogram histogram;
+    float min;          /* normalized intensity */
+    float max;
+    float range_lo;     /* see histogram_range() */
+    float range_hi;
+    bool wide;          /* 16 bit pairs */
+    PyramidLevel preview;
+} VolumeCache;
+
+/* false on a miss, stale or unreadable cache */
+bool volume_cache_read(const InitOptions &opt, VolumeCache *cache);
+/* What a cold open writes, from @rg, the whole loaded (intensity,
+   gradient) volume: the preview box filtered straight down to its
+   size, in a single pass. False for volumes already smaller than the
+   preview, nothing to write then.
+*/
+bool volume_cache_build(const InitOptions &opt, const void *rg, bool wide,
+                        const Histogram &hist, VolumeCache *cache);
+/* any thread, @cache as built above */
+bool volume_cache_write(const InitOptions &opt, const VolumeCache &cache);
+void volume_cache_free(VolumeCache *cache);
+
+#endif /* VOLUME_CACHE_H */
@@ -0,0 +1,431 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#include "volumemask.h"
+#include "util.h"
+
+#include <QtConcurrent>
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct _CutBrick
+{
+    VolumeMask *m;
+    const QMatrix4x4 *mvp;
+    const QImage *coverage;
+    QRect bounds;       /* of the set pixels */
+    QReadWriteLock *lock;
+    int k;
+    size_t cut;
+} CutBrick;
+
+typedef struct _MipBrick
+{
+    VolumeMask *m;
+    int level;
+    int box[6];         /* of the destination level */
+} MipBrick;
+
+void volume_mask_init(VolumeMask *m, int w, int h, int d)
+{
+    size_t n = (size_t) w * h * d;
+
+    m->w = w;
+    m->h = h;
+    m->d = d;
+    m->data = (uint8_t *) malloc(n);
+    memset(m->data, 255, n);
+
+    /* same sizing as the volume ones, the raycaster samples both at
+     * the same level */
+    m->mips.clear();
+    m->mip_bytes = 0;
+    while (w > 1 || h > 1 || d > 1) {
+        PyramidLevel l;
+        l.w = w = MAX(1, w / 2);
+        l.h = h = MAX(1, h / 2);
+        l.d = d = MAX(1, d / 2);
+        l.size = (size_t) l.w * l.h * l.d;
+        l.data = malloc(l.size);
+        memset(l.data, 255, l.size);
+        m->mips << l;
+        m->mip_bytes += l.size;
+    }
+
+    for (int i=0; i<3; i++)
+        m->bricks[i] = ((i == 0 ? m->w : i == 1 ? m->h : m->d) + MASK_BRICK - 1) / MASK_BRICK;
+    m->dirty.fill(0, m->bricks[0] * m->bricks[1] * m->bricks[2]);
+    m->cut = 0;
+}
+
+void volume_mask_free(VolumeMask *m)
+{
+    free(m->data);
+    m->data = NULL;
+    pyramid_free(&m->mips);
+}
+
+static inline void mark_dirty(VolumeMask *m, int x, int y, int z)
+{
+    int k = ((z / MASK_BRICK) * m->bricks[1] + y / MASK_BRICK) * m->bricks[0] + x / MASK_BRICK;
+    m->dirty[k] = 1;
+}
+
+void volume_mask_brick(const VolumeMask *m, int k, int box[6])
+{
+    int bx = k % m->bricks[0];
+    int by = (k / m->bricks[0]) % m->bricks[1];
+    int bz = k / (m->bricks[0] * m->bricks[1]);
+
+    box[0] = bx * MASK_BRICK;
+    box[1] = by * MASK_BRICK;
+    box[2] = bz * MASK_BRICK;
+    box[3] = MIN(box[0] + MASK_BRICK, m->w);
+    box[4] = MIN(box[1] + MASK_BRICK, m->h);
+    box[5] = MIN(box[2] + MASK_BRICK, m->d);
+}
+
+/* a level voxel averages the 2x2x2 below it, the last one of an odd
+ * side is never read, see the pyramid downsampling */
+void volume_mask_level_box(const VolumeMask *m, int level, const int box[6], int out[6])
+{
+    for (int i=0; i<6; i++)
+        out[i] = box[i];
+
+    for (int l=0; l<=level; l++) {
+        const PyramidLevel &pl = m->mips[l];
+        int size[3] = { pl.w, pl.h, pl.d };
+        for (int i=0; i<3; i++) {
+            out[i] = out[i] / 2;
+            out[i+3] = MIN((out[i+3] + 1) / 2, size[i]);
+        }
+    }
+}
+
+/* the brick's corners on screen, skipped if they miss the shape.
+ * Projected without the lock, only the cuts themselves take it */
+static void cut_brick(CutBrick &c)
+{
+    VolumeMask *m = c.m;
+    const QMatrix4x4 &mvp = *c.mvp;
+    int box[6];
+    volume_mask_brick(m, c.k, box);
+
+    float sw = c.coverage->width(), sh = c.coverage->height();
+
+    bool behind = false;
+    float x0 = 1e30f, y0 = 1e30f, x1 = -1e30f, y1 = -1e30f;
+    for (int i=0; i<8; i++) {
+        QVector4D v = mvp * QVector4D((float) box[i & 1 ? 3 : 0] / m->w,
+                                      (float) box[i & 2 ? 4 : 1] / m->h,
+                                      (float) box[i & 4 ? 5 : 2] / m->d, 1.0f);
+        if (v.w() <= 0.0f) {
+            behind = true;
+            break;
+        }
+        float px = (v.x() / v.w() * 0.5f + 0.5f) * sw;
+        float py = (0.5f - v.y() / v.w() * 0.5f) * sh;
+        x0 = MIN(x0, px);
+        y0 = MIN(y0, py);
+        x1 = MAX(x1, px);
+        y1 = MAX(y1, py);
+    }
+    if (!behind && (x1 < c.bounds.left() || x0 > c.bounds.right() + 1 ||
+                    y1 < c.bounds.top() || y0 > c.bounds.bottom() + 1))
+        return;
+
+    /* clip space is affine in the voxel coordinates before the
+     * divide, a column per axis */
+    QVector4D cx = mvp.column(0) / m->w;
+    QVector4D cy = mvp.column(1) / m->h;
+    QVector4D cz = mvp.column(2) / m->d;
+    QVector4D c0 = mvp.column(3);
+    QVector<size_t> hits;
+
+    for (int z=box[2]; z<box[5]; z++) {
+        for (int y=box[1]; y<box[4]; y++) {
+            QVector4D row = c0 + cy * (y + 0.5f) + cz * (z + 0.5f);
+            size_t first = ((size_t) z * m->h + y) * m->w;
+            const uint8_t *v = m->data + first;
+
+            for (int x=box[0]; x<box[3]; x++) {
+                if (!v[x])
+                    continue;
+
+                QVector4D p = row + cx * (x + 0.5f);
+                if (p.w() <= 0.0f)
+                    continue;
+
+                float nx = p.x() / p.w(), ny = p.y() / p.w();
+                if (fabsf(nx) >= 1.0f || fabsf(ny) >= 1.0f)
+                    continue;
+
+                int px = (int) ((nx * 0.5f + 0.5f) * sw);
+                int py = (int) ((0.5f - ny * 0.5f) * sh);
+                if (!c.bounds.contains(px, py) || !c.coverage->constScanLine(py)[px])
+                    continue;
+
+                hits << first + x;
+            }
+        }
+    }
+
+    if (hits.isEmpty())
+        return;
+
+    c.lock->lockForWrite();
+    for (int i=0; i<hits.size(); i++)
+        m->data[hits[i]] = 0;
+    c.lock->unlock();
+
+    c.cut = hits.size();
+    m->dirty[c.k] = 1;
+}
+
+size_t volume_mask_cut_view(VolumeMask *m, const QMatrix4x4 &mvp, const QImage &coverage,
+                            QReadWriteLock *lock)
+{
+    QImage gray = coverage.convertToFormat(QImage::Format_Grayscale8);
+
+    /* set pixels only, most bricks miss them */
+    int x0 = gray.width(), y0 = gray.height(), x1 = -1, y1 = -1;
+    for (int y=0; y<gray.height(); y++) {
+        const uchar *row = gray.constScanLine(y);
+        for (int x=0; x<gray.width(); x++) {
+            if (row[x]) {
+                x0 = MIN(x0, x);
+                x1 = MAX(x1, x);
+                y0 = MIN(y0, y);
+                y1 = MAX(y1, y);
+            }
+        }
+    }
+    if (x1 < 0)
+        return 0;
+    QRect bounds(QPoint(x0, y0), QPoint(x1, y1));
+
+    QVector<CutBrick> bricks;
+    for (int k=0; k<m->dirty.size(); k++) {
+        CutBrick c = { m, &mvp, &gray, bounds, lock, k, 0 };
+        bricks << c;
+    }
+    QtConcurrent::blockingMap(bricks, cut_brick);
+
+    size_t cut = 0;
+    for (int k=0; k<bricks.size(); k++)
+        cut += bricks[k].cut;
+    m->cut += cut;
+
+    return cut;
+}
+
+bool volume_mask_seed(const VolumeMask *m, const VolumeProbe *pr,
+                      QVector3D from, QVector3D to, uint16_t threshold, int seed[3])
+{
+    if (!pr->rg)
+        return false;
+
+    /* the part of the segment inside the volume */
+    QVector3D dir = to - from;
+    float t0 = 0.0f, t1 = 1.0f;
+    for (int a=0; a<3; a++) {
+        if (fabsf(dir[a]) < 1e-9f) {
+            if (from[a] < 0.0f || from[a] > 1.0f)
+                return false;
+            continue;
+        }
+        float ta = -from[a] / dir[a];
+        float tb = (1.0f - from[a]) / dir[a];
+        t0 = MAX(t0, MIN(ta, tb));
+        t1 = MIN(t1, MAX(ta, tb));
+    }
+    if (t0 > t1)
+        return false;
+
+    /* half a voxel at a time */
+    QVector3D size(m->w, m->h, m->d);
+    int steps = (int) ceilf((dir * size).length() * (t1 - t0) * 2.0f) + 1;
+
+    for (int i=0; i<=steps; i++) {
+        QVector3D p = (from + dir * (t0 + (t1 - t0) * i / steps)) * size;
+        int x = CLAMP((int) p.x(), 0, m->w - 1);
+        int y = CLAMP((int) p.y(), 0, m->h - 1);
+        int z = CLAMP((int) p.z(), 0, m->d - 1);
+        size_t idx = ((size_t) z * m->h + y) * m->w + x;
+
+        if (m->data[idx] && volume_probe_intensity(pr, idx) >= threshold) {
+            seed[0] = x;
+            seed[1] = y;
+            seed[2] = z;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+size_t volume_mask_flood(VolumeMask *m, const VolumeProbe *pr,
+                         const int seed[3], uint16_t threshold, QReadWriteLock *lock)
+{
+    if (!pr->rg)
+        return 0;
+
+    size_t row = m->w, plane = (size_t) m->w * m->h;
+    size_t start = seed[2] * plane + seed[1] * row + seed[0];
+    if (!m->data[start] || volume_probe_intensity(pr, start) < threshold)
+        return 0;
+
+    /* cut when pushed, nothing goes on the stack twice */
+    lock->lockForWrite();
+    QVector<size_t> stack;
+    stack << start;
+    m->data[start] = 0;
+    size_t cut = 1;
+    int batch = 0;
+
+    while (!stack.isEmpty()) {
+        /* a brick's worth at a time, readers get their turn in
+         * between */
+        if (++batch == MASK_FLOOD_BATCH) {
+            lock->unlock();
+            lock->lockForWrite();
+            batch = 0;
+        }
+
+        size_t i = stack.takeLast();
+        int x = i % row, y = (i / row) % m->h, z = i / plane;
+        mark_dirty(m, x, y, z);
+
+        size_t next[6];
+        int count = 0;
+        if (x > 0)
+            next[count++] = i - 1;
+        if (x < m->w - 1)
+            next[count++] = i + 1;
+        if (y > 0)
+            next[count++] = i - row;
+        if (y < m->h - 1)
+            next[count++] = i + row;
+        if (z > 0)
+            next[count++] = i - plane;
+        if (z < m->d - 1)
+            next[count++] = i + plane;
+
+        for (int k=0; k<count; k++) {
+            if (m->data[next[k]] && volume_probe_intensity(pr, next[k]) >= threshold) {
+                m->data[next[k]] = 0;
+                stack << next[k];
+                cut++;
+            }
+        }
+    }
+    lock->unlock();
+    m->cut += cut;
+
+    return cut;
+}
+
+/* only the bricks that have cuts go back, one at a time under the
+ * lock */
+void volume_mask_clear(VolumeMask *m, QReadWriteLock *lock)
+{
+    for (int k=0; k<m->dirty.size(); k++) {
+        int box[6];
+        volume_mask_brick(m, k, box);
+
+        QWriteLocker locker(lock);
+        for (int z=box[2]; z<box[5]; z++) {
+            for (int y=box[1]; y<box[4]; y++) {
+                uint8_t *v = m->data + ((size_t) z * m->h + y) * m->w + box[0];
+                size_t n = box[3] - box[0];
+                if (memchr(v, 0, n)) {
+                    memset(v, 255, n);
+                    m->dirty[k] = 1;
+                }
+            }
+        }
+    }
+    m->cut = 0;
+}
+
+/* box averages of the level above over @box, clamped at the border
+ * like the volume pyramid */
+static void downsample_box(MipBrick &b)
+{
+    const VolumeMask *m = b.m;
+    const uint8_t *src = b.level ? (const uint8_t *) m->mips[b.level - 1].data : m->data;
+    int sw = b.level ? m->mips[b.level - 1].w : m->w;
+    int sh = b.level ? m->mips[b.level - 1].h : m->h;
+    int sd = b.level ? m->mips[b.level - 1].d : m->d;
+    const PyramidLevel &l = m->mips[b.level];
+    uint8_t *dst = (uint8_t *) l.data;
+
+    for (int z=b.box[2]; z<b.box[5]; z++) {
+        int z0 = MIN(2 * z, sd - 1), z1 = MIN(2 * z + 1, sd - 1);
+        for (int y=b.box[1]; y<b.box[4]; y++) {
+            int y0 = MIN(2 * y, sh - 1), y1 = MIN(2 * y + 1, sh - 1);
+            for (int x=b.box[0]; x<b.box[3]; x++) {
+                int x0 = MIN(2 * x, sw - 1), x1 = MIN(2 * x + 1, sw - 1);
+                uint32_t acc =
+                    src[((size_t) z0 * sh + y0) * sw + x0] + src[((size_t) z0 * sh + y0) * sw + x1] +
+                    src[((size_t) z0 * sh + y1) * sw + x0] + src[((size_t) z0 * sh + y1) * sw + x1] +
+                    src[((size_t) z1 * sh + y0) * sw + x0] + src[((size_t) z1 * sh + y0) * sw + x1] +
+                    src[((size_t) z1 * sh + y1) * sw + x0] + src[((size_t) z1 * sh + y1) * sw + x1];
+                dst[((size_t) z * l.h + y) * l.w + x] = (acc + 4) / 8;
+            }
+        }
+    }
+}
+
+/* Level by level, each from the one above. While a brick still covers
+   whole voxels of a level the bricks don't overlap there and go in
+   parallel, past that the levels are tiny and get redone whole.
+*/
+void volume_mask_update_mips(VolumeMask *m)
+{
+    for (int i=0; i<m->mips.size(); i++) {
+        QVector<MipBrick> boxes;
+
+        if (i < MASK_BRICK_LEVELS) {
+            for (int k=0; k<m->dirty.size(); k++) {
+                if (!m->dirty[k])
+                    continue;
+
+                MipBrick b;
+                int box[6];
+                b.m = m;
+                b.level = i;
+                volume_mask_brick(m, k, box);
+                volume_mask_level_box(m, i, box, b.box);
+                boxes << b;
+            }
+        } else {
+            const PyramidLevel &l = m->mips[i];
+            MipBrick b = { m, i, { 0, 0, 0, l.w, l.h, l.d } };
+            boxes << b;
+        }
+
+        QtConcurrent::blockingMap(boxes, downsample_box);
+    }
+}
@@ -0,0 +1,101 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#ifndef VOLUME_MASK_H
+#define VOLUME_MASK_H
+
+#include <QVector>
+#include <QImage>
+#include <QReadWriteLock>
+#include <QMatrix4x4>
+#include <QVector3D>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "volumepyramid.h"
+#include "volumeprobe.h"
+
+/* side of the bricks the edits mark dirty, only those go to the gpu */
+#define MASK_BRICK 32
+/* mip levels a brick still covers whole voxels of, log2(MASK_BRICK),
+ * the ones past it are redone and uploaded whole */
+#define MASK_BRICK_LEVELS 5
+/* voxels a flood fill visits between releasing the lock, a brick */
+#define MASK_FLOOD_BATCH (MASK_BRICK * MASK_BRICK * MASK_BRICK)
+
+/* Cuts through the volume, a byte per voxel on top of it: 255 keeps
+   the voxel, 0 cuts it away, the raycaster multiplies opacities by
+   it. The volume itself is never touched, clearing the mask brings
+   everything back.
+
+   Box averaged mipmaps so the level of detail sees the same cuts,
+   edits only recompute the part of each level under the dirty bricks.
+   Flood fills go by the intensities the probe keeps, see
+   volumeprobe.h.
+
+   Edits run on one thread, the only one writing the mask. @lock is
+   the probe's, the one the readers of the data take: edits hold it
+   for writing a brick at a time, never across the whole edit.
+*/
+typedef struct _VolumeMask
+{
+    int w;
+    int h;
+    int d;
+    uint8_t *data;                  /* x fastest */
+    QVector<PyramidLevel> mips;     /* one byte per voxel too */
+    size_t mip_bytes;
+
+    int bricks[3];
+    QVector<uint8_t> dirty;         /* per brick, x fastest */
+    size_t cut;                     /* voxels at 0 */
+} VolumeMask;
+
+void volume_mask_init(VolumeMask *m, int w, int h, int d);
+void volume_mask_free(VolumeMask *m);
+
+/* Everything that projects through @mvp (volume coordinates to clip
+   space) onto a set pixel of @coverage, so a shape drawn on the view
+   cuts all the way through. Returns the voxels cut.
+*/
+size_t volume_mask_cut_view(VolumeMask *m, const QMatrix4x4 &mvp, const QImage &coverage,
+                            QReadWriteLock *lock);
+/* first voxel not cut and at least @threshold along @from-@to, in
+   volume coordinates, false if there's none. @threshold is as
+   stored in @pr, shift included. Only reads, no lock needed on the
+   writing thread */
+bool volume_mask_seed(const VolumeMask *m, const VolumeProbe *pr,
+                      QVector3D from, QVector3D to, uint16_t threshold, int seed[3]);
+/* everything connected to @seed (6-neighbours) at least @threshold */
+size_t volume_mask_flood(VolumeMask *m, const VolumeProbe *pr,
+                         const int seed[3], uint16_t threshold, QReadWriteLock *lock);
+void volume_mask_clear(VolumeMask *m, QReadWriteLock *lock);
+
+/* voxels of brick @k, first x, y, z, end x, y, z */
+void volume_mask_brick(const VolumeMask *m, int k, int box[6]);
+/* part of mip level @level (0 is the first past the mask) under
+ * @box, same layout */
+void volume_mask_level_box(const VolumeMask *m, int level, const int box[6], int out[6]);
+/* the mipmaps under the dirty bricks, the flags stay for the upload */
+void volume_mask_update_mips(VolumeMask *m);
+
+#endif /* VOLUME_MASK_H */
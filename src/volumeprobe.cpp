@@ -0,0 +1,462 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#include "volumeprobe.h"
+
+#include <QtConcurrent>
+
+#include <math.h>
+#include <stdlib.h>
+
+typedef struct _CellSlice
+{
+    VolumeProbe *pr;
+    int z;              /* of the level 0 cells */
+} CellSlice;
+
+/* everything a ray needs from the query, worked out once */
+typedef struct _PickContext
+{
+    const VolumeProbe *pr;
+    const ProbeQuery *q;
+    float norm;         /* texture normalization, 255 or 65535 */
+    float map_scale;    /* normalized to windowed, see window_map() */
+    float map_offset;
+    int n;              /* transfer function entries along intensity */
+    QVector<float> alpha;   /* most opaque of each entry, any gradient */
+    QVector<float> sparse;  /* range maxima of alpha, power of two spans */
+} PickContext;
+
+void volume_probe_init(VolumeProbe *pr)
+{
+    pr->w = pr->h = pr->d = 0;
+    pr->rg = NULL;
+    pr->wide = false;
+    pr->shift = 0;
+    pr->mask = NULL;
+}
+
+void volume_probe_free(VolumeProbe *pr)
+{
+    free(pr->rg);
+    pr->rg = NULL;
+    pr->levels.clear();
+}
+
+/* one voxel past the cell on each side, trilinear samples in the cell
+ * read them too */
+static void cell_ranges(CellSlice &s)
+{
+    VolumeProbe *pr = s.pr;
+    ProbeLevel &l = pr->levels[0];
+    int z0 = MAX(s.z * PROBE_CELL - 1, 0), z1 = MIN((s.z + 1) * PROBE_CELL + 1, pr->d);
+
+    for (int cy=0; cy<l.h; cy++) {
+        int y0 = MAX(cy * PROBE_CELL - 1, 0), y1 = MIN((cy + 1) * PROBE_CELL + 1, pr->h);
+
+        for (int cx=0; cx<l.w; cx++) {
+            int x0 = MAX(cx * PROBE_CELL - 1, 0), x1 = MIN((cx + 1) * PROBE_CELL + 1, pr->w);
+            uint16_t lo = 0xffff, hi = 0;
+
+            for (int z=z0; z<z1; z++) {
+                for (int y=y0; y<y1; y++) {
+                    size_t row = ((size_t) z * pr->h + y) * pr->w;
+                    for (int x=x0; x<x1; x++) {
+                        uint16_t v = volume_probe_intensity(pr, row + x);
+                        lo = MIN(lo, v);
+                        hi = MAX(hi, v);
+                    }
+                }
+            }
+
+            size_t c = ((size_t) s.z * l.h + cy) * l.w + cx;
+            l.lo[c] = lo;
+            l.hi[c] = hi;
+        }
+    }
+}
+
+/* the min/max hierarchy of @pr's volume, from scratch */
+static void build_levels(VolumeProbe *pr)
+{
+    int w = pr->w, h = pr->h, d = pr->d;
+
+    pr->levels.clear();
+    ProbeLevel l;
+    l.w = (w + PROBE_CELL - 1) / PROBE_CELL;
+    l.h = (h + PROBE_CELL - 1) / PROBE_CELL;
+    l.d = (d + PROBE_CELL - 1) / PROBE_CELL;
+    l.lo.resize(l.w * l.h * l.d);
+    l.hi.resize(l.w * l.h * l.d);
+    pr->levels << l;
+
+    QVector<CellSlice> slices;
+    for (int z=0; z<l.d; z++) {
+        CellSlice s = { pr, z };
+        slices << s;
+    }
+    QtConcurrent::blockingMap(slices, cell_ranges);
+
+    /* 2x2x2 of the level below, up to a single cell */
+    while (l.w > 1 || l.h > 1 || l.d > 1) {
+        const ProbeLevel &b = pr->levels.last();
+        ProbeLevel u;
+        u.w = (b.w + 1) / 2;
+        u.h = (b.h + 1) / 2;
+        u.d = (b.d + 1) / 2;
+        u.lo.fill(0xffff, u.w * u.h * u.d);
+        u.hi.fill(0, u.w * u.h * u.d);
+
+        for (int z=0; z<b.d; z++) {
+            for (int y=0; y<b.h; y++) {
+                for (int x=0; x<b.w; x++) {
+                    size_t i = ((size_t) z * b.h + y) * b.w + x;
+                    size_t c = ((size_t) (z / 2) * u.h + y / 2) * u.w + x / 2;
+                    u.lo[c] = MIN(u.lo[c], b.lo[i]);
+                    u.hi[c] = MAX(u.hi[c], b.hi[i]);
+                }
+            }
+        }
+
+        pr->levels << u;
+        l = u;
+    }
+}
+
+void volume_probe_set_volume(VolumeProbe *pr, void *rg, bool wide, int shift,
+                             int w, int h, int d)
+{
+    /* readers keep going on the old volume meanwhile */
+    VolumeProbe next;
+    volume_probe_init(&next);
+    next.rg = rg;
+    next.wide = wide;
+    next.shift = shift;
+    next.w = w;
+    next.h = h;
+    next.d = d;
+    build_levels(&next);
+
+    pr->lock.lockForWrite();
+    void *old = pr->rg;
+    pr->rg = rg;
+    pr->wide = wide;
+    pr->shift = shift;
+    pr->w = w;
+    pr->h = h;
+    pr->d = d;
+    pr->levels.swap(next.levels);
+    pr->lock.unlock();
+
+    /* the old levels go with next */
+    free(old);
+}
+
+static inline float windowed(const PickContext &c, float v)
+{
+    return CLAMP(v / c.norm * c.map_scale + c.map_offset, 0.0f, 1.0f);
+}
+
+/* most opaque transfer function entry a cell's range can reach,
+ * linear filtering included */
+static float range_alpha(const PickContext &c, uint16_t lo, uint16_t hi)
+{
+    float x0 = windowed(c, lo), x1 = windowed(c, hi);
+    if (x0 > x1) {
+        float t = x0;
+        x0 = x1;
+        x1 = t;
+    }
+
+    int i0 = CLAMP((int) floorf(x0 * c.n - 0.5f), 0, c.n - 1);
+    int i1 = CLAMP((int) ceilf(x1 * c.n - 0.5f), 0, c.n - 1);
+    int j = 0;
+    while ((2 << j) <= i1 - i0 + 1)
+        j++;
+
+    return MAX(c.sparse[j * c.n + i0], c.sparse[j * c.n + i1 - (1 << j) + 1]);
+}
+
+/* texel @i of a clamp to edge table of @n, GL_LINEAR */
+static inline float lerp_table(const float *alpha, int stride, int n, float u)
+{
+    u = u * n - 0.5f;
+    int i = (int) floorf(u);
+    float f = u - i;
+    float a = alpha[CLAMP(i, 0, n - 1) * stride];
+    float b = alpha[CLAMP(i + 1, 0, n - 1) * stride];
+
+    return a + (b - a) * f;
+}
+
+/* (intensity, gradient) at @p, trilinear like the texture */
+static void sample(const VolumeProbe *pr, QVector3D p, float *intensity, float *gradient)
+{
+    float u[3] = { p.x() * pr->w - 0.5f, p.y() * pr->h - 0.5f, p.z() * pr->d - 0.5f };
+    int size[3] = { pr->w, pr->h, pr->d };
+    int i0[3], i1[3];
+    float f[3];
+
+    for (int a=0; a<3; a++) {
+        int i = (int) floorf(u[a]);
+        f[a] = u[a] - i;
+        i0[a] = CLAMP(i, 0, size[a] - 1);
+        i1[a] = CLAMP(i + 1, 0, size[a] - 1);
+    }
+
+    float acc[2] = { 0.0f, 0.0f };
+    for (int k=0; k<8; k++) {
+        int x = k & 1 ? i1[0] : i0[0];
+        int y = k & 2 ? i1[1] : i0[1];
+        int z = k & 4 ? i1[2] : i0[2];
+        float wt = (k & 1 ? f[0] : 1.0f - f[0]) * (k & 2 ? f[1] : 1.0f - f[1]) *
+            (k & 4 ? f[2] : 1.0f - f[2]);
+        size_t i = 2 * (((size_t) z * pr->h + y) * pr->w + x);
+
+        if (pr->wide) {
+            acc[0] += wt * ((const uint16_t *) pr->rg)[i];
+            acc[1] += wt * ((const uint16_t *) pr->rg)[i+1];
+        } else {
+            acc[0] += wt * ((const uint8_t *) pr->rg)[i];
+            acc[1] += wt * ((const uint8_t *) pr->rg)[i+1];
+        }
+    }
+
+    *intensity = acc[0];
+    *gradient = acc[1];
+}
+
+/* the transfer function opacity of a sample, what the raycaster
+ * composites before the opacity correction */
+static float sample_alpha(const PickContext &c, QVector3D p, float *intensity)
+{
+    const ProbeQuery &q = *c.q;
+    float gradient;
+    sample(c.pr, p, intensity, &gradient);
+
+    float x = windowed(c, *intensity);
+    float a;
+    if (q.tf_mode == 1) {
+        /* bilinear, rows along the gradient */
+        float v = gradient / c.norm * q.tf2d_height - 0.5f;
+        int j = (int) floorf(v);
+        float f = v - j;
+        const float *r0 = q.tf2d + 4 * q.tf2d_width * CLAMP(j, 0, q.tf2d_height - 1) + 3;
+        const float *r1 = q.tf2d + 4 * q.tf2d_width * CLAMP(j + 1, 0, q.tf2d_height - 1) + 3;
+        float a0 = lerp_table(r0, 4, q.tf2d_width, x);
+        float a1 = lerp_table(r1, 4, q.tf2d_width, x);
+        a = a0 + (a1 - a0) * f;
+    } else {
+        a = lerp_table(q.tf + 3, 4, q.tf_len, x);
+    }
+
+    /* nearest is close enough for the cuts */
+    if (c.pr->mask) {
+        int vx = CLAMP((int) (p.x() * c.pr->w), 0, c.pr->w - 1);
+        int vy = CLAMP((int) (p.y() * c.pr->h), 0, c.pr->h - 1);
+        int vz = CLAMP((int) (p.z() * c.pr->d), 0, c.pr->d - 1);
+        a *= c.pr->mask[((size_t) vz * c.pr->h + vy) * c.pr->w + vx] / 255.0f;
+    }
+
+    return a;
+}
+
+/* Same ray, steps and opacity correction as the raycaster, without
+   the jitter. Empty space goes a cell at a time: the coarsest cell
+   around the sample whose range can't be seen (or can't beat the
+   most opaque sample so far) is skipped whole, a cell we've found
+   something in isn't looked up again.
+*/
+static bool pick(const VolumeProbe *pr, const InitOptions &opt,
+                 const ProbeQuery &q, ProbeHit *hit)
+{
+    int n = q.tf_mode == 1 ? q.tf2d_width : q.tf_len;
+    if (!pr->rg || n <= 0 || (q.tf_mode == 1 && q.tf2d_height <= 0))
+        return false;
+
+    /* the part of the ray inside the volume */
+    QVector3D dir = q.to - q.from;
+    float t0 = 0.0f, t1 = 1.0f;
+    for (int a=0; a<3; a++) {
+        if (fabsf(dir[a]) < 1e-9f) {
+            if (q.from[a] < 0.0f || q.from[a] > 1.0f)
+                return false;
+            continue;
+        }
+        float ta = -q.from[a] / dir[a];
+        float tb = (1.0f - q.from[a]) / dir[a];
+        t0 = MAX(t0, MIN(ta, tb));
+        t1 = MIN(t1, MAX(ta, tb));
+    }
+    if (t0 >= t1)
+        return false;
+
+    QVector3D start = q.from + dir * t0;
+    QVector3D direction = dir * (t1 - t0);
+    float len = direction.length();
+    direction /= len;
+
+    /* step and opacity correction, see the raycast shader */
+    QVector3D size(pr->w, pr->h, pr->d);
+    QVector3D scale(opt.xscale, opt.yscale, opt.zscale);
+    float voxels_per_unit = MAX((direction * size).length(), 1.0f);
+    float world_per_unit = (direction * scale).length();
+    float stepsize, opacity_step;
+    if (q.fixed_step) {
+        opacity_step = MIN(MIN(scale.x() / size.x(), scale.y() / size.y()),
+                           scale.z() / size.z()) / q.sampling_rate;
+        stepsize = opacity_step / MAX(world_per_unit, 1e-6f);
+    } else {
+        stepsize = 1.0f / (q.sampling_rate * voxels_per_unit);
+        opacity_step = stepsize * world_per_unit;
+    }
+    int nsteps = (int) ceilf(len / stepsize);
+
+    PickContext c;
+    c.pr = pr;
+    c.q = &q;
+    c.norm = pr->wide ? 65535.0f : 255.0f;
+    double stored_max = c.norm / (1 << pr->shift);
+    window_map(opt, q.window_level, q.window_width, stored_max, &c.map_scale, &c.map_offset);
+    c.n = n;
+
+    c.alpha.resize(n);
+    for (int i=0; i<n; i++) {
+        if (q.tf_mode == 1) {
+            float a = 0.0f;
+            for (int j=0; j<q.tf2d_height; j++)
+                a = MAX(a, q.tf2d[4 * (j * n + i) + 3]);
+            c.alpha[i] = a;
+        } else {
+            c.alpha[i] = q.tf[4 * i + 3];
+        }
+    }
+    c.sparse = c.alpha;
+    for (int j=1; (1 << j) <= n; j++) {
+        c.sparse.resize((j + 1) * n);
+        for (int i=0; i + (1 << j) <= n; i++)
+            c.sparse[j * n + i] = MAX(c.sparse[(j - 1) * n + i],
+                                      c.sparse[(j - 1) * n + i + (1 << (j - 1))]);
+    }
+
+    QVector3D step_v = direction * size;    /* voxels per unit of t */
+    float accumulated = 0.0f, best = 0.0f;
+    bool found = false;
+    float found_intensity = 0.0f;
+    QVector3D found_pos;
+    size_t seen_cell = (size_t) -1;
+
+    for (int k=0; k<nsteps; ) {
+        float t = k * stepsize;
+        QVector3D pos = start + direction * t;
+        QVector3D pv = pos * size;
+
+        const ProbeLevel &l0 = pr->levels[0];
+        size_t cell = ((size_t) CLAMP((int) pv.z() / PROBE_CELL, 0, l0.d - 1) * l0.h +
+                       CLAMP((int) pv.y() / PROBE_CELL, 0, l0.h - 1)) * l0.w +
+            CLAMP((int) pv.x() / PROBE_CELL, 0, l0.w - 1);
+
+        float skip = -1.0f;
+        if (cell != seen_cell) {
+            for (int L=pr->levels.size()-1; L>=0; L--) {
+                const ProbeLevel &l = pr->levels[L];
+                float side = PROBE_CELL << L;
+                int ci[3];
+                for (int a=0; a<3; a++)
+                    ci[a] = CLAMP((int) (pv[a] / side), 0, (a == 0 ? l.w : a == 1 ? l.h : l.d) - 1);
+                size_t i = ((size_t) ci[2] * l.h + ci[1]) * l.w + ci[0];
+
+                float a = range_alpha(c, l.lo[i], l.hi[i]);
+                if (q.mode == PROBE_FIRST_HIT ? a > 0.0f : a > best)
+                    continue;
+
+                /* out of the cell, in t */
+                float dt = 1e30f;
+                for (int ax=0; ax<3; ax++) {
+                    if (step_v[ax] > 0.0f)
+                        dt = MIN(dt, ((ci[ax] + 1) * side - pv[ax]) / step_v[ax]);
+                    else if (step_v[ax] < 0.0f)
+                        dt = MIN(dt, (ci[ax] * side - pv[ax]) / step_v[ax]);
+                }
+                skip = t + dt;
+                break;
+            }
+            if (skip < 0.0f)
+                seen_cell = cell;
+        }
+
+        if (skip >= 0.0f) {
+            k = MAX(k + 1, (int) ceilf(skip / stepsize));
+            continue;
+        }
+
+        float intensity;
+        float a = sample_alpha(c, pos, &intensity);
+
+        if (q.mode == PROBE_FIRST_HIT) {
+            a = 1.0f - powf(1.0f - a, opacity_step * 200.0f);
+            accumulated += (1.0f - accumulated) * a;
+            if (accumulated >= PROBE_HIT_OPACITY) {
+                found = true;
+                found_pos = pos;
+                found_intensity = intensity;
+                break;
+            }
+        } else if (a > best) {
+            best = a;
+            found = true;
+            found_pos = pos;
+            found_intensity = intensity;
+        }
+
+        k++;
+    }
+
+    if (!found)
+        return false;
+
+    hit->position = found_pos;
+    hit->voxel[0] = CLAMP((int) (found_pos.x() * pr->w), 0, pr->w - 1);
+    hit->voxel[1] = CLAMP((int) (found_pos.y() * pr->h), 0, pr->h - 1);
+    hit->voxel[2] = CLAMP((int) (found_pos.z() * pr->d), 0, pr->d - 1);
+    hit->value = found_intensity / (1 << pr->shift) * opt.rescale_slope + opt.rescale_intercept;
+    hit->opacity = q.mode == PROBE_FIRST_HIT ? accumulated : best;
+
+    return true;
+}
+
+bool volume_probe_pick(VolumeProbe *pr, const InitOptions &opt,
+                       const ProbeQuery &q, ProbeHit *hit, bool *busy)
+{
+    if (busy) {
+        *busy = !pr->lock.tryLockForRead();
+        if (*busy)
+            return false;
+    } else {
+        pr->lock.lockForRead();
+    }
+
+    bool found = pick(pr, opt, q, hit);
+    pr->lock.unlock();
+
+    return found;
+}
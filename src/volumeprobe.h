@@ -0,0 +1,133 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#ifndef VOLUME_PROBE_H
+#define VOLUME_PROBE_H
+
+#include <QVector>
+#include <QVector3D>
+#include <QReadWriteLock>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "util.h"
+
+/* side of the finest min/max cells, each level up merges 2x2x2 */
+#define PROBE_CELL 8
+
+/* accumulated opacity a first hit stops at, the surface you'd point
+ * at in a translucent rendering */
+#define PROBE_HIT_OPACITY 0.5f
+
+/* ms before the hover tries a locked probe again */
+#define PROBE_RETRY_MS 15
+
+enum {
+    PROBE_FIRST_HIT,    /* front to back until PROBE_HIT_OPACITY */
+    PROBE_MAX_OPACITY   /* most opaque sample, like mip picks it */
+};
+
+typedef struct _ProbeLevel
+{
+    int w;
+    int h;
+    int d;
+    QVector<uint16_t> lo;   /* intensity range of each cell, x fastest */
+    QVector<uint16_t> hi;
+} ProbeLevel;
+
+/* The (intensity, gradient) volume kept in memory after the upload,
+   for rays cast on the cpu: picking and the hover probe. Cells of
+   PROBE_CELL voxels know their intensity range (one voxel more on
+   each side, for the interpolation), a ray skips any cell the
+   transfer function makes transparent over that range, at the
+   coarsest level that is.
+
+   The gui thread reads it while the render thread replaces the
+   volume or edits the mask, hence the lock. The render thread is the
+   only writer, it reads without the lock and only takes it, briefly,
+   to change things: the hover shouldn't wait on a whole edit.
+*/
+typedef struct _VolumeProbe
+{
+    QReadWriteLock lock;
+
+    int w;
+    int h;
+    int d;
+    void *rg;           /* NULL until the full volume is in */
+    bool wide;          /* uint16_t pairs, uint8_t otherwise */
+    int shift;          /* stored values are shifted up this much */
+    QVector<ProbeLevel> levels;
+
+    const uint8_t *mask; /* cuts, see volumemask.h, NULL for none */
+} VolumeProbe;
+
+/* the view ray and how the raycaster would sample it */
+typedef struct _ProbeQuery
+{
+    QVector3D from;     /* volume coordinates, anywhere on the ray */
+    QVector3D to;
+    int mode;           /* PROBE_* */
+
+    /* rgba tables as the editor sends them, see RenderParams */
+    const float *tf;
+    int tf_len;
+    const float *tf2d;
+    int tf2d_width;     /* intensity */
+    int tf2d_height;    /* gradient magnitude */
+    int tf_mode;
+
+    double window_level;    /* physical units */
+    double window_width;
+    float sampling_rate;    /* samples per voxel */
+    bool fixed_step;
+} ProbeQuery;
+
+typedef struct _ProbeHit
+{
+    QVector3D position; /* volume coordinates */
+    int voxel[3];       /* nearest one */
+    double value;       /* physical units */
+    float opacity;      /* accumulated, or of the sample for max */
+} ProbeHit;
+
+void volume_probe_init(VolumeProbe *pr);
+void volume_probe_free(VolumeProbe *pr);
+/* @rg: takes ownership, see read_volume(). The cell ranges are built
+ * before the lock is taken, it only covers the swap */
+void volume_probe_set_volume(VolumeProbe *pr, void *rg, bool wide, int shift,
+                             int w, int h, int d);
+
+/* intensity of voxel @i as stored in rg, shift included */
+static inline uint16_t volume_probe_intensity(const VolumeProbe *pr, size_t i)
+{
+    return pr->wide ? ((const uint16_t *) pr->rg)[2*i] : ((const uint8_t *) pr->rg)[2*i];
+}
+
+/* false if the ray misses, there's no volume yet or nothing along it
+ * is visible. Any thread, takes the read lock: waits for it with
+ * @busy NULL, otherwise only tries and sets *@busy if it's held */
+bool volume_probe_pick(VolumeProbe *pr, const InitOptions &opt,
+                       const ProbeQuery &q, ProbeHit *hit, bool *busy);
+
+#endif /* VOLUME_PROBE_H */
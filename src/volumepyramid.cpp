@@ -0,0 +1,140 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#include "volumepyramid.h"
+#include "util.h"
+
+#include <QtConcurrent>
+
+#include <stdlib.h>
+
+typedef struct _DownsampleSlice
+{
+    const void *src;
+    void *dst;
+    bool wide;
+    PyramidFilter filter;
+    int sw, sh, sd;     /* source size */
+    int dw, dh;         /* destination size */
+    int z;              /* destination slice */
+} DownsampleSlice;
+
+int pyramid_level_count(int w, int h, int d)
+{
+    int count = 0;
+
+    while (w > 1 || h > 1 || d > 1) {
+        w = MAX(1, w / 2);
+        h = MAX(1, h / 2);
+        d = MAX(1, d / 2);
+        count++;
+    }
+
+    return count;
+}
+
+/* 2x2x2 blocks, clamped at the border so odd sides and sides already
+ * at 1 still work */
+template <typename T>
+static void downsample(const DownsampleSlice &s)
+{
+    const T *src = (const T *) s.src;
+    T *dst = (T *) s.dst + (size_t) 2 * s.dw * s.dh * s.z;
+
+    int z0 = MIN(2 * s.z, s.sd - 1), z1 = MIN(2 * s.z + 1, s.sd - 1);
+
+    for (int y=0; y<s.dh; y++) {
+        int y0 = MIN(2 * y, s.sh - 1), y1 = MIN(2 * y + 1, s.sh - 1);
+
+        for (int x=0; x<s.dw; x++) {
+            int x0 = MIN(2 * x, s.sw - 1), x1 = MIN(2 * x + 1, s.sw - 1);
+
+            size_t idx[8] = {
+                ((size_t) z0 * s.sh + y0) * s.sw + x0, ((size_t) z0 * s.sh + y0) * s.sw + x1,
+                ((size_t) z0 * s.sh + y1) * s.sw + x0, ((size_t) z0 * s.sh + y1) * s.sw + x1,
+                ((size_t) z1 * s.sh + y0) * s.sw + x0, ((size_t) z1 * s.sh + y0) * s.sw + x1,
+                ((size_t) z1 * s.sh + y1) * s.sw + x0, ((size_t) z1 * s.sh + y1) * s.sw + x1
+            };
+
+            for (int c=0; c<2; c++) {
+                uint32_t acc = 0;
+                if (s.filter == PYRAMID_MAX) {
+                    for (int k=0; k<8; k++)
+                        acc = MAX(acc, (uint32_t) src[2 * idx[k] + c]);
+                } else {
+                    for (int k=0; k<8; k++)
+                        acc += src[2 * idx[k] + c];
+                    acc = (acc + 4) / 8;
+                }
+                dst[2 * (y * s.dw + x) + c] = (T) acc;
+            }
+        }
+    }
+}
+
+static void downsample_slice(DownsampleSlice &s)
+{
+    if (s.wide)
+        downsample<uint16_t>(s);
+    else
+        downsample<uint8_t>(s);
+}
+
+void pyramid_build(const void *rg, bool wide, int w, int h, int d,
+                   PyramidFilter filter, QVector<PyramidLevel> *levels)
+{
+    size_t elem = wide ? sizeof(uint16_t) : sizeof(uint8_t);
+    const void *src = rg;
+
+    levels->clear();
+
+    while (w > 1 || h > 1 || d > 1) {
+        PyramidLevel l;
+        l.w = MAX(1, w / 2);
+        l.h = MAX(1, h / 2);
+        l.d = MAX(1, d / 2);
+        l.size = (size_t) 2 * l.w * l.h * l.d * elem;
+        l.data = malloc(l.size);
+
+        QVector<DownsampleSlice> slices;
+        for (int z=0; z<l.d; z++) {
+            DownsampleSlice s = { src, l.data, wide, filter, w, h, d, l.w, l.h, z };
+            slices << s;
+        }
+        QtConcurrent::blockingMap(slices, downsample_slice);
+
+        *levels << l;
+
+        src = l.data;
+        w = l.w;
+        h = l.h;
+        d = l.d;
+    }
+}
+
+void pyramid_free(QVector<PyramidLevel> *levels)
+{
+    for (int i=0; i<levels->size(); i++)
+        free((*levels)[i].data);
+
+    levels->clear();
+}
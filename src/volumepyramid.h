@@ -0,0 +1,61 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#ifndef VOLUME_PYRAMID_H
+#define VOLUME_PYRAMID_H
+
+#include <QVector>
+#include <stdint.h>
+#include <stddef.h>
+
+/* Mip pyramids of the (intensity, gradient) volume, built on the cpu
+ * so we get to pick the filter: averages for the compositing modes
+ * that integrate, maxima for mip where averaging would make thin
+ * bright structures fade out as the camera pulls back. */
+typedef enum _PyramidFilter
+{
+    PYRAMID_BOX,
+    PYRAMID_MAX
+} PyramidFilter;
+
+typedef struct _PyramidLevel
+{
+    int w;
+    int h;
+    int d;
+    void *data;     /* malloc'd */
+    size_t size;    /* bytes */
+} PyramidLevel;
+
+/* GL sizing, each level halves every side rounding down, stops at
+ * 1x1x1, the count doesn't include the volume itself */
+int pyramid_level_count(int w, int h, int d);
+
+/* Levels past the first of @rg, interleaved pairs, uint16_t if @wide,
+   uint8_t otherwise. @levels is cleared and gets one entry per level
+   in the same layout, free them with pyramid_free().
+*/
+void pyramid_build(const void *rg, bool wide, int w, int h, int d,
+                   PyramidFilter filter, QVector<PyramidLevel> *levels);
+void pyramid_free(QVector<PyramidLevel> *levels);
+
+#endif /* VOLUME_PYRAMID_H */
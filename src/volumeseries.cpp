@@ -0,0 +1,340 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#include "volumeseries.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QCollator>
+#include <QtConcurrent>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+/* see renderer.cpp */
+void *read_volume(const InitOptions &o, bool *wide, Histogram *hist);
+
+/* a row of bricks along x, hashed on its own thread */
+typedef struct _BrickRow
+{
+    const uint8_t *rg;
+    size_t voxel;
+    int w, h, d;
+    int by, bz;
+    int bricks_x;
+    quint64 *out;
+} BrickRow;
+
+/* FNV-1a over the bytes of each brick, a collision would leave a
+ * brick of the previous frame on screen, at 64 bit we can live with
+ * that */
+static void hash_brick_row(const BrickRow &r)
+{
+    int y0 = r.by * SERIES_BRICK, y1 = MIN(y0 + SERIES_BRICK, r.h);
+    int z0 = r.bz * SERIES_BRICK, z1 = MIN(z0 + SERIES_BRICK, r.d);
+
+    for (int bx=0; bx<r.bricks_x; bx++) {
+        int x0 = bx * SERIES_BRICK, x1 = MIN(x0 + SERIES_BRICK, r.w);
+        size_t len = (x1 - x0) * r.voxel;
+        quint64 hash = 14695981039346656037ULL;
+
+        for (int z=z0; z<z1; z++) {
+            for (int y=y0; y<y1; y++) {
+                const uint8_t *row = r.rg + (((size_t) z * r.h + y) * r.w + x0) * r.voxel;
+                for (size_t i=0; i<len; i++) {
+                    hash ^= row[i];
+                    hash *= 1099511628211ULL;
+                }
+            }
+        }
+
+        r.out[bx] = hash;
+    }
+}
+
+static void series_hash_bricks(VolumeSeries *s, const void *rg, bool wide,
+                               QVector<quint64> *bricks)
+{
+    const InitOptions &o = s->opt;
+    bricks->resize(s->bricks[0] * s->bricks[1] * s->bricks[2]);
+
+    QVector<BrickRow> rows;
+    for (int bz=0; bz<s->bricks[2]; bz++) {
+        for (int by=0; by<s->bricks[1]; by++) {
+            BrickRow r;
+            r.rg = (const uint8_t *) rg;
+            r.voxel = wide ? 4 : 2;
+            r.w = o.width;
+            r.h = o.height;
+            r.d = o.depth;
+            r.by = by;
+            r.bz = bz;
+            r.bricks_x = s->bricks[0];
+            r.out = bricks->data() + (bz * s->bricks[1] + by) * s->bricks[0];
+            rows << r;
+        }
+    }
+
+    QtConcurrent::blockingMap(rows, hash_brick_row);
+}
+
+/* where frame @i is, every other option is the series' */
+static void series_frame_options(const InitOptions &opt, int i, InitOptions *o)
+{
+    *o = opt;
+
+    if (opt.series_files.size() > 1) {
+        o->filename = opt.series_files[i];
+        o->file_offset = 0;
+    } else {
+        qint64 frame_bytes = (qint64) opt.file_width * opt.file_height * opt.file_depth *
+            (opt.bit_depth > 8 ? 2 : 1);
+        o->filename = opt.series_files[0];
+        o->file_offset = frame_bytes * i;
+    }
+}
+
+static SeriesFrame *series_find(VolumeSeries *s, int i)
+{
+    for (int k=0; k<SERIES_RING_SIZE; k++) {
+        if (s->ring[k].index == i)
+            return &s->ring[k];
+    }
+
+    return NULL;
+}
+
+/* Decode the first frame past the playhead that isn't in the ring yet
+   into a slot holding one that is behind it, sleep when there's
+   nothing like that. A slot is always left over for the frame the
+   renderer might still be uploading after the playhead moved on.
+*/
+static void series_read_ahead(VolumeSeries *s)
+{
+    int ahead = MIN(SERIES_RING_SIZE - 1, s->frames);
+
+    s->lock.lock();
+    while (!s->quit) {
+        int next = -1;
+        for (int k=0; k<ahead && next < 0; k++) {
+            int i = (s->playhead + k) % s->frames;
+            if (!series_find(s, i))
+                next = i;
+        }
+
+        SeriesFrame *slot = NULL;
+        for (int k=0; k<SERIES_RING_SIZE && next >= 0 && !slot; k++) {
+            SeriesFrame *f = &s->ring[k];
+            int distance = (f->index - s->playhead + s->frames) % s->frames;
+            if (!f->busy && (f->index < 0 || distance >= ahead))
+                slot = f;
+        }
+
+        if (!slot) {
+            s->wake.wait(&s->lock);
+            continue;
+        }
+
+        free(slot->rg);
+        slot->rg = NULL;
+        slot->index = next;
+        slot->busy = true;
+
+        InitOptions o;
+        series_frame_options(s->opt, next, &o);
+        s->lock.unlock();
+
+        bool wide;
+        Histogram hist;
+        QVector<quint64> bricks;
+        void *rg = read_volume(o, &wide, &hist);
+        /* gone since volume_series_probe() saw it, play on with an empty one */
+        if (!rg) {
+            fprintf(stderr, "frame %d unreadable, shown empty\n", next);
+            wide = o.bit_depth > 8;
+            rg = calloc((size_t) o.width * o.height * o.depth, 2 * (wide ? 2 : 1));
+            hist.total = 0;
+            hist.peak = 0;
+            hist.bit_depth = o.bit_depth;
+            hist.joint_peak = 0;
+        }
+        series_hash_bricks(s, rg, wide, &bricks);
+
+        s->lock.lock();
+        slot->rg = rg;
+        slot->wide = wide;
+        slot->histogram = hist;
+        slot->bricks = bricks;
+        slot->busy = false;
+        s->wake.wakeAll();
+    }
+    s->lock.unlock();
+}
+
+/* Before session_select(), the frame size is the whole file grid of
+   -s and -d, any box and stride apply to every frame. Files in a
+   directory too small for a frame are left out.
+*/
+bool volume_series_probe(InitOptions *opt)
+{
+    QFileInfo info(opt->series);
+    qint64 frame_bytes = (qint64) opt->width * opt->height * opt->depth *
+        (opt->bit_depth > 8 ? 2 : 1);
+
+    opt->series_files.clear();
+    opt->series_frames = 0;
+    opt->file_offset = 0;
+
+    if (!info.exists()) {
+        fprintf(stderr, "couldn't open: %s\n", opt->series.toUtf8().data());
+        return false;
+    }
+
+    if (info.isDir()) {
+        QDir dir(opt->series);
+        QStringList names = dir.entryList(QDir::Files);
+
+        /* frame2 before frame10 */
+        QCollator collator;
+        collator.setNumericMode(true);
+        std::sort(names.begin(), names.end(), collator);
+
+        foreach (const QString &name, names) {
+            QString path = dir.filePath(name);
+            if (QFileInfo(path).size() < frame_bytes) {
+                fprintf(stderr, "%s is too small for a frame, skipped\n",
+                        path.toUtf8().data());
+                continue;
+            }
+            opt->series_files << path;
+        }
+        opt->series_frames = opt->series_files.size();
+    } else {
+        opt->series_files << opt->series;
+        opt->series_frames = info.size() / frame_bytes;
+    }
+
+    if (opt->series_frames < 1) {
+        fprintf(stderr, "no %ux%ux%u frames in %s\n", opt->width, opt->height, opt->depth,
+                opt->series.toUtf8().data());
+        return false;
+    }
+
+    opt->filename = opt->series_files[0];
+    printf("Series: %d frames of %.1f MB\n", opt->series_frames, frame_bytes / 1048576.0);
+
+    return true;
+}
+
+/* @opt: after session_select(), the reader starts right away */
+void volume_series_open(VolumeSeries *s, const InitOptions &opt)
+{
+    s->opt = opt;
+    s->frames = opt.series_frames;
+    s->bricks[0] = (opt.width + SERIES_BRICK - 1) / SERIES_BRICK;
+    s->bricks[1] = (opt.height + SERIES_BRICK - 1) / SERIES_BRICK;
+    s->bricks[2] = (opt.depth + SERIES_BRICK - 1) / SERIES_BRICK;
+
+    for (int k=0; k<SERIES_RING_SIZE; k++) {
+        s->ring[k].index = -1;
+        s->ring[k].busy = false;
+        s->ring[k].rg = NULL;
+        s->ring[k].wide = false;
+    }
+    s->playhead = 0;
+    s->quit = false;
+
+    s->pool.setMaxThreadCount(1);
+    s->reader = QtConcurrent::run(&s->pool, series_read_ahead, s);
+}
+
+void volume_series_seek(VolumeSeries *s, int i)
+{
+    s->lock.lock();
+    if (i != s->playhead) {
+        s->playhead = i;
+        s->wake.wakeAll();
+    }
+    s->lock.unlock();
+}
+
+/* @wait: only frames past the playhead ever turn up */
+SeriesFrame *volume_series_acquire(VolumeSeries *s, int i, bool wait)
+{
+    SeriesFrame *f;
+
+    s->lock.lock();
+    for (;;) {
+        f = series_find(s, i);
+        if (f && !f->busy) {
+            f->busy = true;
+            break;
+        }
+        f = NULL;
+        if (!wait)
+            break;
+        s->wake.wait(&s->lock);
+    }
+    s->lock.unlock();
+
+    return f;
+}
+
+void volume_series_release(VolumeSeries *s, SeriesFrame *f)
+{
+    s->lock.lock();
+    f->busy = false;
+    s->wake.wakeAll();
+    s->lock.unlock();
+}
+
+void volume_series_brick(const VolumeSeries *s, int k, int box[6])
+{
+    int bx = k % s->bricks[0];
+    int by = (k / s->bricks[0]) % s->bricks[1];
+    int bz = k / (s->bricks[0] * s->bricks[1]);
+
+    box[0] = bx * SERIES_BRICK;
+    box[1] = by * SERIES_BRICK;
+    box[2] = bz * SERIES_BRICK;
+    box[3] = MIN(box[0] + SERIES_BRICK, (int) s->opt.width);
+    box[4] = MIN(box[1] + SERIES_BRICK, (int) s->opt.height);
+    box[5] = MIN(box[2] + SERIES_BRICK, (int) s->opt.depth);
+}
+
+/* stops the reader, frames still in the ring are freed */
+void volume_series_close(VolumeSeries *s)
+{
+    s->lock.lock();
+    s->quit = true;
+    s->wake.wakeAll();
+    s->lock.unlock();
+
+    s->reader.waitForFinished();
+
+    for (int k=0; k<SERIES_RING_SIZE; k++) {
+        free(s->ring[k].rg);
+        s->ring[k].rg = NULL;
+        s->ring[k].index = -1;
+    }
+}
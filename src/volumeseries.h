@@ -0,0 +1,95 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#ifndef VOLUME_SERIES_H
+#define VOLUME_SERIES_H
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QMutex>
+#include <QWaitCondition>
+#include <QThreadPool>
+#include <QFuture>
+
+#include "util.h"
+#include "histogram.h"
+
+/* decoded frames kept around, the one on screen and the ones coming
+ * up next */
+#define SERIES_RING_SIZE 6
+
+/* side of the bricks compared across frames, only the ones that
+ * changed are uploaded */
+#define SERIES_BRICK 32
+
+typedef struct _SeriesFrame
+{
+    int index;          /* time point, -1 while empty */
+    bool busy;          /* being decoded or uploaded, stays put */
+    void *rg;           /* (intensity, gradient) pairs, see read_volume() */
+    bool wide;
+    Histogram histogram;
+    QVector<quint64> bricks; /* a hash per brick, x fastest */
+} SeriesFrame;
+
+/* Time series: the same grid over a number of time points, a raw
+   file per frame in a directory (name order, numbers compare as
+   numbers) or all of them back to back in a single file. A reader of
+   its own decodes the frames past the playhead into a small ring,
+   the renderer takes them from there and never waits on the disk.
+
+   Gradients and histograms are per frame, worked out on the reader
+   thread like for any other volume.
+*/
+typedef struct _VolumeSeries
+{
+    InitOptions opt;
+    int frames;
+    int bricks[3];
+
+    QMutex lock;
+    QWaitCondition wake;
+    SeriesFrame ring[SERIES_RING_SIZE];
+    int playhead;
+    bool quit;
+
+    QThreadPool pool;   /* just the reader, the global one does gradients */
+    QFuture<void> reader;
+} VolumeSeries;
+
+/* fills in the frame files and count of @opt->series, the first frame
+ * becomes opt->filename */
+bool volume_series_probe(InitOptions *opt);
+
+void volume_series_open(VolumeSeries *s, const InitOptions &opt);
+/* read ahead from frame @i on, what's behind it can go */
+void volume_series_seek(VolumeSeries *s, int i);
+/* frame @i if it's decoded, NULL otherwise unless @wait. It stays in
+ * the ring until released */
+SeriesFrame *volume_series_acquire(VolumeSeries *s, int i, bool wait);
+void volume_series_release(VolumeSeries *s, SeriesFrame *f);
+/* voxels of brick @k, first x, y, z, end x, y, z */
+void volume_series_brick(const VolumeSeries *s, int k, int box[6]);
+void volume_series_close(VolumeSeries *s);
+
+#endif /* VOLUME_SERIES_H */
@@ -0,0 +1,438 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#include "volumestorage.h"
+#include "util.h"
+
+#include <QVector>
+#include <QtConcurrent>
+
+#include <math.h>
+#include <string.h>
+
+/* a code never gets more than this many times its fair share of
+ * voxels, otherwise the background peak alone eats half the codes */
+#define CODEBOOK_CLIP 1.0
+
+/* importance of a fine bin: floor + opacity + capped slope */
+#define IMPORTANCE_FLOOR 0.02
+#define IMPORTANCE_SLOPE 0.1
+#define IMPORTANCE_SLOPE_MAX 4.0
+
+bool volume_storage_from_string(const QString &name, VolumeStorage *storage)
+{
+    if (name == "native")
+        *storage = STORAGE_NATIVE;
+    else if (name == "linear8")
+        *storage = STORAGE_LINEAR8;
+    else if (name == "equalized8")
+        *storage = STORAGE_EQUALIZED8;
+    else if (name == "tf8")
+        *storage = STORAGE_TF8;
+    else if (name == "rgtc")
+        *storage = STORAGE_RGTC;
+    else if (name == "packed12")
+        *storage = STORAGE_PACKED12;
+    else
+        return false;
+
+    return true;
+}
+
+QString volume_storage_to_string(VolumeStorage storage)
+{
+    switch (storage) {
+    case STORAGE_NATIVE:     return "native";
+    case STORAGE_LINEAR8:    return "linear8";
+    case STORAGE_EQUALIZED8: return "equalized8";
+    case STORAGE_TF8:        return "tf8";
+    case STORAGE_RGTC:       return "rgtc";
+    case STORAGE_PACKED12:   return "packed12";
+    }
+
+    return QString();
+}
+
+int volume_storage_format(VolumeStorage storage)
+{
+    switch (storage) {
+    case STORAGE_EQUALIZED8:
+    case STORAGE_TF8:
+        return VOLUME_FORMAT_CODES;
+    case STORAGE_PACKED12:
+        return VOLUME_FORMAT_PACKED12;
+    default:
+        return VOLUME_FORMAT_NORMALIZED;
+    }
+}
+
+size_t volume_storage_size(VolumeStorage storage, bool wide, int w, int h, int d)
+{
+    size_t n = (size_t) w * h * d;
+
+    switch (storage) {
+    case STORAGE_NATIVE:
+        return 2 * n * (wide ? sizeof(uint16_t) : sizeof(uint8_t));
+    case STORAGE_RGTC:
+        /* 16 bytes per 4x4 block, two BC4 blocks */
+        return (size_t) ((w + 3) / 4) * ((h + 3) / 4) * d * 16;
+    default:
+        return 2 * n;
+    }
+}
+
+void storage_encode_linear8(const uint16_t *rg, size_t n, uint8_t *out)
+{
+    for (size_t i=0; i<2*n; i++)
+        out[i] = rg[i] >> 8;
+}
+
+// -----------------------------------------------------------------------
+//    CODEBOOKS
+// -----------------------------------------------------------------------
+
+void storage_build_codebook(const uint16_t *rg, size_t n, const float *importance,
+                            uint8_t *lut, float *dequant)
+{
+    QVector<quint64> counts(STORAGE_FINE_BINS, 0);
+    for (size_t i=0; i<n; i++)
+        counts[rg[2*i] >> 4]++;
+
+    QVector<double> weights(STORAGE_FINE_BINS, 0.0);
+    double total = 0.0;
+    for (int b=0; b<STORAGE_FINE_BINS; b++) {
+        if (importance)
+            weights[b] = counts[b] ? importance[b] : 0.0;
+        else
+            weights[b] = counts[b];
+        total += weights[b];
+    }
+
+    /* empty volume, fall back to linear */
+    if (total <= 0.0) {
+        for (int b=0; b<STORAGE_FINE_BINS; b++)
+            weights[b] = 1.0;
+        total = STORAGE_FINE_BINS;
+    }
+
+    /* clip the peaks, twice as clipping lowers the total */
+    for (int k=0; k<2; k++) {
+        double cap = CODEBOOK_CLIP * total / STORAGE_CODES;
+        total = 0.0;
+        for (int b=0; b<STORAGE_FINE_BINS; b++) {
+            weights[b] = MIN(weights[b], cap);
+            total += weights[b];
+        }
+    }
+
+    /* each bin takes the code at the middle of its cumulative share */
+    double acc = 0.0;
+    for (int b=0; b<STORAGE_FINE_BINS; b++) {
+        int code = (int) (STORAGE_CODES * (acc + 0.5 * weights[b]) / total);
+        lut[b] = CLAMP(code, 0, STORAGE_CODES-1);
+        acc += weights[b];
+    }
+
+    /* a code stands for the mean of its voxels, bins without voxels
+     * only count when the code has none */
+    double sum[STORAGE_CODES], count[STORAGE_CODES];
+    double bin_sum[STORAGE_CODES], bin_count[STORAGE_CODES];
+    memset(sum, 0, sizeof(sum));
+    memset(count, 0, sizeof(count));
+    memset(bin_sum, 0, sizeof(bin_sum));
+    memset(bin_count, 0, sizeof(bin_count));
+    for (int b=0; b<STORAGE_FINE_BINS; b++) {
+        double center = (16.0 * b + 7.5) / 65535.0;
+        sum[lut[b]] += counts[b] * center;
+        count[lut[b]] += counts[b];
+        bin_sum[lut[b]] += center;
+        bin_count[lut[b]] += 1.0;
+    }
+
+    int known[STORAGE_CODES];
+    for (int c=0; c<STORAGE_CODES; c++) {
+        known[c] = 1;
+        if (count[c] > 0)
+            dequant[c] = sum[c] / count[c];
+        else if (bin_count[c] > 0)
+            dequant[c] = bin_sum[c] / bin_count[c];
+        else
+            known[c] = 0;
+    }
+
+    /* unused codes still show up when filtering between two used
+     * ones, interpolate so the filtering stays linear */
+    for (int c=0; c<STORAGE_CODES; c++) {
+        if (known[c])
+            continue;
+
+        int lo = c - 1, hi = c + 1;
+        while (lo >= 0 && !known[lo]) lo--;
+        while (hi < STORAGE_CODES && !known[hi]) hi++;
+
+        if (lo < 0)
+            dequant[c] = dequant[hi];
+        else if (hi >= STORAGE_CODES)
+            dequant[c] = dequant[lo];
+        else
+            dequant[c] = lerp(dequant[lo], dequant[hi], (double) (c - lo) / (hi - lo));
+    }
+}
+
+void storage_encode_codes(const uint16_t *rg, size_t n, const uint8_t *lut, uint8_t *out)
+{
+    for (size_t i=0; i<n; i++) {
+        out[2*i] = lut[rg[2*i] >> 4];
+        out[2*i+1] = rg[2*i+1] >> 8;
+    }
+}
+
+static void tf_sample(const float *tf, int len, double t, float *rgba)
+{
+    double x = CLAMP(t, 0.0, 1.0) * (len - 1);
+    int i = MIN((int) x, len - 2);
+    double f = x - i;
+
+    for (int c=0; c<4; c++)
+        rgba[c] = lerp(tf[4*i+c], tf[4*(i+1)+c], f);
+}
+
+void storage_tf_importance(const float *tf, int len, float scale, float offset,
+                           float *importance)
+{
+    if (len < 2) {
+        for (int b=0; b<STORAGE_FINE_BINS; b++)
+            importance[b] = 1.0;
+        return;
+    }
+
+    double dt = 1.0 / STORAGE_FINE_BINS;
+
+    for (int b=0; b<STORAGE_FINE_BINS; b++) {
+        float c[4], l[4], h[4];
+        double t = (b + 0.5) * dt;
+        tf_sample(tf, len, t * scale + offset, c);
+        tf_sample(tf, len, (t - dt) * scale + offset, l);
+        tf_sample(tf, len, (t + dt) * scale + offset, h);
+
+        /* color changes only matter where something is visible */
+        double alpha = CLAMP(c[3], 0.0f, 1.0f);
+        double slope = fabs(h[3] - l[3]);
+        for (int k=0; k<3; k++)
+            slope += alpha * fabs(h[k] - l[k]);
+        slope /= 2.0 * dt;
+
+        importance[b] = IMPORTANCE_FLOOR + alpha +
+            MIN(IMPORTANCE_SLOPE * slope, IMPORTANCE_SLOPE_MAX);
+    }
+}
+
+// -----------------------------------------------------------------------
+//    RGTC
+// -----------------------------------------------------------------------
+
+/* BC4 block, max and min as endpoints so we always get the 8 level
+ * mode, each texel picks the nearest level */
+static void bc4_encode_block(const uint8_t v[16], uint8_t *out)
+{
+    uint8_t lo = 255, hi = 0;
+    for (int t=0; t<16; t++) {
+        lo = MIN(lo, v[t]);
+        hi = MAX(hi, v[t]);
+    }
+
+    uint64_t bits = 0;
+    if (hi > lo) {
+        for (int t=0; t<16; t++) {
+            /* k levels up from lo */
+            int k = (int) floor((v[t] - lo) * 7.0 / (hi - lo) + 0.5);
+            uint64_t idx = k == 7 ? 0 : (k == 0 ? 1 : 8 - k);
+            bits |= idx << (3 * t);
+        }
+    }
+
+    out[0] = hi;
+    out[1] = lo;
+    for (int j=0; j<6; j++)
+        out[2+j] = (bits >> (8 * j)) & 0xff;
+}
+
+static double bc4_decode_texel(const uint8_t *block, int t)
+{
+    uint64_t bits = 0;
+    for (int j=0; j<6; j++)
+        bits |= (uint64_t) block[2+j] << (8 * j);
+
+    int idx = (bits >> (3 * t)) & 7;
+    double r0 = block[0], r1 = block[1];
+    double v;
+
+    if (idx == 0)
+        v = r0;
+    else if (idx == 1)
+        v = r1;
+    else if (r0 > r1)
+        v = ((8 - idx) * r0 + (idx - 1) * r1) / 7.0;
+    else if (idx < 6)
+        v = ((6 - idx) * r0 + (idx - 1) * r1) / 5.0;
+    else
+        v = idx == 6 ? 0.0 : 255.0;
+
+    return v / 255.0;
+}
+
+typedef struct _RgtcSlice
+{
+    const uint8_t *rg;
+    uint8_t *out;
+    int w;
+    int h;
+    int z;
+} RgtcSlice;
+
+static void rgtc_encode_slice(RgtcSlice &s)
+{
+    int bw = (s.w + 3) / 4;
+    int bh = (s.h + 3) / 4;
+    const uint8_t *slice = s.rg + (size_t) 2 * s.w * s.h * s.z;
+    uint8_t *out = s.out + (size_t) bw * bh * s.z * 16;
+
+    for (int by=0; by<bh; by++) {
+        for (int bx=0; bx<bw; bx++) {
+            uint8_t r[16], g[16];
+
+            /* partial blocks at the border repeat the last texel */
+            for (int t=0; t<16; t++) {
+                int x = MIN(bx * 4 + (t & 3), s.w - 1);
+                int y = MIN(by * 4 + (t >> 2), s.h - 1);
+                r[t] = slice[2 * (y * s.w + x)];
+                g[t] = slice[2 * (y * s.w + x) + 1];
+            }
+
+            uint8_t *block = out + (by * bw + bx) * 16;
+            bc4_encode_block(r, block);
+            bc4_encode_block(g, block + 8);
+        }
+    }
+}
+
+void storage_encode_rgtc(const uint8_t *rg, int w, int h, int d, uint8_t *out)
+{
+    QVector<RgtcSlice> slices;
+    for (int z=0; z<d; z++) {
+        RgtcSlice s = { rg, out, w, h, z };
+        slices << s;
+    }
+
+    QtConcurrent::blockingMap(slices, rgtc_encode_slice);
+}
+
+void storage_encode_packed12(const uint16_t *rg, size_t n, uint16_t *out)
+{
+    for (size_t i=0; i<n; i++)
+        out[i] = (rg[2*i] & 0xfff0) | (rg[2*i+1] >> 12);
+}
+
+// -----------------------------------------------------------------------
+//    ERROR
+// -----------------------------------------------------------------------
+
+typedef struct _ErrorSlice
+{
+    const void *rg;
+    bool wide;
+    int w;
+    int h;
+    int z;
+    VolumeStorage storage;
+    const void *stored;
+    const float *dequant;
+    double sum;
+    double max;
+} ErrorSlice;
+
+/* same decoding the shader does */
+static double decode_intensity(const ErrorSlice &s, int x, int y, size_t i)
+{
+    switch (s.storage) {
+    case STORAGE_LINEAR8:
+        return ((const uint8_t *) s.stored)[2*i] / 255.0;
+    case STORAGE_EQUALIZED8:
+    case STORAGE_TF8:
+        return s.dequant[((const uint8_t *) s.stored)[2*i]];
+    case STORAGE_RGTC: {
+        int bw = (s.w + 3) / 4;
+        int bh = (s.h + 3) / 4;
+        size_t block = ((size_t) s.z * bh + y / 4) * bw + x / 4;
+        return bc4_decode_texel((const uint8_t *) s.stored + block * 16,
+                                (y & 3) * 4 + (x & 3));
+    }
+    case STORAGE_PACKED12:
+        return ((((const uint16_t *) s.stored)[i] & 0xfff0) + 8.0) / 65535.0;
+    default:
+        if (s.wide)
+            return ((const uint16_t *) s.rg)[2*i] / 65535.0;
+        return ((const uint8_t *) s.rg)[2*i] / 255.0;
+    }
+}
+
+static void error_slice(ErrorSlice &s)
+{
+    s.sum = 0.0;
+    s.max = 0.0;
+
+    for (int y=0; y<s.h; y++) {
+        for (int x=0; x<s.w; x++) {
+            size_t i = ((size_t) s.z * s.h + y) * s.w + x;
+            double v = s.wide ? ((const uint16_t *) s.rg)[2*i] / 65535.0
+                              : ((const uint8_t *) s.rg)[2*i] / 255.0;
+            double e = fabs(decode_intensity(s, x, y, i) - v);
+
+            s.sum += e * e;
+            s.max = MAX(s.max, e);
+        }
+    }
+}
+
+void storage_error(const void *rg, bool wide, int w, int h, int d,
+                   VolumeStorage storage, const void *stored, const float *dequant,
+                   StorageError *err)
+{
+    QVector<ErrorSlice> slices;
+    for (int z=0; z<d; z++) {
+        ErrorSlice s = { rg, wide, w, h, z, storage, stored, dequant, 0.0, 0.0 };
+        slices << s;
+    }
+
+    QtConcurrent::blockingMap(slices, error_slice);
+
+    double sum = 0.0;
+    err->max_error = 0.0;
+    for (int z=0; z<d; z++) {
+        sum += slices[z].sum;
+        err->max_error = MAX(err->max_error, slices[z].max);
+    }
+
+    size_t n = (size_t) w * h * d;
+    err->rmse = n ? sqrt(sum / n) : 0.0;
+    err->psnr = err->rmse > 0.0 ? 20.0 * log10(1.0 / err->rmse) : INFINITY;
+}
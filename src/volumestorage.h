@@ -0,0 +1,122 @@
+/*
+ *  qvrc - a GLSL volume rendering engine
+ *  well... engine... let's say prototype/proof of concept... hack?
+ *
+ *  Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+ *
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU General Public License as
+ *  published by the Free Software Foundation; either version 2 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ *  General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ *  02110-1301 USA.
+ */
+
+#ifndef VOLUME_STORAGE_H
+#define VOLUME_STORAGE_H
+
+#include <QString>
+#include <stdint.h>
+#include <stddef.h>
+
+/* how the (intensity, gradient) volume is kept on the gpu, sizes are
+ * per voxel:
+ *   native:     GL_RG8 / GL_RG16, 2 or 4 bytes
+ *   linear8:    top byte of both channels, 2 bytes
+ *   equalized8: 8 bit intensity codes spread by histogram
+ *               equalization, decoded through a 256 entry table, 2 bytes
+ *   tf8:        same, codes spread where the transfer function
+ *               changes, requantized when it does, 2 bytes
+ *   rgtc:       RGTC2 (BC5) compressed 4x4 blocks, 1 byte
+ *   packed12:   12 bit intensity and 4 bit gradient in a GL_R16UI,
+ *               filtered in the shader, 2 bytes */
+typedef enum _VolumeStorage
+{
+    STORAGE_NATIVE,
+    STORAGE_LINEAR8,
+    STORAGE_EQUALIZED8,
+    STORAGE_TF8,
+    STORAGE_RGTC,
+    STORAGE_PACKED12
+} VolumeStorage;
+
+/* shader side decoding, the volume_format uniform */
+enum {
+    VOLUME_FORMAT_NORMALIZED,
+    VOLUME_FORMAT_CODES,
+    VOLUME_FORMAT_PACKED12
+};
+
+/* intensity quantization works on 12 bit bins, codebooks map them to
+ * 8 bit codes */
+#define STORAGE_FINE_BINS 4096
+#define STORAGE_CODES 256
+
+typedef struct _StorageError
+{
+    double rmse;        /* normalized intensity */
+    double max_error;
+    double psnr;        /* dB, peak 1.0 */
+} StorageError;
+
+bool volume_storage_from_string(const QString &name, VolumeStorage *storage);
+QString volume_storage_to_string(VolumeStorage storage);
+
+/* shader decoding and bytes per volume for a storage, @wide: 16 bit
+ * source data */
+int volume_storage_format(VolumeStorage storage);
+size_t volume_storage_size(VolumeStorage storage, bool wide, int w, int h, int d);
+
+/* All encoders take @n interleaved (intensity, gradient) voxels, as
+   coming from gradient_pack_*. 16 bit input must span the whole 16 bit
+   range. */
+
+/* top byte of both channels */
+void storage_encode_linear8(const uint16_t *rg, size_t n, uint8_t *out);
+
+/* Codebook from the intensity distribution: with @importance NULL
+   every code gets the same share of voxels (histogram equalization),
+   otherwise occupied bins are weighted by @importance, one value per
+   fine bin. @dequant gets the normalized intensity each code stands
+   for, @lut the code of each fine bin.
+*/
+void storage_build_codebook(const uint16_t *rg, size_t n, const float *importance,
+                            uint8_t *lut, float *dequant);
+void storage_encode_codes(const uint16_t *rg, size_t n, const uint8_t *lut, uint8_t *out);
+
+/* Per fine bin importance from an RGBA transfer function of @len
+   entries: opacity plus how fast the table changes, edges in the
+   transfer function need the resolution, flat transparent ranges
+   don't.
+
+   @scale, @offset: stored intensity to table coordinate, the window
+*/
+void storage_tf_importance(const float *tf, int len, float scale, float offset,
+                           float *importance);
+
+/* RGTC2 blocks, slice by slice, @out must hold
+   volume_storage_size(STORAGE_RGTC, ...) bytes */
+void storage_encode_rgtc(const uint8_t *rg, int w, int h, int d, uint8_t *out);
+
+/* 12 bit intensity in the top bits, 4 bit gradient at the bottom */
+void storage_encode_packed12(const uint16_t *rg, size_t n, uint16_t *out);
+
+/* Intensity error of the stored volume against the original one, as
+   the shader would decode it.
+
+   @rg: original, uint16_t pairs if @wide, uint8_t otherwise
+   @dequant: code table, only for the codebook storages
+*/
+void storage_error(const void *rg, bool wide, int w, int h, int d,
+                   VolumeStorage storage, const void *stored, const float *dequant,
+                   StorageError *err);
+
+#endif /* VOLUME_STORAGE_H */
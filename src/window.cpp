@@ -34,6 +34,12 @@
 #include <QFormLayout>
 #include <QGroupBox>
 #include <QColorDialog>
+#include <QCheckBox>
+#include <QStatusBar>
+#include <QFileInfo>
+#include <QSlider>
+
+#include <math.h>
 
 #include "colorbutton.h"
 
@@ -58,7 +64,7 @@ Window::Window(InitOptions &opt)
     prman = new PresetManager("presets");
 
     QWidget *centralwidget = new QWidget();
-    GLWidget *glWidget = new GLWidget(opt);
+    glWidget = new GLWidget(opt);
 
     QGroupBox *tfgroup = new QGroupBox("Transfer Function");
     QVBoxLayout *tflayout = new QVBoxLayout();
@@ -87,6 +93,7 @@ Window::Window(InitOptions &opt)
     hlayout->addLayout(vlayout);
 
     tf = new TransFuncWidget(prman);
+    tf->set_auto_range(opt.auto_range);
     tflayout->addWidget(tf);
     tfgroup->setLayout(tflayout);
     tflayout->addLayout(playout);
@@ -96,6 +103,51 @@ Window::Window(InitOptions &opt)
     sgroup->setLayout(flayout);
     vlayout->addWidget(sgroup);
 
+    /* session, the volumes we left stay on the gpu for a while */
+    QLabel *dataset_label = new QLabel("Dataset");
+    QComboBox *dataset_combo = new QComboBox();
+    for (int i=0; i<opt.datasets.size(); i++)
+        dataset_combo->addItem(QFileInfo(opt.datasets[i].filename).fileName(), i);
+    dataset_combo->setEnabled(opt.datasets.size() > 1);
+    flayout->addRow(dataset_label, dataset_combo);
+
+    /* time series, the slider follows playback */
+    QPushButton *series_play = NULL;
+    QSlider *series_slider = NULL;
+    QLabel *series_frame_label = NULL;
+    if (opt.series_frames > 0) {
+        QLabel *series_label = new QLabel("Time");
+        QHBoxLayout *series_layout = new QHBoxLayout();
+        series_play = new QPushButton("Play");
+        series_play->setCheckable(true);
+        series_slider = new QSlider(Qt::Horizontal);
+        series_slider->setRange(0, opt.series_frames - 1);
+        series_frame_label = new QLabel(QString("1/%1").arg(opt.series_frames));
+        series_layout->addWidget(series_play);
+        series_layout->addWidget(series_slider, 1);
+        series_layout->addWidget(series_frame_label);
+        flayout->addRow(series_label, series_layout);
+    }
+
+    /* cutting tools, the left button draws instead of rotating */
+    QComboBox *mask_combo = NULL;
+    QPushButton *mask_clear = NULL;
+    if (opt.mask) {
+        QLabel *mask_label = new QLabel("Mask");
+        QHBoxLayout *mask_layout = new QHBoxLayout();
+        mask_combo = new QComboBox();
+        mask_combo->addItem("Rotate", MASK_TOOL_NONE);
+        mask_combo->addItem("Box", MASK_TOOL_BOX);
+        mask_combo->addItem("Lasso", MASK_TOOL_LASSO);
+        mask_combo->addItem("Flood", MASK_TOOL_FLOOD);
+        mask_combo->setToolTip("Box and lasso cut through the view, flood cuts what's "
+                               "connected to the click and above the window");
+        mask_clear = new QPushButton("Clear");
+        mask_layout->addWidget(mask_combo, 1);
+        mask_layout->addWidget(mask_clear);
+        flayout->addRow(mask_label, mask_layout);
+    }
+
     /* general settings */
     QLabel *shading_label = new QLabel("Shading");
     shading_combo = new QComboBox();
@@ -113,6 +165,9 @@ Window::Window(InitOptions &opt)
     comp_combo->addItem("debug: ray start");
     comp_combo->addItem("debug: ray end");
     comp_combo->addItem("debug: ray dir");
+    comp_combo->addItem("debug: samples per ray");
+    comp_combo->addItem("debug: early termination");
+    comp_combo->addItem("debug: shaded samples");
     flayout->addRow(comp_label, comp_combo);
 
     QLabel *background_color_label = new QLabel("Background color");
@@ -146,6 +201,59 @@ Window::Window(InitOptions &opt)
     specular_spinbox->setValue(glWidget->get_specular_reflectance());
     flayout->addRow(specular_label, specular_spinbox);
 
+    QLabel *window_label = new QLabel("Window/Level");
+    QHBoxLayout *window_layout = new QHBoxLayout();
+    window_level_spinbox = new QDoubleSpinBox();
+    window_level_spinbox->setToolTip("Level");
+    window_width_spinbox = new QDoubleSpinBox();
+    window_width_spinbox->setToolTip("Width");
+    update_window_ranges();
+    window_level_spinbox->setValue(glWidget->get_window_level());
+    window_width_spinbox->setValue(glWidget->get_window_width());
+    QPushButton *window_reset = new QPushButton("Reset");
+    window_layout->addWidget(window_level_spinbox, 1);
+    window_layout->addWidget(window_width_spinbox, 1);
+    window_layout->addWidget(window_reset);
+    flayout->addRow(window_label, window_layout);
+
+    QLabel *quality_label = new QLabel("Quality");
+    QComboBox *quality_combo = new QComboBox();
+    quality_combo->addItem("Preview");
+    quality_combo->addItem("Interactive");
+    quality_combo->addItem("Final");
+    quality_combo->setCurrentIndex(opt.quality);
+    flayout->addRow(quality_label, quality_combo);
+
+    QLabel *fixed_step_label = new QLabel("Fixed step");
+    QCheckBox *fixed_step_check = new QCheckBox();
+    fixed_step_check->setChecked(opt.fixed_step);
+    flayout->addRow(fixed_step_label, fixed_step_check);
+
+    QLabel *lod_label = new QLabel("Level of detail");
+    QCheckBox *lod_check = new QCheckBox();
+    lod_check->setChecked(opt.lod);
+    flayout->addRow(lod_label, lod_check);
+
+    QLabel *stats_label = new QLabel("Frame statistics");
+    QCheckBox *stats_check = new QCheckBox();
+    flayout->addRow(stats_label, stats_check);
+
+    QLabel *ray_stats_label = new QLabel("Ray statistics");
+    QCheckBox *ray_stats_check = new QCheckBox();
+    flayout->addRow(ray_stats_label, ray_stats_check);
+
+    /* long side, the other one follows the window */
+    QLabel *poster_label = new QLabel("Poster");
+    QHBoxLayout *poster_layout = new QHBoxLayout();
+    poster_combo = new QComboBox();
+    poster_combo->addItem("4096", 4096);
+    poster_combo->addItem("8192", 8192);
+    poster_combo->addItem("16384", 16384);
+    poster_combo->setCurrentIndex(1);
+    poster_button = new QPushButton("Export");
+    poster_layout->addWidget(poster_combo, 1);
+    poster_layout->addWidget(poster_button);
+    flayout->addRow(poster_label, poster_layout);
 
     /* stretch to the bottom */
     vlayout->addStretch();
@@ -155,9 +263,16 @@ Window::Window(InitOptions &opt)
 
     /* signals */
     connect(tf, &TransFuncWidget::transfer_function_ready,
-            glWidget, &GLWidget::new_transfer_function, Qt::QueuedConnection);
+            glWidget, &GLWidget::update_transfer_function, Qt::QueuedConnection);
     connect(tf, &TransFuncWidget::fast_rendering_hint,
             glWidget, &GLWidget::set_fast_rendering, Qt::QueuedConnection);
+    connect(glWidget, &GLWidget::histogram_ready,
+            tf, &TransFuncWidget::set_histogram);
+    connect(tf, &TransFuncWidget::transfer_function_2d_ready,
+            glWidget, &GLWidget::update_transfer_function_2d, Qt::QueuedConnection);
+    connect(tf, &TransFuncWidget::tf_mode_changed,
+            glWidget, &GLWidget::set_tf_mode, Qt::QueuedConnection);
+    glWidget->set_tf_mode(tf->get_tf_mode());
 
     /* seriously? this is legal syntax?! I hate C++ */
     connect(preset_combo, static_cast<void(QComboBox::*)(int)>(&QComboBox::currentIndexChanged),
@@ -199,10 +314,158 @@ Window::Window(InitOptions &opt)
     connect(specular_spinbox, static_cast<void(QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged),
             glWidget, &GLWidget::set_specular_reflectance, Qt::QueuedConnection);
 
+    /* spin boxes, right button drags and the editor histograms all
+     * follow the widget */
+    auto window_edited = [=]() {
+        glWidget->set_window(window_level_spinbox->value(), window_width_spinbox->value());
+    };
+    connect(window_level_spinbox, static_cast<void(QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged),
+            this, window_edited);
+    connect(window_width_spinbox, static_cast<void(QDoubleSpinBox::*)(double)>(&QDoubleSpinBox::valueChanged),
+            this, window_edited);
+    connect(window_reset, &QPushButton::clicked,
+            glWidget, &GLWidget::reset_window);
+    auto window_changed = [=](double level, double width) {
+        window_level_spinbox->blockSignals(true);
+        window_width_spinbox->blockSignals(true);
+        window_level_spinbox->setValue(level);
+        window_width_spinbox->setValue(width);
+        window_level_spinbox->blockSignals(false);
+        window_width_spinbox->blockSignals(false);
+
+        const InitOptions &o = glWidget->get_options();
+        float scale, offset;
+        window_map(o, level, width, (1 << o.bit_depth) - 1, &scale, &offset);
+        tf->set_histogram_window(scale, offset);
+    };
+    connect(glWidget, &GLWidget::window_changed, this, window_changed);
+    window_changed(glWidget->get_window_level(), glWidget->get_window_width());
+
+    /* ranges first, the new window would be clamped to the old ones */
+    connect(dataset_combo,
+            static_cast<void(QComboBox::*)(int)>(&QComboBox::currentIndexChanged),
+            this, [=](int i) {
+                InitOptions o = glWidget->get_options();
+                session_select(&o, i);
+                update_window_ranges(o);
+                glWidget->set_dataset(i);
+            });
+    /* the renderer stays on what it had, so do we, unless something
+     * else was picked meanwhile */
+    connect(glWidget, &GLWidget::dataset_failed, this, [=](int i, int current) {
+            statusBar()->showMessage(QString("couldn't read %1")
+                                     .arg(glWidget->get_options().datasets[i].filename), 5000);
+            if (dataset_combo->currentIndex() == i)
+                dataset_combo->setCurrentIndex(current);
+        });
+    if (series_play) {
+        connect(series_play, &QPushButton::toggled, this, [=](bool playing) {
+                series_play->setText(playing ? "Pause" : "Play");
+                glWidget->set_series_playing(playing);
+            });
+        connect(series_slider, &QSlider::valueChanged,
+                glWidget, &GLWidget::set_series_frame);
+        connect(glWidget, &GLWidget::series_frame_changed, this, [=](int i) {
+                series_slider->blockSignals(true);
+                series_slider->setValue(i);
+                series_slider->blockSignals(false);
+            });
+        connect(glWidget, &GLWidget::series_frame_shown, this, [=](int i, int late) {
+                series_frame_label->setText(QString("%1/%2").arg(i + 1)
+                                            .arg(glWidget->get_options().series_frames));
+                series_frame_label->setToolTip(QString("%1 frames not read in time").arg(late));
+            });
+    }
+    if (mask_combo) {
+        connect(mask_combo,
+                static_cast<void(QComboBox::*)(int)>(&QComboBox::currentIndexChanged),
+                this, [=](int i) {
+                    glWidget->set_mask_tool(mask_combo->itemData(i).toInt());
+                });
+        connect(mask_clear, &QPushButton::clicked, glWidget, &GLWidget::clear_mask);
+        connect(glWidget, &GLWidget::mask_edited, this,
+                [=](qulonglong cut, qulonglong total, double ms) {
+                    statusBar()->showMessage(QString("%1 voxels cut, %2 in total, %3 ms")
+                                             .arg(cut).arg(total).arg(ms, 0, 'f', 1), 5000);
+                });
+    }
+    if (glWidget->get_options().probe) {
+        connect(glWidget, &GLWidget::probe_moved, this,
+                [=](bool found, const ProbeHit &hit, double ms) {
+                    if (!found) {
+                        statusBar()->clearMessage();
+                        return;
+                    }
+                    statusBar()->showMessage(QString("(%1, %2, %3) value %4, opacity %5, %6 ms")
+                                             .arg(hit.voxel[0]).arg(hit.voxel[1]).arg(hit.voxel[2])
+                                             .arg(hit.value, 0, 'g', 5).arg(hit.opacity, 0, 'f', 2)
+                                             .arg(ms, 0, 'f', 3));
+                });
+    }
+    connect(glWidget, &GLWidget::dataset_ready, this, [=](int i, bool resident, double ms) {
+            statusBar()->showMessage(QString("%1 %2 in %3 ms")
+                                     .arg(QFileInfo(glWidget->get_options().datasets[i].filename).fileName())
+                                     .arg(resident ? "was on the gpu, swapped" : "loaded")
+                                     .arg(ms, 0, 'f', 1), 5000);
+        });
+
+    connect(quality_combo,
+            static_cast<void(QComboBox::*)(int)>(&QComboBox::currentIndexChanged),
+            glWidget,
+            &GLWidget::set_quality,
+            Qt::QueuedConnection);
+    connect(fixed_step_check, &QCheckBox::toggled,
+            glWidget, &GLWidget::set_fixed_step);
+    connect(lod_check, &QCheckBox::toggled,
+            glWidget, &GLWidget::set_lod);
+    connect(stats_check, &QCheckBox::toggled,
+            glWidget, &GLWidget::set_stats_overlay);
+    connect(ray_stats_check, &QCheckBox::toggled,
+            glWidget, &GLWidget::set_ray_stats);
+
+    connect(poster_button, &QPushButton::clicked,
+            this, &Window::export_poster);
+    connect(glWidget, &GLWidget::export_progress, this, [=](int done, int total) {
+            statusBar()->showMessage(QString("Exporting poster... %1/%2 tiles")
+                                     .arg(done).arg(total));
+        });
+    connect(glWidget, &GLWidget::export_finished, this, [=](bool ok, const QString &path) {
+            statusBar()->showMessage(ok ? QString("Poster saved to %1").arg(path)
+                                     : QString("Couldn't export %1").arg(path), 5000);
+            poster_button->setEnabled(true);
+        });
+
 
 
 }
 
+/* physical units, a little past the data range either way */
+void Window::update_window_ranges()
+{
+    update_window_ranges(glWidget->get_options());
+}
+
+void Window::update_window_ranges(const InitOptions &o)
+{
+    double top = o.rescale_slope * ((1 << o.bit_depth) - 1);
+    double range = fabs(top);
+    double range_lo = o.rescale_intercept + MIN(top, 0.0);
+
+    window_level_spinbox->blockSignals(true);
+    window_width_spinbox->blockSignals(true);
+    window_level_spinbox->setRange(range_lo - range, range_lo + 2.0 * range);
+    window_level_spinbox->setSingleStep(range / 100.0);
+    window_width_spinbox->setRange(range * 1e-3, range * 2.0);
+    window_width_spinbox->setSingleStep(range / 100.0);
+    window_level_spinbox->blockSignals(false);
+    window_width_spinbox->blockSignals(false);
+}
+
+GLWidget *Window::get_gl_widget()
+{
+    return glWidget;
+}
+
 void Window::save_preset()
 {
     Preset *p = prman->presets[prman->selected];
@@ -230,6 +493,29 @@ void Window::save_preset()
     }
 }
 
+void Window::export_poster()
+{
+    QString path = QFileDialog::getSaveFileName(this, "Export Poster", "poster.tiff",
+                                                "Images (*.tiff *.tif *.png)");
+    if (path.isEmpty())
+        return;
+
+    int side = poster_combo->currentData().toInt();
+    int w = MAX(glWidget->width(), 1);
+    int h = MAX(glWidget->height(), 1);
+    if (w >= h) {
+        h = MAX(side * h / w, 1);
+        w = side;
+    } else {
+        w = MAX(side * w / h, 1);
+        h = side;
+    }
+
+    poster_button->setEnabled(false);
+    statusBar()->showMessage("Exporting poster...");
+    glWidget->export_poster(path, w, h);
+}
+
 void Window::preset_selected(int i)
 {
     int selected = preset_combo->itemData(i).toInt();
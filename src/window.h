@@ -27,6 +27,7 @@
 #include <QMainWindow>
 #include <QComboBox>
 #include <QDoubleSpinBox>
+#include <QPushButton>
 #include "glwidget.h"
 #include "presetmanager.h"
 #include "transfuncwidget.h"
@@ -41,11 +42,14 @@ class Window : public QMainWindow
 public:
     Window(InitOptions &opt);
 
+    GLWidget *get_gl_widget();
+
 public slots:
     void preset_selected(int i);
     void save_preset();
     void set_background_color();
     void set_light_color();
+    void export_poster();
 
 protected:
     void keyReleaseEvent(QKeyEvent *event) Q_DECL_OVERRIDE;
@@ -55,6 +59,9 @@ signals:
     void light_color_ready(const QColor &color);
 
 private:
+    void update_window_ranges();
+    void update_window_ranges(const InitOptions &o);
+
     PresetManager *prman;
     GLWidget *glWidget;
     QComboBox *preset_combo;
@@ -67,6 +74,10 @@ private:
     QDoubleSpinBox *ambient_spinbox;
     QDoubleSpinBox *diffuse_spinbox;
     QDoubleSpinBox *specular_spinbox;
+    QDoubleSpinBox *window_level_spinbox;
+    QDoubleSpinBox *window_width_spinbox;
+    QComboBox *poster_combo;
+    QPushButton *poster_button;
 };
 
 #endif
@@ -0,0 +1,65 @@
+#!/usr/bin/python
+#
+# qvrc - a GLSL volume rendering engine
+# well... engine... let's say prototype/proof of concept... hack?
+#
+# Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License as
+# published by the Free Software Foundation; either version 2 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+# 02110-1301 USA.
+
+# compare two `qvrc --benchmark` result files run by run
+
+import json
+
+from optparse import OptionParser
+
+parser = OptionParser(usage="usage: %prog [options] baseline.json candidate.json")
+parser.add_option("-m", "--metric", dest="metric", default="wall_ms",
+                  help="metric to compare: cpu_ms, gpu_ms or wall_ms [default: %default]")
+parser.add_option("-p", "--percentile", dest="percentile", default="p50",
+                  help="summary field to compare: min, mean, p50, p90, p95, p99, max [default: %default]")
+
+(options, args) = parser.parse_args()
+
+if len(args) != 2:
+    parser.error("need a baseline and a candidate result file")
+
+with open(args[0]) as f:
+    base = json.load(f)
+with open(args[1]) as f:
+    cand = json.load(f)
+
+if base["renderer"] != cand["renderer"]:
+    print("warning: different renderers, numbers are not comparable")
+    print("  {}\n  {}".format(base["renderer"], cand["renderer"]))
+
+if base["dataset"] != cand["dataset"] or base["viewport"] != cand["viewport"]:
+    print("warning: different dataset or viewport")
+
+cand_runs = dict((r["name"], r) for r in cand["runs"])
+
+print("{:<32} {:>10} {:>10} {:>8}".format("run", "baseline", "candidate", "change"))
+
+for r in base["runs"]:
+    c = cand_runs.get(r["name"])
+    if c is None:
+        continue
+
+    b = r["summary"][options.metric].get(options.percentile, 0.0)
+    n = c["summary"][options.metric].get(options.percentile, 0.0)
+    change = (n - b) / b * 100.0 if b > 0 else 0.0
+
+    print("{:<32} {:>10.2f} {:>10.2f} {:>+7.1f}%".format(r["name"], b, n, change))
@@ -0,0 +1,195 @@
+#!/usr/bin/python
+#
+# qvrc - a GLSL volume rendering engine
+# well... engine... let's say prototype/proof of concept... hack?
+#
+# Copyright (C) 2017 Filippo Argiolas <filippo.argiolas@gmail.com>
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License as
+# published by the Free Software Foundation; either version 2 of the
+# License, or (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+# General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program; if not, write to the Free Software
+# Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+# 02110-1301 USA.
+
+# reference client for `qvrc --server`, orbits the camera and reports
+# latency and throughput, see src/renderserver.h for the protocol
+
+import math
+import os
+import select
+import socket
+import struct
+import time
+
+from optparse import OptionParser
+
+MSG_VIEWPORT, MSG_CAMERA, MSG_TF, MSG_PRESET, MSG_QUALITY, MSG_PING = range(1, 7)
+MSG_INFO, MSG_FRAME, MSG_PONG = range(0x80, 0x83)
+
+ENCODINGS = { "jpeg": 0, "png": 1, "raw": 2 }
+STAGES = [ "preview", "final" ]
+
+parser = OptionParser(usage="usage: %prog [options] name|port")
+parser.add_option("-s", "--size", dest="size", default="1024,768",
+                  help="frame size [default: %default]")
+parser.add_option("-n", "--frames", dest="frames", type="int", default=120,
+                  help="camera updates along the orbit [default: %default]")
+parser.add_option("-r", "--rate", dest="rate", type="float", default=30.0,
+                  help="camera updates per second [default: %default]")
+parser.add_option("-q", "--quality", dest="quality", type="int", default=2,
+                  help="still frame quality, 0 preview to 2 final [default: %default]")
+parser.add_option("-e", "--encoding", dest="encoding", default="jpeg",
+                  help="jpeg, png or raw [default: %default]")
+parser.add_option("-p", "--preset", dest="preset",
+                  help="preset file in the server presets directory")
+parser.add_option("-o", "--output", dest="output",
+                  help="save the last full quality frame here")
+
+(options, args) = parser.parse_args()
+
+if len(args) != 1:
+    parser.error("need the server socket name or port")
+
+def now_us():
+    return int(time.time() * 1e6)
+
+def connect(address):
+    if address.isdigit():
+        s = socket.create_connection(("127.0.0.1", int(address)))
+        s.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        return s
+    # QLocalServer puts bare names in the temp directory
+    if not os.path.isabs(address):
+        address = os.path.join(os.environ.get("TMPDIR", "/tmp"), address)
+    s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    s.connect(address)
+    return s
+
+def send(s, type, payload=b""):
+    s.sendall(struct.pack("<IB", len(payload) + 1, type) + payload)
+
+def request(s, type, rid, payload=b""):
+    send(s, type, struct.pack("<IQ", rid, now_us()) + payload)
+
+class Reader:
+    def __init__(self, s):
+        self.s = s
+        self.buf = b""
+        self.bytes = 0
+
+    # every complete message that's in, waits at most @timeout
+    def poll(self, timeout):
+        msgs = []
+        r, _, _ = select.select([self.s], [], [], max(timeout, 0))
+        if r:
+            data = self.s.recv(1 << 20)
+            if not data:
+                raise SystemExit("server closed the connection")
+            self.buf += data
+            self.bytes += len(data)
+        while len(self.buf) >= 4:
+            (n,) = struct.unpack("<I", self.buf[:4])
+            if len(self.buf) < 4 + n:
+                break
+            msgs.append((self.buf[4], self.buf[5:4 + n]))
+            self.buf = self.buf[4 + n:]
+        return msgs
+
+def percentile(values, p):
+    if not values:
+        return float("nan")
+    values = sorted(values)
+    rank = p / 100.0 * (len(values) - 1)
+    lo = int(rank)
+    hi = min(lo + 1, len(values) - 1)
+    return values[lo] + (values[hi] - values[lo]) * (rank - lo)
+
+s = connect(args[0])
+reader = Reader(s)
+w, h = [int(v) for v in options.size.split(",")]
+
+# round trip first, nothing else in the pipe
+rtts = []
+for i in range(10):
+    send(s, MSG_PING, struct.pack("<Q", now_us()))
+    pong = None
+    while pong is None:
+        for type, payload in reader.poll(1.0):
+            if type == MSG_INFO:
+                version, vw, vh, vd = struct.unpack("<4I", payload[:16])
+                print("server protocol %d, volume %dx%dx%d, %s" %
+                      (version, vw, vh, vd, payload[16:].decode("utf-8", "replace")))
+            elif type == MSG_PONG:
+                pong = struct.unpack("<Q", payload)[0]
+    rtts.append((now_us() - pong) / 1000.0)
+
+send(s, MSG_VIEWPORT, struct.pack("<II", w, h))
+request(s, MSG_QUALITY, 0, struct.pack("<4B", options.quality, 0, 0,
+                                       ENCODINGS[options.encoding]))
+if options.preset:
+    request(s, MSG_PRESET, 0, options.preset.encode("utf-8"))
+
+latency = { 0: [], 1: [] }
+server_ms = { 0: [], 1: [] }
+encode_ms = { 0: [], 1: [] }
+answered = set()
+last = None
+
+def handle(msgs):
+    global last
+    for type, payload in msgs:
+        if type != MSG_FRAME:
+            continue
+        rid, t, stage, enc, fw, fh, render, encode = struct.unpack("<IQBBIIff", payload[:30])
+        latency[stage].append((now_us() - t) / 1000.0)
+        server_ms[stage].append(render)
+        encode_ms[stage].append(encode)
+        if stage == 1:
+            answered.add(rid)
+            last = (rid, enc, fw, fh, payload[30:])
+
+start = time.time()
+bytes_start = reader.bytes
+period = 1.0 / options.rate
+for i in range(1, options.frames + 1):
+    a = 2.0 * math.pi * i / options.frames
+    request(s, MSG_CAMERA, i, struct.pack("<5f", math.cos(a / 2), 0.0, math.sin(a / 2), 0.0, 1.1))
+    deadline = start + i * period
+    while True:
+        handle(reader.poll(deadline - time.time()))
+        if time.time() >= deadline:
+            break
+
+# the last request always gets its final frame
+while options.frames not in answered:
+    handle(reader.poll(5.0))
+
+elapsed = time.time() - start
+frames = len(latency[0]) + len(latency[1])
+
+print("ping       p50 %7.2f ms" % percentile(rtts, 50))
+for stage in (0, 1):
+    print("%-10s %4d frames, latency p50 %7.2f p90 %7.2f ms, server p50 %7.2f ms, encode p50 %6.2f ms" %
+          (STAGES[stage], len(latency[stage]), percentile(latency[stage], 50),
+           percentile(latency[stage], 90), percentile(server_ms[stage], 50),
+           percentile(encode_ms[stage], 50)))
+print("requests   %d sent, %d got a final frame, the rest were superseded" %
+      (options.frames, len(answered)))
+print("throughput %.1f frames/s, %.1f MB/s" %
+      (frames / elapsed, (reader.bytes - bytes_start) / elapsed / 1e6))
+
+if options.output and last:
+    rid, enc, fw, fh, image = last
+    with open(options.output, "wb") as f:
+        if enc == ENCODINGS["raw"]:
+            f.write(b"P6\n%d %d\n255\n" % (fw, fh))
+        f.write(image)